@@ -0,0 +1,378 @@
+/*! \file e4_acquisition.cpp
+ * \brief Defines class Acquisition.
+ */
+#include <chrono>
+#include <cstring>
+
+#ifdef _WIN32
+#include "windows.h"
+#else
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#endif
+
+#include "e4_acquisition.h"
+
+/*! \brief Returns the mask of the cores available to the process, limited to the first 64.
+ */
+static unsigned long long processAffinityMask()
+{
+#ifdef _WIN32
+    DWORD_PTR processMask;
+    DWORD_PTR systemMask;
+    if (!GetProcessAffinityMask(GetCurrentProcess(), &processMask, &systemMask)) {return 0;}
+    return (unsigned long long)processMask;
+#else
+    cpu_set_t cpuSet;
+    unsigned long long mask = 0;
+    if (sched_getaffinity(getpid(), sizeof(cpuSet), &cpuSet) != 0) {return 0;}
+    for (unsigned int cpuIdx = 0; cpuIdx < 64 && cpuIdx < CPU_SETSIZE; cpuIdx++)
+    {
+        if (CPU_ISSET(cpuIdx, &cpuSet)) {mask |= 1ULL << cpuIdx;}
+    }
+    return mask;
+#endif
+}
+
+/*! \brief Restricts the calling thread to the cores of \a mask.
+ */
+static void setThreadAffinity(unsigned long long mask)
+{
+#ifdef _WIN32
+    SetThreadAffinityMask(GetCurrentThread(), (DWORD_PTR)mask);
+#else
+    cpu_set_t cpuSet;
+    CPU_ZERO(&cpuSet);
+    for (unsigned int cpuIdx = 0; cpuIdx < 64 && cpuIdx < CPU_SETSIZE; cpuIdx++)
+    {
+        if (mask & (1ULL << cpuIdx)) {CPU_SET(cpuIdx, &cpuSet);}
+    }
+    pthread_setaffinity_np(pthread_self(), sizeof(cpuSet), &cpuSet);
+#endif
+}
+
+Acquisition::Acquisition(EdlBackend &edl, std::mutex &edlMutex, RunningStatistics &statistics, ReadScheduler &scheduler, PipelineMetrics &metrics) :
+    edl(edl),
+    edlMutex(edlMutex),
+    statistics(statistics),
+    scheduler(scheduler),
+    metrics(metrics),
+    recording(NULL),
+    recordingEventsOnly(false),
+    sharedRing(NULL),
+    affinityMask(0),
+    affinityChanged(false),
+    running(false),
+    lastError(EdlSuccess),
+    packetsRead(0),
+    packetsDropped(0),
+    bufferOverflowCount(0),
+    lostDataCount(0),
+    filteredPacketsDropped(0)
+{
+}
+
+Acquisition::~Acquisition()
+{
+    stop();
+}
+
+EdlErrorCode_t Acquisition::start(unsigned int ringPackets)
+{
+    if (thread.joinable()) {stop();}
+
+    if (!ring.allocate(ringPackets > 0 ? ringPackets : E4_DEFAULT_RING_PACKETS)) {return EdlUnknownError;}
+    {
+        std::lock_guard <std::mutex> lock(filterMutex);
+        filter.reset();
+        if (!allocateFilteredRing(false)) {return EdlUnknownError;}
+    }
+    {
+        std::lock_guard <std::mutex> lock(spectrumMutex);
+        spectrum.reset();
+    }
+    {
+        std::lock_guard <std::mutex> lock(sweepsMutex);
+        sweeps.reset();
+    }
+    {
+        std::lock_guard <std::mutex> detectorLock(detectorMutex);
+        detector.reset();
+        std::lock_guard <std::mutex> recordingLock(recordingMutex);
+        gate.configure(detector.getConfig().preWindowPackets, detector.getConfig().postWindowPackets);
+    }
+
+    EdlErrorCode_t res;
+    {
+        std::lock_guard <std::mutex> lock(edlMutex);
+        res = edl.purgeData();
+    }
+    if (res != EdlSuccess) {return res;}
+
+    lastError = EdlSuccess;
+    packetsRead = 0;
+    packetsDropped = 0;
+    bufferOverflowCount = 0;
+    lostDataCount = 0;
+    filteredPacketsDropped = 0;
+    statistics.reset();
+    scheduler.reset();
+    metrics.reset();
+
+    // A new thread inherits the cores of the caller: apply the mask again.
+    if (affinityMask != 0) {affinityChanged = true;}
+    running = true;
+    thread = std::thread(&Acquisition::run, this);
+    return EdlSuccess;
+}
+
+void Acquisition::stop()
+{
+    running = false;
+    if (thread.joinable()) {thread.join();}
+}
+
+bool Acquisition::isRunning() const
+{
+    return running;
+}
+
+EdlErrorCode_t Acquisition::pull(float * dst, unsigned int maxPackets, unsigned int &packetsRead)
+{
+    packetsRead = (unsigned int)ring.pop(dst, maxPackets);
+    if (packetsRead == 0 && !running) {return (EdlErrorCode_t)lastError.load();}
+    return EdlSuccess;
+}
+
+EdlErrorCode_t Acquisition::pullChannelMajor(float * dst, size_t maxPackets, size_t channelStride, size_t &packetsRead)
+{
+    packetsRead = ring.popChannelMajor(dst, maxPackets, channelStride);
+    if (packetsRead == 0 && !running) {return (EdlErrorCode_t)lastError.load();}
+    return EdlSuccess;
+}
+
+EdlErrorCode_t Acquisition::pullFiltered(float * dst, unsigned int maxPackets, unsigned int &packetsRead)
+{
+    std::lock_guard <std::mutex> lock(filteredRingMutex);
+    packetsRead = (unsigned int)filteredRing.pop(dst, maxPackets);
+    if (packetsRead == 0 && !running) {return (EdlErrorCode_t)lastError.load();}
+    return EdlSuccess;
+}
+
+bool Acquisition::setFilter(const E4FilterConfig_t &config, double samplingRateHz)
+{
+    std::lock_guard <std::mutex> lock(filterMutex);
+    if (!filter.configure(config, samplingRateHz)) {return false;}
+    if (allocateFilteredRing(true)) {return true;}
+
+    E4FilterConfig_t disabled;
+    memset(&disabled, 0, sizeof(disabled));
+    filter.configure(disabled, samplingRateHz);
+    return false;
+}
+
+bool Acquisition::setDetector(const E4DetectorConfig_t &config, double samplingRateHz)
+{
+    std::lock_guard <std::mutex> detectorLock(detectorMutex);
+    if (!detector.configure(config, samplingRateHz)) {return false;}
+
+    std::lock_guard <std::mutex> recordingLock(recordingMutex);
+    gate.configure(detector.getConfig().preWindowPackets, detector.getConfig().postWindowPackets);
+    return true;
+}
+
+bool Acquisition::setSpectrum(const E4SpectrumConfig_t &config, double samplingRateHz)
+{
+    std::lock_guard <std::mutex> lock(spectrumMutex);
+    return spectrum.configure(config, samplingRateHz);
+}
+
+void Acquisition::getSpectrum(float * dst, unsigned int maxBins, E4SpectrumInfo_t &info) const
+{
+    spectrum.get(dst, maxBins, info);
+}
+
+bool Acquisition::setSweeps(const E4SweepConfig_t &config, double samplingRateHz, double protocolPeriodMs)
+{
+    std::lock_guard <std::mutex> lock(sweepsMutex);
+    return sweeps.configure(config, samplingRateHz, protocolPeriodMs);
+}
+
+void Acquisition::getSweep(float * dst, unsigned int maxBins, E4SweepInfo_t &info) const
+{
+    sweeps.get(dst, maxBins, info);
+}
+
+unsigned int Acquisition::pollEvents(E4Event_t * dst, unsigned int maxEvents)
+{
+    return detector.poll(dst, maxEvents);
+}
+
+void Acquisition::setRecording(Recording * recording, bool eventsOnly)
+{
+    std::lock_guard <std::mutex> detectorLock(detectorMutex);
+    std::lock_guard <std::mutex> recordingLock(recordingMutex);
+    this->recording = recording;
+    recordingEventsOnly = eventsOnly;
+    gate.configure(detector.getConfig().preWindowPackets, detector.getConfig().postWindowPackets);
+}
+
+void Acquisition::setSharedRing(SharedRing * sharedRing)
+{
+    std::lock_guard <std::mutex> lock(sharedMutex);
+    this->sharedRing = sharedRing;
+}
+
+void Acquisition::getStats(E4AcquisitionStats_t &stats) const
+{
+    stats.packetsRead = packetsRead;
+    stats.packetsDropped = packetsDropped;
+    stats.bufferOverflowCount = bufferOverflowCount;
+    stats.lostDataCount = lostDataCount;
+    stats.ringCapacityPackets = (unsigned int)ring.capacity();
+    stats.ringAvailablePackets = (unsigned int)ring.available();
+    stats.lastError = (EdlErrorCode_t)lastError.load();
+    stats.filteredPacketsDropped = filteredPacketsDropped;
+    {
+        std::lock_guard <std::mutex> lock(filteredRingMutex);
+        stats.filteredRingAvailablePackets = (unsigned int)filteredRing.available();
+        stats.filteredRingCapacityPackets = (unsigned int)filteredRing.capacity();
+    }
+    detector.getCounts(stats.eventsDetected, stats.eventsDropped);
+}
+
+bool Acquisition::setAffinity(unsigned long long cpuMask)
+{
+    const unsigned long long processMask = processAffinityMask();
+    if (cpuMask != 0 && (cpuMask & processMask) == 0) {return false;}
+
+    affinityMask = cpuMask;
+    affinityChanged = true;
+    return true;
+}
+
+/*! \brief Sizes the filtered ring for the decimation of the filter, or frees it if the filter is disabled.
+ * Called with filterMutex held, so that the reader thread does not push meanwhile.
+ * The ring is not allocated before the first start, which sizes it from the capacity of the acquisition ring.
+ * If \a keepPackets is true and the size does not change, the filtered data packets not pulled yet are kept.
+ */
+bool Acquisition::allocateFilteredRing(bool keepPackets)
+{
+    const size_t capacityPackets = filter.isEnabled() ? ring.capacity()/filter.getDecimation() : 0;
+    size_t roundedPackets = 1;
+    while (roundedPackets < capacityPackets) {roundedPackets <<= 1;}
+
+    std::lock_guard <std::mutex> lock(filteredRingMutex);
+    if (capacityPackets == 0)
+    {
+        filteredRing.release();
+        return true;
+    }
+    // PacketRing::allocate rounds the capacity the same way.
+    if (keepPackets && filteredRing.capacity() == roundedPackets) {return true;}
+    return filteredRing.allocate(capacityPackets);
+}
+
+void Acquisition::run()
+{
+    EdlErrorCode_t res;
+    EdlDeviceStatus_t status;
+    unsigned int readPacketsNum;
+
+    while (running) {
+        if (affinityChanged.exchange(false))
+        {
+            const unsigned long long processMask = processAffinityMask();
+            setThreadAffinity(affinityMask != 0 ? affinityMask & processMask : processMask);
+        }
+
+        readPacketsNum = 0;
+        status.availableDataPackets = 0;
+        {
+            std::lock_guard <std::mutex> lock(edlMutex);
+            std::chrono::steady_clock::time_point stageTime = std::chrono::steady_clock::now();
+            res = edl.getDeviceStatus(status);
+            stageTime = metrics.addTime(E4StageStatusPoll, stageTime);
+            metrics.addPoll(res, status);
+            if (res == EdlSuccess && status.availableDataPackets > 0)
+            {
+                res = edl.readData(status.availableDataPackets, readPacketsNum, readBuffer);
+                metrics.addTime(E4StageRead, stageTime);
+                metrics.addRead(res, status.availableDataPackets, readPacketsNum);
+            }
+        }
+
+        if (res == EdlSuccess || res == EdlNotEnoughAvailableDataError)
+        {
+            // EdlNotEnoughAvailableDataError still returns all of the available data packets.
+            if (status.bufferOverflowFlag) {bufferOverflowCount++;}
+            if (status.lostDataFlag) {lostDataCount++;}
+        }
+        else
+        {
+            lastError = res;
+            if (res == EdlDeviceNotConnectedError) {break;}
+        }
+
+        if (readPacketsNum > 0)
+        {
+            std::chrono::steady_clock::time_point stageTime = std::chrono::steady_clock::now();
+            const unsigned long long firstPacketIdx = packetsRead;
+            const size_t pushedNum = ring.push(readBuffer.data(), readPacketsNum);
+            packetsRead += readPacketsNum;
+            packetsDropped += readPacketsNum-pushedNum;
+            metrics.addDrop(E4_METRICS_RING_FULL, firstPacketIdx+pushedNum, (unsigned int)(readPacketsNum-pushedNum));
+
+            {
+                std::lock_guard <std::mutex> lock(sharedMutex);
+                if (sharedRing != NULL) {sharedRing->publish(readBuffer.data(), readPacketsNum);}
+            }
+            stageTime = metrics.addTime(E4StageCopy, stageTime);
+
+            statistics.update(readBuffer.data(), readPacketsNum, status.bufferOverflowFlag, status.lostDataFlag);
+
+            {
+                std::lock_guard <std::mutex> lock(filterMutex);
+                if (filter.isEnabled())
+                {
+                    if (filteredBuffer.size() < (size_t)readPacketsNum*EDL_CHANNEL_NUM) {filteredBuffer.resize((size_t)readPacketsNum*EDL_CHANNEL_NUM);}
+                    const unsigned int filteredNum = filter.process(readBuffer.data(), readPacketsNum, filteredBuffer.data());
+                    const size_t filteredPushedNum = filteredRing.push(filteredBuffer.data(), filteredNum);
+                    filteredPacketsDropped += filteredNum-filteredPushedNum;
+                    metrics.addDrop(E4_METRICS_FILTERED_RING_FULL, firstPacketIdx, (unsigned int)(filteredNum-filteredPushedNum));
+                }
+            }
+
+            {
+                std::lock_guard <std::mutex> lock(spectrumMutex);
+                spectrum.process(readBuffer.data(), readPacketsNum);
+            }
+
+            {
+                std::lock_guard <std::mutex> lock(sweepsMutex);
+                sweeps.process(readBuffer.data(), readPacketsNum, status.bufferOverflowFlag || status.lostDataFlag);
+            }
+
+            std::lock_guard <std::mutex> detectorLock(detectorMutex);
+            if (activeBuffer.size() < readPacketsNum) {activeBuffer.resize(readPacketsNum);}
+            detector.process(readBuffer.data(), readPacketsNum, firstPacketIdx, activeBuffer.data());
+            stageTime = metrics.addTime(E4StageProcessing, stageTime);
+
+            std::lock_guard <std::mutex> recordingLock(recordingMutex);
+            if (recording != NULL && recordingEventsOnly)
+            {
+                gate.write(*recording, readBuffer.data(), readPacketsNum, firstPacketIdx, activeBuffer.data(), status.bufferOverflowFlag, status.lostDataFlag);
+                metrics.addTime(E4StageWrite, stageTime);
+            }
+            else if (recording != NULL)
+            {
+                recording->write(readBuffer.data(), readPacketsNum, firstPacketIdx, status.bufferOverflowFlag, status.lostDataFlag);
+                metrics.addTime(E4StageWrite, stageTime);
+            }
+        }
+
+        scheduler.wait(res == EdlSuccess || res == EdlNotEnoughAvailableDataError ? status.availableDataPackets : 0, readPacketsNum);
+    }
+    running = false;
+}
@@ -0,0 +1,265 @@
+/*! \file e4_acquisition.h
+ * \brief Declares class Acquisition.
+ */
+#ifndef E4_ACQUISITION_H
+#define E4_ACQUISITION_H
+
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "e4_backend.h"
+#include "e4_events.h"
+#include "e4_filter.h"
+#include "e4_metrics.h"
+#include "e4_recording.h"
+#include "e4_ringbuffer.h"
+#include "e4_scheduler.h"
+#include "e4_sharedring.h"
+#include "e4_spectrum.h"
+#include "e4_statistics.h"
+#include "e4_sweeps.h"
+
+/*! \def E4_DEFAULT_RING_PACKETS
+ * \brief Default capacity of the acquisition ring: about 10s of data at 200kHz.
+ */
+#define E4_DEFAULT_RING_PACKETS (1 << 21)
+
+/*! \struct E4AcquisitionStats_t
+ * \brief Struct that contains counters of the background acquisition.
+ * Returned by getAcquisitionStats.
+ */
+typedef struct {
+    unsigned long long packetsRead; /*!< Data packets read from the device since the acquisition started. */
+    unsigned long long packetsDropped; /*!< Data packets read from the device but discarded because the ring was full. */
+    unsigned long long bufferOverflowCount; /*!< Number of device status polls reporting EdlDeviceStatus_t::bufferOverflowFlag. */
+    unsigned long long lostDataCount; /*!< Number of device status polls reporting EdlDeviceStatus_t::lostDataFlag. */
+    unsigned int ringCapacityPackets; /*!< Number of data packets the ring can hold. */
+    unsigned int ringAvailablePackets; /*!< Number of data packets waiting in the ring. */
+    EdlErrorCode_t lastError; /*!< Last error that stopped the reader thread, #EdlSuccess if none. */
+    unsigned long long filteredPacketsDropped; /*!< Filtered data packets discarded because the filtered ring was full. */
+    unsigned int filteredRingAvailablePackets; /*!< Number of filtered data packets waiting in the filtered ring. */
+    unsigned long long eventsDetected; /*!< Events found by the detector since it was configured. */
+    unsigned long long eventsDropped; /*!< Events discarded because they were not polled in time. */
+    unsigned int filteredRingCapacityPackets; /*!< Number of filtered data packets the filtered ring can hold, 0 while no filter is set. */
+} E4AcquisitionStats_t;
+
+/*! \class Acquisition
+ * \brief Drains an EDL device from a dedicated reader thread into a PacketRing.
+ * The reader thread keeps reading at the device pace regardless of how often the consumer pulls;
+ * if the consumer falls behind, the ring fills up and the newest packets are counted as dropped.
+ * Every call to the device backend is serialized through the mutex passed to the constructor,
+ * so that configuration commands can be issued while the acquisition is running.
+ * If a StreamFilter is configured, the reader thread also filters every batch into a second ring,
+ * of the capacity of the first one divided by the decimation; the second ring is only allocated while a filter is set.
+ * If an EventDetector is configured, the reader thread also searches every batch for events.
+ * If a WelchSpectrum is configured, the reader thread also adds every batch to the power spectral density estimate.
+ * If a SweepAverager is configured, the reader thread also averages every batch into the protocol sweeps.
+ * If a SharedRing is set, the reader thread also publishes every batch to it, for other processes.
+ * Every batch is added to the RunningStatistics passed to the constructor, and every stage of its handling is timed by the PipelineMetrics.
+ * The waits between device polls are decided by the ReadScheduler passed to the constructor.
+ * Acquisitions of different devices share no state, so each runs on its own thread at the pace of its own device.
+ */
+class Acquisition {
+public:
+    /*! \brief Acquisition constructor.
+     *
+     * \param edl [in] Connected device to read from.
+     * \param edlMutex [in] Mutex guarding every call to \a edl.
+     * \param statistics [in] Statistics updated with every read data packet, reset by Acquisition::start.
+     * \param scheduler [in] Scheduler of the device polls, reset by Acquisition::start.
+     * \param metrics [in] Instrumentation of the device reads and of the processing stages, reset by Acquisition::start.
+     */
+    Acquisition(EdlBackend &edl, std::mutex &edlMutex, RunningStatistics &statistics, ReadScheduler &scheduler, PipelineMetrics &metrics);
+
+    /*! \brief Acquisition destructor. Stops the reader thread.
+     */
+    ~Acquisition();
+
+    /*! \brief Purges the device data and starts the reader thread.
+     *
+     * \param ringPackets [in] Capacity of the ring in data packets, 0 for #E4_DEFAULT_RING_PACKETS.
+     * \return #EdlErrorCode_t Error code.
+     */
+    EdlErrorCode_t start(EDL_IN unsigned int ringPackets);
+
+    /*! \brief Stops the reader thread. Packets already in the ring can still be pulled.
+     */
+    void stop(EDL_VOID);
+
+    /*! \brief Returns true while the reader thread is running.
+     */
+    bool isRunning(EDL_VOID) const;
+
+    /*! \brief Pulls data packets from the ring.
+     *
+     * \param dst [out] Buffer with room for \a maxPackets data packets of #EDL_CHANNEL_NUM values.
+     * \param maxPackets [in] Maximum number of data packets to pull.
+     * \param packetsRead [out] Number of data packets actually pulled.
+     * \return #EdlSuccess, or the error that stopped the reader thread once the ring is empty.
+     */
+    EdlErrorCode_t pull(EDL_OUT float * dst,
+                        EDL_IN unsigned int maxPackets,
+                        EDL_OUT unsigned int &packetsRead);
+
+    /*! \brief Pulls data packets from the ring into per-channel arrays.
+     *
+     * \param dst [out] Buffer of #EDL_CHANNEL_NUM arrays of \a channelStride values each.
+     * \param maxPackets [in] Maximum number of data packets to pull, not greater than \a channelStride.
+     * \param channelStride [in] Distance in values between the beginnings of two consecutive channel arrays in \a dst.
+     * \param packetsRead [out] Number of data packets actually pulled.
+     * \return #EdlSuccess, or the error that stopped the reader thread once the ring is empty.
+     */
+    EdlErrorCode_t pullChannelMajor(EDL_OUT float * dst,
+                                    EDL_IN size_t maxPackets,
+                                    EDL_IN size_t channelStride,
+                                    EDL_OUT size_t &packetsRead);
+
+    /*! \brief Pulls filtered data packets from the filtered ring.
+     *
+     * \param dst [out] Buffer with room for \a maxPackets data packets of #EDL_CHANNEL_NUM values.
+     * \param maxPackets [in] Maximum number of data packets to pull.
+     * \param packetsRead [out] Number of data packets actually pulled.
+     * \return #EdlSuccess, or the error that stopped the reader thread once the filtered ring is empty.
+     */
+    EdlErrorCode_t pullFiltered(EDL_OUT float * dst,
+                                EDL_IN unsigned int maxPackets,
+                                EDL_OUT unsigned int &packetsRead);
+
+    /*! \brief Configures the filter applied by the reader thread. The filter state is reset;
+     * packets filtered with the previous configuration and not pulled yet are kept, unless the filtered ring is resized
+     * because the decimation changed or the filter was disabled.
+     *
+     * \param config [in] Filter configuration, see StreamFilter::configure.
+     * \param samplingRateHz [in] Applied sampling rate, used if E4FilterConfig_t::samplingRateHz is 0.
+     * \return false, leaving the filter unchanged, if the configuration is invalid;
+     * false, with the filter disabled, if the filtered ring could not be allocated.
+     */
+    bool setFilter(EDL_IN const E4FilterConfig_t &config,
+                   EDL_IN double samplingRateHz);
+
+    /*! \brief Configures the event detector applied by the reader thread. The baselines are learnt again.
+     *
+     * \param config [in] Detector configuration, see EventDetector::configure.
+     * \param samplingRateHz [in] Applied sampling rate, used if E4DetectorConfig_t::samplingRateHz is 0.
+     * \return false, leaving the detector unchanged, if the configuration is invalid.
+     */
+    bool setDetector(EDL_IN const E4DetectorConfig_t &config,
+                     EDL_IN double samplingRateHz);
+
+    /*! \brief Configures the power spectral density estimate updated by the reader thread. The spectra are discarded.
+     *
+     * \param config [in] Spectrum configuration, see WelchSpectrum::configure.
+     * \param samplingRateHz [in] Applied sampling rate, used if E4SpectrumConfig_t::samplingRateHz is 0.
+     * \return false, leaving the spectrum unchanged, if the configuration is invalid.
+     */
+    bool setSpectrum(EDL_IN const E4SpectrumConfig_t &config,
+                     EDL_IN double samplingRateHz);
+
+    /*! \brief Returns the latest power spectral density estimate, see WelchSpectrum::get.
+     */
+    void getSpectrum(EDL_OUT float * dst,
+                     EDL_IN unsigned int maxBins,
+                     EDL_OUT E4SpectrumInfo_t &info) const;
+
+    /*! \brief Configures the protocol sweeps averaged by the reader thread. The averaged sweeps are discarded.
+     *
+     * \param config [in] Sweep configuration, see SweepAverager::configure.
+     * \param samplingRateHz [in] Applied sampling rate, used if E4SweepConfig_t::samplingRateHz is 0.
+     * \param protocolPeriodMs [in] Applied protocol period, used if E4SweepConfig_t::periodMs is 0.
+     * \return false, leaving the sweeps unchanged, if the configuration is invalid.
+     */
+    bool setSweeps(EDL_IN const E4SweepConfig_t &config,
+                   EDL_IN double samplingRateHz,
+                   EDL_IN double protocolPeriodMs);
+
+    /*! \brief Returns the latest averaged sweep, see SweepAverager::get.
+     */
+    void getSweep(EDL_OUT float * dst,
+                  EDL_IN unsigned int maxBins,
+                  EDL_OUT E4SweepInfo_t &info) const;
+
+    /*! \brief Moves detected events out of the detector queue.
+     *
+     * \param dst [out] Buffer with room for \a maxEvents events.
+     * \param maxEvents [in] Maximum number of events to move.
+     * \return Number of events actually moved.
+     */
+    unsigned int pollEvents(EDL_OUT E4Event_t * dst,
+                            EDL_IN unsigned int maxEvents);
+
+    /*! \brief Sets the recording every read data packet is written to, NULL for none.
+     * The reader thread only encodes chunks; the file is written by the recording's own I/O thread.
+     *
+     * \param recording [in] Recording to write to.
+     * \param eventsOnly [in] Flag to write only the data packets around events, see EventGate.
+     */
+    void setRecording(EDL_IN Recording * recording,
+                      EDL_IN bool eventsOnly);
+
+    /*! \brief Sets the shared ring every read data packet is published to, NULL for none.
+     */
+    void setSharedRing(EDL_IN SharedRing * sharedRing);
+
+    /*! \brief Returns the acquisition counters.
+     */
+    void getStats(EDL_OUT E4AcquisitionStats_t &stats) const;
+
+    /*! \brief Restricts the reader thread to a set of cores, e.g. to keep the reader threads of several devices apart.
+     * Takes effect at the next read if the thread is running, at the start otherwise.
+     *
+     * \param cpuMask [in] Bit mask of the allowed cores, bit 0 being core 0; 0 to allow every core of the process.
+     * \return false, leaving the cores unchanged, if none of the cores in \a cpuMask is available to the process.
+     */
+    bool setAffinity(EDL_IN unsigned long long cpuMask);
+
+private:
+    void run(EDL_VOID);
+    bool allocateFilteredRing(bool keepPackets);
+
+    EdlBackend &edl;
+    std::mutex &edlMutex;
+    RunningStatistics &statistics;
+    ReadScheduler &scheduler;
+    PipelineMetrics &metrics;
+    PacketRing ring;
+    std::thread thread;
+    std::vector <float> readBuffer;
+    std::mutex recordingMutex; /*!< Guards recording and gate; taken after detectorMutex when both are needed. */
+    Recording * recording;
+    bool recordingEventsOnly;
+    EventGate gate;
+
+    std::mutex sharedMutex; /*!< Guards sharedRing. */
+    SharedRing * sharedRing;
+
+    std::mutex detectorMutex;
+    EventDetector detector;
+    std::vector <unsigned char> activeBuffer;
+
+    std::mutex spectrumMutex;
+    WelchSpectrum spectrum;
+
+    std::mutex sweepsMutex;
+    SweepAverager sweeps;
+
+    std::mutex filterMutex; /*!< Guards filter, and the producer side of filteredRing; taken before filteredRingMutex. */
+    StreamFilter filter;
+    mutable std::mutex filteredRingMutex; /*!< Guards the consumer side of filteredRing, and its size, against its reallocation. */
+    PacketRing filteredRing;
+    std::vector <float> filteredBuffer;
+
+    std::atomic <unsigned long long> affinityMask;
+    std::atomic <bool> affinityChanged;
+
+    std::atomic <bool> running;
+    std::atomic <int> lastError;
+    std::atomic <unsigned long long> packetsRead;
+    std::atomic <unsigned long long> packetsDropped;
+    std::atomic <unsigned long long> bufferOverflowCount;
+    std::atomic <unsigned long long> lostDataCount;
+    std::atomic <unsigned long long> filteredPacketsDropped;
+};
+
+#endif // E4_ACQUISITION_H
@@ -0,0 +1,41 @@
+/*! \file e4_backend.cpp
+ * \brief Defines class VendorBackend.
+ */
+#include "e4_backend.h"
+
+#ifdef _WIN32
+EdlErrorCode_t VendorBackend::detectDevices(std::vector <std::string> &deviceIds)
+{
+    return edl.detectDevices(deviceIds);
+}
+
+EdlErrorCode_t VendorBackend::connectDevice(std::string deviceId)
+{
+    return edl.connectDevice(deviceId);
+}
+
+EdlErrorCode_t VendorBackend::disconnectDevice()
+{
+    return edl.disconnectDevice();
+}
+
+EdlErrorCode_t VendorBackend::getDeviceStatus(EdlDeviceStatus_t &status)
+{
+    return edl.getDeviceStatus(status);
+}
+
+EdlErrorCode_t VendorBackend::readData(unsigned int dataToRead, unsigned int &dataRead, std::vector <float> &buffer)
+{
+    return edl.readData(dataToRead, dataRead, buffer);
+}
+
+EdlErrorCode_t VendorBackend::purgeData()
+{
+    return edl.purgeData();
+}
+
+EdlErrorCode_t VendorBackend::setCommand(EdlCommandId_t commandId, EdlCommandStruct_t &commandStruct, bool sendFlag)
+{
+    return edl.setCommand(commandId, commandStruct, sendFlag);
+}
+#endif
@@ -0,0 +1,78 @@
+/*! \file e4_backend.h
+ * \brief Declares the interface EdlBackend and class VendorBackend.
+ */
+#ifndef E4_BACKEND_H
+#define E4_BACKEND_H
+
+#include <string>
+#include <vector>
+
+#include "edl.h"
+
+/*! \class EdlBackend
+ * \brief Interface to a device, mirroring the methods of class EDL used by the library.
+ * Implemented by VendorBackend on top of the vendor library, by SimulatedBackend, which needs no hardware,
+ * and by ReplayBackend, which plays a recording file back.
+ * As with EDL, calls to the same backend must be serialized by the caller.
+ */
+class EdlBackend {
+public:
+    virtual ~EdlBackend() {}
+
+    /*! \brief Detects the plugged in devices, see EDL::detectDevices.
+     */
+    virtual EdlErrorCode_t detectDevices(EDL_OUT std::vector <std::string> &deviceIds) = 0;
+
+    /*! \brief Connects to a device, see EDL::connectDevice.
+     */
+    virtual EdlErrorCode_t connectDevice(EDL_IN std::string deviceId) = 0;
+
+    /*! \brief Disconnects the device, see EDL::disconnectDevice.
+     */
+    virtual EdlErrorCode_t disconnectDevice(EDL_VOID) = 0;
+
+    /*! \brief Returns the device status, see EDL::getDeviceStatus.
+     */
+    virtual EdlErrorCode_t getDeviceStatus(EDL_OUT EdlDeviceStatus_t &status) = 0;
+
+    /*! \brief Reads data packets from the device, see EDL::readData.
+     */
+    virtual EdlErrorCode_t readData(EDL_IN unsigned int dataToRead,
+                                    EDL_OUT unsigned int &dataRead,
+                                    EDL_OUT std::vector <float> &buffer) = 0;
+
+    /*! \brief Purges the data available in the device, see EDL::purgeData.
+     */
+    virtual EdlErrorCode_t purgeData(EDL_VOID) = 0;
+
+    /*! \brief Sets a command for the device, see EDL::setCommand.
+     */
+    virtual EdlErrorCode_t setCommand(EDL_IN EdlCommandId_t commandId,
+                                      EDL_IN EdlCommandStruct_t &commandStruct,
+                                      EDL_IN bool sendFlag) = 0;
+};
+
+#ifdef _WIN32
+/*! \class VendorBackend
+ * \brief EdlBackend forwarding every call to an EDL object of the vendor library, only available on Windows.
+ */
+class VendorBackend : public EdlBackend {
+public:
+    EdlErrorCode_t detectDevices(EDL_OUT std::vector <std::string> &deviceIds);
+    EdlErrorCode_t connectDevice(EDL_IN std::string deviceId);
+    EdlErrorCode_t disconnectDevice(EDL_VOID);
+    EdlErrorCode_t getDeviceStatus(EDL_OUT EdlDeviceStatus_t &status);
+    EdlErrorCode_t readData(EDL_IN unsigned int dataToRead,
+                            EDL_OUT unsigned int &dataRead,
+                            EDL_OUT std::vector <float> &buffer);
+    EdlErrorCode_t purgeData(EDL_VOID);
+    EdlErrorCode_t setCommand(EDL_IN EdlCommandId_t commandId,
+                              EDL_IN EdlCommandStruct_t &commandStruct,
+                              EDL_IN bool sendFlag);
+
+private:
+    EDL edl;
+};
+#endif
+
+#endif // E4_BACKEND_H
@@ -0,0 +1,497 @@
+/*! \file e4_bench.cpp
+ * \brief Benchmarks of the data path, built by the Benchmark target.
+ *
+ * Microbenchmarks are printed in ns per data packet, to compare with the 5 us packet period at 200 kHz.
+ * The end-to-end benchmarks drive a simulated device through the exported functions at every sampling rate,
+ * once with the background acquisition and a polling consumer, and once with readData;
+ * their results are also written to a JSON file, so that changes to the pipeline can be compared.
+ *
+ * Usage: e4_bench [-o results.json] [-s seconds per rate] [-p consumer poll period in us] [-b device buffer packets] [-c]
+ * -c compresses the recordings of the background acquisition.
+ */
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <time.h>
+#endif
+
+#include "edl_global.h"
+#include "edl_devicespecs.h"
+#include "e4_acquisition.h"
+#include "e4_deinterleave.h"
+#include "e4_filewriter.h"
+#include "e4_recording.h"
+#include "e4_scheduler.h"
+#include "e4_settings.h"
+#include "e4_simulator.h"
+#include "e4_statistics.h"
+
+#define BENCH_PACKETS (1 << 16)
+#define BENCH_REPETITIONS 200
+
+#define BENCH_DEFAULT_SECONDS 2.0
+#define BENCH_DEFAULT_POLL_US 1000
+#define BENCH_DEFAULT_JSON "e4_bench.json"
+#define BENCH_RECORDING_FILE "e4_bench.e4r"
+#define BENCH_RATE_NUM (EDL_RADIO_SAMPLING_RATE_200_KHZ+1)
+
+// Exported by e4_dll.cpp, which is linked into the benchmark.
+extern "C" EdlErrorCode_t setSimulation(const E4SimulatorConfig_t * config);
+extern "C" int openDevice(unsigned int deviceIdx);
+extern "C" EdlErrorCode_t setCommand(int deviceHandle, EdlCommandId_t commandId, const EdlCommandStruct_t * commandStruct, bool sendFlag);
+extern "C" EdlErrorCode_t readData(int deviceHandle, FILE * f);
+extern "C" EdlErrorCode_t readInto(int deviceHandle, float * dst, size_t capacityPackets, size_t * packetsRead);
+extern "C" EdlErrorCode_t startAcquisition(int deviceHandle, unsigned int ringPackets);
+extern "C" void stopAcquisition(int deviceHandle);
+extern "C" EdlErrorCode_t pullPackets(int deviceHandle, float * dst, unsigned int maxPackets, unsigned int * packetsRead);
+extern "C" void getAcquisitionStats(int deviceHandle, E4AcquisitionStats_t * stats);
+extern "C" void getStats(int deviceHandle, E4Stats_t * stats);
+extern "C" EdlErrorCode_t startRecording(int deviceHandle, const char * path, unsigned int flags, unsigned long long preallocateBytes);
+extern "C" EdlErrorCode_t stopRecording(int deviceHandle);
+extern "C" void getWriterStats(int deviceHandle, E4WriterStats_t * stats);
+extern "C" void getSchedulerStats(int deviceHandle, E4SchedulerStats_t * stats);
+extern "C" EdlErrorCode_t closeEDL(int deviceHandle);
+
+typedef struct {
+    const char * name;
+    double nsPerPacket;
+    bool match;
+} BenchKernelResult_t;
+
+typedef struct {
+    double samplingRateHz;
+    double seconds; /*!< Wall clock time of the measurement. */
+    unsigned long long packetsRead; /*!< Data packets read from the device. */
+    unsigned long long packetsConsumed; /*!< Data packets pulled by the consumer; for readData, read by readData. */
+    unsigned long long backlogPackets; /*!< Data packets left in the device when the measurement ended. */
+    unsigned long long packetsDropped; /*!< Data packets discarded because the acquisition ring was full. */
+    unsigned long long bytesWritten; /*!< Bytes written to the recording file. */
+    double cpuPercentPerChannel; /*!< CPU time of the library per channel, in percent of a core, without the simulated device. */
+    double simulatorCpuPercentPerChannel; /*!< CPU time spent generating the synthetic data packets, per channel, in percent of a core. */
+    double latencyUs[3]; /*!< p50, p99 and p999 of the time from a data packet being produced to being pulled, 0 if not measured. */
+    bool latencyValid; /*!< false if data packets were lost on the way, making the latency of the following ones unknown. */
+    unsigned long long bufferOverflowCount;
+    unsigned long long lostDataCount;
+    E4SchedulerStats_t scheduler; /*!< Decisions of the poll scheduler of the device. */
+    EdlErrorCode_t error;
+} BenchRateResult_t;
+
+static double deinterleaveNsPerPacket(E4DeinterleaveKernel_t kernel, const std::vector <float> &src, std::vector <float> &dst)
+{
+    const size_t packetsNum = src.size()/EDL_CHANNEL_NUM;
+    double best = 0.0;
+
+    // Keep the best of several runs, to filter out the noise of the OS.
+    for (int runIdx = 0; runIdx < 5; runIdx++)
+    {
+        const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        for (int repetitionIdx = 0; repetitionIdx < BENCH_REPETITIONS; repetitionIdx++)
+        {
+            deinterleavePacketsWith(kernel, src.data(), packetsNum, dst.data(), packetsNum);
+        }
+        const double ns = std::chrono::duration <double, std::nano> (std::chrono::steady_clock::now()-start).count();
+        const double nsPerPacket = ns/((double)packetsNum*BENCH_REPETITIONS);
+        if (runIdx == 0 || nsPerPacket < best) {best = nsPerPacket;}
+    }
+    return best;
+}
+
+static bool benchDeinterleave(std::vector <BenchKernelResult_t> &results)
+{
+    std::vector <float> src((size_t)BENCH_PACKETS*EDL_CHANNEL_NUM);
+    std::vector <float> reference(src.size());
+    std::vector <float> dst(src.size());
+    for (size_t valueIdx = 0; valueIdx < src.size(); valueIdx++) {src[valueIdx] = (float)valueIdx;}
+    deinterleavePacketsWith(E4DeinterleaveScalar, src.data(), BENCH_PACKETS, reference.data(), BENCH_PACKETS);
+
+    printf("deinterleave, %d channels, %d packets, dispatched kernel: %s\n",
+           EDL_CHANNEL_NUM, BENCH_PACKETS, deinterleaveKernelName(deinterleaveKernel()));
+
+    bool ok = true;
+    double scalarNs = 0.0;
+    for (int kernel = 0; kernel < E4DeinterleaveKernelNum; kernel++)
+    {
+        const E4DeinterleaveKernel_t k = (E4DeinterleaveKernel_t)kernel;
+        if (!deinterleaveKernelAvailable(k))
+        {
+            printf("  %-8s not available\n", deinterleaveKernelName(k));
+            continue;
+        }
+
+        // Odd packet counts exercise the scalar tails.
+        std::fill(dst.begin(), dst.end(), -1.0f);
+        deinterleavePacketsWith(k, src.data(), BENCH_PACKETS-3, dst.data(), BENCH_PACKETS);
+        bool match = true;
+        for (size_t channelIdx = 0; channelIdx < EDL_CHANNEL_NUM; channelIdx++)
+        {
+            match = match && memcmp(&dst[channelIdx*BENCH_PACKETS], &reference[channelIdx*BENCH_PACKETS], (BENCH_PACKETS-3)*sizeof(float)) == 0;
+        }
+        ok = ok && match;
+
+        const double ns = deinterleaveNsPerPacket(k, src, dst);
+        if (k == E4DeinterleaveScalar) {scalarNs = ns;}
+        printf("  %-8s %7.3f ns/packet  x%5.2f  %s\n", deinterleaveKernelName(k), ns, scalarNs/ns, match ? "ok" : "MISMATCH");
+
+        BenchKernelResult_t result = {deinterleaveKernelName(k), ns, match};
+        results.push_back(result);
+    }
+    return ok;
+}
+
+/*! \brief Returns the CPU time used by all of the threads of the process.
+ */
+static double processCpuSeconds()
+{
+#ifdef _WIN32
+    FILETIME creationTime, exitTime, kernelTime, userTime;
+    if (!GetProcessTimes(GetCurrentProcess(), &creationTime, &exitTime, &kernelTime, &userTime)) {return 0.0;}
+    const unsigned long long kernel100Ns = ((unsigned long long)kernelTime.dwHighDateTime << 32) | kernelTime.dwLowDateTime;
+    const unsigned long long user100Ns = ((unsigned long long)userTime.dwHighDateTime << 32) | userTime.dwLowDateTime;
+    return (double)(kernel100Ns+user100Ns)*1.0e-7;
+#else
+    timespec ts;
+    if (clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts) != 0) {return 0.0;}
+    return (double)ts.tv_sec+(double)ts.tv_nsec*1.0e-9;
+#endif
+}
+
+static double secondsSince(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration <double> (std::chrono::steady_clock::now()-start).count();
+}
+
+/*! \brief Returns the CPU time the simulated device spends generating each data packet at \a radioId,
+ * to be taken out of the CPU time measured end to end.
+ */
+static double simulatorCpuSecondsPerPacket(E4SimulatorConfig_t config, unsigned int radioId)
+{
+    const unsigned int calibrationPackets = 1 << 20;
+
+    // Fast enough that the buffer is always full.
+    config.speedFactor = 1.0e4;
+    config.bufferPackets = calibrationPackets;
+    SimulatedBackend backend(config);
+
+    std::vector <std::string> deviceIds;
+    if (backend.detectDevices(deviceIds) != EdlSuccess || deviceIds.empty()) {return 0.0;}
+    if (backend.connectDevice(deviceIds[0]) != EdlSuccess) {return 0.0;}
+
+    EdlCommandStruct_t commandStruct;
+    commandStruct.radioId = radioId;
+    backend.setCommand(EdlCommandSamplingRate, commandStruct, true);
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+
+    std::vector <float> buffer;
+    unsigned int readPacketsNum;
+    unsigned long long packetsNum = 0;
+    const double cpuStart = processCpuSeconds();
+    while (packetsNum < calibrationPackets) {
+        if (backend.readData(calibrationPackets/16, readPacketsNum, buffer) == EdlDeviceNotConnectedError) {break;}
+        packetsNum += readPacketsNum;
+    }
+    const double cpuSeconds = processCpuSeconds()-cpuStart;
+    backend.disconnectDevice();
+    return packetsNum > 0 ? cpuSeconds/packetsNum : 0.0;
+}
+
+/*! \brief Returns the quantile \a q of \a values, which are reordered.
+ */
+static double quantile(std::vector <float> &values, double q)
+{
+    if (values.empty()) {return 0.0;}
+    const size_t idx = std::min(values.size()-1, (size_t)(q*values.size()));
+    std::nth_element(values.begin(), values.begin()+idx, values.end());
+    return values[idx];
+}
+
+static int openBenchDevice(const E4SimulatorConfig_t &config, unsigned int radioId)
+{
+    if (setSimulation(&config) != EdlSuccess) {return -1;}
+    const int handle = openDevice(0);
+    if (handle < 0) {return -1;}
+
+    EdlCommandStruct_t commandStruct;
+    commandStruct.radioId = EDL_RADIO_RANGE_200_PA;
+    setCommand(handle, EdlCommandRange, &commandStruct, false);
+    commandStruct.radioId = EDL_RADIO_FINAL_BANDWIDTH_SR_2;
+    setCommand(handle, EdlCommandFinalBandwidth, &commandStruct, false);
+    commandStruct.radioId = radioId;
+    if (setCommand(handle, EdlCommandSamplingRate, &commandStruct, true) != EdlSuccess)
+    {
+        closeEDL(handle);
+        return -1;
+    }
+    return handle;
+}
+
+/*! \brief Acquires for \a seconds with the background acquisition, recording to a file,
+ * while a consumer pulls the data packets every \a pollUs like a client would.
+ *
+ * The simulated device produces its data packets at a steady pace from the purge done by startAcquisition,
+ * so the production time of the n-th data packet pulled is known as long as none is lost.
+ */
+static BenchRateResult_t benchAcquisition(const E4SimulatorConfig_t &config, unsigned int radioId, double seconds, unsigned int pollUs, unsigned int recordingFlags)
+{
+    BenchRateResult_t result;
+    memset(&result, 0, sizeof(result));
+    result.samplingRateHz = DeviceSettings::samplingRateHz(radioId);
+
+    const double simulatorCpuPerPacket = simulatorCpuSecondsPerPacket(config, radioId);
+
+    const int handle = openBenchDevice(config, radioId);
+    if (handle < 0)
+    {
+        result.error = EdlDeviceNotConnectedError;
+        return result;
+    }
+
+    const size_t expectedPackets = (size_t)(result.samplingRateHz*(seconds+1.0));
+    std::vector <float> latencies;
+    latencies.reserve(expectedPackets);
+    std::vector <float> buffer((size_t)E4_DEFAULT_RING_PACKETS*EDL_CHANNEL_NUM);
+    unsigned int pulledNum;
+
+    result.error = startRecording(handle, BENCH_RECORDING_FILE, recordingFlags, 0);
+    if (result.error == EdlSuccess) {result.error = startAcquisition(handle, 0);}
+    if (result.error != EdlSuccess)
+    {
+        closeEDL(handle);
+        return result;
+    }
+
+    const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    const double cpuStart = processCpuSeconds();
+    while (secondsSince(start) < seconds) {
+        std::this_thread::sleep_for(std::chrono::microseconds(pollUs));
+        if (pullPackets(handle, buffer.data(), E4_DEFAULT_RING_PACKETS, &pulledNum) != EdlSuccess) {continue;}
+
+        // The k-th data packet since the purge is produced (k+1)/rate after it.
+        const double nowS = secondsSince(start);
+        for (unsigned int packetIdx = 0; packetIdx < pulledNum; packetIdx++)
+        {
+            const double producedS = (double)(result.packetsConsumed+packetIdx+1)/result.samplingRateHz;
+            latencies.push_back((float)((nowS-producedS)*1.0e6));
+        }
+        result.packetsConsumed += pulledNum;
+    }
+    result.seconds = secondsSince(start);
+    const double cpuSeconds = processCpuSeconds()-cpuStart;
+
+    stopAcquisition(handle);
+    result.backlogPackets = 0;
+    size_t backlogNum;
+    while (readInto(handle, buffer.data(), E4_DEFAULT_RING_PACKETS, &backlogNum) == EdlSuccess && backlogNum > 0) {result.backlogPackets += backlogNum;}
+    if (stopRecording(handle) != EdlSuccess) {result.error = EdlUnknownError;}
+
+    E4AcquisitionStats_t acquisitionStats;
+    getAcquisitionStats(handle, &acquisitionStats);
+    E4WriterStats_t writerStats;
+    getWriterStats(handle, &writerStats);
+    getSchedulerStats(handle, &result.scheduler);
+    closeEDL(handle);
+    remove(BENCH_RECORDING_FILE);
+
+    result.packetsRead = acquisitionStats.packetsRead;
+    result.packetsDropped = acquisitionStats.packetsDropped;
+    result.bufferOverflowCount = acquisitionStats.bufferOverflowCount;
+    result.lostDataCount = acquisitionStats.lostDataCount;
+    result.bytesWritten = writerStats.bytesWritten;
+
+    const double simulatorCpuSeconds = simulatorCpuPerPacket*result.packetsRead;
+    result.cpuPercentPerChannel = 100.0*std::max(0.0, cpuSeconds-simulatorCpuSeconds)/result.seconds/EDL_CHANNEL_NUM;
+    result.simulatorCpuPercentPerChannel = 100.0*simulatorCpuSeconds/result.seconds/EDL_CHANNEL_NUM;
+
+    result.latencyValid = result.bufferOverflowCount == 0 && result.packetsDropped == 0;
+    result.latencyUs[0] = quantile(latencies, 0.5);
+    result.latencyUs[1] = quantile(latencies, 0.99);
+    result.latencyUs[2] = quantile(latencies, 0.999);
+    return result;
+}
+
+/*! \brief Runs readData once, recording to a file, and measures how many data packets it leaves in the device.
+ */
+static BenchRateResult_t benchReadData(const E4SimulatorConfig_t &config, unsigned int radioId)
+{
+    BenchRateResult_t result;
+    memset(&result, 0, sizeof(result));
+    result.samplingRateHz = DeviceSettings::samplingRateHz(radioId);
+
+    const double simulatorCpuPerPacket = simulatorCpuSecondsPerPacket(config, radioId);
+
+    const int handle = openBenchDevice(config, radioId);
+    if (handle < 0)
+    {
+        result.error = EdlDeviceNotConnectedError;
+        return result;
+    }
+
+    FILE * f = fopen(BENCH_RECORDING_FILE, "wb");
+    if (f == NULL)
+    {
+        closeEDL(handle);
+        result.error = EdlUnknownError;
+        return result;
+    }
+
+    // readData waits 500 ms before purging the device: measure from the purge.
+    const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    const double cpuStart = processCpuSeconds();
+    result.error = readData(handle, f);
+    const double cpuSeconds = processCpuSeconds()-cpuStart;
+    result.seconds = std::max(1.0e-6, secondsSince(start)-0.5);
+
+    // Whatever is still in the device was produced while readData ran but not read.
+    std::vector <float> buffer((size_t)(config.bufferPackets > 0 ? config.bufferPackets : E4_SIMULATOR_DEFAULT_BUFFER_PACKETS)*EDL_CHANNEL_NUM);
+    size_t backlogNum = 0;
+    if (result.error != EdlDeviceNotConnectedError)
+    {
+        readInto(handle, buffer.data(), buffer.size()/EDL_CHANNEL_NUM, &backlogNum);
+        fseek(f, 0, SEEK_END);
+        result.bytesWritten = (unsigned long long)ftell(f);
+        fclose(f);
+    }
+    result.backlogPackets = backlogNum;
+
+    E4Stats_t stats;
+    getStats(handle, &stats);
+    getSchedulerStats(handle, &result.scheduler);
+    closeEDL(handle);
+    remove(BENCH_RECORDING_FILE);
+
+    result.packetsRead = stats.packetNum;
+    result.packetsConsumed = stats.packetNum;
+    result.bufferOverflowCount = stats.bufferOverflowCount;
+    result.lostDataCount = stats.lostDataCount;
+
+    const double simulatorCpuSeconds = simulatorCpuPerPacket*(result.packetsRead+result.backlogPackets);
+    result.cpuPercentPerChannel = 100.0*std::max(0.0, cpuSeconds-simulatorCpuSeconds)/result.seconds/EDL_CHANNEL_NUM;
+    result.simulatorCpuPercentPerChannel = 100.0*simulatorCpuSeconds/result.seconds/EDL_CHANNEL_NUM;
+    return result;
+}
+
+static void printRateResult(const BenchRateResult_t &result)
+{
+    printf("  %8.2f kHz  %10.0f pkt/s  %6.2f MB/s  cpu %6.3f%%/ch (sim %6.3f%%)  backlog %8llu  drop %llu  ovf %llu  lost %llu",
+           result.samplingRateHz*1.0e-3, result.packetsConsumed/result.seconds, result.bytesWritten/result.seconds*1.0e-6,
+           result.cpuPercentPerChannel, result.simulatorCpuPercentPerChannel, result.backlogPackets,
+           result.packetsDropped, result.bufferOverflowCount, result.lostDataCount);
+    if (result.latencyUs[2] > 0.0)
+    {
+        printf("  latency p50 %.0f p99 %.0f p999 %.0f us%s", result.latencyUs[0], result.latencyUs[1], result.latencyUs[2], result.latencyValid ? "" : " (invalid)");
+    }
+    printf("  polls %llu (empty %llu, late %llu) batch %.0f", result.scheduler.polls, result.scheduler.emptyPolls, result.scheduler.latePolls, result.scheduler.meanBatchPackets);
+    if (result.error != EdlSuccess) {printf("  error %d", (int)result.error);}
+    printf("\n");
+}
+
+static void writeRateResults(FILE * f, const char * name, const std::vector <BenchRateResult_t> &results, bool withLatency)
+{
+    fprintf(f, "  \"%s\": [\n", name);
+    for (size_t resultIdx = 0; resultIdx < results.size(); resultIdx++)
+    {
+        const BenchRateResult_t &result = results[resultIdx];
+        fprintf(f, "    {\"samplingRateHz\": %.2f, \"seconds\": %.6f, \"packetsRead\": %llu, \"packetsConsumed\": %llu, "
+                "\"packetsPerSecond\": %.1f, \"backlogPackets\": %llu, \"packetsDropped\": %llu, "
+                "\"bytesWritten\": %llu, \"bytesPerSecond\": %.1f, "
+                "\"cpuPercentPerChannel\": %.4f, \"simulatorCpuPercentPerChannel\": %.4f, ",
+                result.samplingRateHz, result.seconds, result.packetsRead, result.packetsConsumed,
+                result.packetsConsumed/result.seconds, result.backlogPackets, result.packetsDropped,
+                result.bytesWritten, result.bytesWritten/result.seconds,
+                result.cpuPercentPerChannel, result.simulatorCpuPercentPerChannel);
+        if (withLatency)
+        {
+            fprintf(f, "\"latencyP50Us\": %.1f, \"latencyP99Us\": %.1f, \"latencyP999Us\": %.1f, \"latencyValid\": %s, ",
+                    result.latencyUs[0], result.latencyUs[1], result.latencyUs[2], result.latencyValid ? "true" : "false");
+        }
+        fprintf(f, "\"polls\": %llu, \"emptyPolls\": %llu, \"catchUpPolls\": %llu, \"latePolls\": %llu, \"meanBatchPackets\": %.1f, \"pollIntervalUs\": %.1f, \"oversleepUs\": %.1f, ",
+                result.scheduler.polls, result.scheduler.emptyPolls, result.scheduler.catchUpPolls, result.scheduler.latePolls,
+                result.scheduler.meanBatchPackets, result.scheduler.pollIntervalUs, result.scheduler.oversleepUs);
+        fprintf(f, "\"bufferOverflowCount\": %llu, \"lostDataCount\": %llu, \"error\": %d}%s\n",
+                result.bufferOverflowCount, result.lostDataCount, (int)result.error, resultIdx+1 < results.size() ? "," : "");
+    }
+    fprintf(f, "  ]");
+}
+
+int main(int argc, char ** argv)
+{
+    const char * jsonPath = BENCH_DEFAULT_JSON;
+    double seconds = BENCH_DEFAULT_SECONDS;
+    unsigned int pollUs = BENCH_DEFAULT_POLL_US;
+    unsigned int recordingFlags = 0;
+
+    E4SimulatorConfig_t config;
+    memset(&config, 0, sizeof(config));
+    config.baselineCurrent = 100.0;
+    config.noiseRms = 5.0;
+    config.seed = 1;
+
+    for (int argIdx = 1; argIdx < argc; argIdx++)
+    {
+        const bool hasValue = argIdx+1 < argc;
+        if (strcmp(argv[argIdx], "-o") == 0 && hasValue) {jsonPath = argv[++argIdx];}
+        else if (strcmp(argv[argIdx], "-s") == 0 && hasValue) {seconds = atof(argv[++argIdx]);}
+        else if (strcmp(argv[argIdx], "-p") == 0 && hasValue) {pollUs = (unsigned int)atoi(argv[++argIdx]);}
+        else if (strcmp(argv[argIdx], "-b") == 0 && hasValue) {config.bufferPackets = (unsigned int)atoi(argv[++argIdx]);}
+        else if (strcmp(argv[argIdx], "-c") == 0) {recordingFlags |= E4_RECORDING_COMPRESS;}
+        else
+        {
+            printf("usage: %s [-o results.json] [-s seconds per rate] [-p consumer poll period in us] [-b device buffer packets] [-c]\n", argv[0]);
+            return 2;
+        }
+    }
+
+    std::vector <BenchKernelResult_t> kernelResults;
+    bool ok = benchDeinterleave(kernelResults);
+
+    std::vector <BenchRateResult_t> acquisitionResults;
+    printf("background acquisition, %.1f s per rate, consumer polling every %u us, recording%s\n",
+           seconds, pollUs, recordingFlags & E4_RECORDING_COMPRESS ? " compressed" : "");
+    for (unsigned int radioId = 0; radioId < BENCH_RATE_NUM; radioId++)
+    {
+        acquisitionResults.push_back(benchAcquisition(config, radioId, seconds, pollUs, recordingFlags));
+        printRateResult(acquisitionResults.back());
+        ok = ok && acquisitionResults.back().error == EdlSuccess;
+    }
+
+    std::vector <BenchRateResult_t> readDataResults;
+    printf("readData\n");
+    for (unsigned int radioId = 0; radioId < BENCH_RATE_NUM; radioId++)
+    {
+        readDataResults.push_back(benchReadData(config, radioId));
+        printRateResult(readDataResults.back());
+        ok = ok && readDataResults.back().error == EdlSuccess;
+    }
+
+    FILE * f = fopen(jsonPath, "w");
+    if (f == NULL)
+    {
+        printf("cannot write %s\n", jsonPath);
+        return 1;
+    }
+    fprintf(f, "{\n  \"channels\": %d, \"secondsPerRate\": %.3f, \"pollUs\": %u, \"deviceBufferPackets\": %u, \"compressed\": %s,\n",
+            EDL_CHANNEL_NUM, seconds, pollUs, config.bufferPackets > 0 ? config.bufferPackets : E4_SIMULATOR_DEFAULT_BUFFER_PACKETS,
+            recordingFlags & E4_RECORDING_COMPRESS ? "true" : "false");
+    fprintf(f, "  \"deinterleave\": [\n");
+    for (size_t resultIdx = 0; resultIdx < kernelResults.size(); resultIdx++)
+    {
+        fprintf(f, "    {\"kernel\": \"%s\", \"nsPerPacket\": %.4f, \"ok\": %s}%s\n", kernelResults[resultIdx].name, kernelResults[resultIdx].nsPerPacket,
+                kernelResults[resultIdx].match ? "true" : "false", resultIdx+1 < kernelResults.size() ? "," : "");
+    }
+    fprintf(f, "  ],\n");
+    writeRateResults(f, "acquisition", acquisitionResults, true);
+    fprintf(f, ",\n");
+    writeRateResults(f, "readData", readDataResults, false);
+    fprintf(f, "\n}\n");
+    fclose(f);
+    printf("results written to %s\n", jsonPath);
+
+    return ok ? 0 : 1;
+}
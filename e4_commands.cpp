@@ -0,0 +1,261 @@
+/*! \file e4_commands.cpp
+ * \brief Defines class CommandQueue.
+ */
+#include <chrono>
+#include <cstring>
+
+#include "e4_commands.h"
+#include "e4_device.h"
+
+/*! \brief Returns true for the protocol values, which EDL::setCommand refuses to send.
+ */
+static bool isTrialValue(EdlCommandId_t commandId)
+{
+    return commandId >= EdlCommandMainTrial && commandId <= EdlCommandTPeriod;
+}
+
+/*! \brief Returns true for the push buttons, which EDL::setCommand refuses to stack.
+ */
+static bool isPushButton(EdlCommandId_t commandId)
+{
+    return commandId == EdlCommandZAPAllChannels || commandId == EdlCommandResetComp
+            || commandId == EdlCommandPulse || commandId == EdlCommandApplyProtocol;
+}
+
+CommandQueue::CommandQueue(Device &device) :
+    device(device),
+    runningNum(0),
+    stopping(false),
+    nextTicket(1),
+    lastCompletedTicket(0)
+{
+    memset(&stats, 0, sizeof(stats));
+}
+
+CommandQueue::~CommandQueue()
+{
+    stop();
+}
+
+EdlErrorCode_t CommandQueue::validate(const E4Command_t * commands, unsigned int commandsNum)
+{
+    if (commandsNum == 0 || commandsNum > E4_COMMAND_MAX_SEQUENCE) {return EdlUnknownError;}
+
+    for (unsigned int commandIdx = 0; commandIdx < commandsNum; commandIdx++)
+    {
+        const E4Command_t &command = commands[commandIdx];
+        if ((unsigned int)command.commandId >= EdlCommandIdNum) {return EdlCommandIdOutOfRangeError;}
+        if (isTrialValue(command.commandId) && command.sendFlag) {return EdlTrialValueSendNotDisabledError;}
+        if (isPushButton(command.commandId) && !command.sendFlag) {return EdlPushButtonSendDisabledError;}
+    }
+    return EdlSuccess;
+}
+
+EdlErrorCode_t CommandQueue::submit(const E4Command_t * commands, unsigned int commandsNum, E4CommandCallback_t callback, void * context, unsigned long long &ticket)
+{
+    const EdlErrorCode_t res = validate(commands, commandsNum);
+
+    std::lock_guard <std::mutex> lock(mutex);
+    if (res != EdlSuccess)
+    {
+        stats.sequencesRejected++;
+        return res;
+    }
+    if (stopping) {return EdlDeviceNotConnectedError;}
+
+    Sequence_t sequence;
+    sequence.ticket = nextTicket++;
+    sequence.commands.assign(commands, commands+commandsNum);
+    sequence.callback = callback;
+    sequence.context = context;
+    pending.push_back(sequence);
+
+    stats.sequencesSubmitted++;
+    stats.commandsSubmitted += commandsNum;
+    ticket = sequence.ticket;
+
+    if (!thread.joinable()) {thread = std::thread(&CommandQueue::run, this);}
+    changed.notify_all();
+    return EdlSuccess;
+}
+
+int CommandQueue::wait(unsigned long long ticket, unsigned int timeoutMs, EdlErrorCode_t &result)
+{
+    std::unique_lock <std::mutex> lock(mutex);
+    if (ticket == 0 || ticket >= nextTicket) {return -1;}
+
+    if (!changed.wait_for(lock, std::chrono::milliseconds(timeoutMs), [&] {return ticket <= lastCompletedTicket;})) {return 0;}
+
+    std::map <unsigned long long, EdlErrorCode_t>::const_iterator it = results.find(ticket);
+    if (it == results.end()) {return -1;}
+    result = it->second;
+    return 1;
+}
+
+void CommandQueue::stop()
+{
+    std::unique_lock <std::mutex> lock(mutex);
+    stopping = true;
+    changed.notify_all();
+
+    if (thread.joinable())
+    {
+        lock.unlock();
+        thread.join();
+        lock.lock();
+    }
+
+    std::vector <Sequence_t> sequences(pending.begin(), pending.end());
+    pending.clear();
+    if (!sequences.empty()) {complete(sequences, EdlDeviceNotConnectedError, lock);}
+}
+
+void CommandQueue::getStats(E4CommandStats_t &stats) const
+{
+    std::lock_guard <std::mutex> lock(mutex);
+    stats = this->stats;
+    stats.pendingSequences = (unsigned int)pending.size()+runningNum;
+}
+
+void CommandQueue::run()
+{
+    std::unique_lock <std::mutex> lock(mutex);
+    for (;;) {
+        changed.wait(lock, [this] {return stopping || !pending.empty();});
+        if (stopping) {break;}
+
+        // Take the first sequence, and the following ones as long as the previous can be merged into them.
+        std::vector <Sequence_t> sequences;
+        sequences.push_back(pending.front());
+        pending.pop_front();
+        while (!pending.empty() && isMergeable(sequences.back()) && hasSend(pending.front()))
+        {
+            sequences.push_back(pending.front());
+            pending.pop_front();
+        }
+        runningNum = (unsigned int)sequences.size();
+        lock.unlock();
+
+        // The sends of the merged sequences become stacks: the first send of the last sequence applies them all.
+        std::vector <E4Command_t> commands;
+        for (size_t sequenceIdx = 0; sequenceIdx < sequences.size(); sequenceIdx++)
+        {
+            for (size_t commandIdx = 0; commandIdx < sequences[sequenceIdx].commands.size(); commandIdx++)
+            {
+                commands.push_back(sequences[sequenceIdx].commands[commandIdx]);
+                if (sequenceIdx+1 < sequences.size()) {commands.back().sendFlag = false;}
+            }
+        }
+        const unsigned long long coalescedNum = coalesce(commands);
+
+        unsigned long long issuedNum = 0;
+        unsigned long long sendNum = 0;
+        const EdlErrorCode_t res = apply(commands, issuedNum, sendNum);
+
+        lock.lock();
+        stats.sequencesMerged += sequences.size()-1;
+        stats.commandsCoalesced += coalescedNum;
+        stats.commandsIssued += issuedNum;
+        stats.sends += sendNum;
+        complete(sequences, res, lock);
+    }
+}
+
+bool CommandQueue::isMergeable(const Sequence_t &sequence)
+{
+    for (size_t commandIdx = 0; commandIdx < sequence.commands.size(); commandIdx++)
+    {
+        const E4Command_t &command = sequence.commands[commandIdx];
+        if (isPushButton(command.commandId) || command.delayMs > 0) {return false;}
+    }
+    return true;
+}
+
+bool CommandQueue::hasSend(const Sequence_t &sequence)
+{
+    for (size_t commandIdx = 0; commandIdx < sequence.commands.size(); commandIdx++)
+    {
+        if (sequence.commands[commandIdx].sendFlag) {return true;}
+    }
+    return false;
+}
+
+unsigned long long CommandQueue::coalesce(std::vector <E4Command_t> &commands)
+{
+    std::vector <E4Command_t> kept;
+    kept.reserve(commands.size());
+
+    for (size_t commandIdx = 0; commandIdx < commands.size(); commandIdx++)
+    {
+        const E4Command_t &command = commands[commandIdx];
+        bool superseded = false;
+
+        // A stacked value is overwritten by a later one of the same command stacked or sent before the next send.
+        if (!command.sendFlag && command.delayMs == 0)
+        {
+            for (size_t laterIdx = commandIdx+1; laterIdx < commands.size(); laterIdx++)
+            {
+                if (commands[laterIdx].commandId == command.commandId)
+                {
+                    superseded = true;
+                    break;
+                }
+                if (commands[laterIdx].sendFlag) {break;}
+            }
+        }
+        if (!superseded) {kept.push_back(command);}
+    }
+
+    const unsigned long long coalescedNum = commands.size()-kept.size();
+    commands.swap(kept);
+    return coalescedNum;
+}
+
+EdlErrorCode_t CommandQueue::apply(const std::vector <E4Command_t> &commands, unsigned long long &issuedNum, unsigned long long &sendNum)
+{
+    for (size_t commandIdx = 0; commandIdx < commands.size(); commandIdx++)
+    {
+        E4Command_t command = commands[commandIdx];
+        EdlErrorCode_t res;
+        {
+            std::lock_guard <std::mutex> lock(device.edlMutex);
+            res = device.setCommand(command.commandId, command.commandStruct, command.sendFlag);
+        }
+        issuedNum++;
+        if (command.sendFlag) {sendNum++;}
+        if (res != EdlSuccess) {return res;}
+
+        if (command.delayMs > 0)
+        {
+            // Wait without holding the device, so that the acquisition keeps reading; stop interrupts the wait.
+            std::unique_lock <std::mutex> lock(mutex);
+            if (changed.wait_for(lock, std::chrono::milliseconds(command.delayMs), [this] {return stopping;})) {return EdlDeviceNotConnectedError;}
+        }
+    }
+    return EdlSuccess;
+}
+
+void CommandQueue::complete(std::vector <Sequence_t> &sequences, EdlErrorCode_t result, std::unique_lock <std::mutex> &lock)
+{
+    for (size_t sequenceIdx = 0; sequenceIdx < sequences.size(); sequenceIdx++)
+    {
+        results[sequences[sequenceIdx].ticket] = result;
+        if (results.size() > E4_COMMAND_RESULTS_KEPT) {results.erase(results.begin());}
+        lastCompletedTicket = sequences[sequenceIdx].ticket;
+        stats.sequencesCompleted++;
+        if (result != EdlSuccess) {stats.sequencesFailed++;}
+    }
+    runningNum = 0;
+    changed.notify_all();
+
+    // Callbacks may submit further sequences: call them without the lock.
+    lock.unlock();
+    for (size_t sequenceIdx = 0; sequenceIdx < sequences.size(); sequenceIdx++)
+    {
+        if (sequences[sequenceIdx].callback != NULL)
+        {
+            sequences[sequenceIdx].callback(sequences[sequenceIdx].ticket, result, sequences[sequenceIdx].context);
+        }
+    }
+    lock.lock();
+}
@@ -0,0 +1,159 @@
+/*! \file e4_commands.h
+ * \brief Declares class CommandQueue.
+ */
+#ifndef E4_COMMANDS_H
+#define E4_COMMANDS_H
+
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "edl.h"
+
+class Device;
+
+/*! \def E4_COMMAND_MAX_SEQUENCE
+ * \brief Maximum number of commands in a sequence passed to submitCommands.
+ */
+#define E4_COMMAND_MAX_SEQUENCE 256
+
+/*! \def E4_COMMAND_RESULTS_KEPT
+ * \brief Number of completed sequences whose result can still be queried with waitCommands.
+ */
+#define E4_COMMAND_RESULTS_KEPT 1024
+
+/*! \struct E4Command_t
+ * \brief Struct that describes one command of a sequence passed to submitCommands, i.e. the arguments of one EDL::setCommand call.
+ */
+typedef struct {
+    EdlCommandId_t commandId; /*!< Index of the command. */
+    EdlCommandStruct_t commandStruct; /*!< Configuration of the command. */
+    bool sendFlag; /*!< Flag to send the command and all of the stacked ones: false for protocol values, true for push buttons. */
+    unsigned int delayMs; /*!< Time to wait after the command before the next one of the sequence, e.g. while a compensation runs. The device is not held meanwhile. */
+} E4Command_t;
+
+/*! \typedef E4CommandCallback_t
+ * \brief Function called from the command thread of a device when a sequence passed to submitCommands completes.
+ * \a ticket identifies the sequence, \a result is #EdlSuccess or the error of the first command that failed.
+ * It must return quickly and must not close the device.
+ */
+typedef void (*E4CommandCallback_t)(unsigned long long ticket, EdlErrorCode_t result, void * context);
+
+/*! \struct E4CommandStats_t
+ * \brief Struct that contains the counters of the command queue of a device. Returned by getCommandStats.
+ */
+typedef struct {
+    unsigned long long sequencesSubmitted; /*!< Sequences accepted by submitCommands. */
+    unsigned long long sequencesRejected; /*!< Sequences refused by submitCommands without any device I/O. */
+    unsigned long long sequencesCompleted; /*!< Sequences completed, successfully or not. */
+    unsigned long long sequencesFailed; /*!< Completed sequences with a command that failed. */
+    unsigned long long sequencesMerged; /*!< Sequences applied together with the next one, with a single send. */
+    unsigned long long commandsSubmitted; /*!< Commands of the accepted sequences. */
+    unsigned long long commandsIssued; /*!< Calls to EDL::setCommand actually made. */
+    unsigned long long commandsCoalesced; /*!< Stacked commands dropped because a later command of the same id superseded them. */
+    unsigned long long sends; /*!< Calls to EDL::setCommand made with the send flag. */
+    unsigned int pendingSequences; /*!< Sequences waiting to be applied or being applied. */
+} E4CommandStats_t;
+
+/*! \class CommandQueue
+ * \brief Applies sequences of commands to a device from a dedicated thread, so that callers do not wait for the device,
+ * and the acquisition keeps reading while protocols are applied and compensations run.
+ *
+ * Sequences are checked against the stacking rules of EDL::setCommand when submitted, before any device I/O:
+ * protocol values (#EdlCommandMainTrial to #EdlCommandTPeriod) must be stacked, push buttons must be sent.
+ * Sequences are applied in order, each command under Device::edlMutex and through Device::setCommand;
+ * a sequence stops at the first command that fails.
+ * Consecutive pending sequences without push buttons nor delays are merged into the next one: their sends become stacks,
+ * so that all of their commands are applied by the first send of the next sequence. Within a sequence,
+ * a stacked command superseded by a later command of the same id before the next send is dropped.
+ * Completion is reported by a callback, from the command thread, and by CommandQueue::wait.
+ */
+class CommandQueue {
+public:
+    /*! \brief CommandQueue constructor.
+     *
+     * \param device [in] Device the commands are applied to.
+     */
+    CommandQueue(Device &device);
+
+    /*! \brief CommandQueue destructor. Stops the command thread, see CommandQueue::stop.
+     */
+    ~CommandQueue();
+
+    /*! \brief Checks a sequence of commands against the stacking rules of EDL::setCommand.
+     *
+     * \param commands [in] Commands of the sequence.
+     * \param commandsNum [in] Number of commands in \a commands, from 1 to #E4_COMMAND_MAX_SEQUENCE.
+     * \return #EdlSuccess, #EdlCommandIdOutOfRangeError, #EdlTrialValueSendNotDisabledError, #EdlPushButtonSendDisabledError,
+     * or #EdlUnknownError if the sequence is empty or too long.
+     */
+    static EdlErrorCode_t validate(EDL_IN const E4Command_t * commands,
+                                   EDL_IN unsigned int commandsNum);
+
+    /*! \brief Checks a sequence of commands and queues it.
+     *
+     * \param commands [in] Commands of the sequence, copied.
+     * \param commandsNum [in] Number of commands in \a commands.
+     * \param callback [in] Function called when the sequence completes, NULL for none.
+     * \param context [in] Argument passed to \a callback.
+     * \param ticket [out] Identifier of the sequence, increasing from 1.
+     * \return #EdlSuccess, or the error of CommandQueue::validate, in which case nothing is queued.
+     */
+    EdlErrorCode_t submit(EDL_IN const E4Command_t * commands,
+                          EDL_IN unsigned int commandsNum,
+                          EDL_IN E4CommandCallback_t callback,
+                          EDL_IN void * context,
+                          EDL_OUT unsigned long long &ticket);
+
+    /*! \brief Waits for a sequence to complete.
+     *
+     * \param ticket [in] Identifier returned by CommandQueue::submit.
+     * \param timeoutMs [in] Longest wait in ms.
+     * \param result [out] Result of the sequence, if completed.
+     * \return 1 if the sequence completed, 0 if it is still pending, -1 if the ticket is unknown or its result no longer kept.
+     */
+    int wait(EDL_IN unsigned long long ticket,
+             EDL_IN unsigned int timeoutMs,
+             EDL_OUT EdlErrorCode_t &result);
+
+    /*! \brief Stops the command thread. Pending sequences complete with #EdlDeviceNotConnectedError; delays are interrupted.
+     */
+    void stop(EDL_VOID);
+
+    /*! \brief Returns the counters.
+     */
+    void getStats(EDL_OUT E4CommandStats_t &stats) const;
+
+private:
+    typedef struct {
+        unsigned long long ticket;
+        std::vector <E4Command_t> commands;
+        E4CommandCallback_t callback;
+        void * context;
+    } Sequence_t;
+
+    void run(EDL_VOID);
+    static bool isMergeable(const Sequence_t &sequence);
+    static bool hasSend(const Sequence_t &sequence);
+    static unsigned long long coalesce(std::vector <E4Command_t> &commands);
+    EdlErrorCode_t apply(const std::vector <E4Command_t> &commands, unsigned long long &issuedNum, unsigned long long &sendNum);
+    void complete(std::vector <Sequence_t> &sequences, EdlErrorCode_t result, std::unique_lock <std::mutex> &lock);
+
+    Device &device;
+    std::thread thread;
+
+    mutable std::mutex mutex;
+    std::condition_variable changed; /*!< Signalled when a sequence is queued or completed, and on stop. */
+    std::deque <Sequence_t> pending;
+    unsigned int runningNum; /*!< Sequences taken by the command thread and not completed yet. */
+    bool stopping;
+    unsigned long long nextTicket;
+    unsigned long long lastCompletedTicket; /*!< Sequences complete in the order of their tickets. */
+    std::map <unsigned long long, EdlErrorCode_t> results; /*!< Results of the last #E4_COMMAND_RESULTS_KEPT completed sequences. */
+    E4CommandStats_t stats;
+};
+
+#endif // E4_COMMANDS_H
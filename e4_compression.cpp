@@ -0,0 +1,249 @@
+/*! \file e4_compression.cpp
+ * \brief Defines class TraceCodec.
+ */
+#include <cmath>
+#include <cstring>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "e4_compression.h"
+#include "e4_deinterleave.h"
+
+#define E4_CODEC_MODE_CODES 0
+#define E4_CODEC_MODE_BITS 1
+
+static inline uint32_t floatBits(float value)
+{
+    uint32_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    return bits;
+}
+
+static inline float bitsFloat(uint32_t bits)
+{
+    float value;
+    memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+static inline unsigned int bitWidth(uint32_t value)
+{
+    return value == 0 ? 0 : 32-__builtin_clz(value);
+}
+
+/*! \brief Converts samples to ADC codes. Returns false unless every code times \a step rebuilds its sample bit by bit.
+ */
+static bool quantize(const float * samples, unsigned int samplesNum, float step, uint32_t * codes)
+{
+    const float inverseStep = 1.0f/step;
+    unsigned int sampleIdx = 0;
+
+#if defined(__SSE2__)
+    const __m128 inverseSteps = _mm_set1_ps(inverseStep);
+    const __m128 stepsVector = _mm_set1_ps(step);
+    __m128i mismatch = _mm_setzero_si128();
+    for (; sampleIdx+4 <= samplesNum; sampleIdx += 4)
+    {
+        // Out of range values convert to 0x80000000 and fail the check below, as NaNs do.
+        const __m128 values = _mm_loadu_ps(samples+sampleIdx);
+        const __m128i codesVector = _mm_cvtps_epi32(_mm_mul_ps(values, inverseSteps));
+        const __m128 rebuilt = _mm_mul_ps(_mm_cvtepi32_ps(codesVector), stepsVector);
+        mismatch = _mm_or_si128(mismatch, _mm_xor_si128(_mm_castps_si128(rebuilt), _mm_castps_si128(values)));
+        _mm_storeu_si128((__m128i *)(codes+sampleIdx), codesVector);
+    }
+    if (_mm_movemask_epi8(_mm_cmpeq_epi32(mismatch, _mm_setzero_si128())) != 0xFFFF) {return false;}
+#endif
+
+    for (; sampleIdx < samplesNum; sampleIdx++)
+    {
+        const float scaled = samples[sampleIdx]*inverseStep;
+        if (!(std::fabs(scaled) < 2147483648.0f)) {return false;}
+        const int32_t code = (int32_t)lrintf(scaled);
+        if (floatBits((float)code*step) != floatBits(samples[sampleIdx])) {return false;}
+        codes[sampleIdx] = (uint32_t)code;
+    }
+    return true;
+}
+
+/*! \brief Computes the zigzag mapped differences between consecutive codes and returns their OR.
+ * residuals[0] is left untouched: the first code is stored as is.
+ */
+static uint32_t deltaCodes(const uint32_t * codes, unsigned int samplesNum, uint32_t * residuals)
+{
+    uint32_t allBits = 0;
+    unsigned int sampleIdx = 1;
+
+#if defined(__SSE2__)
+    __m128i allBitsVector = _mm_setzero_si128();
+    for (; sampleIdx+4 <= samplesNum; sampleIdx += 4)
+    {
+        const __m128i current = _mm_loadu_si128((const __m128i *)(codes+sampleIdx));
+        const __m128i previous = _mm_loadu_si128((const __m128i *)(codes+sampleIdx-1));
+        const __m128i delta = _mm_sub_epi32(current, previous);
+        const __m128i zigzag = _mm_xor_si128(_mm_slli_epi32(delta, 1), _mm_srai_epi32(delta, 31));
+        allBitsVector = _mm_or_si128(allBitsVector, zigzag);
+        _mm_storeu_si128((__m128i *)(residuals+sampleIdx), zigzag);
+    }
+    uint32_t lanes[4];
+    _mm_storeu_si128((__m128i *)lanes, allBitsVector);
+    allBits = lanes[0] | lanes[1] | lanes[2] | lanes[3];
+#endif
+
+    for (; sampleIdx < samplesNum; sampleIdx++)
+    {
+        const uint32_t delta = codes[sampleIdx]-codes[sampleIdx-1];
+        residuals[sampleIdx] = (delta << 1) ^ (uint32_t)((int32_t)delta >> 31);
+        allBits |= residuals[sampleIdx];
+    }
+    return allBits;
+}
+
+/*! \brief Computes the XOR between consecutive float bit patterns and returns their OR.
+ */
+static uint32_t xorBits(const float * samples, unsigned int samplesNum, uint32_t * residuals)
+{
+    uint32_t allBits = 0;
+    for (unsigned int sampleIdx = 1; sampleIdx < samplesNum; sampleIdx++)
+    {
+        residuals[sampleIdx] = floatBits(samples[sampleIdx]) ^ floatBits(samples[sampleIdx-1]);
+        allBits |= residuals[sampleIdx];
+    }
+    return allBits;
+}
+
+TraceCodec::TraceCodec()
+{
+    for (unsigned int channelIdx = 0; channelIdx < EDL_CHANNEL_NUM; channelIdx++) {steps[channelIdx] = 0.0f;}
+}
+
+void TraceCodec::setSteps(const float * steps)
+{
+    for (unsigned int channelIdx = 0; channelIdx < EDL_CHANNEL_NUM; channelIdx++) {this->steps[channelIdx] = steps[channelIdx];}
+}
+
+void TraceCodec::setRanges(double currentFullScale)
+{
+    // The first channel is the voltage, the others are currents.
+    steps[0] = (float)(E4_VOLTAGE_FULL_SCALE_MV/E4_ADC_CODES_HALF_RANGE);
+    for (unsigned int channelIdx = 1; channelIdx < EDL_CHANNEL_NUM; channelIdx++) {steps[channelIdx] = (float)(currentFullScale/E4_ADC_CODES_HALF_RANGE);}
+}
+
+void TraceCodec::compress(const float * packets, unsigned int packetsNum, std::vector <unsigned char> &out)
+{
+    out.clear();
+    channels.resize((size_t)packetsNum*EDL_CHANNEL_NUM);
+    deinterleavePackets(packets, packetsNum, channels.data(), packetsNum);
+
+    for (unsigned int channelIdx = 0; channelIdx < EDL_CHANNEL_NUM; channelIdx++)
+    {
+        const unsigned char * stepBytes = (const unsigned char *)&steps[channelIdx];
+        out.insert(out.end(), stepBytes, stepBytes+sizeof(float));
+
+        const float * samples = &channels[(size_t)channelIdx*packetsNum];
+        for (unsigned int sampleIdx = 0; sampleIdx < packetsNum; sampleIdx += E4_CODEC_BLOCK_SAMPLES)
+        {
+            const unsigned int samplesNum = packetsNum-sampleIdx < E4_CODEC_BLOCK_SAMPLES ? packetsNum-sampleIdx : E4_CODEC_BLOCK_SAMPLES;
+            compressBlock(samples+sampleIdx, samplesNum, steps[channelIdx], out);
+        }
+    }
+}
+
+void TraceCodec::compressBlock(const float * samples, unsigned int samplesNum, float step, std::vector <unsigned char> &out)
+{
+    unsigned char mode;
+    uint32_t first;
+    uint32_t allBits;
+
+    if (step > 0.0f && quantize(samples, samplesNum, step, codes))
+    {
+        mode = E4_CODEC_MODE_CODES;
+        first = codes[0];
+        allBits = deltaCodes(codes, samplesNum, residuals);
+    }
+    else
+    {
+        mode = E4_CODEC_MODE_BITS;
+        first = floatBits(samples[0]);
+        allBits = xorBits(samples, samplesNum, residuals);
+    }
+
+    const unsigned int width = bitWidth(allBits);
+    const size_t headerIdx = out.size();
+    const size_t packedBytes = ((size_t)(samplesNum-1)*width+7)/8;
+    out.resize(headerIdx+2+sizeof(first)+packedBytes);
+
+    unsigned char * dst = &out[headerIdx];
+    dst[0] = mode;
+    dst[1] = (unsigned char)width;
+    memcpy(dst+2, &first, sizeof(first));
+    dst += 2+sizeof(first);
+
+    // Pack the residuals LSB first through a 64 bit accumulator.
+    uint64_t accumulator = 0;
+    unsigned int accumulatorBits = 0;
+    for (unsigned int sampleIdx = 1; sampleIdx < samplesNum; sampleIdx++)
+    {
+        accumulator |= (uint64_t)residuals[sampleIdx] << accumulatorBits;
+        accumulatorBits += width;
+        while (accumulatorBits >= 8) {
+            *dst++ = (unsigned char)accumulator;
+            accumulator >>= 8;
+            accumulatorBits -= 8;
+        }
+    }
+    if (accumulatorBits > 0) {*dst = (unsigned char)accumulator;}
+}
+
+bool TraceCodec::decompress(const unsigned char * in, size_t inBytes, unsigned int packetsNum, unsigned int channelNum, float * dst)
+{
+    const unsigned char * end = in+inBytes;
+
+    for (unsigned int channelIdx = 0; channelIdx < channelNum; channelIdx++)
+    {
+        float step;
+        if (end-in < (ptrdiff_t)sizeof(step)) {return false;}
+        memcpy(&step, in, sizeof(step));
+        in += sizeof(step);
+
+        float * channelDst = dst+channelIdx;
+        for (unsigned int sampleIdx = 0; sampleIdx < packetsNum; sampleIdx += E4_CODEC_BLOCK_SAMPLES)
+        {
+            const unsigned int samplesNum = packetsNum-sampleIdx < E4_CODEC_BLOCK_SAMPLES ? packetsNum-sampleIdx : E4_CODEC_BLOCK_SAMPLES;
+
+            uint32_t value;
+            if (end-in < (ptrdiff_t)(2+sizeof(value))) {return false;}
+            const unsigned char mode = in[0];
+            const unsigned int width = in[1];
+            memcpy(&value, in+2, sizeof(value));
+            in += 2+sizeof(value);
+
+            const size_t packedBytes = ((size_t)(samplesNum-1)*width+7)/8;
+            if (width > 32 || mode > E4_CODEC_MODE_BITS || end-in < (ptrdiff_t)packedBytes) {return false;}
+
+            const uint32_t mask = width == 32 ? 0xFFFFFFFF : ((uint32_t)1 << width)-1;
+            uint64_t accumulator = 0;
+            unsigned int accumulatorBits = 0;
+            for (unsigned int blockIdx = 0; blockIdx < samplesNum; blockIdx++)
+            {
+                if (blockIdx > 0)
+                {
+                    while (accumulatorBits < width) {
+                        accumulator |= (uint64_t)(*in++) << accumulatorBits;
+                        accumulatorBits += 8;
+                    }
+                    const uint32_t residual = (uint32_t)accumulator & mask;
+                    accumulator = width == 32 ? accumulator >> 32 : accumulator >> width;
+                    accumulatorBits -= width;
+
+                    if (mode == E4_CODEC_MODE_CODES) {value += (residual >> 1) ^ (0-(residual & 1));}
+                    else {value ^= residual;}
+                }
+
+                channelDst[(size_t)(sampleIdx+blockIdx)*channelNum] = mode == E4_CODEC_MODE_CODES ? (float)(int32_t)value*step : bitsFloat(value);
+            }
+        }
+    }
+    return true;
+}
@@ -0,0 +1,92 @@
+/*! \file e4_compression.h
+ * \brief Declares class TraceCodec.
+ */
+#ifndef E4_COMPRESSION_H
+#define E4_COMPRESSION_H
+
+#include <vector>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "edl_global.h"
+#include "edl_devicespecs.h"
+
+/*! \def E4_CODEC_BLOCK_SAMPLES
+ * \brief Number of samples of one channel encoded with the same bit width.
+ */
+#define E4_CODEC_BLOCK_SAMPLES 128
+
+/*! \def E4_ADC_CODES_HALF_RANGE
+ * \brief Nominal number of ADC codes between zero and the full scale of a range, used to derive the quantization step.
+ * If the samples are not multiples of the derived step the codec still round-trips them, with a lower compression ratio.
+ */
+#define E4_ADC_CODES_HALF_RANGE 32768
+
+/*! \def E4_VOLTAGE_FULL_SCALE_MV
+ * \brief Nominal full scale of the voltage channel, in mV.
+ */
+#define E4_VOLTAGE_FULL_SCALE_MV 512.0
+
+/*! \class TraceCodec
+ * \brief Lossless compression of the data packets of a recording chunk.
+ *
+ * Each channel is split in blocks of #E4_CODEC_BLOCK_SAMPLES samples. A block is encoded as ADC codes when every sample
+ * is exactly a multiple of the channel quantization step, i.e. when code*step rebuilds the very same float:
+ * codes are delta encoded, zigzag mapped and bit packed with the smallest width fitting the block.
+ * Any other block (unknown step, clipped or non quantized values) is encoded as the XOR of consecutive float bit patterns,
+ * bit packed the same way. Decoding is therefore bit exact in both cases.
+ *
+ * Compressed layout, per channel: the float quantization step, then per block:
+ * 1 byte mode (0 codes, 1 float bits), 1 byte bit width, the 4 bytes first value, the packed values of the other samples.
+ */
+class TraceCodec {
+public:
+    TraceCodec();
+
+    /*! \brief Sets the quantization step of each channel, 0 if unknown.
+     *
+     * \param steps [in] #EDL_CHANNEL_NUM quantization steps, in the unit of the channels.
+     */
+    void setSteps(EDL_IN const float * steps);
+
+    /*! \brief Sets the quantization steps from the nominal ranges of the device.
+     *
+     * \param currentFullScale [in] Full scale of the current range, in the unit of the current channels, 0 if unknown.
+     */
+    void setRanges(EDL_IN double currentFullScale);
+
+    /*! \brief Compresses data packets.
+     *
+     * \param packets [in] Buffer of \a packetsNum data packets of #EDL_CHANNEL_NUM values.
+     * \param packetsNum [in] Number of data packets in \a packets.
+     * \param out [out] Compressed bytes. Any previous content is replaced.
+     */
+    void compress(EDL_IN const float * packets,
+                  EDL_IN unsigned int packetsNum,
+                  EDL_OUT std::vector <unsigned char> &out);
+
+    /*! \brief Decompresses data packets.
+     *
+     * \param in [in] Compressed bytes.
+     * \param inBytes [in] Number of compressed bytes.
+     * \param packetsNum [in] Number of data packets encoded in \a in.
+     * \param channelNum [in] Number of values per data packet.
+     * \param dst [out] Buffer of \a packetsNum data packets of \a channelNum values.
+     * \return false if \a in is truncated or corrupted.
+     */
+    static bool decompress(EDL_IN const unsigned char * in,
+                           EDL_IN size_t inBytes,
+                           EDL_IN unsigned int packetsNum,
+                           EDL_IN unsigned int channelNum,
+                           EDL_OUT float * dst);
+
+private:
+    void compressBlock(const float * samples, unsigned int samplesNum, float step, std::vector <unsigned char> &out);
+
+    float steps[EDL_CHANNEL_NUM];
+    std::vector <float> channels; /*!< Channel-major copy of the chunk. */
+    uint32_t codes[E4_CODEC_BLOCK_SAMPLES];
+    uint32_t residuals[E4_CODEC_BLOCK_SAMPLES];
+};
+
+#endif // E4_COMPRESSION_H
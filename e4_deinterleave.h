@@ -0,0 +1,49 @@
+/*! \file e4_deinterleave.h
+ * \brief Declares functions converting packet-major data to channel-major data.
+ */
+#ifndef E4_DEINTERLEAVE_H
+#define E4_DEINTERLEAVE_H
+
+#include <stddef.h>
+
+#include "edl_devicespecs.h"
+
+/*! \enum E4DeinterleaveKernel_t
+ * \brief Implementations of deinterleavePackets.
+ */
+typedef enum {
+    E4DeinterleaveScalar = 0, /*!< Portable loop, any #EDL_CHANNEL_NUM. */
+    E4DeinterleaveSse = 1, /*!< Preferred; 4 packets per iteration with SSE4.1 blends; only for #EDL_CHANNEL_NUM 4 or 5. */
+    E4DeinterleaveAvx2 = 2, /*!< 8 packets per iteration: lane-wise blends for #EDL_CHANNEL_NUM 5, gathers otherwise. */
+    E4DeinterleaveKernelNum /*!< Number of kernels. \note This is not a valid kernel. */
+} E4DeinterleaveKernel_t;
+
+/*! \brief Deinterleaves data packets into per-channel arrays, with the fastest kernel supported by the CPU.
+ * Sample \a i of channel \a c is written to \a dst[c*\a channelStride + \a i].
+ *
+ * \param src [in] Buffer of \a packetsNum data packets of #EDL_CHANNEL_NUM values, as returned by EDL::readData.
+ * \param packetsNum [in] Number of data packets in \a src.
+ * \param dst [out] Buffer of #EDL_CHANNEL_NUM arrays of at least \a packetsNum values each.
+ * \param channelStride [in] Distance in values between the beginnings of two consecutive channel arrays in \a dst.
+ */
+void deinterleavePackets(const float * src, size_t packetsNum, float * dst, size_t channelStride);
+
+/*! \brief Same as deinterleavePackets, with a given kernel.
+ *
+ * \return false, without writing \a dst, if \a kernel is not available on this CPU or for #EDL_CHANNEL_NUM.
+ */
+bool deinterleavePacketsWith(E4DeinterleaveKernel_t kernel, const float * src, size_t packetsNum, float * dst, size_t channelStride);
+
+/*! \brief Returns true if \a kernel can run on this CPU for #EDL_CHANNEL_NUM.
+ */
+bool deinterleaveKernelAvailable(E4DeinterleaveKernel_t kernel);
+
+/*! \brief Returns the kernel used by deinterleavePackets.
+ */
+E4DeinterleaveKernel_t deinterleaveKernel(void);
+
+/*! \brief Returns a printable name of \a kernel.
+ */
+const char * deinterleaveKernelName(E4DeinterleaveKernel_t kernel);
+
+#endif // E4_DEINTERLEAVE_H
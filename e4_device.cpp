@@ -0,0 +1,218 @@
+/*! \file e4_device.cpp
+ * \brief Defines class Device.
+ */
+#include <chrono>
+#include <cstring>
+#include <new>
+#include <thread>
+
+#ifdef _WIN32
+#include <malloc.h>
+#else
+#include <stdlib.h>
+#endif
+
+#include "e4_device.h"
+
+#define E4_DEVICE_ALIGNMENT 64
+
+Device::Device(EdlBackend * backend) :
+    edl(backend),
+    acquisition(*edl, edlMutex, statistics, scheduler, metrics),
+    commands(*this),
+    designRateHz(0.0),
+    protocolStacked(false)
+{
+    memset(&filterConfig, 0, sizeof(filterConfig));
+    memset(&detectorConfig, 0, sizeof(detectorConfig));
+    memset(&spectrumConfig, 0, sizeof(spectrumConfig));
+    memset(&sweepConfig, 0, sizeof(sweepConfig));
+}
+
+Device::~Device()
+{
+    commands.stop();
+    acquisition.stop();
+    acquisition.setRecording(NULL, false);
+    recording.close();
+    stopSharing();
+}
+
+void * Device::operator new(size_t size)
+{
+    void * ptr;
+#ifdef _WIN32
+    ptr = _aligned_malloc(size, E4_DEVICE_ALIGNMENT);
+#else
+    if (posix_memalign(&ptr, E4_DEVICE_ALIGNMENT, size) != 0) {ptr = NULL;}
+#endif
+    if (ptr == NULL) {throw std::bad_alloc();}
+    return ptr;
+}
+
+void Device::operator delete(void * ptr)
+{
+#ifdef _WIN32
+    _aligned_free(ptr);
+#else
+    free(ptr);
+#endif
+}
+
+EdlErrorCode_t Device::connect(unsigned int deviceIdx)
+{
+    std::vector <std::string> deviceIds;
+
+    const EdlErrorCode_t res = detectDevices(deviceIds);
+    if (res != EdlSuccess) {return res;}
+    if (deviceIdx >= deviceIds.size()) {return EdlUnknownError;}
+    return connectDevice(deviceIds[deviceIdx]);
+}
+
+EdlErrorCode_t Device::detectDevices(std::vector <std::string> &deviceIds)
+{
+    std::lock_guard <std::mutex> lock(edlMutex);
+    return edl->detectDevices(deviceIds);
+}
+
+EdlErrorCode_t Device::connectDevice(const std::string &deviceId)
+{
+    std::lock_guard <std::mutex> lock(edlMutex);
+    const EdlErrorCode_t res = edl->connectDevice(deviceId);
+    if (res != EdlSuccess) {return res;}
+    id = deviceId;
+    settings.clear();
+
+    edl->purgeData();
+    return EdlSuccess;
+}
+
+EdlErrorCode_t Device::disconnect()
+{
+    EdlErrorCode_t res;
+    const std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::now()+std::chrono::milliseconds(E4_DEVICE_DISCONNECT_TIMEOUT_MS);
+    std::chrono::milliseconds retryDelay(1);
+
+    commands.stop();
+    acquisition.stop();
+    acquisition.setRecording(NULL, false);
+    recording.close();
+    stopSharing();
+
+    for (;;) {
+        {
+            std::lock_guard <std::mutex> lock(edlMutex);
+            res = edl->disconnectDevice();
+        }
+        if (res == EdlSuccess || std::chrono::steady_clock::now()+retryDelay > deadline) {break;}
+
+        // Back off: a busy device is retried often at first, then every 64ms.
+        std::this_thread::sleep_for(retryDelay);
+        if (retryDelay < std::chrono::milliseconds(64)) {retryDelay *= 2;}
+    }
+
+    return res;
+}
+
+const std::string &Device::getId() const
+{
+    return id;
+}
+
+EdlErrorCode_t Device::setCommand(EdlCommandId_t commandId, EdlCommandStruct_t &commandStruct, bool sendFlag)
+{
+    EdlErrorCode_t res = edl->setCommand(commandId, commandStruct, sendFlag);
+    if (res == EdlSuccess) {settings.setCommand(commandId, commandStruct, sendFlag);}
+    if (res == EdlSuccess && commandId >= EdlCommandMainTrial && commandId <= EdlCommandTPeriod) {protocolStacked = true;}
+    if (sendFlag)
+    {
+        statistics.setRanges(settings.currentRangeFullScale());
+        scheduler.setSamplingRate(settings.samplingRateHz());
+    }
+
+    // Sweeps of another protocol or sampling rate would be averaged out of phase: start over.
+    const bool rateChanged = sendFlag && settings.samplingRateHz() != designRateHz;
+    if (sendFlag && (protocolStacked || rateChanged) && sweepConfig.channelMask != 0
+            && !acquisition.setSweeps(sweepConfig, settings.samplingRateHz(), settings.protocolPeriodMs()))
+    {
+        memset(&sweepConfig, 0, sizeof(sweepConfig));
+        acquisition.setSweeps(sweepConfig, settings.samplingRateHz(), settings.protocolPeriodMs());
+    }
+    if (sendFlag) {protocolStacked = false;}
+
+    // Follow the applied sampling rate, unless set for a given one; disable what is no longer valid at the new rate.
+    if (rateChanged)
+    {
+        sharedRing.setSamplingRate(settings.samplingRateHz());
+        designRateHz = settings.samplingRateHz();
+        if (filterConfig.samplingRateHz == 0.0 && !acquisition.setFilter(filterConfig, designRateHz))
+        {
+            memset(&filterConfig, 0, sizeof(filterConfig));
+            acquisition.setFilter(filterConfig, designRateHz);
+        }
+        if (detectorConfig.samplingRateHz == 0.0 && !acquisition.setDetector(detectorConfig, designRateHz))
+        {
+            memset(&detectorConfig, 0, sizeof(detectorConfig));
+            acquisition.setDetector(detectorConfig, designRateHz);
+        }
+        if (spectrumConfig.samplingRateHz == 0.0 && !acquisition.setSpectrum(spectrumConfig, designRateHz))
+        {
+            memset(&spectrumConfig, 0, sizeof(spectrumConfig));
+            acquisition.setSpectrum(spectrumConfig, designRateHz);
+        }
+    }
+    return res;
+}
+
+bool Device::setFilter(const E4FilterConfig_t &config)
+{
+    std::lock_guard <std::mutex> lock(edlMutex);
+    if (!acquisition.setFilter(config, settings.samplingRateHz())) {return false;}
+    filterConfig = config;
+    designRateHz = settings.samplingRateHz();
+    return true;
+}
+
+bool Device::setDetector(const E4DetectorConfig_t &config)
+{
+    std::lock_guard <std::mutex> lock(edlMutex);
+    if (!acquisition.setDetector(config, settings.samplingRateHz())) {return false;}
+    detectorConfig = config;
+    designRateHz = settings.samplingRateHz();
+    return true;
+}
+
+bool Device::setSpectrum(const E4SpectrumConfig_t &config)
+{
+    std::lock_guard <std::mutex> lock(edlMutex);
+    if (!acquisition.setSpectrum(config, settings.samplingRateHz())) {return false;}
+    spectrumConfig = config;
+    designRateHz = settings.samplingRateHz();
+    return true;
+}
+
+bool Device::setSweeps(const E4SweepConfig_t &config)
+{
+    std::lock_guard <std::mutex> lock(edlMutex);
+    if (!acquisition.setSweeps(config, settings.samplingRateHz(), settings.protocolPeriodMs())) {return false;}
+    sweepConfig = config;
+    return true;
+}
+
+bool Device::startSharing(const char * name, size_t capacityPackets)
+{
+    stopSharing();
+
+    std::lock_guard <std::mutex> lock(edlMutex);
+    if (!sharedRing.create(name, capacityPackets, settings.samplingRateHz())) {return false;}
+    acquisition.setSharedRing(&sharedRing);
+    return true;
+}
+
+void Device::stopSharing()
+{
+    acquisition.setSharedRing(NULL);
+
+    std::lock_guard <std::mutex> lock(edlMutex);
+    sharedRing.close();
+}
@@ -0,0 +1,143 @@
+/*! \file e4_device.h
+ * \brief Declares class Device.
+ */
+#ifndef E4_DEVICE_H
+#define E4_DEVICE_H
+
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "e4_acquisition.h"
+#include "e4_backend.h"
+#include "e4_commands.h"
+#include "e4_metrics.h"
+#include "e4_recording.h"
+#include "e4_scheduler.h"
+#include "e4_settings.h"
+#include "e4_sharedring.h"
+#include "e4_statistics.h"
+
+/*! \def E4_DEVICE_DISCONNECT_TIMEOUT_MS
+ * \brief How long Device::disconnect retries a device that refuses to disconnect.
+ */
+#define E4_DEVICE_DISCONNECT_TIMEOUT_MS 1000
+
+/*! \class Device
+ * \brief Everything the library keeps for one connected EDL device: its backend and the lock serializing its calls,
+ * the applied settings, the background acquisition with its processing stages, and the recordings.
+ * Devices share no state, so several devices are configured and read in parallel, each from its own threads.
+ * The members used by the exports are public; Device::edlMutex must be held to call Device::edl.
+ */
+class Device {
+public:
+    /*! \brief Device constructor.
+     *
+     * \param backend [in] Backend of the device, VendorBackend, SimulatedBackend or ReplayBackend, deleted with the device.
+     */
+    Device(EDL_IN EdlBackend * backend);
+
+    /*! \brief Device destructor. Stops the command queue, the acquisition, the recordings and the sharing.
+     */
+    ~Device();
+
+    /*! \brief Allocates devices on cache line boundaries, as required by the rings of their acquisition:
+     * before C++17, plain new does not honour extended alignments.
+     */
+    static void * operator new(size_t size);
+    static void operator delete(void * ptr);
+
+    /*! \brief Detects the plugged in devices and connects to one of them.
+     *
+     * \param deviceIdx [in] Index of the device in the list returned by EdlBackend::detectDevices.
+     * \return #EdlErrorCode_t Error code, #EdlUnknownError if there is no such device.
+     */
+    EdlErrorCode_t connect(EDL_IN unsigned int deviceIdx);
+
+    /*! \brief Detects the plugged in devices through the backend, see EdlBackend::detectDevices.
+     *
+     * \param deviceIds [out] Identifiers of the devices, in the order of detection.
+     * \return #EdlErrorCode_t Error code.
+     */
+    EdlErrorCode_t detectDevices(EDL_OUT std::vector <std::string> &deviceIds);
+
+    /*! \brief Connects to a detected device, see EdlBackend::connectDevice, and purges its data.
+     *
+     * \param deviceId [in] Identifier returned by Device::detectDevices.
+     * \return #EdlErrorCode_t Error code.
+     */
+    EdlErrorCode_t connectDevice(EDL_IN const std::string &deviceId);
+
+    /*! \brief Stops the command queue, the acquisition, the recordings and the sharing, then disconnects the device,
+     * retrying with a growing delay for up to #E4_DEVICE_DISCONNECT_TIMEOUT_MS.
+     *
+     * \return #EdlErrorCode_t Error code.
+     */
+    EdlErrorCode_t disconnect(EDL_VOID);
+
+    /*! \brief Returns the identifier of the connected device, as returned by EdlBackend::detectDevices.
+     */
+    const std::string &getId(EDL_VOID) const;
+
+    /*! \brief Calls EdlBackend::setCommand and keeps track of the applied settings. The caller must hold Device::edlMutex.
+     * The filter, the detector and the spectrum follow the applied sampling rate, unless configured for a given one;
+     * those no longer valid at the new rate are disabled. The averaged sweeps are discarded when a new protocol or sampling rate is applied.
+     */
+    EdlErrorCode_t setCommand(EDL_IN EdlCommandId_t commandId,
+                              EDL_IN EdlCommandStruct_t &commandStruct,
+                              EDL_IN bool sendFlag);
+
+    /*! \brief Configures the filter of the acquisition at the applied sampling rate, see Acquisition::setFilter.
+     */
+    bool setFilter(EDL_IN const E4FilterConfig_t &config);
+
+    /*! \brief Configures the event detector of the acquisition at the applied sampling rate, see Acquisition::setDetector.
+     */
+    bool setDetector(EDL_IN const E4DetectorConfig_t &config);
+
+    /*! \brief Configures the spectrum of the acquisition at the applied sampling rate, see Acquisition::setSpectrum.
+     */
+    bool setSpectrum(EDL_IN const E4SpectrumConfig_t &config);
+
+    /*! \brief Configures the protocol sweeps of the acquisition at the applied sampling rate and protocol, see Acquisition::setSweeps.
+     */
+    bool setSweeps(EDL_IN const E4SweepConfig_t &config);
+
+    /*! \brief Creates the shared ring, see SharedRing::create, and publishes to it every data packet read by the acquisition.
+     */
+    bool startSharing(EDL_IN const char * name,
+                      EDL_IN size_t capacityPackets);
+
+    /*! \brief Stops publishing and closes the shared ring.
+     */
+    void stopSharing(EDL_VOID);
+
+    std::unique_ptr <EdlBackend> edl;
+    std::mutex edlMutex; /*!< Guards edl: the acquisition thread reads while exports configure. */
+    RunningStatistics statistics; /*!< Statistics of the data packets read by the acquisition or by readData. */
+    ReadScheduler scheduler; /*!< Waits between the device polls of the acquisition or of readData. */
+    PipelineMetrics metrics; /*!< Instrumentation of the device reads of the acquisition or of readData, see getMetrics. */
+    Acquisition acquisition;
+
+    DeviceSettings settings; /*!< Commands applied to edl, stored in the header of recordings. */
+    CommandQueue commands; /*!< Sequences of commands applied in the background, see submitCommands. */
+    Recording recording; /*!< File written by the background acquisition, see startRecording. */
+    Recording dataRecording; /*!< File written by readData. */
+    SharedRing sharedRing; /*!< Ring published to other processes, see startSharing. */
+
+    std::mutex readMutex; /*!< Held by readDataFor and by readInto for their whole read, and by startAcquisition: only one of them reads the device at a time. */
+    std::vector <float> data; /*!< Data packets read by the exports, kept across calls so that its storage is allocated only once. Guarded by readMutex. */
+
+private:
+    std::string id;
+
+    E4FilterConfig_t filterConfig; /*!< Configuration passed to setFilter, redesigned when the sampling rate changes. */
+    E4DetectorConfig_t detectorConfig; /*!< Configuration passed to setDetector, redesigned when the sampling rate changes. */
+    E4SpectrumConfig_t spectrumConfig; /*!< Configuration passed to setSpectrum, redesigned when the sampling rate changes. */
+    E4SweepConfig_t sweepConfig; /*!< Configuration passed to setSweeps, applied again with each new protocol or sampling rate. */
+    double designRateHz; /*!< Sampling rate filterConfig, detectorConfig and spectrumConfig were designed for. */
+    bool protocolStacked; /*!< Protocol values were stacked since the last send. */
+};
+
+#endif // E4_DEVICE_H
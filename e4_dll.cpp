@@ -5,166 +5,1111 @@ EYafuso, 2019
 */
 
 #include <iostream>
-#include "windows.h"
+#include <chrono>
+#include <climits>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <thread>
 #include "edl.h"
+#include "e4_backend.h"
+#include "e4_deinterleave.h"
+#include "e4_device.h"
+#include "e4_recordreader.h"
+#include "e4_replay.h"
+#include "e4_sharedring.h"
+#include "e4_simulator.h"
 
-#define MINIMUM_DATA_PACKETS_TO_READ 10
+// Duration of the recordings of readData.
+#define E4_READ_DATA_SECONDS 1.0
 
-static EDL edl;
+static std::mutex devicesMutex;
+static std::vector <std::shared_ptr <Device> > devices; // Devices connected by openDevice or initEDL, indexed by handle.
+#ifdef _WIN32
+static bool simulation = false; // Set by setSimulation: devices opened next are simulated.
+#else
+static bool simulation = true; // Without the vendor library devices are always simulated.
+#endif
+static E4SimulatorConfig_t simulatorConfig; // Configuration of the simulated devices, see setSimulation.
+static std::unique_ptr <EdlBackend> detectionBackend; // Backend of getDeviceCount, created on first use and dropped by setSimulation.
 
-extern "C" __declspec(dllexport) int initEDL()
+static std::mutex readersMutex;
+static std::vector <RecordReader *> readers; // Recording files opened by openRecordingFile, indexed by handle.
+
+static std::mutex sharedReadersMutex;
+static std::vector <SharedRingReader *> sharedReaders; // Shared rings attached by openSharedRing, indexed by handle.
+
+/*! \brief Returns the device of a handle returned by openDevice or initEDL, NULL if invalid.
+ * Every device function takes such a handle first, and returns #EdlDeviceNotConnectedError, or does nothing, if it is invalid.
+ * The device stays valid while the returned pointer is held, even if closeEDL is called meanwhile.
+ */
+static std::shared_ptr <Device> getDevice(int handle)
 {
-    // Declare an #EdlErrorCode_t to be returned from #EDL methods.
-    EdlErrorCode_t res;
+    std::lock_guard <std::mutex> lock(devicesMutex);
+    if (handle < 0 || (size_t)handle >= devices.size()) {return std::shared_ptr <Device>();}
+    return devices[handle];
+}
+
+/*! \brief Returns a new backend for the devices opened next, as selected by setSimulation. The caller must hold #devicesMutex.
+ */
+static EdlBackend * createBackend()
+{
+#ifdef _WIN32
+    if (!simulation) {return new VendorBackend;}
+#endif
+    return new SimulatedBackend(simulatorConfig);
+}
+
+/*! \fn setSimulation
+ * \brief Makes the devices opened next by openDevice or initEDL simulated, as configured by \a config, see SimulatedBackend;
+ * NULL goes back to the physical devices. Devices already open are not affected.
+ * Without the vendor library, i.e. on platforms other than Windows, devices are always simulated and NULL returns #EdlUnknownError.
+ */
+extern "C" __declspec(dllexport) EdlErrorCode_t setSimulation(const E4SimulatorConfig_t * config)
+{
+    std::lock_guard <std::mutex> lock(devicesMutex);
+    if (config == NULL)
+    {
+#ifdef _WIN32
+        simulation = false;
+        detectionBackend.reset();
+        return EdlSuccess;
+#else
+        return EdlUnknownError;
+#endif
+    }
+
+    simulatorConfig = *config;
+    simulation = true;
+    detectionBackend.reset();
+    return EdlSuccess;
+}
+
+/*! \fn getDeviceCount
+ * \brief Returns the number of plugged in devices, connected or not, -1 on error. Valid indexes for openDevice go from 0 to this number minus one.
+ * The devices are detected through a backend kept for the purpose, so that polling the count does not create a device interface per call.
+ */
+extern "C" __declspec(dllexport) int getDeviceCount()
+{
+    std::vector <std::string> deviceIds;
+
+    std::lock_guard <std::mutex> lock(devicesMutex);
+    if (!detectionBackend) {detectionBackend.reset(createBackend());}
+    if (detectionBackend->detectDevices(deviceIds) != EdlSuccess) {return -1;}
+    return (int)deviceIds.size();
+}
 
-    // Initialize a vector of strings to collect the detected devices.
-    std::vector <std::string> devices;
+/*! \brief Returns true if a device with identifier \a deviceId is open. The caller must hold #devicesMutex.
+ */
+static bool isOpen(const std::string &deviceId)
+{
+    for (size_t handle = 0; handle < devices.size(); handle++)
+    {
+        if (devices[handle] && devices[handle]->getId() == deviceId) {return true;}
+    }
+    return false;
+}
+
+/*! \brief Gives a handle to a connected device. Returns -1, and disconnects \a device, if a device with the same identifier
+ * was opened meanwhile: the connection of the first handle is left alone.
+ */
+static int addDevice(const std::shared_ptr <Device> &device)
+{
+    {
+        std::lock_guard <std::mutex> lock(devicesMutex);
+        if (!isOpen(device->getId()))
+        {
+            for (size_t handle = 0; handle < devices.size(); handle++)
+            {
+                if (!devices[handle])
+                {
+                    devices[handle] = device;
+                    return (int)handle;
+                }
+            }
+            devices.push_back(device);
+            return (int)devices.size()-1;
+        }
+    }
+    device->disconnect();
+    return -1;
+}
+
+/*! \fn openDevice
+ * \brief Connects to the plugged in device \a deviceIdx, in the order of detection.
+ * Returns a handle for the other device functions, -1 on error or if the device is already open.
+ * Every device has its own acquisition thread, buffers and recordings, so several devices are acquired in parallel.
+ */
+extern "C" __declspec(dllexport) int openDevice(unsigned int deviceIdx)
+{
     std::ios::sync_with_stdio(true);
 
-    // Detect plugged in devices
-    res = edl.detectDevices(devices);
-    if (res != EdlSuccess) {return -1;}
+    std::shared_ptr <Device> device;
+    std::vector <std::string> deviceIds;
+    {
+        std::lock_guard <std::mutex> lock(devicesMutex);
+        device.reset(new Device(createBackend()));
+    }
+    if (device->detectDevices(deviceIds) != EdlSuccess || deviceIdx >= deviceIds.size()) {return -1;}
 
-    //Connect
-    res = edl.connectDevice(devices.at(0));
-    if (res != EdlSuccess) {return -1;}
+    // An open device is refused before connecting a second time to it.
+    {
+        std::lock_guard <std::mutex> lock(devicesMutex);
+        if (isOpen(deviceIds[deviceIdx])) {return -1;}
+    }
+    if (device->connectDevice(deviceIds[deviceIdx]) != EdlSuccess) {return -1;}
+    return addDevice(device);
+}
 
-    edl.purgeData();
+/*! \fn initEDL
+ * \brief Connects to the first plugged in device, same as openDevice(0). Returns its handle, -1 on error:
+ * 0 unless other devices are open, so that single device clients can keep passing handle 0.
+ */
+extern "C" __declspec(dllexport) int initEDL()
+{
+    return openDevice(0);
+}
 
-    return 0;
+/*! \fn openReplay
+ * \brief Opens a recording file as a device that produces its data packets, see ReplayBackend, paced as set by \a config.
+ * Returns a handle for the other device functions, -1 on error: the acquisition, its processing stages and readData
+ * then run on the recorded data, e.g. to try other filter or detector settings on a recorded run.
+ * The settings stored in the file are applied to the device, so that the processing follows the recorded sampling rate.
+ */
+extern "C" __declspec(dllexport) int openReplay(const E4ReplayConfig_t * config)
+{
+    if (config == NULL || config->path == NULL) {return -1;}
+
+    ReplayBackend * backend = new ReplayBackend(*config);
+    std::shared_ptr <Device> device(new Device(backend));
+    if (device->connect(0) != EdlSuccess) {return -1;}
+
+    {
+        std::lock_guard <std::mutex> lock(device->edlMutex);
+        const E4RecordHeader_t &header = backend->getHeader();
+        const int commandNum = header.commandNum < (uint32_t)EdlCommandIdNum ? (int)header.commandNum : EdlCommandIdNum;
+
+        // Stack the recorded commands, then apply them with the last one.
+        int lastCommandIdx = -1;
+        for (int commandIdx = 0; commandIdx < commandNum; commandIdx++)
+        {
+            if (header.commands[commandIdx].applied) {lastCommandIdx = commandIdx;}
+        }
+        for (int commandIdx = 0; commandIdx <= lastCommandIdx; commandIdx++)
+        {
+            const E4RecordCommand_t &command = header.commands[commandIdx];
+            if (!command.applied) {continue;}
+
+            EdlCommandStruct_t commandStruct;
+            commandStruct.radioId = command.radioId;
+            commandStruct.checkboxChecked = command.checkboxChecked != 0;
+            commandStruct.buttonPressed = command.buttonPressed != 0;
+            commandStruct.value = command.value;
+            device->setCommand((EdlCommandId_t)commandIdx, commandStruct, commandIdx == lastCommandIdx);
+        }
+    }
+    return addDevice(device);
+}
+
+/*! \fn getReplayStats
+ * \brief Returns the progress and the throughput of a device opened by openReplay. Returns #EdlUnknownError for other devices.
+ */
+extern "C" __declspec(dllexport) EdlErrorCode_t getReplayStats(int deviceHandle, E4ReplayStats_t * stats)
+{
+    std::shared_ptr <Device> device = getDevice(deviceHandle);
+    if (!device) {return EdlDeviceNotConnectedError;}
+
+    std::lock_guard <std::mutex> lock(device->edlMutex);
+    const ReplayBackend * backend = dynamic_cast <const ReplayBackend *>(device->edl.get());
+    if (backend == NULL) {return EdlUnknownError;}
+    backend->getStats(*stats);
+    return EdlSuccess;
 }
 
-extern "C" __declspec(dllexport)void configureWorkingModality()
+/*! \brief Returns a command of a sequence for submitCommands.
+ */
+static E4Command_t makeCommand(EdlCommandId_t commandId, bool sendFlag, unsigned int delayMs = 0)
 {
-    EdlCommandStruct_t commandStruct;
+    E4Command_t command;
+    memset(&command, 0, sizeof(command));
+    command.commandId = commandId;
+    command.sendFlag = sendFlag;
+    command.delayMs = delayMs;
+    return command;
+}
+
+/*! \brief Queues a sequence of commands on \a device and waits for it to complete. Returns the result of the sequence.
+ */
+static EdlErrorCode_t applyCommands(Device &device, const E4Command_t * commands, unsigned int commandsNum)
+{
+    unsigned long long ticket;
+    EdlErrorCode_t res = device.commands.submit(commands, commandsNum, NULL, NULL, ticket);
+    if (res != EdlSuccess) {return res;}
+    while (device.commands.wait(ticket, UINT_MAX, res) == 0) {}
+    return res;
+}
+
+/*! \fn configureWorkingModality
+ * \brief Sets the sampling rate to 5kHz, the current range to 200pA and disables the current filters.
+ * Returns the error of the first command that failed.
+ */
+extern "C" __declspec(dllexport)EdlErrorCode_t configureWorkingModality(int deviceHandle)
+{
+    std::shared_ptr <Device> device = getDevice(deviceHandle);
+    if (!device) {return EdlDeviceNotConnectedError;}
+
+    E4Command_t commands[3];
 
 	// Set the sampling rate to 5kHz. Stack the command (do not apply)
-    commandStruct.radioId = EDL_RADIO_SAMPLING_RATE_5_KHZ;
-    edl.setCommand(EdlCommandSamplingRate, commandStruct, false);
+    commands[0] = makeCommand(EdlCommandSamplingRate, false);
+    commands[0].commandStruct.radioId = EDL_RADIO_SAMPLING_RATE_5_KHZ;
 
 	// Set the current range to 200pA. Stack the command (do not apply).
-    commandStruct.radioId = EDL_RADIO_RANGE_200_PA;
-    edl.setCommand(EdlCommandRange, commandStruct, false);
+    commands[1] = makeCommand(EdlCommandRange, false);
+    commands[1].commandStruct.radioId = EDL_RADIO_RANGE_200_PA;
 
 	// Disable current filters (final bandwidth equal to half sampling rate). Apply all of the stacked commands.
-    commandStruct.radioId = EDL_RADIO_FINAL_BANDWIDTH_SR_2;
-    edl.setCommand(EdlCommandFinalBandwidth, commandStruct, true);
+    commands[2] = makeCommand(EdlCommandFinalBandwidth, true);
+    commands[2].commandStruct.radioId = EDL_RADIO_FINAL_BANDWIDTH_SR_2;
+
+    return applyCommands(*device, commands, 3);
 }
 
-extern "C" __declspec(dllexport)void compensateDigitalOffset()
+/*! \brief Fills \a commands with the sequence of the digital offset compensation: 5 commands.
+ */
+static void digitalOffsetCommands(E4Command_t * commands)
 {
-    EdlCommandStruct_t commandStruct;
+    // Select the constant protocol: protocol 0.
+    commands[0] = makeCommand(EdlCommandMainTrial, false);
+    commands[0].commandStruct.value = 0.0;
 
-	// Select the constant protocol: protocol 0.
-    commandStruct.value = 0.0;
-    edl.setCommand(EdlCommandMainTrial, commandStruct, false);
+    // Set the vHold to 0mV.
+    commands[1] = makeCommand(EdlCommandVhold, false);
+    commands[1].commandStruct.value = 0.0;
+    commands[2] = makeCommand(EdlCommandApplyProtocol, true);
+    commands[2].commandStruct.buttonPressed = EDL_BUTTON_PRESSED;
 
-	// Set the vHold to 0mV.
-    commandStruct.value = 0.0;
-    edl.setCommand(EdlCommandVhold, commandStruct, false);
-    edl.setCommand(EdlCommandApplyProtocol, commandStruct, true);
+    // Start the digital compensation, and let it run for 5s without holding the device, so a running acquisition keeps reading.
+    commands[3] = makeCommand(EdlCommandCompAll, true, 5000);
+    commands[3].commandStruct.buttonPressed = EDL_BUTTON_PRESSED;
 
-    // Start the digital compensation.
-    commandStruct.buttonPressed = EDL_BUTTON_PRESSED;
-    edl.setCommand(EdlCommandCompAll, commandStruct, true);
+    // Stop the digital compensation.
+    commands[4] = makeCommand(EdlCommandCompAll, true);
+    commands[4].commandStruct.buttonPressed = EDL_BUTTON_RELEASED;
+}
 
-    Sleep(5000);
+/*! \fn compensateDigitalOffset
+ * \brief Compensates the digital offset of the current channels at 0mV, returning when the compensation is done, after 5s.
+ * See startDigitalOffsetCompensation to not wait. Returns the error of the first command that failed.
+ */
+extern "C" __declspec(dllexport)EdlErrorCode_t compensateDigitalOffset(int deviceHandle)
+{
+    std::shared_ptr <Device> device = getDevice(deviceHandle);
+    if (!device) {return EdlDeviceNotConnectedError;}
 
-    // Stop the digital compensation.
-    commandStruct.buttonPressed = EDL_BUTTON_RELEASED;
-    edl.setCommand(EdlCommandCompAll, commandStruct, true);
+    E4Command_t commands[5];
+    digitalOffsetCommands(commands);
+    return applyCommands(*device, commands, 5);
 }
 
-extern "C" __declspec(dllexport)void setPotential()
+/*! \fn startDigitalOffsetCompensation
+ * \brief Same as compensateDigitalOffset, but returns at once with the \a ticket of the command sequence, see submitCommands.
+ * \a ticket may be NULL if the sequence is not waited for.
+ */
+extern "C" __declspec(dllexport) EdlErrorCode_t startDigitalOffsetCompensation(int deviceHandle, E4CommandCallback_t callback, void * context, unsigned long long * ticket)
 {
-    EdlCommandStruct_t commandStruct;
+    std::shared_ptr <Device> device = getDevice(deviceHandle);
+    if (!device) {return EdlDeviceNotConnectedError;}
 
-    commandStruct.value = 1.0;
-    edl.setCommand(EdlCommandMainTrial, commandStruct, false);
+    E4Command_t commands[5];
+    unsigned long long submitted = 0;
+    digitalOffsetCommands(commands);
+    EdlErrorCode_t res = device->commands.submit(commands, 5, callback, context, submitted);
+    if (res == EdlSuccess && ticket != NULL) {*ticket = submitted;}
+    return res;
+}
+
+/*! \fn setPotential
+ * \brief Applies a triangular wave of 50mV amplitude around 0mV with a period of 100ms. Returns the error of the first command that failed.
+ */
+extern "C" __declspec(dllexport)EdlErrorCode_t setPotential(int deviceHandle)
+{
+    std::shared_ptr <Device> device = getDevice(deviceHandle);
+    if (!device) {return EdlDeviceNotConnectedError;}
+
+    E4Command_t commands[5];
+
+    commands[0] = makeCommand(EdlCommandMainTrial, false);
+    commands[0].commandStruct.value = E4_PROTOCOL_TRIANGULAR;
 
     /*! Set the vHold to 0mV. */
-    commandStruct.value = 0.0;
-    edl.setCommand(EdlCommandVhold, commandStruct, false);
+    commands[1] = makeCommand(EdlCommandVhold, false);
+    commands[1].commandStruct.value = 0.0;
 
     /*! Set the triangular wave amplitude to 50mV: 100mV positive to negative delta voltage. */
-    commandStruct.value = 50.0;
-    edl.setCommand(EdlCommandVamp, commandStruct, false);
+    commands[2] = makeCommand(EdlCommandVamp, false);
+    commands[2].commandStruct.value = 50.0;
 
     /*! Set the triangular period to 100ms. */
-    commandStruct.value = 100.0;
-    edl.setCommand(EdlCommandTPeriod, commandStruct, false);
+    commands[3] = makeCommand(EdlCommandTPeriod, false);
+    commands[3].commandStruct.value = 100.0;
 
     /*! Apply the protocol. */
-    edl.setCommand(EdlCommandApplyProtocol, commandStruct, true);
+    commands[4] = makeCommand(EdlCommandApplyProtocol, true);
+    commands[4].commandStruct.buttonPressed = EDL_BUTTON_PRESSED;
+
+    return applyCommands(*device, commands, 5);
 }
 
-/*! \fn readAndSaveSomeData
- * \brief Reads data from the EDL device and writes them on an open file.
+/*! \fn submitCommands
+ * \brief Queues a sequence of \a commandsNum commands, applied in the background in order by the command thread of the device, see CommandQueue;
+ * the acquisition keeps reading meanwhile. Returns at once, with the \a ticket identifying the sequence.
+ * The sequence is first checked against the stacking rules of EDL::setCommand: if it breaks them, its error is returned and nothing is applied.
+ * On completion \a callback, if not NULL, is called from the command thread with \a context; waitCommands also reports it.
+ * \a ticket may be NULL if the sequence is not waited for.
+ */
+extern "C" __declspec(dllexport) EdlErrorCode_t submitCommands(int deviceHandle, const E4Command_t * commands, unsigned int commandsNum,
+                                                               E4CommandCallback_t callback, void * context, unsigned long long * ticket)
+{
+    std::shared_ptr <Device> device = getDevice(deviceHandle);
+    if (!device) {return EdlDeviceNotConnectedError;}
+
+    unsigned long long submitted = 0;
+    EdlErrorCode_t res = device->commands.submit(commands, commandsNum, callback, context, submitted);
+    if (res == EdlSuccess && ticket != NULL) {*ticket = submitted;}
+    return res;
+}
+
+/*! \fn waitCommands
+ * \brief Waits up to \a timeoutMs for the sequence \a ticket returned by submitCommands to complete, and returns its \a result.
+ * Returns 1 if the sequence completed, 0 if it is still pending, -1 if the handle or the ticket is invalid.
+ */
+extern "C" __declspec(dllexport) int waitCommands(int deviceHandle, unsigned long long ticket, unsigned int timeoutMs, EdlErrorCode_t * result)
+{
+    std::shared_ptr <Device> device = getDevice(deviceHandle);
+    if (!device) {return -1;}
+    return device->commands.wait(ticket, timeoutMs, *result);
+}
+
+/*! \fn getCommandStats
+ * \brief Returns the counters of the command queue of a device, including the commands saved by coalescing.
+ */
+extern "C" __declspec(dllexport) void getCommandStats(int deviceHandle, E4CommandStats_t * stats)
+{
+    std::shared_ptr <Device> device = getDevice(deviceHandle);
+    if (!device) {return;}
+    device->commands.getStats(*stats);
+}
+
+/*! \fn setCommand
+ * \brief Stacks the command \a commandId with the value in \a commandStruct, and applies all of the stacked commands if \a sendFlag is true,
+ * same as EDL::setCommand. For the settings not covered by configureWorkingModality and setPotential, e.g. other sampling rates.
  */
-extern "C" __declspec(dllexport)EdlErrorCode_t readData(FILE * f)
+extern "C" __declspec(dllexport) EdlErrorCode_t setCommand(int deviceHandle, EdlCommandId_t commandId, const EdlCommandStruct_t * commandStruct, bool sendFlag)
 {
+    std::shared_ptr <Device> device = getDevice(deviceHandle);
+    if (!device) {return EdlDeviceNotConnectedError;}
+
+    EdlCommandStruct_t command = *commandStruct;
+    std::lock_guard <std::mutex> lock(device->edlMutex);
+    return device->setCommand(commandId, command, sendFlag);
+}
+
+/*! \fn readDataFor
+ * \brief Reads data from the EDL device for \a seconds, or until \a packetsNum data packets are read, whichever comes first,
+ * and writes them on an open file, in the format described in e4_recordformat.h. 0 disables either limit, but not both.
+ * The file must be at its start, e.g. just created: #EdlUnknownError is returned otherwise.
+ * The device is polled as scheduled by its ReadScheduler, see setReadScheduling and getSchedulerStats.
+ * Returns #EdlUnknownError without reading if the background acquisition is running, use pullPackets instead,
+ * or if another thread is reading the device with readDataFor or readInto.
+ */
+extern "C" __declspec(dllexport) EdlErrorCode_t readDataFor(int deviceHandle, FILE * f, double seconds, unsigned long long packetsNum)
+{
+    std::shared_ptr <Device> device = getDevice(deviceHandle);
+    if (!device) {return EdlDeviceNotConnectedError;}
+
     EdlErrorCode_t res;
     EdlDeviceStatus_t status;
 
-	// Variable for the number of read data packets.
+    // Variable for the number of read data packets.
     unsigned int readPacketsNum;
 
-	// Vector to collect the read data packets.
-    std::vector <float> data;
+    // Index of the next data packet, counted from the purge.
+    unsigned long long packetIdx = 0;
+
+    if (!(seconds > 0.0) && packetsNum == 0) {return EdlUnknownError;}
 
-    Sleep(500);
+    // Held until the end of the read: Device::data and Device::dataRecording are not shared.
+    std::unique_lock <std::mutex> readLock(device->readMutex, std::try_to_lock);
+    if (!readLock.owns_lock()) {return EdlUnknownError;}
+    if (device->acquisition.isRunning()) {return EdlUnknownError;}
 
-	res = edl.purgeData();
+    {
+        std::lock_guard <std::mutex> lock(device->edlMutex);
+        res = device->edl->purgeData();
+    }
     if (res != EdlSuccess) {return res;}
 
-	// Data collection
-	unsigned int c;
-    for (c = 0; c < 1e3; c++) {
-		// Current status shows number of available data packets EdlDeviceStatus_t::availableDataPackets.
-        res = edl.getDeviceStatus(status);
-        if (res != EdlSuccess) {return res;}
-		if (status.bufferOverflowFlag) {}
-		if (status.lostDataFlag) {}
-        if (status.availableDataPackets >= MINIMUM_DATA_PACKETS_TO_READ) {
-		    // If at least MINIMUM_DATA_PACKETS_TO_READ data packet are available read them.
-			res = edl.readData(status.availableDataPackets, readPacketsNum, data);
-            if (res == EdlDeviceNotConnectedError)
+    // The file is written from the writer I/O thread, so that disk stalls do not delay the device reads.
+    if (!device->dataRecording.open(f, device->settings)) {return EdlUnknownError;}
+    device->statistics.reset();
+    device->scheduler.reset();
+    device->metrics.reset();
+
+    const std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::now()
+            +std::chrono::duration_cast <std::chrono::steady_clock::duration> (std::chrono::duration <double> (seconds > 0.0 ? seconds : 0.0));
+
+    // Data collection
+    for (;;) {
+        readPacketsNum = 0;
+        {
+            std::lock_guard <std::mutex> lock(device->edlMutex);
+            // Current status shows number of available data packets EdlDeviceStatus_t::availableDataPackets.
+            std::chrono::steady_clock::time_point stageTime = std::chrono::steady_clock::now();
+            res = device->edl->getDeviceStatus(status);
+            stageTime = device->metrics.addTime(E4StageStatusPoll, stageTime);
+            device->metrics.addPoll(res, status);
+            if (res != EdlSuccess) {break;}
+            if (status.availableDataPackets > 0)
             {
-                fclose(f);
-				return res;
-			}
-			else
-			{
-				if (res == EdlNotEnoughAvailableDataError)
-                {
-				}
+                unsigned int dataToRead = status.availableDataPackets;
+                if (packetsNum > 0 && dataToRead > packetsNum-packetIdx) {dataToRead = (unsigned int)(packetsNum-packetIdx);}
+                res = device->edl->readData(dataToRead, readPacketsNum, device->data);
+                device->metrics.addTime(E4StageRead, stageTime);
+                device->metrics.addRead(res, dataToRead, readPacketsNum);
+            }
+        }
 
-	            /* Output vector: readPacketsNum data packets of EDL_CHANNEL_NUM floating point values
-				 * The first item in each data packet is the value voltage channel [mV];
-				 * following are values of current channels in pA or nA, depending on value assigned to EdlCommandSamplingRate. */
-                for (unsigned int readPacketsIdx = 0; readPacketsIdx < readPacketsNum; readPacketsIdx++)
-                {
-                    for (unsigned int channelIdx = 0; channelIdx < EDL_CHANNEL_NUM; channelIdx++)
-                    {
-                        fwrite((unsigned char *)&data.at(readPacketsIdx*EDL_CHANNEL_NUM+channelIdx), sizeof(float), 1, f);
-                    }
-                }
-			}
-        } else {Sleep(1);}
+        if (res == EdlDeviceNotConnectedError)
+        {
+            device->dataRecording.close();
+            fclose(f);
+            return res;
+        }
+
+        // All of the available data packets are returned anyway.
+        if (res == EdlNotEnoughAvailableDataError) {res = EdlSuccess;}
+
+        if (readPacketsNum > 0)
+        {
+            /* Output vector: readPacketsNum data packets of EDL_CHANNEL_NUM floating point values
+             * The first item in each data packet is the value voltage channel [mV];
+             * following are values of current channels in pA or nA, depending on value assigned to EdlCommandSamplingRate. */
+            std::chrono::steady_clock::time_point stageTime = std::chrono::steady_clock::now();
+            device->dataRecording.write(device->data.data(), readPacketsNum, packetIdx, status.bufferOverflowFlag, status.lostDataFlag);
+            stageTime = device->metrics.addTime(E4StageWrite, stageTime);
+            device->statistics.update(device->data.data(), readPacketsNum, status.bufferOverflowFlag, status.lostDataFlag);
+            device->metrics.addTime(E4StageProcessing, stageTime);
+            packetIdx += readPacketsNum;
+        }
+
+        if (packetsNum > 0 && packetIdx >= packetsNum) {break;}
+        if (seconds > 0.0 && std::chrono::steady_clock::now() >= deadline) {break;}
+        device->scheduler.wait(status.availableDataPackets, readPacketsNum);
+    }
+    device->dataRecording.close();
+    return res;
+}
+
+/*! \fn readAndSaveSomeData
+ * \brief Reads data from the EDL device for #E4_READ_DATA_SECONDS and writes them on an open file, in the format described in e4_recordformat.h,
+ * see readDataFor. Waits 500ms before starting, to let the applied commands settle.
+ * Returns #EdlUnknownError without reading if the background acquisition is running: use pullPackets instead.
+ */
+extern "C" __declspec(dllexport)EdlErrorCode_t readData(int deviceHandle, FILE * f)
+{
+    std::shared_ptr <Device> device = getDevice(deviceHandle);
+    if (!device) {return EdlDeviceNotConnectedError;}
+    if (device->acquisition.isRunning()) {return EdlUnknownError;}
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(500));
+    return readDataFor(deviceHandle, f, E4_READ_DATA_SECONDS, 0);
+}
+
+/*! \brief Reads up to \a maxPackets of the data packets available in \a device into Device::data.
+ * Returns immediately with \a readPacketsNum set to 0 if no data packets are available.
+ * The caller holds Device::readMutex until it is done with Device::data.
+ */
+static EdlErrorCode_t readAvailableData(Device &device, size_t maxPackets, unsigned int &readPacketsNum)
+{
+    EdlErrorCode_t res;
+    EdlDeviceStatus_t status;
+
+    readPacketsNum = 0;
+
+    std::lock_guard <std::mutex> lock(device.edlMutex);
+    std::chrono::steady_clock::time_point stageTime = std::chrono::steady_clock::now();
+    res = device.edl->getDeviceStatus(status);
+    stageTime = device.metrics.addTime(E4StageStatusPoll, stageTime);
+    device.metrics.addPoll(res, status);
+    if (res != EdlSuccess) {return res;}
+    if (status.availableDataPackets == 0) {return EdlSuccess;}
+
+    unsigned int dataToRead = status.availableDataPackets;
+    if (dataToRead > maxPackets) {dataToRead = (unsigned int)maxPackets;}
+    res = device.edl->readData(dataToRead, readPacketsNum, device.data);
+    device.metrics.addTime(E4StageRead, stageTime);
+    device.metrics.addRead(res, dataToRead, readPacketsNum);
+
+    // All of the available data packets are returned anyway.
+    if (res == EdlNotEnoughAvailableDataError) {res = EdlSuccess;}
+    return res;
+}
+
+/*! \fn readInto
+ * \brief Copies up to \a capacityPackets data packets of #EDL_CHANNEL_NUM floats into the caller-owned buffer \a dst.
+ * Data packets come from the acquisition ring if startAcquisition was called, from the device otherwise.
+ * Never blocks: \a packetsRead is 0 if no data packets are ready.
+ * Returns #EdlUnknownError without reading if another thread is reading the device with readDataFor or readInto.
+ */
+extern "C" __declspec(dllexport) EdlErrorCode_t readInto(int deviceHandle, float * dst, size_t capacityPackets, size_t * packetsRead)
+{
+    std::shared_ptr <Device> device = getDevice(deviceHandle);
+    if (!device) {return EdlDeviceNotConnectedError;}
+
+    EdlErrorCode_t res;
+    unsigned int readPacketsNum;
+
+    if (capacityPackets > UINT_MAX) {capacityPackets = UINT_MAX;}
+
+    *packetsRead = 0;
+    std::unique_lock <std::mutex> readLock(device->readMutex, std::defer_lock);
+    if (!device->acquisition.isRunning())
+    {
+        if (!readLock.try_lock()) {return EdlUnknownError;}
+    }
+
+    // The acquisition may have been started before the lock was taken.
+    if (device->acquisition.isRunning())
+    {
+        if (readLock.owns_lock()) {readLock.unlock();}
+        res = device->acquisition.pull(dst, (unsigned int)capacityPackets, readPacketsNum);
+        *packetsRead = readPacketsNum;
+        return res;
+    }
+
+    res = readAvailableData(*device, capacityPackets, readPacketsNum);
+    if (readPacketsNum > 0)
+    {
+        const std::chrono::steady_clock::time_point stageTime = std::chrono::steady_clock::now();
+        memcpy(dst, device->data.data(), sizeof(float)*EDL_CHANNEL_NUM*readPacketsNum);
+        device->metrics.addTime(E4StageCopy, stageTime);
     }
+    *packetsRead = readPacketsNum;
     return res;
 }
 
-extern "C" __declspec(dllexport) EdlErrorCode_t closeEDL()
+/*! \fn readIntoChannelMajor
+ * \brief Same as readInto, but fills \a dst as #EDL_CHANNEL_NUM consecutive arrays of \a capacityPackets floats,
+ * i.e. a C-ordered (#EDL_CHANNEL_NUM, \a capacityPackets) array; the first array is the voltage channel.
+ */
+extern "C" __declspec(dllexport) EdlErrorCode_t readIntoChannelMajor(int deviceHandle, float * dst, size_t capacityPackets, size_t * packetsRead)
 {
+    std::shared_ptr <Device> device = getDevice(deviceHandle);
+    if (!device) {return EdlDeviceNotConnectedError;}
+
     EdlErrorCode_t res;
-    unsigned int c = 0;
-    while (c++ < 1e3)
+    unsigned int readPacketsNum;
+
+    *packetsRead = 0;
+    std::unique_lock <std::mutex> readLock(device->readMutex, std::defer_lock);
+    if (!device->acquisition.isRunning())
     {
-		res = edl.disconnectDevice();
-		if (res == EdlSuccess) {break;}
-        Sleep(1);
+        if (!readLock.try_lock()) {return EdlUnknownError;}
     }
 
+    // The acquisition may have been started before the lock was taken.
+    if (device->acquisition.isRunning())
+    {
+        if (readLock.owns_lock()) {readLock.unlock();}
+        return device->acquisition.pullChannelMajor(dst, capacityPackets, capacityPackets, *packetsRead);
+    }
+
+    if (capacityPackets > UINT_MAX) {capacityPackets = UINT_MAX;}
+    res = readAvailableData(*device, capacityPackets, readPacketsNum);
+    if (readPacketsNum > 0)
+    {
+        const std::chrono::steady_clock::time_point stageTime = std::chrono::steady_clock::now();
+        deinterleavePackets(device->data.data(), readPacketsNum, dst, capacityPackets);
+        device->metrics.addTime(E4StageCopy, stageTime);
+    }
+    *packetsRead = readPacketsNum;
     return res;
 }
+
+/*! \fn startAcquisition
+ * \brief Purges the device data and starts reading it continuously from a background thread.
+ * Read data packets are kept in a ring of \a ringPackets data packets (0 for #E4_DEFAULT_RING_PACKETS) until pulled with pullPackets.
+ * Returns #EdlUnknownError without starting if another thread is reading the device with readDataFor or readInto.
+ */
+extern "C" __declspec(dllexport) EdlErrorCode_t startAcquisition(int deviceHandle, unsigned int ringPackets)
+{
+    std::shared_ptr <Device> device = getDevice(deviceHandle);
+    if (!device) {return EdlDeviceNotConnectedError;}
+
+    std::unique_lock <std::mutex> readLock(device->readMutex, std::try_to_lock);
+    if (!readLock.owns_lock()) {return EdlUnknownError;}
+    return device->acquisition.start(ringPackets);
+}
+
+/*! \fn stopAcquisition
+ * \brief Stops the background acquisition. Data packets left in the ring can still be pulled.
+ */
+extern "C" __declspec(dllexport) void stopAcquisition(int deviceHandle)
+{
+    std::shared_ptr <Device> device = getDevice(deviceHandle);
+    if (!device) {return;}
+    device->acquisition.stop();
+}
+
+/*! \fn pullPackets
+ * \brief Copies up to \a maxPackets data packets of #EDL_CHANNEL_NUM floats from the acquisition ring into \a dst.
+ * Never blocks: \a packetsRead is 0 if no data packets are ready.
+ */
+extern "C" __declspec(dllexport) EdlErrorCode_t pullPackets(int deviceHandle, float * dst, unsigned int maxPackets, unsigned int * packetsRead)
+{
+    std::shared_ptr <Device> device = getDevice(deviceHandle);
+    if (!device) {return EdlDeviceNotConnectedError;}
+    return device->acquisition.pull(dst, maxPackets, *packetsRead);
+}
+
+/*! \fn getAcquisitionStats
+ * \brief Returns the counters of the background acquisition.
+ */
+extern "C" __declspec(dllexport) void getAcquisitionStats(int deviceHandle, E4AcquisitionStats_t * stats)
+{
+    std::shared_ptr <Device> device = getDevice(deviceHandle);
+    if (!device) {return;}
+    device->acquisition.getStats(*stats);
+}
+
+/*! \fn getMetrics
+ * \brief Returns the latency histograms of the stages of the device reads, the outcomes of the device calls
+ * and the latest losses of data packets, since the acquisition or readDataFor started; readInto adds to them otherwise.
+ * Meant to be polled for monitoring: the reader is never blocked.
+ */
+extern "C" __declspec(dllexport) void getMetrics(int deviceHandle, E4Metrics_t * metrics)
+{
+    std::shared_ptr <Device> device = getDevice(deviceHandle);
+    if (!device) {return;}
+    device->metrics.get(*metrics);
+}
+
+/*! \fn setAcquisitionAffinity
+ * \brief Restricts the background acquisition thread of a device to the cores in the bit mask \a cpuMask (0 for every core),
+ * e.g. one core per device when acquiring from several devices. Can be called before or during the acquisition.
+ * Returns #EdlUnknownError if none of the cores is available to the process.
+ */
+extern "C" __declspec(dllexport) EdlErrorCode_t setAcquisitionAffinity(int deviceHandle, unsigned long long cpuMask)
+{
+    std::shared_ptr <Device> device = getDevice(deviceHandle);
+    if (!device) {return EdlDeviceNotConnectedError;}
+    return device->acquisition.setAffinity(cpuMask) ? EdlSuccess : EdlUnknownError;
+}
+
+/*! \fn setReadScheduling
+ * \brief Sets the latency target and the batch size that space the device polls of the acquisition and of readDataFor, see ReadScheduler.
+ * Returns #EdlUnknownError if the configuration is invalid. Takes effect at the next poll.
+ */
+extern "C" __declspec(dllexport) EdlErrorCode_t setReadScheduling(int deviceHandle, const E4SchedulerConfig_t * config)
+{
+    std::shared_ptr <Device> device = getDevice(deviceHandle);
+    if (!device) {return EdlDeviceNotConnectedError;}
+    return device->scheduler.configure(*config) ? EdlSuccess : EdlUnknownError;
+}
+
+/*! \fn getSchedulerStats
+ * \brief Returns the counters of the decisions of the poll scheduler since the acquisition or readDataFor started.
+ */
+extern "C" __declspec(dllexport) void getSchedulerStats(int deviceHandle, E4SchedulerStats_t * stats)
+{
+    std::shared_ptr <Device> device = getDevice(deviceHandle);
+    if (!device) {return;}
+    device->scheduler.getStats(*stats);
+}
+
+/*! \fn getStats
+ * \brief Returns the running statistics of each channel, over the sliding window and since the acquisition started.
+ * Meant to be polled for monitoring: no data packets are copied.
+ */
+extern "C" __declspec(dllexport) void getStats(int deviceHandle, E4Stats_t * stats)
+{
+    std::shared_ptr <Device> device = getDevice(deviceHandle);
+    if (!device) {return;}
+    device->statistics.get(*stats);
+}
+
+/*! \fn setStatsWindow
+ * \brief Sets the length of the sliding window of getStats in data packets (0 for #E4_STATS_DEFAULT_WINDOW_PACKETS) and resets the statistics.
+ */
+extern "C" __declspec(dllexport) void setStatsWindow(int deviceHandle, unsigned int windowPackets)
+{
+    std::shared_ptr <Device> device = getDevice(deviceHandle);
+    if (!device) {return;}
+    device->statistics.setWindow(windowPackets);
+}
+
+/*! \fn setFilter
+ * \brief Configures the low-pass filter and decimator applied to the current channels by the background acquisition.
+ * Filtered data packets are pulled with pullFilteredPackets; the ring pulled by pullPackets and the recordings keep the raw data.
+ * Unless E4FilterConfig_t::samplingRateHz is set, the filter is redesigned whenever the sampling rate changes.
+ * Returns #EdlUnknownError if the configuration is invalid, e.g. if the cutoff is not below half the sampling rate.
+ */
+extern "C" __declspec(dllexport) EdlErrorCode_t setFilter(int deviceHandle, const E4FilterConfig_t * config)
+{
+    std::shared_ptr <Device> device = getDevice(deviceHandle);
+    if (!device) {return EdlDeviceNotConnectedError;}
+    return device->setFilter(*config) ? EdlSuccess : EdlUnknownError;
+}
+
+/*! \fn pullFilteredPackets
+ * \brief Copies up to \a maxPackets filtered data packets of #EDL_CHANNEL_NUM floats into \a dst, see setFilter.
+ * Never blocks: \a packetsRead is 0 if no data packets are ready.
+ */
+extern "C" __declspec(dllexport) EdlErrorCode_t pullFilteredPackets(int deviceHandle, float * dst, unsigned int maxPackets, unsigned int * packetsRead)
+{
+    std::shared_ptr <Device> device = getDevice(deviceHandle);
+    if (!device) {return EdlDeviceNotConnectedError;}
+    return device->acquisition.pullFiltered(dst, maxPackets, *packetsRead);
+}
+
+/*! \fn setDetector
+ * \brief Configures the translocation event detector applied to the current channels by the background acquisition.
+ * Detected events are returned by pollEvents; with #E4_RECORDING_EVENTS_ONLY, recordings keep only the data packets around them.
+ * Unless E4DetectorConfig_t::samplingRateHz is set, the detector is reconfigured whenever the sampling rate changes.
+ * Returns #EdlUnknownError if the configuration is invalid.
+ */
+extern "C" __declspec(dllexport) EdlErrorCode_t setDetector(int deviceHandle, const E4DetectorConfig_t * config)
+{
+    std::shared_ptr <Device> device = getDevice(deviceHandle);
+    if (!device) {return EdlDeviceNotConnectedError;}
+    return device->setDetector(*config) ? EdlSuccess : EdlUnknownError;
+}
+
+/*! \fn pollEvents
+ * \brief Copies up to \a maxEvents detected events into \a dst, oldest first, and removes them from the detector queue.
+ * Never blocks: \a eventsNum is 0 if no events are ready.
+ */
+extern "C" __declspec(dllexport) EdlErrorCode_t pollEvents(int deviceHandle, E4Event_t * dst, unsigned int maxEvents, unsigned int * eventsNum)
+{
+    std::shared_ptr <Device> device = getDevice(deviceHandle);
+    if (!device) {return EdlDeviceNotConnectedError;}
+    *eventsNum = device->acquisition.pollEvents(dst, maxEvents);
+    return EdlSuccess;
+}
+
+/*! \fn setSpectrum
+ * \brief Configures the power spectral density estimate of the current channels computed by the background acquisition
+ * with Welch's method, see WelchSpectrum. The latest spectrum is returned by getSpectrum.
+ * Unless E4SpectrumConfig_t::samplingRateHz is set, the spectrum follows the sampling rate.
+ * Returns #EdlUnknownError if the configuration is invalid, e.g. if the segment length is not a power of two.
+ */
+extern "C" __declspec(dllexport) EdlErrorCode_t setSpectrum(int deviceHandle, const E4SpectrumConfig_t * config)
+{
+    std::shared_ptr <Device> device = getDevice(deviceHandle);
+    if (!device) {return EdlDeviceNotConnectedError;}
+    return device->setSpectrum(*config) ? EdlSuccess : EdlUnknownError;
+}
+
+/*! \fn getSpectrum
+ * \brief Copies the latest power spectral density estimate into \a dst: #E4_SPECTRUM_CHANNEL_NUM arrays of \a maxBins floats,
+ * one per current channel, each filled with the first E4SpectrumInfo_t::binNum bins at most, in squared current units per Hz.
+ * E4SpectrumInfo_t::spectrumCount is 0 until the first spectrum is computed. Never blocks on the acquisition.
+ */
+extern "C" __declspec(dllexport) EdlErrorCode_t getSpectrum(int deviceHandle, float * dst, unsigned int maxBins, E4SpectrumInfo_t * info)
+{
+    std::shared_ptr <Device> device = getDevice(deviceHandle);
+    if (!device) {return EdlDeviceNotConnectedError;}
+    device->acquisition.getSpectrum(dst, maxBins, *info);
+    return EdlSuccess;
+}
+
+/*! \fn setSweeps
+ * \brief Configures the averaging of the protocol sweeps computed by the background acquisition, see SweepAverager:
+ * the voltage channel splits the data into protocol periods, and the current channels are averaged over them against the voltage.
+ * The latest averaged sweep and its fit are returned by getSweep.
+ * Unless set in \a config, the period and the sampling rate follow the applied protocol, e.g. setPotential, and sampling rate;
+ * the averaged sweeps are discarded whenever either is applied again.
+ * Returns #EdlUnknownError if the configuration is invalid, e.g. if no period is set and no triangular protocol is applied.
+ */
+extern "C" __declspec(dllexport) EdlErrorCode_t setSweeps(int deviceHandle, const E4SweepConfig_t * config)
+{
+    std::shared_ptr <Device> device = getDevice(deviceHandle);
+    if (!device) {return EdlDeviceNotConnectedError;}
+    return device->setSweeps(*config) ? EdlSuccess : EdlUnknownError;
+}
+
+/*! \fn getSweep
+ * \brief Copies the latest averaged sweep into \a dst: #EDL_CHANNEL_NUM arrays of \a maxBins floats, the voltage followed by the current channels,
+ * each filled with the first E4SweepInfo_t::binNum values at most. \a info also returns the fit of each current channel.
+ * E4SweepInfo_t::sweepCount is 0 until the first sweep is averaged. Never blocks on the acquisition.
+ */
+extern "C" __declspec(dllexport) EdlErrorCode_t getSweep(int deviceHandle, float * dst, unsigned int maxBins, E4SweepInfo_t * info)
+{
+    std::shared_ptr <Device> device = getDevice(deviceHandle);
+    if (!device) {return EdlDeviceNotConnectedError;}
+    device->acquisition.getSweep(dst, maxBins, *info);
+    return EdlSuccess;
+}
+
+/*! \fn startRecording
+ * \brief Starts writing every data packet read by the background acquisition to the file \a path, in the format described in e4_recordformat.h.
+ * \a flags may combine #E4_WRITER_DIRECT_IO, #E4_RECORDING_COMPRESS and #E4_RECORDING_EVENTS_ONLY; \a preallocateBytes reserves disk space up front (0 for none).
+ * Returns #EdlUnknownError if the file cannot be created.
+ */
+extern "C" __declspec(dllexport) EdlErrorCode_t startRecording(int deviceHandle, const char * path, unsigned int flags, unsigned long long preallocateBytes)
+{
+    std::shared_ptr <Device> device = getDevice(deviceHandle);
+    if (!device) {return EdlDeviceNotConnectedError;}
+
+    device->acquisition.setRecording(NULL, false);
+    device->recording.close();
+
+    if (!device->recording.open(path, device->settings, (flags & E4_WRITER_DIRECT_IO) != 0, preallocateBytes, (flags & E4_RECORDING_COMPRESS) != 0)) {return EdlUnknownError;}
+    device->acquisition.setRecording(&device->recording, (flags & E4_RECORDING_EVENTS_ONLY) != 0);
+    return EdlSuccess;
+}
+
+/*! \fn stopRecording
+ * \brief Stops the recording started by startRecording and waits for all of the data to be written.
+ * Returns #EdlUnknownError if any write failed: see getWriterStats.
+ */
+extern "C" __declspec(dllexport) EdlErrorCode_t stopRecording(int deviceHandle)
+{
+    std::shared_ptr <Device> device = getDevice(deviceHandle);
+    if (!device) {return EdlDeviceNotConnectedError;}
+
+    device->acquisition.setRecording(NULL, false);
+    return device->recording.close() ? EdlSuccess : EdlUnknownError;
+}
+
+/*! \fn getWriterStats
+ * \brief Returns the counters of the recording writer, including the backpressure applied to the acquisition.
+ */
+extern "C" __declspec(dllexport) void getWriterStats(int deviceHandle, E4WriterStats_t * stats)
+{
+    std::shared_ptr <Device> device = getDevice(deviceHandle);
+    if (!device) {return;}
+    device->recording.getWriterStats(*stats);
+}
+
+/*! \fn openRecordingFile
+ * \brief Maps a recording file for reading. Returns a handle for the other recording file functions, -1 on error.
+ */
+extern "C" __declspec(dllexport) int openRecordingFile(const char * path)
+{
+    RecordReader * reader = new RecordReader;
+    if (!reader->open(path))
+    {
+        delete reader;
+        return -1;
+    }
+
+    std::lock_guard <std::mutex> lock(readersMutex);
+    for (size_t handle = 0; handle < readers.size(); handle++)
+    {
+        if (readers[handle] == NULL)
+        {
+            readers[handle] = reader;
+            return (int)handle;
+        }
+    }
+    readers.push_back(reader);
+    return (int)readers.size()-1;
+}
+
+/*! \brief Returns the reader of a handle returned by openRecordingFile, NULL if invalid. The caller must hold #readersMutex.
+ */
+static RecordReader * getReader(int handle)
+{
+    if (handle < 0 || (size_t)handle >= readers.size()) {return NULL;}
+    return readers[handle];
+}
+
+/*! \fn getRecordingInfo
+ * \brief Returns a summary of a recording file. Returns #EdlUnknownError if \a handle is invalid.
+ */
+extern "C" __declspec(dllexport) EdlErrorCode_t getRecordingInfo(int handle, E4RecordingInfo_t * info)
+{
+    std::lock_guard <std::mutex> lock(readersMutex);
+    RecordReader * reader = getReader(handle);
+    if (reader == NULL) {return EdlUnknownError;}
+    reader->getInfo(*info);
+    return EdlSuccess;
+}
+
+/*! \fn readRecordingPackets
+ * \brief Copies up to \a maxPackets data packets of a recording file into \a dst, starting \a packetOffset packets after its first one.
+ * To read from a time offset t, use \a packetOffset = t*E4RecordingInfo_t::samplingRateHz: the data is located in constant time.
+ */
+extern "C" __declspec(dllexport) EdlErrorCode_t readRecordingPackets(int handle, unsigned long long packetOffset, size_t maxPackets, float * dst, size_t * packetsRead)
+{
+    std::lock_guard <std::mutex> lock(readersMutex);
+    RecordReader * reader = getReader(handle);
+    if (reader == NULL) {return EdlUnknownError;}
+    *packetsRead = reader->read(packetOffset, maxPackets, dst);
+    return EdlSuccess;
+}
+
+/*! \fn readRecordingEnvelope
+ * \brief Summarizes \a packetsNum data packets of a recording file, starting \a packetOffset packets after its first one,
+ * into \a pointsNum display points: \a minimum, \a maximum and \a mean each receive \a pointsNum points of
+ * E4RecordingInfo_t::channelNum values, laid out as the data packets. Points without data are set to NaN.
+ * The points are computed from the envelope stored in the file, reading a number of entries proportional to \a pointsNum
+ * whatever the length of the range. Returns #EdlUnknownError if \a handle or \a pointsNum is invalid.
+ */
+extern "C" __declspec(dllexport) EdlErrorCode_t readRecordingEnvelope(int handle, unsigned long long packetOffset, unsigned long long packetsNum, size_t pointsNum, float * minimum, float * maximum, float * mean)
+{
+    std::lock_guard <std::mutex> lock(readersMutex);
+    RecordReader * reader = getReader(handle);
+    if (reader == NULL) {return EdlUnknownError;}
+    return reader->readEnvelope(packetOffset, packetsNum, pointsNum, minimum, maximum, mean) ? EdlSuccess : EdlUnknownError;
+}
+
+/*! \fn closeRecordingFile
+ * \brief Unmaps a recording file opened by openRecordingFile.
+ */
+extern "C" __declspec(dllexport) void closeRecordingFile(int handle)
+{
+    std::lock_guard <std::mutex> lock(readersMutex);
+    RecordReader * reader = getReader(handle);
+    if (reader == NULL) {return;}
+    delete reader;
+    readers[handle] = NULL;
+}
+
+/*! \fn startSharing
+ * \brief Publishes every data packet read by the background acquisition to the shared memory ring \a name, in the layout described
+ * in e4_sharedformat.h, so that other processes read the live data with openSharedRing, or by mapping the ring themselves.
+ * The ring holds \a capacityPackets data packets (0 for #E4_SHARED_DEFAULT_PACKETS); the acquisition never waits for its readers.
+ * Returns #EdlUnknownError if the ring cannot be created.
+ */
+extern "C" __declspec(dllexport) EdlErrorCode_t startSharing(int deviceHandle, const char * name, unsigned int capacityPackets)
+{
+    std::shared_ptr <Device> device = getDevice(deviceHandle);
+    if (!device) {return EdlDeviceNotConnectedError;}
+    return device->startSharing(name, capacityPackets) ? EdlSuccess : EdlUnknownError;
+}
+
+/*! \fn stopSharing
+ * \brief Stops publishing to the shared ring and removes it. Attached readers get the data packets already published, then see it closed.
+ */
+extern "C" __declspec(dllexport) void stopSharing(int deviceHandle)
+{
+    std::shared_ptr <Device> device = getDevice(deviceHandle);
+    if (!device) {return;}
+    device->stopSharing();
+}
+
+/*! \fn openSharedRing
+ * \brief Attaches to a shared ring published by startSharing, possibly in another process.
+ * Only the data packets published from then on are read. Returns a handle for the other shared ring functions, -1 on error.
+ */
+extern "C" __declspec(dllexport) int openSharedRing(const char * name)
+{
+    SharedRingReader * reader = new SharedRingReader;
+    if (!reader->open(name))
+    {
+        delete reader;
+        return -1;
+    }
+
+    std::lock_guard <std::mutex> lock(sharedReadersMutex);
+    for (size_t handle = 0; handle < sharedReaders.size(); handle++)
+    {
+        if (sharedReaders[handle] == NULL)
+        {
+            sharedReaders[handle] = reader;
+            return (int)handle;
+        }
+    }
+    sharedReaders.push_back(reader);
+    return (int)sharedReaders.size()-1;
+}
+
+/*! \brief Returns the reader of a handle returned by openSharedRing, NULL if invalid. The caller must hold #sharedReadersMutex.
+ */
+static SharedRingReader * getSharedReader(int handle)
+{
+    if (handle < 0 || (size_t)handle >= sharedReaders.size()) {return NULL;}
+    return sharedReaders[handle];
+}
+
+/*! \fn peekSharedPackets
+ * \brief Returns in \a packets the address of the next \a packetsNum data packets of a shared ring, in place: nothing is copied.
+ * \a packetsNum is 0 if no data packets are ready. \a firstPacketIdx is the index of the first one, counted from the creation of the ring.
+ * Once used, the data packets must be released with releaseSharedPackets, which tells whether they were overwritten meanwhile.
+ * Returns #EdlDeviceNotConnectedError once the writer stopped and every data packet was read, #EdlUnknownError if \a handle is invalid.
+ */
+extern "C" __declspec(dllexport) EdlErrorCode_t peekSharedPackets(int handle, const float ** packets, size_t * packetsNum, unsigned long long * firstPacketIdx)
+{
+    std::lock_guard <std::mutex> lock(sharedReadersMutex);
+    SharedRingReader * reader = getSharedReader(handle);
+    if (reader == NULL) {return EdlUnknownError;}
+    return reader->peek(*packets, *packetsNum, *firstPacketIdx) ? EdlSuccess : EdlDeviceNotConnectedError;
+}
+
+/*! \fn releaseSharedPackets
+ * \brief Consumes the first \a packetsNum data packets returned by peekSharedPackets. \a overwrittenPackets returns how many of them,
+ * from the first one, were overwritten by the writer while in use and must be discarded: the reader fell behind by a whole ring.
+ */
+extern "C" __declspec(dllexport) EdlErrorCode_t releaseSharedPackets(int handle, size_t packetsNum, size_t * overwrittenPackets)
+{
+    std::lock_guard <std::mutex> lock(sharedReadersMutex);
+    SharedRingReader * reader = getSharedReader(handle);
+    if (reader == NULL) {return EdlUnknownError;}
+    *overwrittenPackets = reader->release(packetsNum);
+    return EdlSuccess;
+}
+
+/*! \fn readSharedPackets
+ * \brief Copies up to \a maxPackets data packets of #EDL_CHANNEL_NUM floats from a shared ring into \a dst.
+ * Never blocks: \a packetsRead is 0 if no data packets are ready. Overwritten data packets are dropped and counted in getSharedRingInfo.
+ * Returns #EdlDeviceNotConnectedError once the writer stopped and every data packet was read, #EdlUnknownError if \a handle is invalid.
+ */
+extern "C" __declspec(dllexport) EdlErrorCode_t readSharedPackets(int handle, float * dst, size_t maxPackets, size_t * packetsRead)
+{
+    std::lock_guard <std::mutex> lock(sharedReadersMutex);
+    SharedRingReader * reader = getSharedReader(handle);
+    if (reader == NULL) {return EdlUnknownError;}
+    return reader->read(dst, maxPackets, *packetsRead) ? EdlSuccess : EdlDeviceNotConnectedError;
+}
+
+/*! \fn getSharedRingInfo
+ * \brief Returns a description of a shared ring and of the progress of its reader. Returns #EdlUnknownError if \a handle is invalid.
+ */
+extern "C" __declspec(dllexport) EdlErrorCode_t getSharedRingInfo(int handle, E4SharedRingInfo_t * info)
+{
+    std::lock_guard <std::mutex> lock(sharedReadersMutex);
+    SharedRingReader * reader = getSharedReader(handle);
+    if (reader == NULL) {return EdlUnknownError;}
+    reader->getInfo(*info);
+    return EdlSuccess;
+}
+
+/*! \fn closeSharedRing
+ * \brief Detaches from a shared ring attached by openSharedRing.
+ */
+extern "C" __declspec(dllexport) void closeSharedRing(int handle)
+{
+    std::lock_guard <std::mutex> lock(sharedReadersMutex);
+    SharedRingReader * reader = getSharedReader(handle);
+    if (reader == NULL) {return;}
+    delete reader;
+    sharedReaders[handle] = NULL;
+}
+
+/*! \fn closeEDL
+ * \brief Stops the acquisition and the recording of a device, disconnects it and releases its handle.
+ */
+extern "C" __declspec(dllexport) EdlErrorCode_t closeEDL(int deviceHandle)
+{
+    std::shared_ptr <Device> device;
+    {
+        std::lock_guard <std::mutex> lock(devicesMutex);
+        if (deviceHandle < 0 || (size_t)deviceHandle >= devices.size() || !devices[deviceHandle]) {return EdlDeviceNotConnectedError;}
+        device = devices[deviceHandle];
+        devices[deviceHandle].reset();
+    }
+    return device->disconnect();
+}
@@ -0,0 +1,119 @@
+/*! \file e4_envelope.cpp
+ * \brief Defines class EnvelopeBuilder.
+ */
+#include <cstring>
+
+#include "e4_envelope.h"
+
+static_assert(sizeof(E4RecordEnvelopeHeader_t) == 24, "E4RecordEnvelopeHeader_t must not be padded");
+static_assert(sizeof(E4RecordEnvelope_t) == 12+12*EDL_CHANNEL_NUM, "E4RecordEnvelope_t must not be padded");
+
+EnvelopeBuilder::EnvelopeBuilder() :
+    chunkPackets(E4_RECORD_CHUNK_PACKETS)
+{
+
+}
+
+void EnvelopeBuilder::reset(unsigned int chunkPackets)
+{
+    chunkLevel.clear();
+    this->chunkPackets = chunkPackets;
+}
+
+void EnvelopeBuilder::addChunk(const float * packets, unsigned int packetsNum, unsigned long long packetOffset, std::vector <E4RecordEnvelope_t> &entries)
+{
+    entries.resize((packetsNum+E4_RECORD_ENVELOPE_PACKETS-1)/E4_RECORD_ENVELOPE_PACKETS);
+
+    for (size_t entryIdx = 0; entryIdx < entries.size(); entryIdx++)
+    {
+        E4RecordEnvelope_t &entry = entries[entryIdx];
+        const unsigned int firstPacket = (unsigned int)entryIdx*E4_RECORD_ENVELOPE_PACKETS;
+        const unsigned int n = packetsNum-firstPacket < E4_RECORD_ENVELOPE_PACKETS ? packetsNum-firstPacket : E4_RECORD_ENVELOPE_PACKETS;
+        const float * packet = packets+(size_t)firstPacket*EDL_CHANNEL_NUM;
+        double sums[EDL_CHANNEL_NUM];
+
+        entry.packetNum = n;
+        entry.reserved = 0;
+        for (unsigned int channelIdx = 0; channelIdx < EDL_CHANNEL_NUM; channelIdx++)
+        {
+            entry.minimum[channelIdx] = packet[channelIdx];
+            entry.maximum[channelIdx] = packet[channelIdx];
+            sums[channelIdx] = 0.0;
+        }
+        for (unsigned int packetIdx = 0; packetIdx < n; packetIdx++, packet += EDL_CHANNEL_NUM)
+        {
+            for (unsigned int channelIdx = 0; channelIdx < EDL_CHANNEL_NUM; channelIdx++)
+            {
+                const float value = packet[channelIdx];
+                if (value < entry.minimum[channelIdx]) {entry.minimum[channelIdx] = value;}
+                if (value > entry.maximum[channelIdx]) {entry.maximum[channelIdx] = value;}
+                sums[channelIdx] += value;
+            }
+        }
+        for (unsigned int channelIdx = 0; channelIdx < EDL_CHANNEL_NUM; channelIdx++) {entry.mean[channelIdx] = (float)(sums[channelIdx]/n);}
+
+        const size_t chunkLevelIdx = (size_t)((packetOffset+firstPacket)/chunkPackets);
+        if (chunkLevelIdx >= chunkLevel.size())
+        {
+            E4RecordEnvelope_t empty;
+            clear(empty);
+            chunkLevel.resize(chunkLevelIdx+1, empty);
+        }
+        merge(chunkLevel[chunkLevelIdx], entry);
+    }
+}
+
+void EnvelopeBuilder::finish(std::vector <std::vector <E4RecordEnvelope_t> > &levels)
+{
+    levels.clear();
+    if (chunkLevel.empty()) {return;}
+
+    levels.push_back(std::vector <E4RecordEnvelope_t>());
+    levels.back().swap(chunkLevel);
+    while (levels.back().size() > 1) {
+        const std::vector <E4RecordEnvelope_t> &below = levels.back();
+        std::vector <E4RecordEnvelope_t> above((below.size()+E4_RECORD_ENVELOPE_FACTOR-1)/E4_RECORD_ENVELOPE_FACTOR);
+        for (size_t entryIdx = 0; entryIdx < above.size(); entryIdx++)
+        {
+            clear(above[entryIdx]);
+            for (size_t belowIdx = entryIdx*E4_RECORD_ENVELOPE_FACTOR; belowIdx < below.size() && belowIdx < (entryIdx+1)*E4_RECORD_ENVELOPE_FACTOR; belowIdx++)
+            {
+                merge(above[entryIdx], below[belowIdx]);
+            }
+        }
+        levels.push_back(std::vector <E4RecordEnvelope_t>());
+        levels.back().swap(above);
+    }
+}
+
+unsigned long long EnvelopeBuilder::levelPackets(unsigned int level, unsigned int chunkPackets)
+{
+    if (level == 0) {return E4_RECORD_ENVELOPE_PACKETS;}
+    unsigned long long packetsNum = chunkPackets;
+    for (unsigned int levelIdx = 1; levelIdx < level; levelIdx++) {packetsNum *= E4_RECORD_ENVELOPE_FACTOR;}
+    return packetsNum;
+}
+
+void EnvelopeBuilder::clear(E4RecordEnvelope_t &entry)
+{
+    memset(&entry, 0, sizeof(entry));
+}
+
+void EnvelopeBuilder::merge(E4RecordEnvelope_t &dst, const E4RecordEnvelope_t &src)
+{
+    if (src.packetNum == 0) {return;}
+    if (dst.packetNum == 0)
+    {
+        dst = src;
+        return;
+    }
+
+    const double weight = (double)src.packetNum/(double)(dst.packetNum+src.packetNum);
+    for (unsigned int channelIdx = 0; channelIdx < EDL_CHANNEL_NUM; channelIdx++)
+    {
+        if (src.minimum[channelIdx] < dst.minimum[channelIdx]) {dst.minimum[channelIdx] = src.minimum[channelIdx];}
+        if (src.maximum[channelIdx] > dst.maximum[channelIdx]) {dst.maximum[channelIdx] = src.maximum[channelIdx];}
+        dst.mean[channelIdx] = (float)(dst.mean[channelIdx]+weight*((double)src.mean[channelIdx]-dst.mean[channelIdx]));
+    }
+    dst.packetNum += src.packetNum;
+}
@@ -0,0 +1,65 @@
+/*! \file e4_envelope.h
+ * \brief Declares class EnvelopeBuilder.
+ */
+#ifndef E4_ENVELOPE_H
+#define E4_ENVELOPE_H
+
+#include <vector>
+
+#include "edl_global.h"
+#include "e4_recordformat.h"
+
+/*! \class EnvelopeBuilder
+ * \brief Builds the envelope levels of a recording file, see e4_recordformat.h, as its chunks are written.
+ * The level 0 entries of a chunk are returned right away; the level 1 entries are kept in memory,
+ * one per chunk of E4RecordHeader_t::chunkPackets data packets, and the levels above are derived from them by EnvelopeBuilder::finish.
+ */
+class EnvelopeBuilder {
+public:
+    EnvelopeBuilder();
+
+    /*! \brief Discards the level 1 entries, before a new recording.
+     *
+     * \param chunkPackets [in] E4RecordHeader_t::chunkPackets of the new recording: the span of the level 1 entries.
+     */
+    void reset(EDL_IN unsigned int chunkPackets);
+
+    /*! \brief Computes the level 0 entries of a chunk and adds them to the level 1 entries.
+     *
+     * \param packets [in] Buffer of \a packetsNum data packets of #EDL_CHANNEL_NUM values.
+     * \param packetsNum [in] Number of data packets in \a packets.
+     * \param packetOffset [in] Offset of the first data packet from E4RecordHeader_t::firstPacketIdx.
+     * \param entries [out] Level 0 entries of the chunk.
+     */
+    void addChunk(EDL_IN const float * packets,
+                  EDL_IN unsigned int packetsNum,
+                  EDL_IN unsigned long long packetOffset,
+                  EDL_OUT std::vector <E4RecordEnvelope_t> &entries);
+
+    /*! \brief Returns levels 1 and above, in that order, then resets the builder. There are none if no chunks were added.
+     */
+    void finish(EDL_OUT std::vector <std::vector <E4RecordEnvelope_t> > &levels);
+
+    /*! \brief Returns the span in data packets of the entries of an envelope level.
+     *
+     * \param level [in] Envelope level.
+     * \param chunkPackets [in] E4RecordHeader_t::chunkPackets of the recording.
+     */
+    static unsigned long long levelPackets(EDL_IN unsigned int level,
+                                           EDL_IN unsigned int chunkPackets);
+
+    /*! \brief Sets an entry to an empty summary.
+     */
+    static void clear(EDL_OUT E4RecordEnvelope_t &entry);
+
+    /*! \brief Merges the summary \a src into \a dst.
+     */
+    static void merge(EDL_OUT E4RecordEnvelope_t &dst,
+                      EDL_IN const E4RecordEnvelope_t &src);
+
+private:
+    std::vector <E4RecordEnvelope_t> chunkLevel; /*!< Level 1 entries. */
+    unsigned int chunkPackets; /*!< Span of the level 1 entries. */
+};
+
+#endif // E4_ENVELOPE_H
@@ -0,0 +1,314 @@
+/*! \file e4_events.cpp
+ * \brief Defines classes EventDetector and EventGate.
+ */
+#include <cfloat>
+#include <cmath>
+#include <cstring>
+
+#include "e4_events.h"
+
+#define E4_DETECTOR_DEFAULT_BASELINE_TIME_S 0.1
+#define E4_DETECTOR_DEFAULT_START_SIGMA 5.0
+#define E4_DETECTOR_DEFAULT_END_SIGMA 1.0
+#define E4_DETECTOR_DEFAULT_CUSUM_DRIFT_SIGMA 1.0
+#define E4_DETECTOR_DEFAULT_CUSUM_THRESHOLD_SIGMA 20.0
+#define E4_DETECTOR_DEFAULT_MAX_DWELL_TIME_S 1.0
+#define E4_DETECTOR_DEFAULT_WINDOW_PACKETS 1000
+
+/*! Number of time constants the baseline is learnt for before detecting. */
+#define E4_DETECTOR_SETTLE_TIME_CONSTANTS 3
+
+EventDetector::EventDetector() :
+    samplingRateHz(0.0),
+    alpha(0.0),
+    settleNum(0),
+    maxDwellNum(0),
+    detectedNum(0),
+    droppedNum(0)
+{
+    memset(&config, 0, sizeof(config));
+    reset();
+}
+
+bool EventDetector::configure(const E4DetectorConfig_t &config, double samplingRateHz)
+{
+    E4DetectorConfig_t c = config;
+    const double rateHz = c.samplingRateHz > 0.0 ? c.samplingRateHz : samplingRateHz;
+
+    if (c.baselineTimeS <= 0.0) {c.baselineTimeS = E4_DETECTOR_DEFAULT_BASELINE_TIME_S;}
+    if (c.startSigma <= 0.0) {c.startSigma = E4_DETECTOR_DEFAULT_START_SIGMA;}
+    if (c.endSigma <= 0.0) {c.endSigma = E4_DETECTOR_DEFAULT_END_SIGMA;}
+    if (c.cusumDriftSigma <= 0.0) {c.cusumDriftSigma = E4_DETECTOR_DEFAULT_CUSUM_DRIFT_SIGMA;}
+    if (c.cusumThresholdSigma <= 0.0) {c.cusumThresholdSigma = E4_DETECTOR_DEFAULT_CUSUM_THRESHOLD_SIGMA;}
+    if (c.minDwellTimeS < 0.0) {c.minDwellTimeS = 0.0;}
+    if (c.maxDwellTimeS <= 0.0) {c.maxDwellTimeS = E4_DETECTOR_DEFAULT_MAX_DWELL_TIME_S;}
+    if (c.preWindowPackets == 0) {c.preWindowPackets = E4_DETECTOR_DEFAULT_WINDOW_PACKETS;}
+    if (c.postWindowPackets == 0) {c.postWindowPackets = E4_DETECTOR_DEFAULT_WINDOW_PACKETS;}
+
+    if ((c.channelMask >> E4_EVENT_CHANNEL_NUM) != 0) {return false;}
+    if (c.channelMask != 0 && !(rateHz > 0.0)) {return false;}
+    if (c.endSigma > c.startSigma || c.minDwellTimeS > c.maxDwellTimeS) {return false;}
+
+    this->config = c;
+    this->samplingRateHz = rateHz;
+    if (c.channelMask != 0)
+    {
+        const double baselineNum = c.baselineTimeS*rateHz;
+        alpha = baselineNum > 1.0 ? 1.0/baselineNum : 1.0;
+        settleNum = (unsigned long long)(E4_DETECTOR_SETTLE_TIME_CONSTANTS*baselineNum)+1;
+        maxDwellNum = (unsigned long long)(c.maxDwellTimeS*rateHz)+1;
+    }
+    reset();
+    return true;
+}
+
+bool EventDetector::isEnabled() const
+{
+    return config.channelMask != 0;
+}
+
+const E4DetectorConfig_t &EventDetector::getConfig() const
+{
+    return config;
+}
+
+void EventDetector::reset()
+{
+    memset(channels, 0, sizeof(channels));
+}
+
+void EventDetector::process(const float * packets, unsigned int packetsNum, unsigned long long firstPacketIdx, unsigned char * active)
+{
+    if (!isEnabled())
+    {
+        if (active != NULL) {memset(active, 0, packetsNum);}
+        return;
+    }
+
+    const unsigned long long minDwellNum = (unsigned long long)(config.minDwellTimeS*samplingRateHz);
+
+    for (unsigned int packetIdx = 0; packetIdx < packetsNum; packetIdx++)
+    {
+        const float * packet = packets+(size_t)packetIdx*EDL_CHANNEL_NUM;
+        const unsigned long long idx = firstPacketIdx+packetIdx;
+        bool anyActive = false;
+
+        for (unsigned int channelIdx = 0; channelIdx < E4_EVENT_CHANNEL_NUM; channelIdx++)
+        {
+            if ((config.channelMask & (1u << channelIdx)) == 0) {continue;}
+
+            ChannelState_t &state = channels[channelIdx];
+            const double x = packet[1+channelIdx];
+            bool learn = false;
+
+            if (state.inEvent)
+            {
+                const double blockade = state.polarity*(state.baseline-x);
+                if (blockade < config.endSigma*state.event.baselineSigma)
+                {
+                    if (idx-state.event.startPacketIdx >= minDwellNum) {closeEvent(state, idx, 0);}
+                    else {state.inEvent = false; state.cusum = 0.0;}
+                }
+                else
+                {
+                    state.candidateSum += blockade;
+                    if (blockade > state.candidateMax) {state.candidateMax = (float)blockade;}
+                    if (idx+1-state.event.startPacketIdx >= maxDwellNum)
+                    {
+                        // The open pore level probably moved: learn it again.
+                        closeEvent(state, idx+1, E4_EVENT_TRUNCATED);
+                        state.learnedNum = 0;
+                    }
+                }
+            }
+            else if (state.learnedNum < settleNum)
+            {
+                learn = true;
+            }
+            else
+            {
+                const double sigma = state.variance > 0.0 ? sqrt(state.variance) : FLT_MIN;
+                const double blockade = state.polarity*(state.baseline-x);
+
+                if (state.cusum == 0.0)
+                {
+                    state.candidateStartIdx = idx;
+                    state.candidateSum = 0.0;
+                    state.candidateMax = -FLT_MAX;
+                }
+                state.cusum += blockade/sigma-config.cusumDriftSigma;
+                if (state.cusum < 0.0) {state.cusum = 0.0;}
+
+                if (state.cusum > 0.0)
+                {
+                    state.candidateSum += blockade;
+                    if (blockade > state.candidateMax) {state.candidateMax = (float)blockade;}
+                }
+
+                if (blockade > config.startSigma*sigma || state.cusum > config.cusumThresholdSigma)
+                {
+                    // The change point is where the cumulative sum left zero.
+                    state.inEvent = true;
+                    state.event.startPacketIdx = state.candidateStartIdx;
+                    state.event.baseline = (float)state.baseline;
+                    state.event.baselineSigma = (float)sigma;
+                }
+                else
+                {
+                    // Learning only below the CUSUM would bias the baseline away from the blockades.
+                    learn = true;
+                }
+            }
+
+            if (learn)
+            {
+                if (state.learnedNum == 0)
+                {
+                    state.baseline = x;
+                    state.variance = 0.0;
+                }
+                else
+                {
+                    const double delta = x-state.baseline;
+                    state.baseline += alpha*delta;
+                    state.variance = (1.0-alpha)*(state.variance+alpha*delta*delta);
+                }
+                state.learnedNum++;
+                state.polarity = state.baseline >= 0.0 ? 1.0 : -1.0;
+            }
+
+            anyActive = anyActive || state.inEvent;
+        }
+
+        if (active != NULL) {active[packetIdx] = anyActive;}
+    }
+}
+
+void EventDetector::closeEvent(ChannelState_t &state, unsigned long long endPacketIdx, unsigned int flags)
+{
+    E4Event_t &event = state.event;
+    const unsigned long long packetNum = endPacketIdx-event.startPacketIdx;
+
+    event.channel = (unsigned int)(&state-channels);
+    event.flags = flags;
+    event.endPacketIdx = endPacketIdx;
+    event.dwellTimeS = packetNum/samplingRateHz;
+    event.meanBlockade = (float)(state.candidateSum/packetNum);
+    event.maxBlockade = state.candidateMax;
+
+    state.inEvent = false;
+    state.cusum = 0.0;
+
+    std::lock_guard <std::mutex> lock(queueMutex);
+    detectedNum++;
+    if (queue.size() < E4_EVENT_QUEUE_EVENTS) {queue.push_back(event);}
+    else {droppedNum++;}
+}
+
+unsigned int EventDetector::poll(E4Event_t * dst, unsigned int maxEvents)
+{
+    std::lock_guard <std::mutex> lock(queueMutex);
+    unsigned int eventsNum = 0;
+    while (eventsNum < maxEvents && !queue.empty()) {
+        dst[eventsNum++] = queue.front();
+        queue.pop_front();
+    }
+    return eventsNum;
+}
+
+void EventDetector::getCounts(unsigned long long &detected, unsigned long long &dropped) const
+{
+    std::lock_guard <std::mutex> lock(queueMutex);
+    detected = detectedNum;
+    dropped = droppedNum;
+}
+
+EventGate::EventGate() :
+    postWindowPackets(0),
+    historyCapacity(0),
+    historyNum(0),
+    historyHead(0),
+    historyEndIdx(0),
+    keepUntilIdx(0)
+{
+}
+
+void EventGate::configure(unsigned int preWindowPackets, unsigned int postWindowPackets)
+{
+    this->postWindowPackets = postWindowPackets;
+    historyCapacity = preWindowPackets;
+    history.assign((size_t)historyCapacity*EDL_CHANNEL_NUM, 0.0f);
+    historyNum = 0;
+    historyHead = 0;
+    historyEndIdx = 0;
+    keepUntilIdx = 0;
+}
+
+void EventGate::pushHistory(const float * packets, unsigned int packetsNum, unsigned long long firstPacketIdx)
+{
+    if (historyCapacity == 0 || packetsNum == 0) {return;}
+
+    // Only the history contiguous with the new data packets can be recorded.
+    if (firstPacketIdx != historyEndIdx) {historyNum = 0;}
+    historyEndIdx = firstPacketIdx+packetsNum;
+
+    if (packetsNum > historyCapacity)
+    {
+        packets += (size_t)(packetsNum-historyCapacity)*EDL_CHANNEL_NUM;
+        packetsNum = historyCapacity;
+    }
+
+    const unsigned int firstNum = packetsNum < historyCapacity-historyHead ? packetsNum : historyCapacity-historyHead;
+    memcpy(&history[(size_t)historyHead*EDL_CHANNEL_NUM], packets, sizeof(float)*EDL_CHANNEL_NUM*firstNum);
+    memcpy(&history[0], packets+(size_t)firstNum*EDL_CHANNEL_NUM, sizeof(float)*EDL_CHANNEL_NUM*(packetsNum-firstNum));
+    historyHead = (historyHead+packetsNum)%historyCapacity;
+    historyNum = historyNum+packetsNum < historyCapacity ? historyNum+packetsNum : historyCapacity;
+}
+
+void EventGate::write(Recording &recording, const float * packets, unsigned int packetsNum, unsigned long long firstPacketIdx,
+                      const unsigned char * active, bool bufferOverflow, bool lostData)
+{
+    unsigned int runStart = 0;
+    bool runKeep = firstPacketIdx < keepUntilIdx;
+
+    for (unsigned int packetIdx = 0; packetIdx <= packetsNum; packetIdx++)
+    {
+        const unsigned long long idx = firstPacketIdx+packetIdx;
+        bool keep = false;
+
+        if (packetIdx < packetsNum)
+        {
+            if (active[packetIdx])
+            {
+                if (!runKeep)
+                {
+                    // An event was detected while discarding: record the pre window first.
+                    // An event starting right where the previous post window ends only extends the kept run.
+                    pushHistory(packets+(size_t)runStart*EDL_CHANNEL_NUM, packetIdx-runStart, firstPacketIdx+runStart);
+                    if (historyNum > 0 && historyEndIdx == idx)
+                    {
+                        const unsigned int oldest = (historyHead+historyCapacity-historyNum)%historyCapacity;
+                        const unsigned int firstNum = historyNum < historyCapacity-oldest ? historyNum : historyCapacity-oldest;
+                        recording.write(&history[(size_t)oldest*EDL_CHANNEL_NUM], firstNum, idx-historyNum, bufferOverflow, lostData);
+                        if (historyNum > firstNum) {recording.write(&history[0], historyNum-firstNum, idx-historyNum+firstNum, bufferOverflow, lostData);}
+                    }
+                    historyNum = 0;
+                    runStart = packetIdx;
+                    runKeep = true;
+                }
+                keepUntilIdx = idx+1+postWindowPackets;
+            }
+            keep = idx < keepUntilIdx;
+            if (keep == runKeep) {continue;}
+        }
+
+        // The run of kept or discarded data packets ends here.
+        if (packetIdx > runStart)
+        {
+            if (runKeep) {recording.write(packets+(size_t)runStart*EDL_CHANNEL_NUM, packetIdx-runStart, firstPacketIdx+runStart, bufferOverflow, lostData);}
+            else {pushHistory(packets+(size_t)runStart*EDL_CHANNEL_NUM, packetIdx-runStart, firstPacketIdx+runStart);}
+        }
+        runStart = packetIdx;
+        runKeep = keep;
+    }
+}
@@ -0,0 +1,201 @@
+/*! \file e4_events.h
+ * \brief Declares classes EventDetector and EventGate.
+ */
+#ifndef E4_EVENTS_H
+#define E4_EVENTS_H
+
+#include <deque>
+#include <mutex>
+#include <vector>
+
+#include "edl_global.h"
+#include "edl_devicespecs.h"
+#include "e4_recording.h"
+
+/*! \def E4_EVENT_CHANNEL_NUM
+ * \brief Number of channels searched for events: the current channels following the voltage in each data packet.
+ */
+#define E4_EVENT_CHANNEL_NUM (EDL_CHANNEL_NUM-1)
+
+/*! \def E4_EVENT_QUEUE_EVENTS
+ * \brief Maximum number of detected events waiting to be polled. Further events are counted as dropped.
+ */
+#define E4_EVENT_QUEUE_EVENTS 65536
+
+/*! \def E4_EVENT_TRUNCATED
+ * \brief Flag of E4Event_t::flags: the event lasted longer than E4DetectorConfig_t::maxDwellTimeS and the baseline was learnt again.
+ */
+#define E4_EVENT_TRUNCATED 0x0001
+
+/*! \struct E4DetectorConfig_t
+ * \brief Struct that configures an EventDetector. Passed to setDetector.
+ * Levels are in units of the baseline noise standard deviation (sigma). Zero fields take the documented default.
+ */
+typedef struct {
+    unsigned int channelMask; /*!< Bit c enables the detection on current channel c; 0 disables the detector. */
+    double baselineTimeS; /*!< Time constant of the baseline and noise tracking, default 0.1s. */
+    double startSigma; /*!< Blockade starting an event at once, default 5 sigma. */
+    double endSigma; /*!< Blockade below which an event ends, default 1 sigma. */
+    double cusumDriftSigma; /*!< CUSUM drift: blockade ignored by the cumulative sum, default 1 sigma. */
+    double cusumThresholdSigma; /*!< CUSUM threshold starting an event, default 20 sigma. */
+    double minDwellTimeS; /*!< Shorter events are discarded, default 0. */
+    double maxDwellTimeS; /*!< Longer events are closed as #E4_EVENT_TRUNCATED, default 1s. */
+    unsigned int preWindowPackets; /*!< Data packets recorded before each event with #E4_RECORDING_EVENTS_ONLY, default 1000. */
+    unsigned int postWindowPackets; /*!< Data packets recorded after each event with #E4_RECORDING_EVENTS_ONLY, default 1000. */
+    double samplingRateHz; /*!< Input sampling rate, 0 to use the rate applied with #EdlCommandSamplingRate. */
+} E4DetectorConfig_t;
+
+/*! \struct E4Event_t
+ * \brief Struct that describes a translocation event, i.e. a blockade of the current of a channel. Returned by pollEvents.
+ * The blockade is the decrease of the current magnitude from the baseline, so it is positive for both polarities.
+ */
+typedef struct {
+    unsigned int channel; /*!< Index of the current channel, 0 for the first current channel of the data packets. */
+    unsigned int flags; /*!< Combination of #E4_EVENT_TRUNCATED. */
+    unsigned long long startPacketIdx; /*!< Index of the first data packet of the event, counted from the start of the acquisition. */
+    unsigned long long endPacketIdx; /*!< Index of the first data packet after the event. */
+    double dwellTimeS; /*!< Duration of the event in seconds. */
+    float baseline; /*!< Open pore current before the event. */
+    float baselineSigma; /*!< Standard deviation of the open pore current before the event. */
+    float meanBlockade; /*!< Mean blockade over the event. */
+    float maxBlockade; /*!< Maximum blockade over the event. */
+} E4Event_t;
+
+/*! \class EventDetector
+ * \brief Detects current blockades on the current channels of a stream of data packets.
+ *
+ * Per channel, the open pore baseline and its noise are tracked with exponential moving averages, frozen during events.
+ * An event starts when the blockade exceeds E4DetectorConfig_t::startSigma, or when its one-sided CUSUM exceeds
+ * E4DetectorConfig_t::cusumThresholdSigma; in the latter case the start is backdated to the change point,
+ * i.e. to where the CUSUM left zero. The event ends when the blockade falls below E4DetectorConfig_t::endSigma.
+ * EventDetector::process and EventDetector::configure must be called from the same thread or serialized;
+ * EventDetector::poll may be called from any thread.
+ */
+class EventDetector {
+public:
+    EventDetector();
+
+    /*! \brief Applies a configuration and learns the baselines again.
+     *
+     * \param config [in] Detector configuration.
+     * \param samplingRateHz [in] Input sampling rate, used if E4DetectorConfig_t::samplingRateHz is 0.
+     * \return false, leaving the detector unchanged, if the configuration is invalid.
+     */
+    bool configure(EDL_IN const E4DetectorConfig_t &config,
+                   EDL_IN double samplingRateHz);
+
+    /*! \brief Returns true if at least one channel is searched for events.
+     */
+    bool isEnabled(EDL_VOID) const;
+
+    /*! \brief Returns the configuration with the defaults filled in.
+     */
+    const E4DetectorConfig_t &getConfig(EDL_VOID) const;
+
+    /*! \brief Learns the baselines again and forgets the events in progress.
+     */
+    void reset(EDL_VOID);
+
+    /*! \brief Searches data packets for events and queues the completed ones.
+     *
+     * \param packets [in] Buffer of \a packetsNum data packets of #EDL_CHANNEL_NUM values.
+     * \param packetsNum [in] Number of data packets in \a packets.
+     * \param firstPacketIdx [in] Index of the first data packet, counted from the start of the acquisition.
+     * \param active [out] If not NULL, buffer of \a packetsNum flags set if any channel is in an event at that data packet.
+     */
+    void process(EDL_IN const float * packets,
+                 EDL_IN unsigned int packetsNum,
+                 EDL_IN unsigned long long firstPacketIdx,
+                 EDL_OUT unsigned char * active);
+
+    /*! \brief Moves detected events out of the queue.
+     *
+     * \param dst [out] Buffer with room for \a maxEvents events.
+     * \param maxEvents [in] Maximum number of events to move.
+     * \return Number of events actually moved.
+     */
+    unsigned int poll(EDL_OUT E4Event_t * dst,
+                      EDL_IN unsigned int maxEvents);
+
+    /*! \brief Returns the number of events detected and the number of them dropped because the queue was full.
+     */
+    void getCounts(EDL_OUT unsigned long long &detected,
+                   EDL_OUT unsigned long long &dropped) const;
+
+private:
+    typedef struct {
+        double baseline;
+        double variance;
+        unsigned long long learnedNum; /*!< Samples learnt since the last reset; no detection before the baseline settles. */
+        double cusum;
+        unsigned long long candidateStartIdx; /*!< Data packet where the CUSUM left zero. */
+        double candidateSum;
+        float candidateMax;
+        bool inEvent;
+        double polarity;
+        E4Event_t event;
+    } ChannelState_t;
+
+    void closeEvent(ChannelState_t &state, unsigned long long endPacketIdx, unsigned int flags);
+
+    E4DetectorConfig_t config;
+    double samplingRateHz;
+    double alpha; /*!< Weight of a new sample in the baseline averages. */
+    unsigned long long settleNum; /*!< Samples learnt before detecting. */
+    unsigned long long maxDwellNum;
+    ChannelState_t channels[E4_EVENT_CHANNEL_NUM];
+
+    mutable std::mutex queueMutex;
+    std::deque <E4Event_t> queue;
+    unsigned long long detectedNum;
+    unsigned long long droppedNum;
+};
+
+/*! \class EventGate
+ * \brief Writes to a Recording only the data packets around events: from E4DetectorConfig_t::preWindowPackets before
+ * the detection to E4DetectorConfig_t::postWindowPackets after the end. The data packets waiting to be either recorded
+ * or discarded are kept in a history of E4DetectorConfig_t::preWindowPackets data packets.
+ */
+class EventGate {
+public:
+    EventGate();
+
+    /*! \brief Sets the windows and forgets the history.
+     *
+     * \param preWindowPackets [in] Data packets recorded before an event is detected.
+     * \param postWindowPackets [in] Data packets recorded after an event ends.
+     */
+    void configure(EDL_IN unsigned int preWindowPackets,
+                   EDL_IN unsigned int postWindowPackets);
+
+    /*! \brief Writes the data packets within the event windows to \a recording.
+     *
+     * \param recording [in] Recording to write to.
+     * \param packets [in] Buffer of \a packetsNum data packets of #EDL_CHANNEL_NUM values.
+     * \param packetsNum [in] Number of data packets in \a packets.
+     * \param firstPacketIdx [in] Index of the first data packet, counted from the start of the acquisition.
+     * \param active [in] Flags returned by EventDetector::process for the same data packets.
+     * \param bufferOverflow [in] See Recording::write.
+     * \param lostData [in] See Recording::write.
+     */
+    void write(EDL_IN Recording &recording,
+               EDL_IN const float * packets,
+               EDL_IN unsigned int packetsNum,
+               EDL_IN unsigned long long firstPacketIdx,
+               EDL_IN const unsigned char * active,
+               EDL_IN bool bufferOverflow,
+               EDL_IN bool lostData);
+
+private:
+    void pushHistory(const float * packets, unsigned int packetsNum, unsigned long long firstPacketIdx);
+
+    unsigned int postWindowPackets;
+    std::vector <float> history; /*!< Circular buffer of the last discarded data packets. */
+    unsigned int historyCapacity;
+    unsigned int historyNum;
+    unsigned int historyHead; /*!< Slot of the next data packet. */
+    unsigned long long historyEndIdx; /*!< Index of the data packet after the newest one in the history. */
+    unsigned long long keepUntilIdx; /*!< Data packets before this index are recorded. */
+};
+
+#endif // E4_EVENTS_H
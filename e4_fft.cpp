@@ -0,0 +1,87 @@
+/*! \file e4_fft.cpp
+ * \brief Defines class FourierTransform.
+ */
+#include <cmath>
+
+#include "e4_fft.h"
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+FourierTransform::FourierTransform() :
+    points(0)
+{
+}
+
+bool FourierTransform::plan(unsigned int size)
+{
+    if (size < 2 || (size & (size-1)) != 0) {return false;}
+    if (size == points) {return true;}
+
+    unsigned int bits = 0;
+    while ((1u << bits) < size) {bits++;}
+
+    reversed.resize(size);
+    for (unsigned int idx = 0; idx < size; idx++)
+    {
+        unsigned int reversedIdx = 0;
+        for (unsigned int bitIdx = 0; bitIdx < bits; bitIdx++) {reversedIdx |= ((idx >> bitIdx) & 1) << (bits-1-bitIdx);}
+        reversed[idx] = reversedIdx;
+    }
+
+    cosines.resize(size/2);
+    sines.resize(size/2);
+    for (unsigned int idx = 0; idx < size/2; idx++)
+    {
+        cosines[idx] = cos(2.0*M_PI*idx/size);
+        sines[idx] = sin(2.0*M_PI*idx/size);
+    }
+
+    points = size;
+    return true;
+}
+
+unsigned int FourierTransform::size() const
+{
+    return points;
+}
+
+void FourierTransform::forward(double * re, double * im) const
+{
+    for (unsigned int idx = 0; idx < points; idx++)
+    {
+        const unsigned int reversedIdx = reversed[idx];
+        if (reversedIdx > idx)
+        {
+            const double swapRe = re[idx];
+            const double swapIm = im[idx];
+            re[idx] = re[reversedIdx];
+            im[idx] = im[reversedIdx];
+            re[reversedIdx] = swapRe;
+            im[reversedIdx] = swapIm;
+        }
+    }
+
+    // Butterflies of span 1, 2, 4... the twiddle of butterfly k in a group of span h is exp(-2*pi*i*k/(2*h)).
+    for (unsigned int half = 1; half < points; half <<= 1)
+    {
+        const unsigned int twiddleStride = points/(2*half);
+        for (unsigned int groupIdx = 0; groupIdx < points; groupIdx += 2*half)
+        {
+            for (unsigned int k = 0; k < half; k++)
+            {
+                const double wRe = cosines[k*twiddleStride];
+                const double wIm = -sines[k*twiddleStride];
+                const unsigned int top = groupIdx+k;
+                const unsigned int bottom = top+half;
+                const double tRe = re[bottom]*wRe-im[bottom]*wIm;
+                const double tIm = re[bottom]*wIm+im[bottom]*wRe;
+                re[bottom] = re[top]-tRe;
+                im[bottom] = im[top]-tIm;
+                re[top] += tRe;
+                im[top] += tIm;
+            }
+        }
+    }
+}
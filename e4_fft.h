@@ -0,0 +1,45 @@
+/*! \file e4_fft.h
+ * \brief Declares class FourierTransform.
+ */
+#ifndef E4_FFT_H
+#define E4_FFT_H
+
+#include <vector>
+
+#include "edl_global.h"
+
+/*! \class FourierTransform
+ * \brief In-place complex FFT of a power of two size: iterative radix-2 decimation in time,
+ * with the twiddle factors and the bit reversal permutation precomputed by FourierTransform::plan.
+ */
+class FourierTransform {
+public:
+    FourierTransform();
+
+    /*! \brief Prepares the transform of \a size points.
+     *
+     * \param size [in] Number of points, a power of two of at least 2.
+     * \return false if \a size is not a power of two.
+     */
+    bool plan(EDL_IN unsigned int size);
+
+    /*! \brief Returns the number of points, 0 before FourierTransform::plan.
+     */
+    unsigned int size(EDL_VOID) const;
+
+    /*! \brief Computes the forward transform X[k] = sum x[n]*exp(-2*pi*i*k*n/size), in place.
+     *
+     * \param re [in,out] Real parts of the \a size points.
+     * \param im [in,out] Imaginary parts of the \a size points.
+     */
+    void forward(EDL_OUT double * re,
+                 EDL_OUT double * im) const;
+
+private:
+    unsigned int points;
+    std::vector <unsigned int> reversed; /*!< Bit reversed index of each point. */
+    std::vector <double> cosines; /*!< cos(2*pi*k/size), k < size/2. */
+    std::vector <double> sines; /*!< sin(2*pi*k/size), k < size/2. */
+};
+
+#endif // E4_FFT_H
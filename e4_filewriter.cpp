@@ -0,0 +1,349 @@
+/*! \file e4_filewriter.cpp
+ * \brief Defines class FileWriter.
+ */
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+
+#ifdef _WIN32
+#include <malloc.h>
+#include "windows.h"
+#else
+#include <fcntl.h>
+#include <stdlib.h>
+#include <unistd.h>
+#endif
+
+#include "e4_filewriter.h"
+
+#ifdef _WIN32
+#define E4_INVALID_HANDLE INVALID_HANDLE_VALUE
+#else
+#define E4_INVALID_HANDLE -1
+#endif
+
+static unsigned char * allocateAligned(size_t bytesNum)
+{
+#ifdef _WIN32
+    return (unsigned char *)_aligned_malloc(bytesNum, E4_WRITER_ALIGNMENT);
+#else
+    void * ptr = NULL;
+    if (posix_memalign(&ptr, E4_WRITER_ALIGNMENT, bytesNum) != 0) {return NULL;}
+    return (unsigned char *)ptr;
+#endif
+}
+
+static void freeAligned(unsigned char * ptr)
+{
+#ifdef _WIN32
+    _aligned_free(ptr);
+#else
+    free(ptr);
+#endif
+}
+
+FileWriter::FileWriter() :
+    blockBytes(0),
+    currentBlockIdx(-1),
+    opened(false),
+    closing(false),
+    failed(false),
+    file(NULL),
+    handle(E4_INVALID_HANDLE),
+    directIo(false),
+    fileBytes(0)
+{
+    memset(&stats, 0, sizeof(stats));
+}
+
+FileWriter::~FileWriter()
+{
+    close();
+}
+
+bool FileWriter::open(const char * path, size_t blockBytes, unsigned int poolBlocks, unsigned long long preallocateBytes, bool directIo)
+{
+    if (opened) {return false;}
+
+    memset(&stats, 0, sizeof(stats));
+    this->directIo = directIo;
+
+#ifdef _WIN32
+    handle = CreateFileA(path, GENERIC_WRITE, FILE_SHARE_READ, NULL, CREATE_ALWAYS,
+                         FILE_ATTRIBUTE_NORMAL | (directIo ? FILE_FLAG_NO_BUFFERING : 0), NULL);
+    if (handle == INVALID_HANDLE_VALUE) {stats.lastOsError = (int)GetLastError(); return false;}
+
+    if (preallocateBytes > 0)
+    {
+        // Reserve the clusters up front so that the file does not fragment while growing.
+        LARGE_INTEGER size;
+        LARGE_INTEGER origin;
+        size.QuadPart = (LONGLONG)preallocateBytes;
+        origin.QuadPart = 0;
+        if (!SetFilePointerEx(handle, size, NULL, FILE_BEGIN) || !SetEndOfFile(handle)) {stats.lastOsError = (int)GetLastError();}
+        SetFilePointerEx(handle, origin, NULL, FILE_BEGIN);
+    }
+#else
+    handle = ::open(path, O_WRONLY | O_CREAT | O_TRUNC | (directIo ? O_DIRECT : 0), 0644);
+    if (handle < 0) {stats.lastOsError = errno; return false;}
+
+    if (preallocateBytes > 0)
+    {
+        // Reserve the blocks up front so that the file does not fragment while growing.
+        int err = posix_fallocate(handle, 0, (off_t)preallocateBytes);
+        if (err != 0) {stats.lastOsError = err;}
+    }
+#endif
+
+    if (!allocateBlocks(blockBytes, poolBlocks))
+    {
+        finishFile();
+        return false;
+    }
+
+    thread = std::thread(&FileWriter::run, this);
+    return true;
+}
+
+bool FileWriter::open(FILE * f, size_t blockBytes, unsigned int poolBlocks)
+{
+    if (opened) {return false;}
+
+    memset(&stats, 0, sizeof(stats));
+    directIo = false;
+    file = f;
+
+    if (!allocateBlocks(blockBytes, poolBlocks))
+    {
+        file = NULL;
+        return false;
+    }
+
+    thread = std::thread(&FileWriter::run, this);
+    return true;
+}
+
+bool FileWriter::isOpen() const
+{
+    std::lock_guard <std::mutex> lock(mutex);
+    return opened;
+}
+
+bool FileWriter::append(const void * bytes, size_t bytesNum)
+{
+    const unsigned char * src = (const unsigned char *)bytes;
+
+    std::unique_lock <std::mutex> lock(mutex);
+    if (!opened) {return false;}
+    stats.bytesAppended += bytesNum;
+
+    while (bytesNum > 0) {
+        if (currentBlockIdx < 0)
+        {
+            if (freeBlockIdxs.empty())
+            {
+                // Every block is queued: wait for the I/O thread to release one.
+                std::chrono::steady_clock::time_point stallStart = std::chrono::steady_clock::now();
+                freeCondition.wait(lock, [this] {return !freeBlockIdxs.empty();});
+                stats.producerStalls++;
+                stats.producerStallMicroseconds += std::chrono::duration_cast <std::chrono::microseconds>(
+                    std::chrono::steady_clock::now()-stallStart).count();
+            }
+            currentBlockIdx = freeBlockIdxs.front();
+            freeBlockIdxs.pop_front();
+            blockUsed[currentBlockIdx] = 0;
+        }
+
+        // The current block is owned by the producer: fill it without holding the lock.
+        const size_t used = blockUsed[currentBlockIdx];
+        const size_t n = bytesNum < blockBytes-used ? bytesNum : blockBytes-used;
+        lock.unlock();
+        memcpy(blocks[currentBlockIdx]+used, src, n);
+        lock.lock();
+
+        blockUsed[currentBlockIdx] = used+n;
+        src += n;
+        bytesNum -= n;
+        if (blockUsed[currentBlockIdx] == blockBytes) {queueCurrentBlock();}
+    }
+    return true;
+}
+
+bool FileWriter::close()
+{
+    {
+        std::lock_guard <std::mutex> lock(mutex);
+        if (!opened) {return true;}
+        if (currentBlockIdx >= 0)
+        {
+            if (blockUsed[currentBlockIdx] > 0) {queueCurrentBlock();}
+            else {freeBlockIdxs.push_back(currentBlockIdx); currentBlockIdx = -1;}
+        }
+        closing = true;
+    }
+    fullCondition.notify_one();
+    thread.join();
+
+    bool ok = finishFile() && !failed;
+
+    std::lock_guard <std::mutex> lock(mutex);
+    freeBlocks();
+    opened = false;
+    closing = false;
+    failed = false;
+    return ok;
+}
+
+void FileWriter::getStats(E4WriterStats_t &stats) const
+{
+    std::lock_guard <std::mutex> lock(mutex);
+    stats = this->stats;
+    stats.queuedBlocks = (unsigned int)fullBlockIdxs.size();
+    stats.poolBlocks = (unsigned int)blocks.size();
+}
+
+bool FileWriter::allocateBlocks(size_t blockBytes, unsigned int poolBlocks)
+{
+    if (blockBytes == 0) {blockBytes = E4_WRITER_BLOCK_BYTES;}
+    if (poolBlocks < 2) {poolBlocks = 2;}
+
+    this->blockBytes = (blockBytes+E4_WRITER_ALIGNMENT-1)/E4_WRITER_ALIGNMENT*E4_WRITER_ALIGNMENT;
+    blocks.assign(poolBlocks, NULL);
+    blockUsed.assign(poolBlocks, 0);
+    freeBlockIdxs.clear();
+    fullBlockIdxs.clear();
+    for (unsigned int blockIdx = 0; blockIdx < poolBlocks; blockIdx++)
+    {
+        blocks[blockIdx] = allocateAligned(this->blockBytes);
+        if (blocks[blockIdx] == NULL)
+        {
+            freeBlocks();
+            return false;
+        }
+        freeBlockIdxs.push_back(blockIdx);
+    }
+
+    currentBlockIdx = -1;
+    fileBytes = 0;
+    opened = true;
+    closing = false;
+    failed = false;
+    return true;
+}
+
+void FileWriter::freeBlocks()
+{
+    for (size_t blockIdx = 0; blockIdx < blocks.size(); blockIdx++)
+    {
+        if (blocks[blockIdx] != NULL) {freeAligned(blocks[blockIdx]);}
+    }
+    blocks.clear();
+    blockUsed.clear();
+    freeBlockIdxs.clear();
+    fullBlockIdxs.clear();
+    currentBlockIdx = -1;
+}
+
+void FileWriter::queueCurrentBlock()
+{
+    fullBlockIdxs.push_back(currentBlockIdx);
+    currentBlockIdx = -1;
+    if (fullBlockIdxs.size() > stats.maxQueuedBlocks) {stats.maxQueuedBlocks = (unsigned int)fullBlockIdxs.size();}
+    fullCondition.notify_one();
+}
+
+void FileWriter::run()
+{
+    std::unique_lock <std::mutex> lock(mutex);
+    for (;;) {
+        fullCondition.wait(lock, [this] {return !fullBlockIdxs.empty() || closing;});
+        if (fullBlockIdxs.empty()) {break;}
+
+        const unsigned int blockIdx = fullBlockIdxs.front();
+        fullBlockIdxs.pop_front();
+        const size_t bytesNum = blockUsed[blockIdx];
+        const bool skip = failed;
+
+        // After a failure blocks are still recycled, so that the producer is never blocked forever.
+        lock.unlock();
+        int osError = 0;
+        const bool ok = skip || writeBlock(blocks[blockIdx], bytesNum, osError);
+        lock.lock();
+
+        if (!ok)
+        {
+            failed = true;
+            stats.lastOsError = osError;
+        }
+        else if (!skip)
+        {
+            stats.bytesWritten += bytesNum;
+            stats.blocksWritten++;
+        }
+        freeBlockIdxs.push_back(blockIdx);
+        freeCondition.notify_one();
+    }
+}
+
+bool FileWriter::writeBlock(const unsigned char * bytes, size_t bytesNum, int &osError)
+{
+    if (file != NULL)
+    {
+        if (fwrite(bytes, 1, bytesNum, file) != bytesNum) {osError = errno; return false;}
+        fileBytes += bytesNum;
+        return true;
+    }
+
+    // Unbuffered writes must cover whole aligned sectors: pad the last block, the file is truncated on close.
+    size_t writeBytes = bytesNum;
+    if (directIo && writeBytes%E4_WRITER_ALIGNMENT != 0)
+    {
+        writeBytes = (writeBytes+E4_WRITER_ALIGNMENT-1)/E4_WRITER_ALIGNMENT*E4_WRITER_ALIGNMENT;
+        memset((unsigned char *)bytes+bytesNum, 0, writeBytes-bytesNum);
+    }
+
+    size_t writtenBytes = 0;
+    while (writtenBytes < writeBytes) {
+#ifdef _WIN32
+        DWORD n = 0;
+        if (!WriteFile(handle, bytes+writtenBytes, (DWORD)(writeBytes-writtenBytes), &n, NULL)) {osError = (int)GetLastError(); return false;}
+#else
+        ssize_t n = ::write(handle, bytes+writtenBytes, writeBytes-writtenBytes);
+        if (n < 0)
+        {
+            if (errno == EINTR) {continue;}
+            osError = errno;
+            return false;
+        }
+#endif
+        writtenBytes += (size_t)n;
+    }
+    fileBytes += bytesNum;
+    return true;
+}
+
+bool FileWriter::finishFile()
+{
+    bool ok = true;
+
+    if (file != NULL)
+    {
+        ok = fflush(file) == 0;
+        file = NULL;
+        return ok;
+    }
+    if (handle == E4_INVALID_HANDLE) {return true;}
+
+    // Drop the padding of unbuffered writes and the unused preallocated space.
+#ifdef _WIN32
+    LARGE_INTEGER size;
+    size.QuadPart = (LONGLONG)fileBytes;
+    if (!SetFilePointerEx(handle, size, NULL, FILE_BEGIN) || !SetEndOfFile(handle)) {stats.lastOsError = (int)GetLastError(); ok = false;}
+    if (!CloseHandle(handle)) {ok = false;}
+#else
+    if (ftruncate(handle, (off_t)fileBytes) != 0) {stats.lastOsError = errno; ok = false;}
+    if (::close(handle) != 0) {ok = false;}
+#endif
+    handle = E4_INVALID_HANDLE;
+    return ok;
+}
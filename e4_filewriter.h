@@ -0,0 +1,150 @@
+/*! \file e4_filewriter.h
+ * \brief Declares class FileWriter.
+ */
+#ifndef E4_FILEWRITER_H
+#define E4_FILEWRITER_H
+
+#include <condition_variable>
+#include <cstdio>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "edl_global.h"
+
+/*! \def E4_WRITER_BLOCK_BYTES
+ * \brief Default size of the blocks handed to the I/O thread.
+ */
+#define E4_WRITER_BLOCK_BYTES (4 << 20)
+
+/*! \def E4_WRITER_QUEUE_BLOCKS
+ * \brief Default number of blocks in the writer pool: one being filled, the others queued or being written.
+ */
+#define E4_WRITER_QUEUE_BLOCKS 8
+
+/*! \def E4_WRITER_ALIGNMENT
+ * \brief Alignment of block buffers, file offsets and write sizes, as required by unbuffered I/O.
+ */
+#define E4_WRITER_ALIGNMENT 4096
+
+/*! \def E4_WRITER_DIRECT_IO
+ * \brief Flag for startRecording: bypass the OS file cache (FILE_FLAG_NO_BUFFERING, O_DIRECT on Linux).
+ */
+#define E4_WRITER_DIRECT_IO 0x0001
+
+/*! \struct E4WriterStats_t
+ * \brief Struct that contains counters of a FileWriter.
+ * Returned by getWriterStats.
+ */
+typedef struct {
+    unsigned long long bytesAppended; /*!< Bytes handed to the writer by the acquisition. */
+    unsigned long long bytesWritten; /*!< Bytes written to the file by the I/O thread. */
+    unsigned long long blocksWritten; /*!< Number of blocks written to the file. */
+    unsigned long long producerStalls; /*!< Number of times the acquisition had to wait for a free block (backpressure). */
+    unsigned long long producerStallMicroseconds; /*!< Total time the acquisition spent waiting for a free block. */
+    unsigned int queuedBlocks; /*!< Blocks currently waiting to be written. */
+    unsigned int maxQueuedBlocks; /*!< Highest number of blocks waiting to be written at the same time. */
+    unsigned int poolBlocks; /*!< Total number of blocks in the pool. */
+    int lastOsError; /*!< Last OS error code returned by a file operation, 0 if none. */
+} E4WriterStats_t;
+
+/*! \class FileWriter
+ * \brief Writes a byte stream to a file from a dedicated I/O thread.
+ * The producer appends into a block taken from a preallocated pool of aligned blocks;
+ * full blocks are queued to the I/O thread, which writes each one with a single call.
+ * When every block is queued the producer waits for the I/O thread: this backpressure is counted in #E4WriterStats_t.
+ */
+class FileWriter {
+public:
+    FileWriter();
+
+    /*! \brief FileWriter destructor. Flushes and closes the file if still open.
+     */
+    ~FileWriter();
+
+    /*! \brief Creates a file and starts the I/O thread.
+     *
+     * \param path [in] Path of the file to create. An existing file is overwritten.
+     * \param blockBytes [in] Size of each block, rounded up to #E4_WRITER_ALIGNMENT.
+     * \param poolBlocks [in] Number of blocks in the pool, at least 2.
+     * \param preallocateBytes [in] Expected file size to reserve on disk, 0 for none. The file is truncated to the written size on close.
+     * \param directIo [in] Flag to bypass the OS file cache.
+     * \return false if the file could not be created or the blocks could not be allocated.
+     */
+    bool open(EDL_IN const char * path,
+              EDL_IN size_t blockBytes,
+              EDL_IN unsigned int poolBlocks,
+              EDL_IN unsigned long long preallocateBytes,
+              EDL_IN bool directIo);
+
+    /*! \brief Starts the I/O thread on a file opened by the caller.
+     * The file is flushed but not closed by FileWriter::close.
+     *
+     * \param f [in] File open for binary writing.
+     * \param blockBytes [in] Size of each block.
+     * \param poolBlocks [in] Number of blocks in the pool, at least 2.
+     * \return false if the blocks could not be allocated.
+     */
+    bool open(EDL_IN FILE * f,
+              EDL_IN size_t blockBytes,
+              EDL_IN unsigned int poolBlocks);
+
+    /*! \brief Returns true between a successful FileWriter::open and FileWriter::close.
+     */
+    bool isOpen(EDL_VOID) const;
+
+    /*! \brief Appends bytes to the stream (producer side). Never touches the file.
+     *
+     * \param bytes [in] Bytes to append.
+     * \param bytesNum [in] Number of bytes to append.
+     * \return false if the writer is not open.
+     */
+    bool append(EDL_IN const void * bytes, EDL_IN size_t bytesNum);
+
+    /*! \brief Queues the partially filled block, waits for the I/O thread to write everything and closes the file.
+     *
+     * \return false if any write failed.
+     */
+    bool close(EDL_VOID);
+
+    /*! \brief Returns the writer counters.
+     */
+    void getStats(EDL_OUT E4WriterStats_t &stats) const;
+
+private:
+    bool allocateBlocks(size_t blockBytes, unsigned int poolBlocks);
+    void freeBlocks(EDL_VOID);
+    void queueCurrentBlock(EDL_VOID);
+    void run(EDL_VOID);
+    bool writeBlock(const unsigned char * bytes, size_t bytesNum, int &osError);
+    bool finishFile(EDL_VOID);
+
+    std::vector <unsigned char *> blocks;
+    std::vector <size_t> blockUsed;
+    size_t blockBytes;
+    std::deque <unsigned int> freeBlockIdxs;
+    std::deque <unsigned int> fullBlockIdxs;
+    int currentBlockIdx; /*!< Block being filled by the producer, -1 if none. */
+
+    mutable std::mutex mutex;
+    std::condition_variable freeCondition;
+    std::condition_variable fullCondition;
+    std::thread thread;
+    bool opened;
+    bool closing;
+    bool failed;
+
+    FILE * file;
+#ifdef _WIN32
+    void * handle;
+#else
+    int handle;
+#endif
+    bool directIo;
+    unsigned long long fileBytes; /*!< Logical size of the file, excluding the padding of unbuffered writes. */
+
+    E4WriterStats_t stats;
+};
+
+#endif // E4_FILEWRITER_H
@@ -0,0 +1,270 @@
+/*! \file e4_filter.cpp
+ * \brief Defines class StreamFilter.
+ */
+#include <cmath>
+#include <cstring>
+
+#include "e4_filter.h"
+
+#if defined(__SSE__) && E4_FILTER_CHANNEL_NUM == 4
+#include <xmmintrin.h>
+
+// One SIMD lane per current channel.
+typedef __m128 Lanes;
+
+static inline Lanes lanesLoad(const float * values) {return _mm_loadu_ps(values);}
+static inline void lanesStore(float * values, Lanes lanes) {_mm_storeu_ps(values, lanes);}
+static inline Lanes lanesSet(float value) {return _mm_set1_ps(value);}
+static inline Lanes lanesAdd(Lanes a, Lanes b) {return _mm_add_ps(a, b);}
+static inline Lanes lanesSub(Lanes a, Lanes b) {return _mm_sub_ps(a, b);}
+static inline Lanes lanesMul(Lanes a, Lanes b) {return _mm_mul_ps(a, b);}
+
+#else
+
+typedef struct {float v[E4_FILTER_CHANNEL_NUM];} Lanes;
+
+static inline Lanes lanesLoad(const float * values) {Lanes r; memcpy(r.v, values, sizeof(r.v)); return r;}
+static inline void lanesStore(float * values, Lanes lanes) {memcpy(values, lanes.v, sizeof(lanes.v));}
+static inline Lanes lanesSet(float value) {Lanes r; for (int i = 0; i < E4_FILTER_CHANNEL_NUM; i++) {r.v[i] = value;} return r;}
+static inline Lanes lanesAdd(Lanes a, Lanes b) {for (int i = 0; i < E4_FILTER_CHANNEL_NUM; i++) {a.v[i] += b.v[i];} return a;}
+static inline Lanes lanesSub(Lanes a, Lanes b) {for (int i = 0; i < E4_FILTER_CHANNEL_NUM; i++) {a.v[i] -= b.v[i];} return a;}
+static inline Lanes lanesMul(Lanes a, Lanes b) {for (int i = 0; i < E4_FILTER_CHANNEL_NUM; i++) {a.v[i] *= b.v[i];} return a;}
+
+#endif
+
+#define E4_FILTER_MAX_TAPS (1 << 16)
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+/*! Poles of the Bessel low-pass prototypes with -3dB at 1rad/s, one per conjugate pair (real part, positive imaginary part).
+ * A zero imaginary part marks the real pole of odd orders.
+ */
+static const double besselPoles[E4_FILTER_MAX_ORDER][(E4_FILTER_MAX_ORDER+1)/2][2] = {
+    {{-1.0000000000, 0.0000000000}},
+    {{-1.1016013306, 0.6360098248}},
+    {{-1.3226757999, 0.0000000000}, {-1.0474091610, 0.9992644363}},
+    {{-1.3700678306, 0.4102497175}, {-0.9952087644, 1.2571057395}},
+    {{-1.5023162714, 0.0000000000}, {-1.3808773259, 0.7179095876}, {-0.9576765486, 1.4711243207}},
+    {{-1.5714904036, 0.3208963742}, {-1.3818580976, 0.9714718907}, {-0.9306565229, 1.6618632689}},
+    {{-1.6843681793, 0.0000000000}, {-1.6120387662, 0.5892445069}, {-1.3789032168, 1.1915667778}, {-0.9098677806, 1.8364513530}},
+    {{-1.7574084004, 0.2728675751}, {-1.6369394181, 0.8227956251}, {-1.3738412176, 1.3883565759}, {-0.8928697188, 1.9983258436}}
+};
+
+StreamFilter::StreamFilter() :
+    inputRateHz(0.0),
+    decimation(1),
+    sectionNum(0),
+    historyIdx(0),
+    phase(0)
+{
+    memset(coefficients, 0, sizeof(coefficients));
+    memset(states, 0, sizeof(states));
+}
+
+bool StreamFilter::configure(const E4FilterConfig_t &config, double samplingRateHz)
+{
+    const double rateHz = config.samplingRateHz > 0.0 ? config.samplingRateHz : samplingRateHz;
+    const unsigned int decimationNum = config.decimation > 1 ? config.decimation : 1;
+    const unsigned int tapsPerPhase = config.tapsPerPhase > 0 ? config.tapsPerPhase : E4_FILTER_DEFAULT_TAPS_PER_PHASE;
+
+    if ((unsigned int)config.type >= E4FilterTypeNum) {return false;}
+    if (config.type != E4FilterNone)
+    {
+        if (config.order < 1 || config.order > E4_FILTER_MAX_ORDER) {return false;}
+        if (!(rateHz > 0.0) || !(config.cutoffHz > 0.0) || !(config.cutoffHz < 0.5*rateHz)) {return false;}
+    }
+    if (decimationNum > 1 && (unsigned long long)decimationNum*tapsPerPhase > E4_FILTER_MAX_TAPS) {return false;}
+
+    inputRateHz = rateHz;
+    decimation = decimationNum;
+    if (config.type != E4FilterNone) {designIir(config.type, config.order, config.cutoffHz, rateHz);}
+    else {sectionNum = 0;}
+    if (decimation > 1) {designFir(decimation, tapsPerPhase);}
+    else {taps.clear();}
+
+    reset();
+    return true;
+}
+
+bool StreamFilter::isEnabled() const
+{
+    return sectionNum > 0 || decimation > 1;
+}
+
+double StreamFilter::outputRateHz() const
+{
+    return inputRateHz/decimation;
+}
+
+unsigned int StreamFilter::getDecimation() const
+{
+    return decimation;
+}
+
+void StreamFilter::reset()
+{
+    memset(states, 0, sizeof(states));
+    history.assign(2*taps.size()*E4_FILTER_CHANNEL_NUM, 0.0f);
+    historyIdx = 0;
+    phase = 0;
+}
+
+void StreamFilter::designIir(E4FilterType_t type, unsigned int order, double cutoffHz, double samplingRateHz)
+{
+    // Bilinear transform s = k*(1-1/z)/(1+1/z), with the analog cutoff prewarped so that the digital one lands on cutoffHz.
+    const double k = 2.0*samplingRateHz;
+    const double omega = k*tan(M_PI*cutoffHz/samplingRateHz);
+
+    sectionNum = (order+1)/2;
+    for (unsigned int sectionIdx = 0; sectionIdx < sectionNum; sectionIdx++)
+    {
+        double re;
+        double im;
+        if (type == E4FilterBessel)
+        {
+            re = besselPoles[order-1][sectionIdx][0];
+            im = besselPoles[order-1][sectionIdx][1];
+        }
+        else
+        {
+            // Butterworth poles lie on the unit circle; the real pole of odd orders is the last one.
+            const double theta = M_PI*(2*sectionIdx+1)/(2*order);
+            re = -sin(theta);
+            im = cos(theta);
+            if (order%2 == 1 && sectionIdx == sectionNum-1) {re = -1.0; im = 0.0;}
+        }
+
+        float * c = coefficients[sectionIdx];
+        if (im == 0.0)
+        {
+            // omega*|re|/(s+omega*|re|)
+            const double w = -re*omega;
+            const double d = k+w;
+            c[0] = (float)(w/d);
+            c[1] = (float)(w/d);
+            c[2] = 0.0f;
+            c[3] = (float)((w-k)/d);
+            c[4] = 0.0f;
+        }
+        else
+        {
+            // omega^2*|p|^2/(s^2-2*re*omega*s+omega^2*|p|^2)
+            const double a1 = -2.0*re*omega;
+            const double a0 = (re*re+im*im)*omega*omega;
+            const double d = k*k+a1*k+a0;
+            c[0] = (float)(a0/d);
+            c[1] = (float)(2.0*a0/d);
+            c[2] = (float)(a0/d);
+            c[3] = (float)(2.0*(a0-k*k)/d);
+            c[4] = (float)((k*k-a1*k+a0)/d);
+        }
+    }
+}
+
+void StreamFilter::designFir(unsigned int decimationNum, unsigned int tapsPerPhase)
+{
+    // Blackman windowed sinc with its cutoff at 80% of the output Nyquist frequency, normalized to a unit DC gain.
+    const unsigned int tapsNum = decimationNum*tapsPerPhase;
+    const double cutoff = 0.4/decimationNum;
+    const double center = 0.5*(tapsNum-1);
+    double sum = 0.0;
+
+    std::vector <double> values(tapsNum);
+    for (unsigned int tapIdx = 0; tapIdx < tapsNum; tapIdx++)
+    {
+        const double x = tapIdx-center;
+        const double sinc = x == 0.0 ? 2.0*cutoff : sin(2.0*M_PI*cutoff*x)/(M_PI*x);
+        const double window = tapsNum == 1 ? 1.0 : 0.42-0.5*cos(2.0*M_PI*tapIdx/(tapsNum-1))+0.08*cos(4.0*M_PI*tapIdx/(tapsNum-1));
+        values[tapIdx] = sinc*window;
+        sum += values[tapIdx];
+    }
+
+    taps.resize(tapsNum);
+    for (unsigned int tapIdx = 0; tapIdx < tapsNum; tapIdx++) {taps[tapIdx] = (float)(values[tapIdx]/sum);}
+}
+
+unsigned int StreamFilter::process(const float * packets, unsigned int packetsNum, float * dst)
+{
+    if (!isEnabled())
+    {
+        if (dst != packets) {memcpy(dst, packets, sizeof(float)*EDL_CHANNEL_NUM*packetsNum);}
+        return packetsNum;
+    }
+
+    block.resize(E4_FILTER_BLOCK_PACKETS*E4_FILTER_CHANNEL_NUM);
+    const unsigned int tapsNum = (unsigned int)taps.size();
+    unsigned int outputNum = 0;
+
+    for (unsigned int blockStart = 0; blockStart < packetsNum; blockStart += E4_FILTER_BLOCK_PACKETS)
+    {
+        const unsigned int blockNum = packetsNum-blockStart < E4_FILTER_BLOCK_PACKETS ? packetsNum-blockStart : E4_FILTER_BLOCK_PACKETS;
+        const float * blockPackets = packets+(size_t)blockStart*EDL_CHANNEL_NUM;
+        float * samples = block.data();
+
+        for (unsigned int packetIdx = 0; packetIdx < blockNum; packetIdx++)
+        {
+            memcpy(samples+packetIdx*E4_FILTER_CHANNEL_NUM, blockPackets+packetIdx*EDL_CHANNEL_NUM+1, sizeof(float)*E4_FILTER_CHANNEL_NUM);
+        }
+
+        // One pass per biquad over the block keeps the coefficients and the state in registers.
+        for (unsigned int sectionIdx = 0; sectionIdx < sectionNum; sectionIdx++)
+        {
+            const float * c = coefficients[sectionIdx];
+            const Lanes b0 = lanesSet(c[0]);
+            const Lanes b1 = lanesSet(c[1]);
+            const Lanes b2 = lanesSet(c[2]);
+            const Lanes a1 = lanesSet(c[3]);
+            const Lanes a2 = lanesSet(c[4]);
+            Lanes s1 = lanesLoad(states[sectionIdx][0]);
+            Lanes s2 = lanesLoad(states[sectionIdx][1]);
+
+            for (unsigned int packetIdx = 0; packetIdx < blockNum; packetIdx++)
+            {
+                const Lanes x = lanesLoad(samples+packetIdx*E4_FILTER_CHANNEL_NUM);
+                const Lanes y = lanesAdd(lanesMul(b0, x), s1);
+                s1 = lanesAdd(lanesSub(lanesMul(b1, x), lanesMul(a1, y)), s2);
+                s2 = lanesSub(lanesMul(b2, x), lanesMul(a2, y));
+                lanesStore(samples+packetIdx*E4_FILTER_CHANNEL_NUM, y);
+            }
+
+            lanesStore(states[sectionIdx][0], s1);
+            lanesStore(states[sectionIdx][1], s2);
+        }
+
+        for (unsigned int packetIdx = 0; packetIdx < blockNum; packetIdx++)
+        {
+            const float * sample = samples+packetIdx*E4_FILTER_CHANNEL_NUM;
+            const float voltage = blockPackets[packetIdx*EDL_CHANNEL_NUM];
+
+            if (decimation > 1)
+            {
+                // The newest input goes before the older ones, so that history[historyIdx+k] is multiplied by taps[k].
+                historyIdx = historyIdx == 0 ? tapsNum-1 : historyIdx-1;
+                memcpy(&history[(size_t)historyIdx*E4_FILTER_CHANNEL_NUM], sample, sizeof(float)*E4_FILTER_CHANNEL_NUM);
+                memcpy(&history[(size_t)(historyIdx+tapsNum)*E4_FILTER_CHANNEL_NUM], sample, sizeof(float)*E4_FILTER_CHANNEL_NUM);
+
+                const bool keep = phase == 0;
+                phase = phase+1 == decimation ? 0 : phase+1;
+                if (!keep) {continue;}
+
+                const float * window = &history[(size_t)historyIdx*E4_FILTER_CHANNEL_NUM];
+                Lanes sum = lanesSet(0.0f);
+                for (unsigned int tapIdx = 0; tapIdx < tapsNum; tapIdx++)
+                {
+                    sum = lanesAdd(sum, lanesMul(lanesSet(taps[tapIdx]), lanesLoad(window+tapIdx*E4_FILTER_CHANNEL_NUM)));
+                }
+                dst[(size_t)outputNum*EDL_CHANNEL_NUM] = voltage;
+                lanesStore(dst+(size_t)outputNum*EDL_CHANNEL_NUM+1, sum);
+            }
+            else
+            {
+                dst[(size_t)outputNum*EDL_CHANNEL_NUM] = voltage;
+                memcpy(dst+(size_t)outputNum*EDL_CHANNEL_NUM+1, sample, sizeof(float)*E4_FILTER_CHANNEL_NUM);
+            }
+            outputNum++;
+        }
+    }
+    return outputNum;
+}
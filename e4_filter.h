@@ -0,0 +1,123 @@
+/*! \file e4_filter.h
+ * \brief Declares class StreamFilter.
+ */
+#ifndef E4_FILTER_H
+#define E4_FILTER_H
+
+#include <vector>
+
+#include "edl_global.h"
+#include "edl_devicespecs.h"
+
+/*! \def E4_FILTER_CHANNEL_NUM
+ * \brief Number of filtered channels: the current channels following the voltage in each data packet.
+ */
+#define E4_FILTER_CHANNEL_NUM (EDL_CHANNEL_NUM-1)
+
+/*! \def E4_FILTER_MAX_ORDER
+ * \brief Maximum order of the IIR low-pass filter.
+ */
+#define E4_FILTER_MAX_ORDER 8
+
+/*! \def E4_FILTER_DEFAULT_TAPS_PER_PHASE
+ * \brief Default number of FIR taps per decimation phase: the FIR has decimation*tapsPerPhase taps.
+ */
+#define E4_FILTER_DEFAULT_TAPS_PER_PHASE 16
+
+/*! \def E4_FILTER_BLOCK_PACKETS
+ * \brief Number of data packets filtered at once, so that the working buffer stays in the L1 cache.
+ */
+#define E4_FILTER_BLOCK_PACKETS 512
+
+/*! \enum E4FilterType_t
+ * \brief Shapes of the IIR low-pass filter.
+ */
+typedef enum {
+    E4FilterNone = 0, /*!< No IIR filter: decimation only. */
+    E4FilterBessel = 1, /*!< Bessel (maximally flat group delay): no overshoot on current steps. */
+    E4FilterButterworth = 2, /*!< Butterworth (maximally flat magnitude). */
+    E4FilterTypeNum /*!< Number of filter types. \note This is not a valid type. */
+} E4FilterType_t;
+
+/*! \struct E4FilterConfig_t
+ * \brief Struct that configures a StreamFilter. Passed to setFilter.
+ */
+typedef struct {
+    E4FilterType_t type; /*!< Shape of the IIR low-pass filter. */
+    unsigned int order; /*!< Order of the IIR low-pass filter, 1 to #E4_FILTER_MAX_ORDER. Ignored for #E4FilterNone. */
+    double cutoffHz; /*!< -3dB frequency of the IIR low-pass filter, lower than half the sampling rate. Ignored for #E4FilterNone. */
+    unsigned int decimation; /*!< Ratio between the input and the output rates, 1 (or 0) for no decimation. */
+    unsigned int tapsPerPhase; /*!< FIR taps per decimation phase, 0 for #E4_FILTER_DEFAULT_TAPS_PER_PHASE. Ignored without decimation. */
+    double samplingRateHz; /*!< Input sampling rate, 0 to use the rate applied with #EdlCommandSamplingRate. */
+} E4FilterConfig_t;
+
+/*! \class StreamFilter
+ * \brief Low-pass filters and decimates the current channels of a stream of data packets.
+ *
+ * The IIR filter is a cascade of biquads in transposed direct form II, designed from the analog prototype poles
+ * with the bilinear transform, prewarped at the cutoff frequency.
+ * The decimator is a windowed-sinc anti-aliasing FIR, of which only the kept output samples are computed (polyphase form),
+ * i.e. tapsPerPhase multiply-adds per input sample.
+ * The current channels are processed together in SIMD lanes; the voltage channel is decimated without filtering.
+ * State is kept across calls, so the stream can be fed in batches of any size.
+ */
+class StreamFilter {
+public:
+    StreamFilter();
+
+    /*! \brief Designs the filter and resets its state.
+     *
+     * \param config [in] Filter configuration.
+     * \param samplingRateHz [in] Input sampling rate, used if E4FilterConfig_t::samplingRateHz is 0.
+     * \return false, leaving the filter unchanged, if the configuration is invalid.
+     */
+    bool configure(EDL_IN const E4FilterConfig_t &config,
+                   EDL_IN double samplingRateHz);
+
+    /*! \brief Returns true if the filter changes the stream, i.e. filters or decimates.
+     */
+    bool isEnabled(EDL_VOID) const;
+
+    /*! \brief Returns the rate of the output data packets in Hz.
+     */
+    double outputRateHz(EDL_VOID) const;
+
+    /*! \brief Returns the ratio between the input and the output rates, 1 without decimation.
+     */
+    unsigned int getDecimation(EDL_VOID) const;
+
+    /*! \brief Clears the filter state, as if no data packets were processed yet.
+     */
+    void reset(EDL_VOID);
+
+    /*! \brief Filters data packets.
+     *
+     * \param packets [in] Buffer of \a packetsNum data packets of #EDL_CHANNEL_NUM values.
+     * \param packetsNum [in] Number of data packets in \a packets.
+     * \param dst [out] Buffer with room for \a packetsNum/decimation+1 data packets. May be \a packets.
+     * \return Number of data packets written to \a dst.
+     */
+    unsigned int process(EDL_IN const float * packets,
+                         EDL_IN unsigned int packetsNum,
+                         EDL_OUT float * dst);
+
+private:
+    void designIir(E4FilterType_t type, unsigned int order, double cutoffHz, double samplingRateHz);
+    void designFir(unsigned int decimationNum, unsigned int tapsPerPhase);
+
+    double inputRateHz;
+    unsigned int decimation;
+
+    unsigned int sectionNum;
+    float coefficients[(E4_FILTER_MAX_ORDER+1)/2][5]; /*!< b0, b1, b2, a1, a2 of each biquad. */
+    float states[(E4_FILTER_MAX_ORDER+1)/2][2][E4_FILTER_CHANNEL_NUM];
+
+    std::vector <float> taps;
+    std::vector <float> history; /*!< Last inputs of the FIR, stored twice in a row to read them without wrapping. */
+    unsigned int historyIdx;
+    unsigned int phase;
+
+    std::vector <float> block; /*!< Current channels of the block being filtered, sample-major. */
+};
+
+#endif // E4_FILTER_H
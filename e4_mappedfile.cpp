@@ -0,0 +1,96 @@
+/*! \file e4_mappedfile.cpp
+ * \brief Defines class MappedFile.
+ */
+#ifdef _WIN32
+#include "windows.h"
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "e4_mappedfile.h"
+
+MappedFile::MappedFile() :
+    bytes(NULL),
+    bytesNum(0)
+#ifdef _WIN32
+    , fileHandle(INVALID_HANDLE_VALUE),
+    mappingHandle(NULL)
+#endif
+{
+}
+
+MappedFile::~MappedFile()
+{
+    close();
+}
+
+bool MappedFile::open(const char * path)
+{
+    close();
+
+#ifdef _WIN32
+    fileHandle = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_EXISTING,
+                             FILE_ATTRIBUTE_NORMAL | FILE_FLAG_RANDOM_ACCESS, NULL);
+    if (fileHandle == INVALID_HANDLE_VALUE) {return false;}
+
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(fileHandle, &size) || size.QuadPart == 0 || (unsigned long long)size.QuadPart > (size_t)-1)
+    {
+        close();
+        return false;
+    }
+
+    mappingHandle = CreateFileMappingA(fileHandle, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (mappingHandle == NULL) {close(); return false;}
+
+    bytes = (const unsigned char *)MapViewOfFile(mappingHandle, FILE_MAP_READ, 0, 0, 0);
+    if (bytes == NULL) {close(); return false;}
+    bytesNum = (size_t)size.QuadPart;
+#else
+    int fd = ::open(path, O_RDONLY);
+    if (fd < 0) {return false;}
+
+    struct stat fileStat;
+    if (fstat(fd, &fileStat) != 0 || fileStat.st_size == 0)
+    {
+        ::close(fd);
+        return false;
+    }
+
+    void * ptr = mmap(NULL, (size_t)fileStat.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (ptr == MAP_FAILED) {return false;}
+
+    bytes = (const unsigned char *)ptr;
+    bytesNum = (size_t)fileStat.st_size;
+#endif
+    return true;
+}
+
+void MappedFile::close()
+{
+#ifdef _WIN32
+    if (bytes != NULL) {UnmapViewOfFile(bytes);}
+    if (mappingHandle != NULL) {CloseHandle(mappingHandle);}
+    if (fileHandle != INVALID_HANDLE_VALUE) {CloseHandle(fileHandle);}
+    mappingHandle = NULL;
+    fileHandle = INVALID_HANDLE_VALUE;
+#else
+    if (bytes != NULL) {munmap((void *)bytes, bytesNum);}
+#endif
+    bytes = NULL;
+    bytesNum = 0;
+}
+
+const unsigned char * MappedFile::data() const
+{
+    return bytes;
+}
+
+size_t MappedFile::size() const
+{
+    return bytesNum;
+}
@@ -0,0 +1,53 @@
+/*! \file e4_mappedfile.h
+ * \brief Declares class MappedFile.
+ */
+#ifndef E4_MAPPEDFILE_H
+#define E4_MAPPEDFILE_H
+
+#include <stddef.h>
+
+#include "edl_global.h"
+
+/*! \class MappedFile
+ * \brief Read-only memory mapping of a whole file.
+ */
+class MappedFile {
+public:
+    MappedFile();
+
+    /*! \brief MappedFile destructor. Unmaps the file.
+     */
+    ~MappedFile();
+
+    /*! \brief Maps a file in memory.
+     *
+     * \param path [in] Path of the file to map.
+     * \return false if the file could not be opened or mapped.
+     */
+    bool open(EDL_IN const char * path);
+
+    /*! \brief Unmaps the file.
+     */
+    void close(EDL_VOID);
+
+    /*! \brief First byte of the file, NULL if no file is mapped.
+     */
+    const unsigned char * data(EDL_VOID) const;
+
+    /*! \brief Size of the mapped file in bytes.
+     */
+    size_t size(EDL_VOID) const;
+
+private:
+    MappedFile(const MappedFile &);
+    MappedFile &operator=(const MappedFile &);
+
+    const unsigned char * bytes;
+    size_t bytesNum;
+#ifdef _WIN32
+    void * fileHandle;
+    void * mappingHandle;
+#endif
+};
+
+#endif // E4_MAPPEDFILE_H
@@ -0,0 +1,184 @@
+/*! \file e4_metrics.cpp
+ * \brief Defines class PipelineMetrics.
+ */
+#include <cstring>
+
+#include "e4_metrics.h"
+
+/*! \brief Returns the histogram bucket of a duration, see #E4_METRICS_BUCKETS.
+ */
+static unsigned int bucketIdx(unsigned long long ns)
+{
+    const unsigned int idx = ns == 0 ? 0 : 63-__builtin_clzll(ns);
+    return idx < E4_METRICS_BUCKETS ? idx : E4_METRICS_BUCKETS-1;
+}
+
+PipelineMetrics::PipelineMetrics()
+{
+    reset();
+}
+
+void PipelineMetrics::reset()
+{
+    for (unsigned int stageIdx = 0; stageIdx < E4StageNum; stageIdx++) {
+        StageCounters &stage = stages[stageIdx];
+        stage.count = 0;
+        stage.totalNs = 0;
+        stage.maxNs = 0;
+        for (unsigned int idx = 0; idx < E4_METRICS_BUCKETS; idx++) {stage.buckets[idx] = 0;}
+    }
+    statusPolls = 0;
+    emptyPolls = 0;
+    statusErrors = 0;
+    reads = 0;
+    notEnoughDataReads = 0;
+    readErrors = 0;
+    lastError = EdlSuccess;
+    packetsRequested = 0;
+    packetsRead = 0;
+    bufferOverflowCount = 0;
+    lostDataCount = 0;
+    ringDroppedPackets = 0;
+    filteredRingDroppedPackets = 0;
+    eventNum = 0;
+    eventsBegun = 0;
+    startTicks = std::chrono::steady_clock::now().time_since_epoch().count();
+}
+
+std::chrono::steady_clock::time_point PipelineMetrics::addTime(E4MetricsStage_t stage, std::chrono::steady_clock::time_point start)
+{
+    const std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
+    const long long elapsedNs = std::chrono::duration_cast <std::chrono::nanoseconds> (end-start).count();
+    const unsigned long long ns = elapsedNs > 0 ? (unsigned long long)elapsedNs : 0;
+    StageCounters &counters = stages[stage];
+
+    counters.count.fetch_add(1, std::memory_order_relaxed);
+    counters.totalNs.fetch_add(ns, std::memory_order_relaxed);
+    counters.buckets[bucketIdx(ns)].fetch_add(1, std::memory_order_relaxed);
+
+    unsigned long long maxNs = counters.maxNs.load(std::memory_order_relaxed);
+    while (ns > maxNs && !counters.maxNs.compare_exchange_weak(maxNs, ns, std::memory_order_relaxed)) {}
+    return end;
+}
+
+void PipelineMetrics::addPoll(EdlErrorCode_t res, const EdlDeviceStatus_t &status)
+{
+    statusPolls.fetch_add(1, std::memory_order_relaxed);
+    if (res != EdlSuccess)
+    {
+        statusErrors.fetch_add(1, std::memory_order_relaxed);
+        lastError.store(res, std::memory_order_relaxed);
+        return;
+    }
+    if (status.availableDataPackets == 0) {emptyPolls.fetch_add(1, std::memory_order_relaxed);}
+
+    unsigned int flags = 0;
+    if (status.bufferOverflowFlag)
+    {
+        bufferOverflowCount.fetch_add(1, std::memory_order_relaxed);
+        flags |= E4_METRICS_BUFFER_OVERFLOW;
+    }
+    if (status.lostDataFlag)
+    {
+        lostDataCount.fetch_add(1, std::memory_order_relaxed);
+        flags |= E4_METRICS_LOST_DATA;
+    }
+
+    // The data packets read so far precede the loss.
+    if (flags != 0) {addEvent(flags, packetsRead.load(std::memory_order_relaxed), status.availableDataPackets);}
+}
+
+void PipelineMetrics::addRead(EdlErrorCode_t res, unsigned int packetsRequested, unsigned int packetsRead)
+{
+    reads.fetch_add(1, std::memory_order_relaxed);
+    this->packetsRequested.fetch_add(packetsRequested, std::memory_order_relaxed);
+    this->packetsRead.fetch_add(packetsRead, std::memory_order_relaxed);
+
+    if (res == EdlNotEnoughAvailableDataError)
+    {
+        notEnoughDataReads.fetch_add(1, std::memory_order_relaxed);
+    }
+    else if (res != EdlSuccess)
+    {
+        readErrors.fetch_add(1, std::memory_order_relaxed);
+        lastError.store(res, std::memory_order_relaxed);
+    }
+}
+
+void PipelineMetrics::addDrop(unsigned int flag, unsigned long long packetIdx, unsigned int packetsNum)
+{
+    if (packetsNum == 0) {return;}
+    if (flag == E4_METRICS_FILTERED_RING_FULL) {filteredRingDroppedPackets.fetch_add(packetsNum, std::memory_order_relaxed);}
+    else {ringDroppedPackets.fetch_add(packetsNum, std::memory_order_relaxed);}
+    addEvent(flag, packetIdx, packetsNum);
+}
+
+void PipelineMetrics::addEvent(unsigned int flags, unsigned long long packetIdx, unsigned int packetsNum)
+{
+    const std::chrono::steady_clock::duration elapsed(std::chrono::steady_clock::now().time_since_epoch().count()-startTicks.load(std::memory_order_relaxed));
+    const long long timeNs = std::chrono::duration_cast <std::chrono::nanoseconds> (elapsed).count();
+    const unsigned long long n = eventNum.load(std::memory_order_relaxed);
+    EventSlot &slot = events[n%E4_METRICS_EVENTS];
+
+    // Readers drop the events whose slots may be overwritten while they copy them.
+    eventsBegun.store(n+1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    slot.packetIdx.store(packetIdx, std::memory_order_relaxed);
+    slot.timeNs.store(timeNs > 0 ? (unsigned long long)timeNs : 0, std::memory_order_relaxed);
+    slot.flags.store(flags, std::memory_order_relaxed);
+    slot.packetsNum.store(packetsNum, std::memory_order_relaxed);
+    eventNum.store(n+1, std::memory_order_release);
+}
+
+void PipelineMetrics::get(E4Metrics_t &metrics) const
+{
+    memset(&metrics, 0, sizeof(metrics));
+
+    const std::chrono::steady_clock::duration elapsed(std::chrono::steady_clock::now().time_since_epoch().count()-startTicks.load(std::memory_order_relaxed));
+    metrics.elapsedS = std::chrono::duration <double> (elapsed).count();
+
+    for (unsigned int stageIdx = 0; stageIdx < E4StageNum; stageIdx++) {
+        const StageCounters &counters = stages[stageIdx];
+        E4StageMetrics_t &stage = metrics.stages[stageIdx];
+        stage.count = counters.count.load(std::memory_order_relaxed);
+        stage.totalNs = counters.totalNs.load(std::memory_order_relaxed);
+        stage.maxNs = counters.maxNs.load(std::memory_order_relaxed);
+        for (unsigned int idx = 0; idx < E4_METRICS_BUCKETS; idx++) {stage.buckets[idx] = counters.buckets[idx].load(std::memory_order_relaxed);}
+    }
+    metrics.statusPolls = statusPolls.load(std::memory_order_relaxed);
+    metrics.emptyPolls = emptyPolls.load(std::memory_order_relaxed);
+    metrics.statusErrors = statusErrors.load(std::memory_order_relaxed);
+    metrics.reads = reads.load(std::memory_order_relaxed);
+    metrics.notEnoughDataReads = notEnoughDataReads.load(std::memory_order_relaxed);
+    metrics.readErrors = readErrors.load(std::memory_order_relaxed);
+    metrics.lastError = (EdlErrorCode_t)lastError.load(std::memory_order_relaxed);
+    metrics.packetsRequested = packetsRequested.load(std::memory_order_relaxed);
+    metrics.packetsRead = packetsRead.load(std::memory_order_relaxed);
+    metrics.bufferOverflowCount = bufferOverflowCount.load(std::memory_order_relaxed);
+    metrics.lostDataCount = lostDataCount.load(std::memory_order_relaxed);
+    metrics.ringDroppedPackets = ringDroppedPackets.load(std::memory_order_relaxed);
+    metrics.filteredRingDroppedPackets = filteredRingDroppedPackets.load(std::memory_order_relaxed);
+
+    // Copy the latest events, then drop those the writer may have overwritten meanwhile, as with a sequence lock.
+    const unsigned long long firstNum = eventNum.load(std::memory_order_acquire);
+    const unsigned long long copiedNum = firstNum < E4_METRICS_EVENTS ? firstNum : E4_METRICS_EVENTS;
+    E4DropEvent_t copied[E4_METRICS_EVENTS];
+    for (unsigned long long idx = 0; idx < copiedNum; idx++) {
+        const EventSlot &slot = events[(firstNum-copiedNum+idx)%E4_METRICS_EVENTS];
+        copied[idx].packetIdx = slot.packetIdx.load(std::memory_order_relaxed);
+        copied[idx].timeNs = slot.timeNs.load(std::memory_order_relaxed);
+        copied[idx].flags = slot.flags.load(std::memory_order_relaxed);
+        copied[idx].packetsNum = slot.packetsNum.load(std::memory_order_relaxed);
+    }
+    std::atomic_thread_fence(std::memory_order_acquire);
+    const unsigned long long begunNum = eventsBegun.load(std::memory_order_relaxed);
+
+    // Events before begunNum-E4_METRICS_EVENTS had their slots reused meanwhile.
+    const unsigned long long staleNum = begunNum > E4_METRICS_EVENTS ? begunNum-E4_METRICS_EVENTS : 0;
+    unsigned long long skipNum = staleNum > firstNum-copiedNum ? staleNum-(firstNum-copiedNum) : 0;
+    if (skipNum > copiedNum) {skipNum = copiedNum;}
+
+    metrics.eventNum = firstNum;
+    metrics.eventsReturned = (unsigned int)(copiedNum-skipNum);
+    memcpy(metrics.events, copied+skipNum, sizeof(E4DropEvent_t)*metrics.eventsReturned);
+}
@@ -0,0 +1,198 @@
+/*! \file e4_metrics.h
+ * \brief Declares class PipelineMetrics.
+ */
+#ifndef E4_METRICS_H
+#define E4_METRICS_H
+
+#include <atomic>
+#include <chrono>
+
+#include "edl.h"
+
+/*! \def E4_METRICS_BUCKETS
+ * \brief Number of buckets of the latency histograms: bucket i counts the durations of 2^i to 2^(i+1)-1 ns,
+ * bucket 0 also counts 0ns and the last bucket every longer duration, i.e. 2.1s and more.
+ */
+#define E4_METRICS_BUCKETS 32
+
+/*! \def E4_METRICS_EVENTS
+ * \brief Number of the latest drop events kept, see E4Metrics_t::events.
+ */
+#define E4_METRICS_EVENTS 64
+
+/*! \def E4_METRICS_BUFFER_OVERFLOW
+ * \brief Flag of E4DropEvent_t::flags: the status poll reported EdlDeviceStatus_t::bufferOverflowFlag.
+ */
+#define E4_METRICS_BUFFER_OVERFLOW 0x0001
+
+/*! \def E4_METRICS_LOST_DATA
+ * \brief Flag of E4DropEvent_t::flags: the status poll reported EdlDeviceStatus_t::lostDataFlag.
+ */
+#define E4_METRICS_LOST_DATA 0x0002
+
+/*! \def E4_METRICS_RING_FULL
+ * \brief Flag of E4DropEvent_t::flags: read data packets were discarded because the acquisition ring was full.
+ */
+#define E4_METRICS_RING_FULL 0x0004
+
+/*! \def E4_METRICS_FILTERED_RING_FULL
+ * \brief Flag of E4DropEvent_t::flags: filtered data packets were discarded because the filtered ring was full.
+ */
+#define E4_METRICS_FILTERED_RING_FULL 0x0008
+
+/*! \enum E4MetricsStage_t
+ * \brief Stages of a device read timed by PipelineMetrics.
+ */
+typedef enum {
+    E4StageStatusPoll = 0, /*!< EDL::getDeviceStatus. */
+    E4StageRead = 1, /*!< EDL::readData. */
+    E4StageCopy = 2, /*!< Copy of the read data packets into the acquisition ring and the shared ring, or into the buffer of readInto. */
+    E4StageProcessing = 3, /*!< Statistics, filter, spectrum, sweeps and event detector. */
+    E4StageWrite = 4, /*!< Encoding of the data packets into the recording, handed to its I/O thread. */
+    E4StageNum /*!< Number of stages. \note This is not a valid stage. */
+} E4MetricsStage_t;
+
+/*! \struct E4StageMetrics_t
+ * \brief Struct that contains the latency histogram of a stage. Part of E4Metrics_t.
+ */
+typedef struct {
+    unsigned long long count; /*!< Times the stage ran. */
+    unsigned long long totalNs; /*!< Total time spent in the stage. */
+    unsigned long long maxNs; /*!< Longest run of the stage. */
+    unsigned long long buckets[E4_METRICS_BUCKETS]; /*!< Runs per duration, see #E4_METRICS_BUCKETS. */
+} E4StageMetrics_t;
+
+/*! \struct E4DropEvent_t
+ * \brief Struct that describes a loss of data packets, in the device or in the library. Part of E4Metrics_t.
+ */
+typedef struct {
+    unsigned long long packetIdx; /*!< Index of the first data packet read after the loss, counted from the start of the acquisition,
+                                   *   as in the recordings and in E4Event_t; for #E4_METRICS_RING_FULL, index of the first discarded data packet;
+                                   *   for #E4_METRICS_FILTERED_RING_FULL, index of the first data packet of the batch that was filtered. */
+    unsigned long long timeNs; /*!< Time of the loss since the acquisition started. */
+    unsigned int flags; /*!< Combination of #E4_METRICS_BUFFER_OVERFLOW, #E4_METRICS_LOST_DATA, #E4_METRICS_RING_FULL and #E4_METRICS_FILTERED_RING_FULL. */
+    unsigned int packetsNum; /*!< Data packets available at the status poll for the device flags, data packets discarded for the ring flags. */
+} E4DropEvent_t;
+
+/*! \struct E4Metrics_t
+ * \brief Struct that contains the instrumentation of the device reads since the acquisition or readDataFor started. Returned by getMetrics.
+ */
+typedef struct {
+    double elapsedS; /*!< Time since the counters were reset. */
+    E4StageMetrics_t stages[E4StageNum]; /*!< Latency histogram of each stage, indexed by E4MetricsStage_t. */
+    unsigned long long statusPolls; /*!< Calls to EDL::getDeviceStatus. */
+    unsigned long long emptyPolls; /*!< Status polls that found no data packets. */
+    unsigned long long statusErrors; /*!< Status polls that failed. */
+    unsigned long long reads; /*!< Calls to EDL::readData. */
+    unsigned long long notEnoughDataReads; /*!< Reads returning #EdlNotEnoughAvailableDataError, i.e. fewer data packets than requested. */
+    unsigned long long readErrors; /*!< Reads that failed with any other error. */
+    EdlErrorCode_t lastError; /*!< Last error of a status poll or of a read, other than #EdlNotEnoughAvailableDataError; #EdlSuccess if none. */
+    unsigned long long packetsRequested; /*!< Data packets requested from EDL::readData. */
+    unsigned long long packetsRead; /*!< Data packets returned by EDL::readData. */
+    unsigned long long bufferOverflowCount; /*!< Status polls reporting EdlDeviceStatus_t::bufferOverflowFlag. */
+    unsigned long long lostDataCount; /*!< Status polls reporting EdlDeviceStatus_t::lostDataFlag. */
+    unsigned long long ringDroppedPackets; /*!< Data packets discarded because the acquisition ring was full. */
+    unsigned long long filteredRingDroppedPackets; /*!< Filtered data packets discarded because the filtered ring was full. */
+    unsigned long long eventNum; /*!< Drop events since the reset; only the latest #E4_METRICS_EVENTS are kept. */
+    unsigned int eventsReturned; /*!< Drop events in \a events, oldest first. */
+    E4DropEvent_t events[E4_METRICS_EVENTS]; /*!< Latest drop events. */
+} E4Metrics_t;
+
+/*! \class PipelineMetrics
+ * \brief Counters and latency histograms of the stages of the device reads, with a log of the losses of data packets,
+ * so that a gap in the data can be tied to its cause: the device buffer, a slow stage or a slow consumer.
+ *
+ * Every counter is a relaxed atomic updated without locks, and every stage is timed with one steady clock read,
+ * so the reader thread is never blocked by PipelineMetrics::get. The snapshot is not taken atomically:
+ * counters updated while it is copied may be one batch apart.
+ * The drop events are appended by one thread at a time: under the mutex of the device for the device flags,
+ * and by the acquisition thread for the ring flags, when no other thread reads the device.
+ */
+class PipelineMetrics {
+public:
+    PipelineMetrics();
+
+    /*! \brief Resets the counters, the histograms and the drop events, when a reader starts.
+     */
+    void reset(EDL_VOID);
+
+    /*! \brief Records a run of a stage.
+     *
+     * \param stage [in] Stage that ran.
+     * \param start [in] Start of the run.
+     * \return End of the run, i.e. the start of the next stage.
+     */
+    std::chrono::steady_clock::time_point addTime(EDL_IN E4MetricsStage_t stage,
+                                                  EDL_IN std::chrono::steady_clock::time_point start);
+
+    /*! \brief Records a status poll and the drop event of its flags, if any.
+     *
+     * \param res [in] Error code of EDL::getDeviceStatus.
+     * \param status [in] Returned status, ignored if \a res is not #EdlSuccess.
+     */
+    void addPoll(EDL_IN EdlErrorCode_t res,
+                 EDL_IN const EdlDeviceStatus_t &status);
+
+    /*! \brief Records a read of the device.
+     *
+     * \param res [in] Error code of EDL::readData.
+     * \param packetsRequested [in] Data packets requested.
+     * \param packetsRead [in] Data packets returned.
+     */
+    void addRead(EDL_IN EdlErrorCode_t res,
+                 EDL_IN unsigned int packetsRequested,
+                 EDL_IN unsigned int packetsRead);
+
+    /*! \brief Records data packets discarded by a ring of the acquisition.
+     *
+     * \param flag [in] #E4_METRICS_RING_FULL or #E4_METRICS_FILTERED_RING_FULL.
+     * \param packetIdx [in] Index of the first discarded data packet.
+     * \param packetsNum [in] Data packets discarded, nothing is recorded if 0.
+     */
+    void addDrop(EDL_IN unsigned int flag,
+                 EDL_IN unsigned long long packetIdx,
+                 EDL_IN unsigned int packetsNum);
+
+    /*! \brief Returns a snapshot of the counters. May be called from any thread.
+     */
+    void get(EDL_OUT E4Metrics_t &metrics) const;
+
+private:
+    struct StageCounters {
+        std::atomic <unsigned long long> count;
+        std::atomic <unsigned long long> totalNs;
+        std::atomic <unsigned long long> maxNs;
+        std::atomic <unsigned long long> buckets[E4_METRICS_BUCKETS];
+    };
+
+    struct EventSlot {
+        std::atomic <unsigned long long> packetIdx;
+        std::atomic <unsigned long long> timeNs;
+        std::atomic <unsigned int> flags;
+        std::atomic <unsigned int> packetsNum;
+    };
+
+    void addEvent(unsigned int flags, unsigned long long packetIdx, unsigned int packetsNum);
+
+    std::atomic <long long> startTicks; /*!< Steady clock time of the reset, in clock ticks. */
+    StageCounters stages[E4StageNum];
+    std::atomic <unsigned long long> statusPolls;
+    std::atomic <unsigned long long> emptyPolls;
+    std::atomic <unsigned long long> statusErrors;
+    std::atomic <unsigned long long> reads;
+    std::atomic <unsigned long long> notEnoughDataReads;
+    std::atomic <unsigned long long> readErrors;
+    std::atomic <int> lastError;
+    std::atomic <unsigned long long> packetsRequested;
+    std::atomic <unsigned long long> packetsRead;
+    std::atomic <unsigned long long> bufferOverflowCount;
+    std::atomic <unsigned long long> lostDataCount;
+    std::atomic <unsigned long long> ringDroppedPackets;
+    std::atomic <unsigned long long> filteredRingDroppedPackets;
+
+    EventSlot events[E4_METRICS_EVENTS];
+    std::atomic <unsigned long long> eventNum; /*!< Drop events appended: event n is in events[n % E4_METRICS_EVENTS]. */
+    std::atomic <unsigned long long> eventsBegun; /*!< Drop events whose slot is being or was written, eventNum+1 during a write. */
+};
+
+#endif // E4_METRICS_H
@@ -0,0 +1,18 @@
+/*! \file e4_platform.h
+ * \brief Portability definitions for building the library on platforms other than Windows.
+ *
+ * Forced into every translation unit by the Linux target of the project (-include e4_platform.h).
+ * The vendor library is only available on Windows: elsewhere devices are simulated, see SimulatedBackend.
+ */
+#ifndef E4_PLATFORM_H
+#define E4_PLATFORM_H
+
+#ifndef _WIN32
+/*! \def __declspec
+ * \brief GCC only accepts __declspec when targeting Windows: elsewhere the exported functions,
+ * and the classes declared by the vendor headers, get the default visibility instead.
+ */
+#define __declspec(x) __attribute__((visibility("default")))
+#endif
+
+#endif // E4_PLATFORM_H
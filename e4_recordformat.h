@@ -0,0 +1,160 @@
+/*! \file e4_recordformat.h
+ * \brief Defines the layout of recording files.
+ *
+ * A recording file consists of:
+ * - one #E4RecordHeader_t, with the device settings applied when the recording started;
+ * - a sequence of chunks, each one made of a #E4RecordChunkHeader_t followed by its payload and padded to 8 bytes;
+ *   every chunk holds #E4RecordHeader_t::chunkPackets data packets, except possibly the last one,
+ *   and is immediately followed by its level 0 envelope block (since version 2);
+ * - the envelope blocks of levels 1 and above (since version 2);
+ * - the index: one 64 bit file offset per chunk;
+ * - one #E4RecordFooter_t, at the very end of the file.
+ *
+ * Payloads hold E4RecordChunkHeader_t::packetNum data packets of #E4RecordHeader_t::channelNum floats,
+ * laid out as returned by EDL::readData, or their lossless encoding by TraceCodec if the chunk has the #E4_CHUNK_COMPRESSED flag.
+ * All fields are little endian.
+ * Since chunks are full, the chunk holding a packet index is found in O(1) by dividing by #E4RecordHeader_t::chunkPackets;
+ * the packet index of a time offset is the offset times #E4RecordHeader_t::samplingRateHz.
+ *
+ * Envelope blocks summarize the data packets for display at any zoom: each one is a #E4RecordEnvelopeHeader_t
+ * followed by E4RecordEnvelopeHeader_t::entryNum #E4RecordEnvelope_t entries, each holding the minimum, maximum and mean
+ * of every channel over a span of data packets.
+ * - Level 0 entries cover #E4_RECORD_ENVELOPE_PACKETS data packets each, counted from the first one of their chunk.
+ * - Level 1 entries cover #E4RecordHeader_t::chunkPackets data packets, and every further level #E4_RECORD_ENVELOPE_FACTOR
+ *   times more. Entry k of level L covers the data packets whose offset from #E4RecordHeader_t::firstPacketIdx is in
+ *   [k*span, (k+1)*span), span being the size of level L entries; its E4RecordEnvelope_t::packetNum is 0 if there are none.
+ *   A level 0 entry is counted in the level 1 entry holding its first data packet. The last level has a single entry.
+ * Levels 1 and above are only written when the file is closed properly.
+ */
+#ifndef E4_RECORDFORMAT_H
+#define E4_RECORDFORMAT_H
+
+#include <stdint.h>
+
+#include "edl_devicespecs.h"
+
+/*! \def E4_RECORD_MAGIC
+ * \brief Value of E4RecordHeader_t::magic.
+ */
+#define E4_RECORD_MAGIC "E4RECORD"
+
+/*! \def E4_RECORD_INDEX_MAGIC
+ * \brief Value of E4RecordFooter_t::magic.
+ */
+#define E4_RECORD_INDEX_MAGIC "E4RINDEX"
+
+/*! \def E4_RECORD_CHUNK_MAGIC
+ * \brief Value of E4RecordChunkHeader_t::magic: "CHNK".
+ */
+#define E4_RECORD_CHUNK_MAGIC 0x4B4E4843
+
+/*! \def E4_RECORD_ENVELOPE_MAGIC
+ * \brief Value of E4RecordEnvelopeHeader_t::magic: "ENVL".
+ */
+#define E4_RECORD_ENVELOPE_MAGIC 0x4C564E45
+
+/*! \def E4_RECORD_VERSION
+ * \brief Value of E4RecordHeader_t::version.
+ */
+#define E4_RECORD_VERSION 2
+
+/*! \def E4_RECORD_CHUNK_PACKETS
+ * \brief Number of data packets per chunk.
+ */
+#define E4_RECORD_CHUNK_PACKETS 4096
+
+/*! \def E4_RECORD_ENVELOPE_PACKETS
+ * \brief Number of data packets per level 0 envelope entry.
+ */
+#define E4_RECORD_ENVELOPE_PACKETS 64
+
+/*! \def E4_RECORD_ENVELOPE_FACTOR
+ * \brief Ratio between the spans of the entries of consecutive envelope levels, from level 1 on.
+ */
+#define E4_RECORD_ENVELOPE_FACTOR 16
+
+/*! Flag for E4RecordChunkHeader_t::flags: EdlDeviceStatus_t::bufferOverflowFlag was set while reading the chunk. */
+#define E4_CHUNK_BUFFER_OVERFLOW 0x0001
+
+/*! Flag for E4RecordChunkHeader_t::flags: EdlDeviceStatus_t::lostDataFlag was set while reading the chunk. */
+#define E4_CHUNK_LOST_DATA 0x0002
+
+/*! Flag for E4RecordChunkHeader_t::flags: the payload is encoded by TraceCodec, see e4_compression.h. */
+#define E4_CHUNK_COMPRESSED 0x0004
+
+/*! \struct E4RecordCommand_t
+ * \brief Last applied configuration of one command, see #EdlCommandStruct_t.
+ */
+typedef struct {
+    uint32_t radioId; /*!< EdlCommandStruct_t::radioId. */
+    uint8_t checkboxChecked; /*!< EdlCommandStruct_t::checkboxChecked. */
+    uint8_t buttonPressed; /*!< EdlCommandStruct_t::buttonPressed. */
+    uint8_t applied; /*!< 1 if the command was applied before the recording started, 0 if the other fields are meaningless. */
+    uint8_t reserved; /*!< Always 0. */
+    double value; /*!< EdlCommandStruct_t::value. */
+} E4RecordCommand_t;
+
+/*! \struct E4RecordHeader_t
+ * \brief Header at the beginning of a recording file.
+ */
+typedef struct {
+    char magic[8]; /*!< #E4_RECORD_MAGIC, not null terminated. */
+    uint32_t version; /*!< #E4_RECORD_VERSION. */
+    uint32_t headerBytes; /*!< Size of this header: the first chunk begins at this offset. */
+    uint32_t channelNum; /*!< Number of values per data packet, #EDL_CHANNEL_NUM of the recording device. */
+    uint32_t chunkPackets; /*!< Number of data packets in every chunk but the last. */
+    double samplingRateHz; /*!< Sampling rate, 0 if it was never set. */
+    uint64_t startTimeMs; /*!< Time of the first data packet, in ms since the Unix epoch. */
+    uint64_t firstPacketIdx; /*!< Index of the first data packet, counted from the start of the acquisition. */
+    uint32_t commandNum; /*!< Number of items in \a commands, #EdlCommandIdNum of the recording device. */
+    uint32_t reserved; /*!< Always 0. */
+    E4RecordCommand_t commands[EdlCommandIdNum]; /*!< Settings applied before the recording started, indexed by #EdlCommandId_t. */
+} E4RecordHeader_t;
+
+/*! \struct E4RecordChunkHeader_t
+ * \brief Header at the beginning of every chunk.
+ */
+typedef struct {
+    uint32_t magic; /*!< #E4_RECORD_CHUNK_MAGIC. */
+    uint32_t flags; /*!< Combination of E4_CHUNK_* flags. */
+    uint64_t firstPacketIdx; /*!< Index of the first data packet of the chunk, counted from the start of the acquisition. */
+    uint32_t packetNum; /*!< Number of data packets in the chunk. */
+    uint32_t payloadBytes; /*!< Size of the payload following this header, padding excluded. */
+} E4RecordChunkHeader_t;
+
+/*! \struct E4RecordEnvelopeHeader_t
+ * \brief Header at the beginning of every envelope block. Same size as #E4RecordChunkHeader_t, with the payload size at the same offset.
+ */
+typedef struct {
+    uint32_t magic; /*!< #E4_RECORD_ENVELOPE_MAGIC. */
+    uint32_t level; /*!< Envelope level, 0 for the block following a chunk. */
+    uint64_t firstPacketIdx; /*!< Index of the first data packet of the first entry: that of the chunk for level 0, #E4RecordHeader_t::firstPacketIdx otherwise. */
+    uint32_t entryNum; /*!< Number of #E4RecordEnvelope_t entries following this header. */
+    uint32_t payloadBytes; /*!< Size of the entries following this header. */
+} E4RecordEnvelopeHeader_t;
+
+/*! \struct E4RecordEnvelope_t
+ * \brief Envelope entry: summary of the data packets in a span.
+ */
+typedef struct {
+    uint64_t packetNum; /*!< Number of data packets summarized, 0 if the other fields are meaningless. */
+    float minimum[EDL_CHANNEL_NUM]; /*!< Minimum value of each channel. */
+    float maximum[EDL_CHANNEL_NUM]; /*!< Maximum value of each channel. */
+    float mean[EDL_CHANNEL_NUM]; /*!< Mean value of each channel. */
+    uint32_t reserved; /*!< Always 0. */
+} E4RecordEnvelope_t;
+
+/*! \struct E4RecordFooter_t
+ * \brief Footer at the end of a recording file.
+ * A file without a valid footer was not closed properly: its chunks can still be read sequentially.
+ */
+typedef struct {
+    uint64_t indexOffset; /*!< File offset of the index. */
+    uint64_t chunkNum; /*!< Number of chunks, i.e. of 64 bit offsets in the index. */
+    uint64_t packetNum; /*!< Total number of data packets in the file. */
+    uint32_t chunkFlags; /*!< Combination of the E4RecordChunkHeader_t::flags of all of the chunks. */
+    uint32_t reserved; /*!< Always 0. */
+    char magic[8]; /*!< #E4_RECORD_INDEX_MAGIC, not null terminated. */
+} E4RecordFooter_t;
+
+#endif // E4_RECORDFORMAT_H
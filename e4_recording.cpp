@@ -0,0 +1,224 @@
+/*! \file e4_recording.cpp
+ * \brief Defines class Recording.
+ */
+#include <chrono>
+#include <cstring>
+
+#include "e4_recording.h"
+
+static_assert(sizeof(E4RecordCommand_t) == 16, "E4RecordCommand_t must not be padded");
+static_assert(sizeof(E4RecordChunkHeader_t) == 24, "E4RecordChunkHeader_t must not be padded");
+static_assert(sizeof(E4RecordFooter_t) == 40, "E4RecordFooter_t must not be padded");
+static_assert(sizeof(E4RecordHeader_t) == 56+16*EdlCommandIdNum, "E4RecordHeader_t must not be padded");
+
+/*! Chunks are padded so that every chunk header is 8 bytes aligned in the file. */
+static const unsigned char padding[8] = {0, 0, 0, 0, 0, 0, 0, 0};
+
+Recording::Recording() :
+    opened(false),
+    headerWritten(false),
+    chunkPacketNum(0),
+    chunkFirstPacketIdx(0),
+    chunkFlags(0),
+    compressed(false),
+    streamBytes(0),
+    packetNum(0),
+    allChunkFlags(0)
+{
+    memset(&header, 0, sizeof(header));
+}
+
+Recording::~Recording()
+{
+    close();
+}
+
+bool Recording::open(const char * path, const DeviceSettings &settings, bool directIo, unsigned long long preallocateBytes, bool compress)
+{
+    if (opened) {return false;}
+    if (!writer.open(path, E4_WRITER_BLOCK_BYTES, E4_WRITER_QUEUE_BLOCKS, preallocateBytes, directIo)) {return false;}
+    setHeader(settings, compress);
+    return true;
+}
+
+bool Recording::open(FILE * f, const DeviceSettings &settings)
+{
+    if (opened) {return false;}
+    // Offsets in the file count from the header, which RecordReader expects at the start of the file.
+    // Streams without a position, e.g. pipes, start where the reader starts reading them.
+    if (ftell(f) > 0) {return false;}
+    if (!writer.open(f, E4_WRITER_BLOCK_BYTES, E4_WRITER_QUEUE_BLOCKS)) {return false;}
+    setHeader(settings, false);
+    return true;
+}
+
+bool Recording::isOpen() const
+{
+    return opened;
+}
+
+void Recording::write(const float * packets, unsigned int packetsNum, unsigned long long firstPacketIdx, bool bufferOverflow, bool lostData)
+{
+    if (!opened || packetsNum == 0) {return;}
+
+    if (!headerWritten)
+    {
+        // The header is written with the first data packets, so that it holds their index and time.
+        header.firstPacketIdx = firstPacketIdx;
+        header.startTimeMs = (uint64_t)std::chrono::duration_cast <std::chrono::milliseconds>(
+            std::chrono::system_clock::now().time_since_epoch()).count();
+        append(&header, sizeof(header));
+        headerWritten = true;
+    }
+
+    // A gap in the packet indexes ends the current chunk, so that every chunk covers contiguous packets.
+    if (chunkPacketNum > 0 && firstPacketIdx != chunkFirstPacketIdx+chunkPacketNum) {flushChunk();}
+
+    // The status flags refer to the data read after the status poll: mark the chunk receiving the first packet.
+    if (bufferOverflow) {chunkFlags |= E4_CHUNK_BUFFER_OVERFLOW;}
+    if (lostData) {chunkFlags |= E4_CHUNK_LOST_DATA;}
+
+    while (packetsNum > 0) {
+        if (chunkPacketNum == 0) {chunkFirstPacketIdx = firstPacketIdx;}
+
+        unsigned int n = header.chunkPackets-chunkPacketNum;
+        if (n > packetsNum) {n = packetsNum;}
+        memcpy(&chunk[chunkPacketNum*EDL_CHANNEL_NUM], packets, sizeof(float)*EDL_CHANNEL_NUM*n);
+        chunkPacketNum += n;
+        packets += n*EDL_CHANNEL_NUM;
+        packetsNum -= n;
+        firstPacketIdx += n;
+
+        if (chunkPacketNum == header.chunkPackets) {flushChunk();}
+    }
+}
+
+bool Recording::close()
+{
+    if (!opened) {return true;}
+
+    if (!headerWritten)
+    {
+        append(&header, sizeof(header));
+        headerWritten = true;
+    }
+    flushChunk();
+
+    std::vector <std::vector <E4RecordEnvelope_t> > levels;
+    envelope.finish(levels);
+    for (size_t levelIdx = 0; levelIdx < levels.size(); levelIdx++) {appendEnvelope((unsigned int)levelIdx+1, header.firstPacketIdx, levels[levelIdx]);}
+
+    E4RecordFooter_t footer;
+    footer.indexOffset = streamBytes;
+    footer.chunkNum = chunkOffsets.size();
+    footer.packetNum = packetNum;
+    footer.chunkFlags = allChunkFlags;
+    footer.reserved = 0;
+    memcpy(footer.magic, E4_RECORD_INDEX_MAGIC, sizeof(footer.magic));
+    if (!chunkOffsets.empty()) {append(chunkOffsets.data(), sizeof(uint64_t)*chunkOffsets.size());}
+    append(&footer, sizeof(footer));
+
+    opened = false;
+    chunkOffsets.clear();
+    return writer.close();
+}
+
+void Recording::getWriterStats(E4WriterStats_t &stats) const
+{
+    writer.getStats(stats);
+}
+
+void Recording::setHeader(const DeviceSettings &settings, bool compress)
+{
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, E4_RECORD_MAGIC, sizeof(header.magic));
+    header.version = E4_RECORD_VERSION;
+    header.headerBytes = sizeof(header);
+    header.channelNum = EDL_CHANNEL_NUM;
+    header.chunkPackets = E4_RECORD_CHUNK_PACKETS;
+    header.samplingRateHz = settings.samplingRateHz();
+    header.commandNum = EdlCommandIdNum;
+
+    for (int commandIdx = 0; commandIdx < EdlCommandIdNum; commandIdx++)
+    {
+        EdlCommandStruct_t commandStruct;
+        if (settings.getCommand((EdlCommandId_t)commandIdx, commandStruct))
+        {
+            header.commands[commandIdx].radioId = commandStruct.radioId;
+            header.commands[commandIdx].checkboxChecked = commandStruct.checkboxChecked ? 1 : 0;
+            header.commands[commandIdx].buttonPressed = commandStruct.buttonPressed ? 1 : 0;
+            header.commands[commandIdx].applied = 1;
+            header.commands[commandIdx].value = commandStruct.value;
+        }
+    }
+
+    compressed = compress;
+    codec.setRanges(settings.currentRangeFullScale());
+
+    chunk.assign((size_t)header.chunkPackets*EDL_CHANNEL_NUM, 0.0f);
+    chunkPacketNum = 0;
+    chunkFlags = 0;
+    envelope.reset(header.chunkPackets);
+    chunkOffsets.clear();
+    streamBytes = 0;
+    packetNum = 0;
+    allChunkFlags = 0;
+    headerWritten = false;
+    opened = true;
+}
+
+void Recording::flushChunk()
+{
+    if (chunkPacketNum == 0) {return;}
+
+    const void * payload = chunk.data();
+    size_t payloadBytes = sizeof(float)*EDL_CHANNEL_NUM*chunkPacketNum;
+    if (compressed)
+    {
+        codec.compress(chunk.data(), chunkPacketNum, compressedChunk);
+        payload = compressedChunk.data();
+        payloadBytes = compressedChunk.size();
+        chunkFlags |= E4_CHUNK_COMPRESSED;
+    }
+
+    E4RecordChunkHeader_t chunkHeader;
+    chunkHeader.magic = E4_RECORD_CHUNK_MAGIC;
+    chunkHeader.flags = chunkFlags;
+    chunkHeader.firstPacketIdx = chunkFirstPacketIdx;
+    chunkHeader.packetNum = chunkPacketNum;
+    chunkHeader.payloadBytes = (uint32_t)payloadBytes;
+
+    chunkOffsets.push_back(streamBytes);
+    append(&chunkHeader, sizeof(chunkHeader));
+    append(payload, payloadBytes);
+    if (streamBytes%8 != 0) {append(padding, 8-streamBytes%8);}
+
+    // The envelope is computed from the data packets before compression, which is lossless.
+    envelope.addChunk(chunk.data(), chunkPacketNum, chunkFirstPacketIdx-header.firstPacketIdx, chunkEnvelope);
+    appendEnvelope(0, chunkFirstPacketIdx, chunkEnvelope);
+
+    packetNum += chunkPacketNum;
+    allChunkFlags |= chunkFlags;
+    chunkPacketNum = 0;
+    chunkFlags = 0;
+}
+
+void Recording::appendEnvelope(unsigned int level, unsigned long long firstPacketIdx, const std::vector <E4RecordEnvelope_t> &entries)
+{
+    E4RecordEnvelopeHeader_t envelopeHeader;
+    envelopeHeader.magic = E4_RECORD_ENVELOPE_MAGIC;
+    envelopeHeader.level = level;
+    envelopeHeader.firstPacketIdx = firstPacketIdx;
+    envelopeHeader.entryNum = (uint32_t)entries.size();
+    envelopeHeader.payloadBytes = (uint32_t)(sizeof(E4RecordEnvelope_t)*entries.size());
+
+    // Entries are a multiple of 8 bytes long: envelope blocks need no padding.
+    append(&envelopeHeader, sizeof(envelopeHeader));
+    if (!entries.empty()) {append(entries.data(), sizeof(E4RecordEnvelope_t)*entries.size());}
+}
+
+void Recording::append(const void * bytes, size_t bytesNum)
+{
+    writer.append(bytes, bytesNum);
+    streamBytes += bytesNum;
+}
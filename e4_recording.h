@@ -0,0 +1,120 @@
+/*! \file e4_recording.h
+ * \brief Declares class Recording.
+ */
+#ifndef E4_RECORDING_H
+#define E4_RECORDING_H
+
+#include <vector>
+
+#include "e4_compression.h"
+#include "e4_envelope.h"
+#include "e4_filewriter.h"
+#include "e4_recordformat.h"
+#include "e4_settings.h"
+
+/*! \def E4_RECORDING_COMPRESS
+ * \brief Flag for startRecording: compress the chunks losslessly with TraceCodec.
+ */
+#define E4_RECORDING_COMPRESS 0x0002
+
+/*! \def E4_RECORDING_EVENTS_ONLY
+ * \brief Flag for startRecording: record only the data packets around the events found by the detector, see setDetector.
+ */
+#define E4_RECORDING_EVENTS_ONLY 0x0004
+
+/*! \class Recording
+ * \brief Encodes data packets into a recording file, see e4_recordformat.h.
+ * Chunks are built on the caller's thread and handed to a FileWriter, which writes them from its I/O thread.
+ * Each chunk is followed by its envelope entries; the coarser envelope levels are written by Recording::close.
+ */
+class Recording {
+public:
+    Recording();
+
+    /*! \brief Recording destructor. Closes the file if still open.
+     */
+    ~Recording();
+
+    /*! \brief Creates a recording file.
+     *
+     * \param path [in] Path of the file to create. An existing file is overwritten.
+     * \param settings [in] Device settings to store in the header.
+     * \param directIo [in] Flag to bypass the OS file cache.
+     * \param preallocateBytes [in] Expected file size to reserve on disk, 0 for none.
+     * \param compress [in] Flag to compress the chunks.
+     * \return false if the file could not be created.
+     */
+    bool open(EDL_IN const char * path,
+              EDL_IN const DeviceSettings &settings,
+              EDL_IN bool directIo,
+              EDL_IN unsigned long long preallocateBytes,
+              EDL_IN bool compress);
+
+    /*! \brief Starts a recording on a file opened by the caller. The file is not closed by Recording::close.
+     *
+     * \param f [in] File open for binary writing, positioned at its start: the offsets stored in the file count from there.
+     * \param settings [in] Device settings to store in the header.
+     * \return false if \a f is past its start or if the writer could not be started.
+     */
+    bool open(EDL_IN FILE * f,
+              EDL_IN const DeviceSettings &settings);
+
+    /*! \brief Returns true between a successful Recording::open and Recording::close.
+     */
+    bool isOpen(EDL_VOID) const;
+
+    /*! \brief Appends data packets to the recording.
+     *
+     * \param packets [in] Buffer of \a packetsNum data packets of #EDL_CHANNEL_NUM values.
+     * \param packetsNum [in] Number of data packets in \a packets.
+     * \param firstPacketIdx [in] Index of the first data packet, counted from the start of the acquisition.
+     * \param bufferOverflow [in] EdlDeviceStatus_t::bufferOverflowFlag of the status poll preceding the read.
+     * \param lostData [in] EdlDeviceStatus_t::lostDataFlag of the status poll preceding the read.
+     */
+    void write(EDL_IN const float * packets,
+               EDL_IN unsigned int packetsNum,
+               EDL_IN unsigned long long firstPacketIdx,
+               EDL_IN bool bufferOverflow,
+               EDL_IN bool lostData);
+
+    /*! \brief Writes the last chunk, the envelope levels, the index and the footer, then closes the file.
+     *
+     * \return false if any write failed.
+     */
+    bool close(EDL_VOID);
+
+    /*! \brief Returns the counters of the underlying FileWriter.
+     */
+    void getWriterStats(EDL_OUT E4WriterStats_t &stats) const;
+
+private:
+    void setHeader(const DeviceSettings &settings, bool compress);
+    void flushChunk(EDL_VOID);
+    void appendEnvelope(unsigned int level, unsigned long long firstPacketIdx, const std::vector <E4RecordEnvelope_t> &entries);
+    void append(const void * bytes, size_t bytesNum);
+
+    FileWriter writer;
+    bool opened;
+
+    E4RecordHeader_t header;
+    bool headerWritten;
+
+    std::vector <float> chunk;
+    unsigned int chunkPacketNum;
+    unsigned long long chunkFirstPacketIdx;
+    unsigned int chunkFlags;
+
+    bool compressed;
+    TraceCodec codec;
+    std::vector <unsigned char> compressedChunk;
+
+    EnvelopeBuilder envelope;
+    std::vector <E4RecordEnvelope_t> chunkEnvelope;
+
+    std::vector <uint64_t> chunkOffsets;
+    unsigned long long streamBytes;
+    unsigned long long packetNum;
+    unsigned int allChunkFlags;
+};
+
+#endif // E4_RECORDING_H
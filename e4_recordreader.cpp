@@ -0,0 +1,376 @@
+/*! \file e4_recordreader.cpp
+ * \brief Defines class RecordReader.
+ */
+#include <cmath>
+#include <cstring>
+
+#include "e4_envelope.h"
+#include "e4_recordreader.h"
+
+RecordReader::RecordReader() :
+    packetNum(0),
+    chunkFlags(0),
+    indexed(false),
+    decodedChunkIdx((size_t)-1)
+{
+    memset(&header, 0, sizeof(header));
+}
+
+bool RecordReader::open(const char * path)
+{
+    close();
+    if (!file.open(path)) {return false;}
+
+    // Fields are copied out of the mapping: offsets in the file are only 8 bytes aligned for chunk headers.
+    if (file.size() < sizeof(header)) {close(); return false;}
+    memcpy(&header, file.data(), sizeof(header));
+    if (memcmp(header.magic, E4_RECORD_MAGIC, sizeof(header.magic)) != 0 ||
+            header.version == 0 ||
+            header.version > E4_RECORD_VERSION ||
+            header.headerBytes < sizeof(header) ||
+            header.channelNum == 0 ||
+            header.chunkPackets == 0)
+    {
+        close();
+        return false;
+    }
+
+    indexed = loadIndex();
+    if (!indexed) {scanChunks();}
+    return true;
+}
+
+void RecordReader::close()
+{
+    file.close();
+    chunkOffsets.clear();
+    levelOffsets.clear();
+    packetNum = 0;
+    chunkFlags = 0;
+    indexed = false;
+    decodedChunkIdx = (size_t)-1;
+}
+
+const E4RecordHeader_t &RecordReader::getHeader() const
+{
+    return header;
+}
+
+void RecordReader::getInfo(E4RecordingInfo_t &info) const
+{
+    info.channelNum = header.channelNum;
+    info.chunkPackets = header.chunkPackets;
+    info.samplingRateHz = header.samplingRateHz;
+    info.startTimeMs = header.startTimeMs;
+    info.firstPacketIdx = header.firstPacketIdx;
+    info.packetNum = packetNum;
+    info.chunkNum = chunkOffsets.size();
+    info.chunkFlags = chunkFlags;
+    info.indexed = indexed ? 1 : 0;
+}
+
+size_t RecordReader::read(unsigned long long packetOffset, size_t maxPackets, float * dst) const
+{
+    size_t chunkIdx;
+    unsigned long long packetIdx = header.firstPacketIdx+packetOffset;
+    size_t readNum = 0;
+
+    if (!findChunk(packetIdx, chunkIdx)) {return 0;}
+
+    while (readNum < maxPackets && chunkIdx < chunkOffsets.size()) {
+        E4RecordChunkHeader_t chunkHeader;
+        if (!getChunkHeader(chunkIdx, chunkHeader)) {break;}
+        if (packetIdx < chunkHeader.firstPacketIdx || packetIdx >= chunkHeader.firstPacketIdx+chunkHeader.packetNum) {break;}
+
+        const unsigned int firstPacket = (unsigned int)(packetIdx-chunkHeader.firstPacketIdx);
+        size_t n = chunkHeader.packetNum-firstPacket;
+        if (n > maxPackets-readNum) {n = maxPackets-readNum;}
+        if (!readChunk(chunkIdx, chunkHeader, firstPacket, (unsigned int)n, dst+readNum*header.channelNum)) {break;}
+
+        readNum += n;
+        packetIdx += n;
+        chunkIdx++;
+    }
+    return readNum;
+}
+
+bool RecordReader::decodeChunk(size_t chunkIdx, E4RecordChunkHeader_t &chunkHeader, float * dst) const
+{
+    if (!getChunkHeader(chunkIdx, chunkHeader) || chunkHeader.packetNum > header.chunkPackets) {return false;}
+
+    const unsigned char * payload = file.data()+chunkOffsets[chunkIdx]+sizeof(chunkHeader);
+    const size_t packetsBytes = sizeof(float)*header.channelNum*chunkHeader.packetNum;
+    if (chunkOffsets[chunkIdx]+sizeof(chunkHeader)+chunkHeader.payloadBytes > file.size()) {return false;}
+
+    // Decoded straight into dst rather than through decodedChunk, which is not shared between threads.
+    if (chunkHeader.flags & E4_CHUNK_COMPRESSED) {return TraceCodec::decompress(payload, chunkHeader.payloadBytes, chunkHeader.packetNum, header.channelNum, dst);}
+    if (chunkHeader.payloadBytes < packetsBytes) {return false;}
+    memcpy(dst, payload, packetsBytes);
+    return true;
+}
+
+bool RecordReader::loadIndex()
+{
+    E4RecordFooter_t footer;
+    if (file.size() < header.headerBytes+sizeof(footer)) {return false;}
+    memcpy(&footer, file.data()+file.size()-sizeof(footer), sizeof(footer));
+    if (memcmp(footer.magic, E4_RECORD_INDEX_MAGIC, sizeof(footer.magic)) != 0) {return false;}
+
+    // A corrupt footer or index is rebuilt by walking the chunks rather than trusted: every offset is checked before use.
+    if (footer.indexOffset < header.headerBytes || footer.indexOffset > file.size()-sizeof(footer)) {return false;}
+    if (footer.chunkNum > (file.size()-sizeof(footer)-footer.indexOffset)/sizeof(uint64_t)) {return false;}
+    if (footer.indexOffset+footer.chunkNum*sizeof(uint64_t)+sizeof(footer) != file.size()) {return false;}
+
+    chunkOffsets.resize((size_t)footer.chunkNum);
+    if (footer.chunkNum > 0) {memcpy(chunkOffsets.data(), file.data()+footer.indexOffset, sizeof(uint64_t)*footer.chunkNum);}
+    for (size_t chunkIdx = 0; chunkIdx < chunkOffsets.size(); chunkIdx++) {
+        const uint64_t offset = chunkOffsets[chunkIdx];
+        if (offset%8 != 0 || offset < header.headerBytes || offset+sizeof(E4RecordChunkHeader_t) > footer.indexOffset)
+        {
+            chunkOffsets.clear();
+            return false;
+        }
+    }
+    packetNum = footer.packetNum;
+    chunkFlags = footer.chunkFlags;
+
+    // The envelope levels lie between the last chunk and the index.
+    E4RecordChunkHeader_t chunkHeader;
+    if (chunkOffsets.empty()) {findLevels(header.headerBytes, footer.indexOffset);}
+    else if (getChunkHeader(chunkOffsets.size()-1, chunkHeader)) {findLevels(chunkEnd(chunkOffsets.size()-1, chunkHeader), footer.indexOffset);}
+    return true;
+}
+
+void RecordReader::scanChunks()
+{
+    // Walk the chunk headers until the first truncated or invalid one, skipping the envelope blocks.
+    uint64_t offset = header.headerBytes;
+    E4RecordChunkHeader_t chunkHeader;
+
+    while (offset+sizeof(chunkHeader) <= file.size()) {
+        memcpy(&chunkHeader, file.data()+offset, sizeof(chunkHeader));
+        if (chunkHeader.magic == E4_RECORD_ENVELOPE_MAGIC)
+        {
+            if (offset+sizeof(chunkHeader)+chunkHeader.payloadBytes > file.size()) {break;}
+            offset += sizeof(chunkHeader)+chunkHeader.payloadBytes;
+            continue;
+        }
+        if (chunkHeader.magic != E4_RECORD_CHUNK_MAGIC) {break;}
+        if (offset+sizeof(chunkHeader)+chunkHeader.payloadBytes > file.size()) {break;}
+
+        chunkOffsets.push_back(offset);
+        packetNum += chunkHeader.packetNum;
+        chunkFlags |= chunkHeader.flags;
+        offset += (sizeof(chunkHeader)+chunkHeader.payloadBytes+7)/8*8;
+    }
+}
+
+void RecordReader::findLevels(uint64_t offset, uint64_t end)
+{
+    E4RecordEnvelopeHeader_t envelopeHeader;
+
+    while (offset+sizeof(envelopeHeader) <= end) {
+        memcpy(&envelopeHeader, file.data()+offset, sizeof(envelopeHeader));
+        if (envelopeHeader.magic != E4_RECORD_ENVELOPE_MAGIC) {break;}
+        if (envelopeHeader.payloadBytes != (uint64_t)envelopeHeader.entryNum*sizeof(E4RecordEnvelope_t)) {break;}
+        if (offset+sizeof(envelopeHeader)+envelopeHeader.payloadBytes > end) {break;}
+
+        if (envelopeHeader.level == levelOffsets.size()+1) {levelOffsets.push_back(offset);}
+        offset += sizeof(envelopeHeader)+envelopeHeader.payloadBytes;
+    }
+}
+
+uint64_t RecordReader::chunkEnd(size_t chunkIdx, const E4RecordChunkHeader_t &chunkHeader) const
+{
+    return chunkOffsets[chunkIdx]+(sizeof(chunkHeader)+chunkHeader.payloadBytes+7)/8*8;
+}
+
+bool RecordReader::getChunkEnvelope(size_t chunkIdx, const E4RecordChunkHeader_t &chunkHeader, uint64_t &entriesOffset) const
+{
+    const uint64_t offset = chunkEnd(chunkIdx, chunkHeader);
+    E4RecordEnvelopeHeader_t envelopeHeader;
+
+    if (offset+sizeof(envelopeHeader) > file.size()) {return false;}
+    memcpy(&envelopeHeader, file.data()+offset, sizeof(envelopeHeader));
+    if (envelopeHeader.magic != E4_RECORD_ENVELOPE_MAGIC ||
+            envelopeHeader.level != 0 ||
+            envelopeHeader.firstPacketIdx != chunkHeader.firstPacketIdx ||
+            envelopeHeader.entryNum != (chunkHeader.packetNum+E4_RECORD_ENVELOPE_PACKETS-1)/E4_RECORD_ENVELOPE_PACKETS ||
+            envelopeHeader.payloadBytes != (uint64_t)envelopeHeader.entryNum*sizeof(E4RecordEnvelope_t) ||
+            offset+sizeof(envelopeHeader)+envelopeHeader.payloadBytes > file.size())
+    {
+        return false;
+    }
+    entriesOffset = offset+sizeof(envelopeHeader);
+    return true;
+}
+
+size_t RecordReader::lowerChunk(unsigned long long packetIdx) const
+{
+    // Binary search for the first chunk ending after packetIdx, which may begin after it if packetIdx falls in a gap.
+    size_t lowIdx = 0;
+    size_t highIdx = chunkOffsets.size();
+    E4RecordChunkHeader_t chunkHeader;
+    while (lowIdx < highIdx) {
+        const size_t midIdx = (lowIdx+highIdx)/2;
+        if (!getChunkHeader(midIdx, chunkHeader)) {return chunkOffsets.size();}
+        if (chunkHeader.firstPacketIdx+chunkHeader.packetNum <= packetIdx) {lowIdx = midIdx+1;}
+        else {highIdx = midIdx;}
+    }
+    return lowIdx;
+}
+
+bool RecordReader::getChunkHeader(size_t chunkIdx, E4RecordChunkHeader_t &chunkHeader) const
+{
+    if (chunkIdx >= chunkOffsets.size()) {return false;}
+    if (chunkOffsets[chunkIdx] > file.size() || file.size()-chunkOffsets[chunkIdx] < sizeof(chunkHeader)) {return false;}
+    memcpy(&chunkHeader, file.data()+chunkOffsets[chunkIdx], sizeof(chunkHeader));
+    return chunkHeader.magic == E4_RECORD_CHUNK_MAGIC;
+}
+
+bool RecordReader::findChunk(unsigned long long packetIdx, size_t &chunkIdx) const
+{
+    E4RecordChunkHeader_t chunkHeader;
+    if (chunkOffsets.empty() || packetIdx < header.firstPacketIdx) {return false;}
+
+    // Every chunk but the last is full, unless the acquisition had gaps: try the direct guess first.
+    unsigned long long guess = (packetIdx-header.firstPacketIdx)/header.chunkPackets;
+    if (guess >= chunkOffsets.size()) {guess = chunkOffsets.size()-1;}
+    chunkIdx = (size_t)guess;
+    if (!getChunkHeader(chunkIdx, chunkHeader)) {return false;}
+    if (packetIdx >= chunkHeader.firstPacketIdx && packetIdx < chunkHeader.firstPacketIdx+chunkHeader.packetNum) {return true;}
+
+    // Fall back to a binary search on the first packet index of the chunks.
+    size_t lowIdx = 0;
+    size_t highIdx = chunkOffsets.size();
+    while (highIdx-lowIdx > 1) {
+        const size_t midIdx = (lowIdx+highIdx)/2;
+        if (!getChunkHeader(midIdx, chunkHeader)) {return false;}
+        if (chunkHeader.firstPacketIdx <= packetIdx) {lowIdx = midIdx;}
+        else {highIdx = midIdx;}
+    }
+    chunkIdx = lowIdx;
+    if (!getChunkHeader(chunkIdx, chunkHeader)) {return false;}
+    return packetIdx >= chunkHeader.firstPacketIdx && packetIdx < chunkHeader.firstPacketIdx+chunkHeader.packetNum;
+}
+
+bool RecordReader::readChunk(size_t chunkIdx, const E4RecordChunkHeader_t &chunkHeader, unsigned int firstPacket, unsigned int packetsNum, float * dst) const
+{
+    const unsigned char * payload = file.data()+chunkOffsets[chunkIdx]+sizeof(chunkHeader);
+    if (chunkOffsets[chunkIdx]+sizeof(chunkHeader)+chunkHeader.payloadBytes > file.size()) {return false;}
+
+    if (chunkHeader.flags & E4_CHUNK_COMPRESSED)
+    {
+        if (decodedChunkIdx != chunkIdx)
+        {
+            decodedChunk.resize((size_t)chunkHeader.packetNum*header.channelNum);
+            decodedChunkIdx = (size_t)-1;
+            if (!TraceCodec::decompress(payload, chunkHeader.payloadBytes, chunkHeader.packetNum, header.channelNum, decodedChunk.data())) {return false;}
+            decodedChunkIdx = chunkIdx;
+        }
+        payload = (const unsigned char *)decodedChunk.data();
+    }
+    else if (chunkHeader.payloadBytes < sizeof(float)*header.channelNum*chunkHeader.packetNum) {return false;}
+
+    memcpy(dst, payload+sizeof(float)*header.channelNum*firstPacket, sizeof(float)*header.channelNum*packetsNum);
+    return true;
+}
+
+/*! \brief Returns the display point holding the data packet at \a packetOffset, clamped to the range of points.
+ */
+static size_t pointIdx(unsigned long long packetOffset, unsigned long long firstOffset, unsigned long long packetsNum, size_t pointsNum)
+{
+    if (packetOffset <= firstOffset) {return 0;}
+    const size_t idx = (size_t)((double)(packetOffset-firstOffset)*(double)pointsNum/(double)packetsNum);
+    return idx < pointsNum ? idx : pointsNum-1;
+}
+
+bool RecordReader::readEnvelope(unsigned long long packetOffset, unsigned long long packetsNum, size_t pointsNum, float * minimum, float * maximum, float * mean) const
+{
+    if (pointsNum == 0 || packetsNum == 0 || header.channelNum != EDL_CHANNEL_NUM) {return false;}
+
+    std::vector <E4RecordEnvelope_t> points(pointsNum);
+    for (size_t idx = 0; idx < pointsNum; idx++) {EnvelopeBuilder::clear(points[idx]);}
+
+    const double pointPackets = (double)packetsNum/(double)pointsNum;
+    const unsigned long long endOffset = packetOffset+packetsNum;
+    E4RecordEnvelope_t entry;
+
+    unsigned int level = (unsigned int)levelOffsets.size();
+    while (level > 0 && (double)EnvelopeBuilder::levelPackets(level, header.chunkPackets) > pointPackets) {level--;}
+
+    if (level > 0)
+    {
+        // Entries of levels 1 and above are indexed by their offset from the first data packet.
+        E4RecordEnvelopeHeader_t envelopeHeader;
+        const uint64_t offset = levelOffsets[level-1];
+        const unsigned long long span = EnvelopeBuilder::levelPackets(level, header.chunkPackets);
+        memcpy(&envelopeHeader, file.data()+offset, sizeof(envelopeHeader));
+
+        for (unsigned long long entryIdx = packetOffset/span; entryIdx < envelopeHeader.entryNum && entryIdx*span < endOffset; entryIdx++)
+        {
+            memcpy(&entry, file.data()+offset+sizeof(envelopeHeader)+entryIdx*sizeof(entry), sizeof(entry));
+            EnvelopeBuilder::merge(points[pointIdx(entryIdx*span, packetOffset, packetsNum, pointsNum)], entry);
+        }
+    }
+    else
+    {
+        // Level 0 entries follow their chunk; spans shorter than them, and chunks without them, are read packet by packet.
+        const bool useEntries = pointPackets >= E4_RECORD_ENVELOPE_PACKETS;
+        const unsigned long long firstIdx = header.firstPacketIdx+packetOffset;
+        const unsigned long long endIdx = header.firstPacketIdx+endOffset;
+        E4RecordChunkHeader_t chunkHeader;
+        uint64_t entriesOffset;
+
+        for (size_t chunkIdx = lowerChunk(firstIdx); chunkIdx < chunkOffsets.size(); chunkIdx++)
+        {
+            if (!getChunkHeader(chunkIdx, chunkHeader) || chunkHeader.firstPacketIdx >= endIdx) {break;}
+
+            const unsigned long long chunkFirstIdx = chunkHeader.firstPacketIdx;
+            const unsigned long long chunkEndIdx = chunkFirstIdx+chunkHeader.packetNum;
+            const unsigned long long fromIdx = firstIdx > chunkFirstIdx ? firstIdx : chunkFirstIdx;
+            const unsigned long long toIdx = endIdx < chunkEndIdx ? endIdx : chunkEndIdx;
+            if (fromIdx >= toIdx) {continue;}
+
+            if (useEntries && getChunkEnvelope(chunkIdx, chunkHeader, entriesOffset))
+            {
+                for (unsigned long long entryIdx = (fromIdx-chunkFirstIdx)/E4_RECORD_ENVELOPE_PACKETS;
+                     chunkFirstIdx+entryIdx*E4_RECORD_ENVELOPE_PACKETS < toIdx; entryIdx++)
+                {
+                    const unsigned long long entryFirstIdx = chunkFirstIdx+entryIdx*E4_RECORD_ENVELOPE_PACKETS;
+                    memcpy(&entry, file.data()+entriesOffset+entryIdx*sizeof(entry), sizeof(entry));
+                    EnvelopeBuilder::merge(points[pointIdx(entryFirstIdx-header.firstPacketIdx, packetOffset, packetsNum, pointsNum)], entry);
+                }
+                continue;
+            }
+
+            const unsigned int firstPacket = (unsigned int)(fromIdx-chunkFirstIdx);
+            const unsigned int n = (unsigned int)(toIdx-fromIdx);
+            std::vector <float> packets((size_t)n*EDL_CHANNEL_NUM);
+            if (!readChunk(chunkIdx, chunkHeader, firstPacket, n, packets.data())) {break;}
+
+            for (unsigned int packetIdx = 0; packetIdx < n; packetIdx++)
+            {
+                const float * packet = &packets[(size_t)packetIdx*EDL_CHANNEL_NUM];
+                entry.packetNum = 1;
+                memcpy(entry.minimum, packet, sizeof(entry.minimum));
+                memcpy(entry.maximum, packet, sizeof(entry.maximum));
+                memcpy(entry.mean, packet, sizeof(entry.mean));
+                EnvelopeBuilder::merge(points[pointIdx(fromIdx+packetIdx-header.firstPacketIdx, packetOffset, packetsNum, pointsNum)], entry);
+            }
+        }
+    }
+
+    for (size_t idx = 0; idx < pointsNum; idx++)
+    {
+        const E4RecordEnvelope_t &point = points[idx];
+        for (unsigned int channelIdx = 0; channelIdx < EDL_CHANNEL_NUM; channelIdx++)
+        {
+            const size_t dstIdx = idx*EDL_CHANNEL_NUM+channelIdx;
+            minimum[dstIdx] = point.packetNum > 0 ? point.minimum[channelIdx] : NAN;
+            maximum[dstIdx] = point.packetNum > 0 ? point.maximum[channelIdx] : NAN;
+            mean[dstIdx] = point.packetNum > 0 ? point.mean[channelIdx] : NAN;
+        }
+    }
+    return true;
+}
@@ -0,0 +1,130 @@
+/*! \file e4_recordreader.h
+ * \brief Declares class RecordReader.
+ */
+#ifndef E4_RECORDREADER_H
+#define E4_RECORDREADER_H
+
+#include <vector>
+
+#include "e4_compression.h"
+#include "e4_mappedfile.h"
+#include "e4_recordformat.h"
+
+/*! \struct E4RecordingInfo_t
+ * \brief Struct that contains a summary of a recording file.
+ * Returned by getRecordingInfo.
+ */
+typedef struct {
+    unsigned int channelNum; /*!< Number of values per data packet. */
+    unsigned int chunkPackets; /*!< Number of data packets per chunk. */
+    double samplingRateHz; /*!< Sampling rate, 0 if unknown. */
+    unsigned long long startTimeMs; /*!< Time of the first data packet, in ms since the Unix epoch. */
+    unsigned long long firstPacketIdx; /*!< Index of the first data packet, counted from the start of the acquisition. */
+    unsigned long long packetNum; /*!< Number of data packets in the file. */
+    unsigned long long chunkNum; /*!< Number of chunks in the file. */
+    unsigned int chunkFlags; /*!< Combination of the E4_CHUNK_* flags of all of the chunks. */
+    unsigned int indexed; /*!< 1 if the index was read from the file, 0 if it was rebuilt because the file was not closed properly. */
+} E4RecordingInfo_t;
+
+/*! \class RecordReader
+ * \brief Reads a recording file through a memory mapping, see e4_recordformat.h.
+ * Compressed chunks are decompressed transparently. A RecordReader must not be used by several threads at the same time,
+ * except for RecordReader::decodeChunk.
+ * Display points over any range of data packets are computed from the envelope levels stored in the file,
+ * see RecordReader::readEnvelope, so that zooming out over a long recording does not read its data packets.
+ */
+class RecordReader {
+public:
+    RecordReader();
+
+    /*! \brief Maps a recording file and loads its index.
+     * If the file has no valid footer the index is rebuilt by walking the chunks.
+     *
+     * \param path [in] Path of the recording file.
+     * \return false if the file could not be mapped or is not a recording file.
+     */
+    bool open(EDL_IN const char * path);
+
+    /*! \brief Unmaps the file.
+     */
+    void close(EDL_VOID);
+
+    /*! \brief Returns the header of the recording.
+     */
+    const E4RecordHeader_t &getHeader(EDL_VOID) const;
+
+    /*! \brief Returns a summary of the recording.
+     */
+    void getInfo(EDL_OUT E4RecordingInfo_t &info) const;
+
+    /*! \brief Copies data packets out of the recording.
+     * Locating the first data packet takes constant time. Reading stops at the end of the file or at a gap in the packet indexes.
+     *
+     * \param packetOffset [in] Index of the first data packet to read, relative to E4RecordHeader_t::firstPacketIdx.
+     * \param maxPackets [in] Maximum number of data packets to read.
+     * \param dst [out] Buffer with room for \a maxPackets data packets of E4RecordHeader_t::channelNum values.
+     * \return Number of data packets actually read.
+     */
+    size_t read(EDL_IN unsigned long long packetOffset,
+                EDL_IN size_t maxPackets,
+                EDL_OUT float * dst) const;
+
+    /*! \brief Summarizes a range of data packets into display points: the minimum, maximum and mean of every channel
+     * over \a pointsNum consecutive spans of equal length.
+     * The data is taken from the coarsest envelope level whose entries are not longer than a span, so that
+     * at most #E4_RECORD_ENVELOPE_FACTOR entries per point are read whatever the length of the range;
+     * only spans shorter than #E4_RECORD_ENVELOPE_PACKETS data packets are computed from the data packets.
+     * Envelope entries are summed into the point holding their first data packet, so point boundaries are accurate
+     * to the length of an entry. Files written before version 2 have no envelope and are summarized from their data packets.
+     *
+     * \param packetOffset [in] Index of the first data packet of the range, relative to E4RecordHeader_t::firstPacketIdx.
+     * \param packetsNum [in] Number of data packets in the range.
+     * \param pointsNum [in] Number of display points.
+     * \param minimum [out] Buffer with room for \a pointsNum points of E4RecordHeader_t::channelNum values: minimum of each channel.
+     * \param maximum [out] Same as \a minimum, for the maximum of each channel.
+     * \param mean [out] Same as \a minimum, for the mean of each channel.
+     * Points without data packets, past the end of the file or in a gap of the acquisition, are set to NaN.
+     * \return false if the arguments are invalid or if the channels of the file are not those of #E4RecordEnvelope_t.
+     */
+    bool readEnvelope(EDL_IN unsigned long long packetOffset,
+                      EDL_IN unsigned long long packetsNum,
+                      EDL_IN size_t pointsNum,
+                      EDL_OUT float * minimum,
+                      EDL_OUT float * maximum,
+                      EDL_OUT float * mean) const;
+
+    /*! \brief Copies out all of the data packets of a chunk. Unlike the other methods, it may be called from several threads at once.
+     *
+     * \param chunkIdx [in] Index of the chunk, from 0 to E4RecordingInfo_t::chunkNum minus one.
+     * \param chunkHeader [out] Header of the chunk.
+     * \param dst [out] Buffer with room for E4RecordHeader_t::chunkPackets data packets of E4RecordHeader_t::channelNum values.
+     * \return false if the chunk is missing, truncated or corrupt.
+     */
+    bool decodeChunk(EDL_IN size_t chunkIdx,
+                     EDL_OUT E4RecordChunkHeader_t &chunkHeader,
+                     EDL_OUT float * dst) const;
+
+private:
+    bool loadIndex(EDL_VOID);
+    void scanChunks(EDL_VOID);
+    void findLevels(uint64_t offset, uint64_t end);
+    uint64_t chunkEnd(size_t chunkIdx, const E4RecordChunkHeader_t &chunkHeader) const;
+    bool getChunkEnvelope(size_t chunkIdx, const E4RecordChunkHeader_t &chunkHeader, uint64_t &entriesOffset) const;
+    size_t lowerChunk(unsigned long long packetIdx) const;
+    bool getChunkHeader(size_t chunkIdx, E4RecordChunkHeader_t &chunkHeader) const;
+    bool findChunk(unsigned long long packetIdx, size_t &chunkIdx) const;
+    bool readChunk(size_t chunkIdx, const E4RecordChunkHeader_t &chunkHeader, unsigned int firstPacket, unsigned int packetsNum, float * dst) const;
+
+    MappedFile file;
+    E4RecordHeader_t header;
+    std::vector <uint64_t> chunkOffsets;
+    std::vector <uint64_t> levelOffsets; /*!< File offsets of the envelope blocks of levels 1 and above. */
+    unsigned long long packetNum;
+    unsigned int chunkFlags;
+    bool indexed;
+
+    mutable std::vector <float> decodedChunk; /*!< Last decompressed chunk, kept for sequential reads. */
+    mutable size_t decodedChunkIdx;
+};
+
+#endif // E4_RECORDREADER_H
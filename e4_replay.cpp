@@ -0,0 +1,284 @@
+/*! \file e4_replay.cpp
+ * \brief Defines class ReplayBackend.
+ */
+#include <atomic>
+#include <climits>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+
+#include "e4_replay.h"
+
+/*! Number of replays opened, so that every replayed device has its own identifier. */
+static std::atomic <unsigned int> replayNum(0);
+
+ReplayBackend::ReplayBackend(const E4ReplayConfig_t &config) :
+    config(config),
+    path(config.path != NULL ? config.path : ""),
+    connected(false),
+    packetNum(0),
+    chunkNum(0),
+    nextDecodeIdx(0),
+    readChunkIdx(0),
+    stopping(false),
+    chunkAcquired(false),
+    chunkPos(0),
+    chunkReported(false),
+    nextPacketIdx(0),
+    ended(false),
+    position(0),
+    startPosition(0)
+{
+    char deviceId[32];
+    snprintf(deviceId, sizeof(deviceId), "REPLAY%u", replayNum++);
+    id = deviceId;
+
+    this->config.path = NULL;
+    if (!(this->config.speedFactor > 0.0)) {this->config.speedFactor = 1.0;}
+    if (this->config.threadNum == 0)
+    {
+        const unsigned int coreNum = std::thread::hardware_concurrency();
+        this->config.threadNum = coreNum > 1 ? coreNum-1 : 1;
+    }
+    if (this->config.threadNum > E4_REPLAY_MAX_THREADS) {this->config.threadNum = E4_REPLAY_MAX_THREADS;}
+}
+
+ReplayBackend::~ReplayBackend()
+{
+    stopDecoding();
+}
+
+EdlErrorCode_t ReplayBackend::detectDevices(std::vector <std::string> &deviceIds)
+{
+    deviceIds.assign(1, id);
+    return EdlSuccess;
+}
+
+EdlErrorCode_t ReplayBackend::connectDevice(std::string deviceId)
+{
+    if (connected) {return EdlDeviceAlreadyConnectedError;}
+    if (deviceId != id || !reader.open(path.c_str())) {return EdlDeviceConnectionError;}
+    if (reader.getHeader().channelNum != EDL_CHANNEL_NUM)
+    {
+        reader.close();
+        return EdlDeviceConnectionError;
+    }
+
+    E4RecordingInfo_t info;
+    reader.getInfo(info);
+    packetNum = info.packetNum;
+    chunkNum = (size_t)info.chunkNum;
+
+    connected = true;
+    chunkAcquired = false;
+    chunkPos = 0;
+    chunkReported = false;
+    nextPacketIdx = reader.getHeader().firstPacketIdx;
+    ended = false;
+    position = 0;
+    settings.clear();
+    startDecoding();
+    purgeData();
+    return EdlSuccess;
+}
+
+EdlErrorCode_t ReplayBackend::disconnectDevice()
+{
+    if (!connected) {return EdlDeviceNotConnectedError;}
+    stopDecoding();
+    reader.close();
+    connected = false;
+    return EdlSuccess;
+}
+
+EdlErrorCode_t ReplayBackend::getDeviceStatus(EdlDeviceStatus_t &status)
+{
+    if (!connected) {return EdlDeviceNotConnectedError;}
+
+    const unsigned long long availableNum = availablePackets();
+    status.availableDataPackets = availableNum < UINT_MAX ? (unsigned int)availableNum : UINT_MAX;
+    status.bufferOverflowFlag = false;
+    status.lostDataFlag = false;
+
+    // The recorded flags of a chunk are reported by the status preceding its first read, as they were recorded.
+    if (availableNum > 0 && chunkPos == 0 && !chunkReported && acquireChunk())
+    {
+        const E4RecordChunkHeader_t &chunkHeader = slotHeaders[readChunkIdx%slots.size()];
+        status.bufferOverflowFlag = (chunkHeader.flags & E4_CHUNK_BUFFER_OVERFLOW) != 0;
+        status.lostDataFlag = (chunkHeader.flags & E4_CHUNK_LOST_DATA) != 0 || chunkHeader.firstPacketIdx != nextPacketIdx;
+        chunkReported = true;
+    }
+    return EdlSuccess;
+}
+
+EdlErrorCode_t ReplayBackend::readData(unsigned int dataToRead, unsigned int &dataRead, std::vector <float> &buffer)
+{
+    dataRead = 0;
+    if (!connected) {return EdlDeviceNotConnectedError;}
+
+    unsigned long long maxNum = availablePackets();
+    if (maxNum > dataToRead) {maxNum = dataToRead;}
+    if (maxNum > E4_REPLAY_BATCH_PACKETS) {maxNum = E4_REPLAY_BATCH_PACKETS;}
+    if (buffer.size() < (size_t)maxNum*EDL_CHANNEL_NUM) {buffer.resize((size_t)maxNum*EDL_CHANNEL_NUM);}
+
+    while (dataRead < maxNum && acquireChunk()) {
+        const size_t slotIdx = readChunkIdx%slots.size();
+        const E4RecordChunkHeader_t &chunkHeader = slotHeaders[slotIdx];
+
+        // Stop before a chunk whose flags the next status must report.
+        if (chunkPos == 0 && !chunkReported && dataRead > 0 &&
+                ((chunkHeader.flags & (E4_CHUNK_BUFFER_OVERFLOW | E4_CHUNK_LOST_DATA)) != 0 || chunkHeader.firstPacketIdx != nextPacketIdx))
+        {
+            break;
+        }
+
+        unsigned int n = chunkHeader.packetNum-chunkPos;
+        if (n > maxNum-dataRead) {n = (unsigned int)(maxNum-dataRead);}
+        memcpy(&buffer[(size_t)dataRead*EDL_CHANNEL_NUM], &slots[slotIdx][(size_t)chunkPos*EDL_CHANNEL_NUM], sizeof(float)*EDL_CHANNEL_NUM*n);
+        chunkPos += n;
+        dataRead += n;
+        position += n;
+        if (chunkPos == chunkHeader.packetNum) {releaseChunk();}
+    }
+
+    if (dataRead > 0) {lastReadTime = std::chrono::steady_clock::now();}
+    return dataRead < dataToRead ? EdlNotEnoughAvailableDataError : EdlSuccess;
+}
+
+EdlErrorCode_t ReplayBackend::purgeData()
+{
+    if (!connected) {return EdlDeviceNotConnectedError;}
+
+    // Nothing is discarded: the pacing starts over from the current position, so that starting an acquisition replays the file from there.
+    startTime = std::chrono::steady_clock::now();
+    lastReadTime = startTime;
+    startPosition = position;
+    return EdlSuccess;
+}
+
+EdlErrorCode_t ReplayBackend::setCommand(EdlCommandId_t commandId, EdlCommandStruct_t &commandStruct, bool sendFlag)
+{
+    if (!connected) {return EdlDeviceNotConnectedError;}
+    if ((unsigned int)commandId >= EdlCommandIdNum) {return EdlCommandIdOutOfRangeError;}
+
+    settings.setCommand(commandId, commandStruct, sendFlag);
+    return EdlSuccess;
+}
+
+const E4RecordHeader_t &ReplayBackend::getHeader() const
+{
+    return reader.getHeader();
+}
+
+void ReplayBackend::getStats(E4ReplayStats_t &stats) const
+{
+    const bool finished = ended || position >= packetNum;
+    const std::chrono::steady_clock::time_point endTime = finished ? lastReadTime : std::chrono::steady_clock::now();
+
+    stats.packetNum = packetNum;
+    stats.packetsReplayed = position;
+    stats.samplingRateHz = connected ? reader.getHeader().samplingRateHz : 0.0;
+    stats.elapsedS = std::chrono::duration <double> (endTime-startTime).count();
+    stats.packetsPerSecond = stats.elapsedS > 0.0 ? (position-startPosition)/stats.elapsedS : 0.0;
+    stats.threadNum = config.threadNum;
+    stats.finished = finished ? 1 : 0;
+}
+
+void ReplayBackend::startDecoding()
+{
+    const size_t slotNum = (size_t)config.threadNum*E4_REPLAY_CHUNKS_AHEAD;
+
+    slots.assign(slotNum, std::vector <float>((size_t)reader.getHeader().chunkPackets*EDL_CHANNEL_NUM));
+    slotHeaders.resize(slotNum);
+    slotChunkIdxs.assign(slotNum, SIZE_MAX);
+    slotValid.assign(slotNum, 0);
+    nextDecodeIdx = 0;
+    readChunkIdx = 0;
+    stopping = false;
+    for (unsigned int threadIdx = 0; threadIdx < config.threadNum; threadIdx++) {threads.push_back(std::thread(&ReplayBackend::decode, this));}
+}
+
+void ReplayBackend::stopDecoding()
+{
+    {
+        std::lock_guard <std::mutex> lock(slotMutex);
+        stopping = true;
+    }
+    slotFreed.notify_all();
+    for (size_t threadIdx = 0; threadIdx < threads.size(); threadIdx++) {threads[threadIdx].join();}
+    threads.clear();
+}
+
+void ReplayBackend::decode()
+{
+    std::unique_lock <std::mutex> lock(slotMutex);
+
+    for (;;) {
+        // A chunk is decoded once the one that used its slot before was read.
+        slotFreed.wait(lock, [this] {return stopping || (nextDecodeIdx < chunkNum && nextDecodeIdx < readChunkIdx+slots.size());});
+        if (stopping) {return;}
+
+        const size_t chunkIdx = nextDecodeIdx++;
+        const size_t slotIdx = chunkIdx%slots.size();
+        E4RecordChunkHeader_t chunkHeader;
+
+        lock.unlock();
+        const bool valid = reader.decodeChunk(chunkIdx, chunkHeader, slots[slotIdx].data());
+        lock.lock();
+
+        slotHeaders[slotIdx] = chunkHeader;
+        slotValid[slotIdx] = valid ? 1 : 0;
+        slotChunkIdxs[slotIdx] = chunkIdx;
+        slotDecoded.notify_all();
+    }
+}
+
+bool ReplayBackend::acquireChunk()
+{
+    if (chunkAcquired) {return true;}
+    if (ended || readChunkIdx >= chunkNum) {return false;}
+
+    const size_t slotIdx = readChunkIdx%slots.size();
+    std::unique_lock <std::mutex> lock(slotMutex);
+    slotDecoded.wait(lock, [this, slotIdx] {return slotChunkIdxs[slotIdx] == readChunkIdx;});
+    if (!slotValid[slotIdx])
+    {
+        // A corrupt chunk ends the replay, as the end of the file would.
+        ended = true;
+        return false;
+    }
+    chunkAcquired = true;
+    return true;
+}
+
+void ReplayBackend::releaseChunk()
+{
+    const E4RecordChunkHeader_t &chunkHeader = slotHeaders[readChunkIdx%slots.size()];
+    nextPacketIdx = chunkHeader.firstPacketIdx+chunkHeader.packetNum;
+    chunkAcquired = false;
+    chunkPos = 0;
+    chunkReported = false;
+
+    {
+        std::lock_guard <std::mutex> lock(slotMutex);
+        slotChunkIdxs[readChunkIdx%slots.size()] = SIZE_MAX;
+        readChunkIdx++;
+    }
+    slotFreed.notify_all();
+}
+
+unsigned long long ReplayBackend::availablePackets() const
+{
+    if (ended || position >= packetNum) {return 0;}
+    const unsigned long long remainingNum = packetNum-position;
+    const double samplingRateHz = reader.getHeader().samplingRateHz;
+
+    // Without a recorded sampling rate there is no pace to follow.
+    if (config.asFastAsPossible || !(samplingRateHz > 0.0)) {return remainingNum;}
+
+    const double elapsedS = std::chrono::duration <double> (std::chrono::steady_clock::now()-startTime).count();
+    const unsigned long long releasedNum = (unsigned long long)(elapsedS*samplingRateHz*config.speedFactor);
+    const unsigned long long readNum = position-startPosition;
+    if (releasedNum <= readNum) {return 0;}
+    return releasedNum-readNum < remainingNum ? releasedNum-readNum : remainingNum;
+}
@@ -0,0 +1,142 @@
+/*! \file e4_replay.h
+ * \brief Declares class ReplayBackend.
+ */
+#ifndef E4_REPLAY_H
+#define E4_REPLAY_H
+
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "e4_backend.h"
+#include "e4_recordreader.h"
+#include "e4_settings.h"
+
+/*! \def E4_REPLAY_MAX_THREADS
+ * \brief Maximum number of threads decoding the chunks of a replayed file.
+ */
+#define E4_REPLAY_MAX_THREADS 8
+
+/*! \def E4_REPLAY_CHUNKS_AHEAD
+ * \brief Number of chunks each decoding thread may keep ready ahead of the reads.
+ */
+#define E4_REPLAY_CHUNKS_AHEAD 4
+
+/*! \def E4_REPLAY_BATCH_PACKETS
+ * \brief Maximum number of data packets returned by a read of a replayed file:
+ * the data packets left are read by the next poll, without waiting, so batches stay cache friendly.
+ */
+#define E4_REPLAY_BATCH_PACKETS 32768
+
+/*! \struct E4ReplayConfig_t
+ * \brief Struct that configures the replay of a recording file. Passed to openReplay.
+ */
+typedef struct {
+    const char * path; /*!< Recording file to replay, as written by startRecording or readData. */
+    double speedFactor; /*!< Pace of the data packets relative to the recorded sampling rate, e.g. 10 for 10 times faster than real time; 0 for real time. */
+    unsigned int asFastAsPossible; /*!< 1 to make the whole file available at once, ignoring \a speedFactor: the replay goes at the pace of the processing. */
+    unsigned int threadNum; /*!< Threads decoding the chunks ahead of the reads, up to #E4_REPLAY_MAX_THREADS; 0 for one per core but one. */
+} E4ReplayConfig_t;
+
+/*! \struct E4ReplayStats_t
+ * \brief Struct that contains the progress of a replay. Returned by getReplayStats.
+ */
+typedef struct {
+    unsigned long long packetNum; /*!< Data packets in the file. */
+    unsigned long long packetsReplayed; /*!< Data packets read from the file since it was opened. */
+    double samplingRateHz; /*!< Recorded sampling rate, 0 if unknown. */
+    double elapsedS; /*!< Time since the replay was last started, i.e. since the acquisition started, up to the last read once finished. */
+    double packetsPerSecond; /*!< Data packets read per second over \a elapsedS: the throughput of the processing when replaying as fast as possible. */
+    unsigned int threadNum; /*!< Threads decoding the chunks. */
+    unsigned int finished; /*!< 1 once every data packet was read, or a corrupt chunk ended the replay. */
+} E4ReplayStats_t;
+
+/*! \class ReplayBackend
+ * \brief EdlBackend producing the data packets of a recording file, so that a recorded run can be fed again
+ * through the acquisition and its processing stages, e.g. to try other filter or detector settings.
+ *
+ * The file is memory mapped, see RecordReader, and its chunks are decoded by a pool of threads, in parallel and ahead of the reads,
+ * into a window of chunk buffers; the reads then copy the data packets out in order, since the processing stages are sequential.
+ * Data packets become available at the recorded sampling rate times E4ReplayConfig_t::speedFactor, measured on the steady clock
+ * from the connection and from every purge, or all at once with E4ReplayConfig_t::asFastAsPossible; they are never lost.
+ * The status preceding the first read of a chunk reports the recorded EdlDeviceStatus_t::bufferOverflowFlag and
+ * EdlDeviceStatus_t::lostDataFlag of the chunk; a gap in the recorded packet indexes is reported as lost data.
+ * Commands are accepted and tracked as with EDL::setCommand, but do not change the replayed data.
+ */
+class ReplayBackend : public EdlBackend {
+public:
+    /*! \brief ReplayBackend constructor.
+     *
+     * \param config [in] Replay configuration; E4ReplayConfig_t::path is copied.
+     */
+    ReplayBackend(EDL_IN const E4ReplayConfig_t &config);
+
+    /*! \brief ReplayBackend destructor. Stops the decoding threads.
+     */
+    ~ReplayBackend();
+
+    EdlErrorCode_t detectDevices(EDL_OUT std::vector <std::string> &deviceIds);
+    EdlErrorCode_t connectDevice(EDL_IN std::string deviceId);
+    EdlErrorCode_t disconnectDevice(EDL_VOID);
+    EdlErrorCode_t getDeviceStatus(EDL_OUT EdlDeviceStatus_t &status);
+    EdlErrorCode_t readData(EDL_IN unsigned int dataToRead,
+                            EDL_OUT unsigned int &dataRead,
+                            EDL_OUT std::vector <float> &buffer);
+    EdlErrorCode_t purgeData(EDL_VOID);
+    EdlErrorCode_t setCommand(EDL_IN EdlCommandId_t commandId,
+                              EDL_IN EdlCommandStruct_t &commandStruct,
+                              EDL_IN bool sendFlag);
+
+    /*! \brief Returns the header of the replayed file, with the settings applied during the recording. Valid once connected.
+     */
+    const E4RecordHeader_t &getHeader(EDL_VOID) const;
+
+    /*! \brief Returns the progress of the replay. Like the other methods, it must be serialized with them by the caller.
+     */
+    void getStats(EDL_OUT E4ReplayStats_t &stats) const;
+
+private:
+    void startDecoding(EDL_VOID);
+    void stopDecoding(EDL_VOID);
+    void decode(EDL_VOID);
+    bool acquireChunk(EDL_VOID);
+    void releaseChunk(EDL_VOID);
+    unsigned long long availablePackets(EDL_VOID) const;
+
+    E4ReplayConfig_t config;
+    std::string path;
+    std::string id;
+    RecordReader reader;
+    DeviceSettings settings;
+    bool connected;
+    unsigned long long packetNum; /*!< Data packets in the file. */
+    size_t chunkNum;
+
+    std::mutex slotMutex; /*!< Guards the slot states, nextDecodeIdx, readChunkIdx and stopping. */
+    std::condition_variable slotDecoded; /*!< Signalled when a slot holds a decoded chunk. */
+    std::condition_variable slotFreed; /*!< Signalled when a slot is released by the reads, and on stop. */
+    std::vector <std::thread> threads;
+    std::vector <std::vector <float> > slots; /*!< Decoded chunks: chunk i goes to slot i % slots.size(). */
+    std::vector <E4RecordChunkHeader_t> slotHeaders;
+    std::vector <size_t> slotChunkIdxs; /*!< Index of the chunk decoded in each slot, SIZE_MAX if none. */
+    std::vector <unsigned char> slotValid; /*!< 0 if the chunk of the slot could not be decoded. */
+    size_t nextDecodeIdx; /*!< Next chunk to hand to a decoding thread. */
+    size_t readChunkIdx; /*!< Chunk being read. */
+    bool stopping;
+
+    bool chunkAcquired; /*!< The chunk being read is decoded and its slot may be used without the lock. */
+    unsigned int chunkPos; /*!< Data packets of the chunk being read already returned. */
+    bool chunkReported; /*!< The flags of the chunk being read were reported by a status. */
+    unsigned long long nextPacketIdx; /*!< Recorded index expected for the next chunk, to detect gaps. */
+    bool ended; /*!< A corrupt chunk ended the replay early. */
+
+    unsigned long long position; /*!< Data packets read since the connection. */
+    unsigned long long startPosition; /*!< Value of position when the pacing clock was last started. */
+    std::chrono::steady_clock::time_point startTime;
+    std::chrono::steady_clock::time_point lastReadTime;
+};
+
+#endif // E4_REPLAY_H
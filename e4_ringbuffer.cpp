@@ -0,0 +1,116 @@
+/*! \file e4_ringbuffer.cpp
+ * \brief Defines class PacketRing.
+ */
+#include <cstring>
+#include <new>
+
+#include "e4_ringbuffer.h"
+#include "e4_deinterleave.h"
+
+PacketRing::PacketRing() :
+    mask(0),
+    head(0),
+    tail(0)
+{
+}
+
+bool PacketRing::allocate(size_t capacityPackets)
+{
+    size_t capacityNum = 1;
+    while (capacityNum < capacityPackets) {capacityNum <<= 1;}
+
+    try
+    {
+        buffer.assign(capacityNum*EDL_CHANNEL_NUM, 0.0f);
+    }
+    catch (const std::bad_alloc &)
+    {
+        buffer.clear();
+        mask = 0;
+        return false;
+    }
+
+    mask = capacityNum-1;
+    head.store(0, std::memory_order_relaxed);
+    tail.store(0, std::memory_order_relaxed);
+    return true;
+}
+
+void PacketRing::release()
+{
+    std::vector <float>().swap(buffer);
+    mask = 0;
+    head.store(0, std::memory_order_relaxed);
+    tail.store(0, std::memory_order_relaxed);
+}
+
+size_t PacketRing::capacity() const
+{
+    return buffer.empty() ? 0 : mask+1;
+}
+
+size_t PacketRing::available() const
+{
+    return (size_t)(head.load(std::memory_order_acquire)-tail.load(std::memory_order_acquire));
+}
+
+size_t PacketRing::push(const float * packets, size_t packetsNum)
+{
+    const uint64_t h = head.load(std::memory_order_relaxed);
+    const uint64_t t = tail.load(std::memory_order_acquire);
+    const size_t freeNum = capacity()-(size_t)(h-t);
+    const size_t n = packetsNum < freeNum ? packetsNum : freeNum;
+    if (n == 0) {return 0;}
+
+    // Copy in at most two segments: up to the end of the storage, then from its beginning.
+    const size_t start = (size_t)h & mask;
+    const size_t firstNum = n < mask+1-start ? n : mask+1-start;
+    memcpy(&buffer[start*EDL_CHANNEL_NUM], packets, firstNum*EDL_CHANNEL_NUM*sizeof(float));
+    if (n > firstNum)
+    {
+        memcpy(&buffer[0], packets+firstNum*EDL_CHANNEL_NUM, (n-firstNum)*EDL_CHANNEL_NUM*sizeof(float));
+    }
+
+    head.store(h+n, std::memory_order_release);
+    return n;
+}
+
+size_t PacketRing::pop(float * dst, size_t maxPackets)
+{
+    const uint64_t t = tail.load(std::memory_order_relaxed);
+    const uint64_t h = head.load(std::memory_order_acquire);
+    const size_t readyNum = (size_t)(h-t);
+    const size_t n = maxPackets < readyNum ? maxPackets : readyNum;
+    if (n == 0) {return 0;}
+
+    const size_t start = (size_t)t & mask;
+    const size_t firstNum = n < mask+1-start ? n : mask+1-start;
+    memcpy(dst, &buffer[start*EDL_CHANNEL_NUM], firstNum*EDL_CHANNEL_NUM*sizeof(float));
+    if (n > firstNum)
+    {
+        memcpy(dst+firstNum*EDL_CHANNEL_NUM, &buffer[0], (n-firstNum)*EDL_CHANNEL_NUM*sizeof(float));
+    }
+
+    tail.store(t+n, std::memory_order_release);
+    return n;
+}
+
+size_t PacketRing::popChannelMajor(float * dst, size_t maxPackets, size_t channelStride)
+{
+    const uint64_t t = tail.load(std::memory_order_relaxed);
+    const uint64_t h = head.load(std::memory_order_acquire);
+    const size_t readyNum = (size_t)(h-t);
+    const size_t n = maxPackets < readyNum ? maxPackets : readyNum;
+    if (n == 0) {return 0;}
+
+    const size_t start = (size_t)t & mask;
+    const size_t firstNum = n < mask+1-start ? n : mask+1-start;
+    deinterleavePackets(&buffer[start*EDL_CHANNEL_NUM], firstNum, dst, channelStride);
+    if (n > firstNum)
+    {
+        deinterleavePackets(&buffer[0], n-firstNum, dst+firstNum, channelStride);
+    }
+
+    tail.store(t+n, std::memory_order_release);
+    return n;
+}
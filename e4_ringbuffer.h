@@ -0,0 +1,78 @@
+/*! \file e4_ringbuffer.h
+ * \brief Declares class PacketRing.
+ */
+#ifndef E4_RINGBUFFER_H
+#define E4_RINGBUFFER_H
+
+#include <atomic>
+#include <vector>
+#include <stdint.h>
+
+#include "edl_devicespecs.h"
+
+/*! \class PacketRing
+ * \brief Preallocated single-producer/single-consumer ring of data packets.
+ * Each slot holds one data packet of #EDL_CHANNEL_NUM floating point values, laid out as returned by EDL::readData.
+ * One thread may call PacketRing::push while another thread calls PacketRing::pop; no locks are taken.
+ */
+class PacketRing {
+public:
+    PacketRing();
+
+    /*! \brief Allocates the ring storage and empties the ring.
+     * Must not be called while a producer or a consumer is active.
+     *
+     * \param capacityPackets [in] Minimum number of data packets the ring can hold. Rounded up to a power of two.
+     * \return false if the storage could not be allocated.
+     */
+    bool allocate(size_t capacityPackets);
+
+    /*! \brief Frees the ring storage: the ring holds no data packets until allocated again.
+     * Must not be called while a producer or a consumer is active.
+     */
+    void release();
+
+    /*! \brief Number of data packets the ring can hold.
+     */
+    size_t capacity() const;
+
+    /*! \brief Number of data packets ready to be popped.
+     */
+    size_t available() const;
+
+    /*! \brief Copies data packets into the ring (producer side).
+     * Packets that do not fit are not copied.
+     *
+     * \param packets [in] Buffer of \a packetsNum data packets.
+     * \param packetsNum [in] Number of data packets in \a packets.
+     * \return Number of data packets actually copied.
+     */
+    size_t push(const float * packets, size_t packetsNum);
+
+    /*! \brief Copies data packets out of the ring (consumer side).
+     *
+     * \param dst [out] Buffer with room for \a maxPackets data packets.
+     * \param maxPackets [in] Maximum number of data packets to copy.
+     * \return Number of data packets actually copied.
+     */
+    size_t pop(float * dst, size_t maxPackets);
+
+    /*! \brief Moves data packets out of the ring into per-channel arrays (consumer side).
+     * Sample \a i of channel \a c is written to \a dst[c*\a channelStride + \a i].
+     *
+     * \param dst [out] Buffer of #EDL_CHANNEL_NUM arrays of at least \a maxPackets values each.
+     * \param maxPackets [in] Maximum number of data packets to move.
+     * \param channelStride [in] Distance in values between the beginnings of two consecutive channel arrays in \a dst.
+     * \return Number of data packets actually moved.
+     */
+    size_t popChannelMajor(float * dst, size_t maxPackets, size_t channelStride);
+
+private:
+    std::vector <float> buffer;
+    size_t mask;
+
+    alignas(64) std::atomic <uint64_t> head; /*!< Total packets pushed, written by the producer only. */
+    alignas(64) std::atomic <uint64_t> tail; /*!< Total packets popped, written by the consumer only. */
+};
+
+#endif // E4_RINGBUFFER_H
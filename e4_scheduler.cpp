@@ -0,0 +1,162 @@
+/*! \file e4_scheduler.cpp
+ * \brief Defines class ReadScheduler.
+ */
+#include <algorithm>
+#include <cstring>
+#include <thread>
+
+#ifdef _WIN32
+#include "windows.h"
+#ifndef CREATE_WAITABLE_TIMER_HIGH_RESOLUTION
+#define CREATE_WAITABLE_TIMER_HIGH_RESOLUTION 0x00000002
+#endif
+#endif
+
+#include "e4_scheduler.h"
+
+// Weight of the newest measurement in the running averages of the arrival rate and of the oversleep.
+#define E4_SCHEDULER_AVERAGING 0.125
+
+ReadScheduler::ReadScheduler() :
+    latencyTargetUs(E4_SCHEDULER_DEFAULT_LATENCY_US),
+    minBatchPackets(E4_SCHEDULER_DEFAULT_MIN_BATCH_PACKETS),
+    samplingRateHz(0.0),
+    timer(NULL)
+{
+#ifdef _WIN32
+    // Not supported before Windows 10 1803: fall back to Sleep.
+    timer = CreateWaitableTimerExW(NULL, NULL, CREATE_WAITABLE_TIMER_HIGH_RESOLUTION, TIMER_ALL_ACCESS);
+#endif
+    reset();
+}
+
+ReadScheduler::~ReadScheduler()
+{
+#ifdef _WIN32
+    if (timer != NULL) {CloseHandle((HANDLE)timer);}
+#endif
+}
+
+bool ReadScheduler::configure(const E4SchedulerConfig_t &config)
+{
+    if (config.latencyTargetUs > E4_SCHEDULER_MAX_LATENCY_US) {return false;}
+
+    std::lock_guard <std::mutex> lock(mutex);
+    latencyTargetUs = config.latencyTargetUs > 0 ? config.latencyTargetUs : E4_SCHEDULER_DEFAULT_LATENCY_US;
+    minBatchPackets = config.minBatchPackets > 0 ? config.minBatchPackets : E4_SCHEDULER_DEFAULT_MIN_BATCH_PACKETS;
+    return true;
+}
+
+void ReadScheduler::setSamplingRate(double samplingRateHz)
+{
+    std::lock_guard <std::mutex> lock(mutex);
+    this->samplingRateHz = samplingRateHz;
+    stats.rateEstimateHz = samplingRateHz;
+}
+
+void ReadScheduler::reset()
+{
+    std::lock_guard <std::mutex> lock(mutex);
+    polled = false;
+    leftoverPackets = 0;
+    batchNum = 0;
+    memset(&stats, 0, sizeof(stats));
+    stats.rateEstimateHz = samplingRateHz;
+    stats.pollIntervalUs = latencyTargetUs;
+}
+
+void ReadScheduler::wait(unsigned int availablePackets, unsigned int readPackets)
+{
+    const std::chrono::steady_clock::time_point pollTime = std::chrono::steady_clock::now();
+    double workUs;
+    double waitUs;
+
+    {
+        std::lock_guard <std::mutex> lock(mutex);
+        stats.polls++;
+        stats.packetsRead += readPackets;
+        if (readPackets == 0) {stats.emptyPolls++;}
+        else
+        {
+            batchNum++;
+            stats.lastBatchPackets = readPackets;
+            stats.maxBatchPackets = std::max(stats.maxBatchPackets, readPackets);
+            stats.meanBatchPackets = (double)stats.packetsRead/batchNum;
+        }
+
+        // The device was read and the batch processed since the previous wake up: count it in the interval.
+        workUs = polled ? std::chrono::duration <double, std::micro> (pollTime-wakeTime).count() : 0.0;
+        if (polled)
+        {
+            const double intervalUs = std::chrono::duration <double, std::micro> (pollTime-lastPollTime).count();
+            if (intervalUs > latencyTargetUs) {stats.latePolls++;}
+
+            // What the poll found beyond the leftovers arrived since the previous poll.
+            if (intervalUs > 0.0 && availablePackets >= leftoverPackets)
+            {
+                const double arrivalHz = (availablePackets-leftoverPackets)*1.0e6/intervalUs;
+                stats.rateEstimateHz = stats.rateEstimateHz > 0.0 ? stats.rateEstimateHz+E4_SCHEDULER_AVERAGING*(arrivalHz-stats.rateEstimateHz) : arrivalHz;
+            }
+        }
+        polled = true;
+        lastPollTime = pollTime;
+        leftoverPackets = availablePackets > readPackets ? availablePackets-readPackets : 0;
+
+        // Gather minBatchPackets, polling at least every half latency target,
+        // and at most every three quarters of it, leaving the rest for the jitter of the wake ups.
+        double intervalUs = 0.75*latencyTargetUs;
+        if (stats.rateEstimateHz > 0.0)
+        {
+            intervalUs = std::min(0.75*latencyTargetUs, std::max(minBatchPackets*1.0e6/stats.rateEstimateHz, 0.5*latencyTargetUs));
+        }
+        stats.pollIntervalUs = intervalUs;
+
+        if (leftoverPackets > 0)
+        {
+            stats.catchUpPolls++;
+            wakeTime = pollTime;
+            return;
+        }
+
+        // Wake up early by the usual oversleep, but by no more than half the interval, so as not to spin on a coarse timer.
+        waitUs = intervalUs-workUs-std::min(stats.oversleepUs, 0.5*intervalUs);
+        if (waitUs <= 0.0)
+        {
+            wakeTime = pollTime;
+            return;
+        }
+    }
+
+    const std::chrono::steady_clock::time_point waitStart = std::chrono::steady_clock::now();
+    sleepFor(waitUs);
+    const double waitedUs = std::chrono::duration <double, std::micro> (std::chrono::steady_clock::now()-waitStart).count();
+
+    std::lock_guard <std::mutex> lock(mutex);
+    wakeTime = std::chrono::steady_clock::now();
+    stats.waitMicroseconds += waitedUs;
+    stats.oversleepUs += E4_SCHEDULER_AVERAGING*(std::max(0.0, waitedUs-waitUs)-stats.oversleepUs);
+}
+
+void ReadScheduler::getStats(E4SchedulerStats_t &stats) const
+{
+    std::lock_guard <std::mutex> lock(mutex);
+    stats = this->stats;
+}
+
+void ReadScheduler::sleepFor(double microseconds)
+{
+#ifdef _WIN32
+    if (timer != NULL)
+    {
+        // Relative due time, in 100ns units.
+        LARGE_INTEGER dueTime;
+        dueTime.QuadPart = -(LONGLONG)(microseconds*10.0);
+        if (SetWaitableTimer((HANDLE)timer, &dueTime, 0, NULL, NULL, FALSE))
+        {
+            WaitForSingleObject((HANDLE)timer, INFINITE);
+            return;
+        }
+    }
+#endif
+    std::this_thread::sleep_for(std::chrono::microseconds((long long)microseconds));
+}
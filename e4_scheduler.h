@@ -0,0 +1,116 @@
+/*! \file e4_scheduler.h
+ * \brief Declares class ReadScheduler.
+ */
+#ifndef E4_SCHEDULER_H
+#define E4_SCHEDULER_H
+
+#include <chrono>
+#include <mutex>
+
+#include "edl_global.h"
+
+/*! \def E4_SCHEDULER_DEFAULT_LATENCY_US
+ * \brief Default longest time a data packet waits in the device before being read.
+ */
+#define E4_SCHEDULER_DEFAULT_LATENCY_US 2000
+
+/*! \def E4_SCHEDULER_MAX_LATENCY_US
+ * \brief Highest latency target, which also bounds how long stopping a reader takes.
+ */
+#define E4_SCHEDULER_MAX_LATENCY_US 100000
+
+/*! \def E4_SCHEDULER_DEFAULT_MIN_BATCH_PACKETS
+ * \brief Default number of data packets worth a device read at low sampling rates.
+ */
+#define E4_SCHEDULER_DEFAULT_MIN_BATCH_PACKETS 64
+
+/*! \struct E4SchedulerConfig_t
+ * \brief Struct that configures the ReadScheduler of a device. Passed to setReadScheduling.
+ */
+typedef struct {
+    unsigned int latencyTargetUs; /*!< Longest time a data packet should wait in the device, up to #E4_SCHEDULER_MAX_LATENCY_US; 0 for #E4_SCHEDULER_DEFAULT_LATENCY_US. */
+    unsigned int minBatchPackets; /*!< Data packets worth a read: polls are spaced to gather as many, within the latency target; 0 for #E4_SCHEDULER_DEFAULT_MIN_BATCH_PACKETS. */
+} E4SchedulerConfig_t;
+
+/*! \struct E4SchedulerStats_t
+ * \brief Struct that contains the decisions of the ReadScheduler of a device since the reader started. Returned by getSchedulerStats.
+ */
+typedef struct {
+    unsigned long long polls; /*!< Device status polls. */
+    unsigned long long emptyPolls; /*!< Polls that found no data packets. */
+    unsigned long long catchUpPolls; /*!< Polls followed by another one without waiting, because data packets were left in the device. */
+    unsigned long long latePolls; /*!< Polls made more than the latency target after the previous one. */
+    unsigned long long packetsRead; /*!< Data packets read by the polls. */
+    unsigned int lastBatchPackets; /*!< Data packets read by the last non-empty poll. */
+    unsigned int maxBatchPackets; /*!< Most data packets read by a poll. */
+    double meanBatchPackets; /*!< Data packets read per non-empty poll. */
+    double pollIntervalUs; /*!< Interval between polls currently aimed at. */
+    double rateEstimateHz; /*!< Arrival rate of the data packets, estimated from the polls. */
+    double waitMicroseconds; /*!< Total time spent waiting between polls. */
+    double oversleepUs; /*!< Average delay of the wake ups past the requested time, anticipated by the next waits. */
+} E4SchedulerStats_t;
+
+/*! \class ReadScheduler
+ * \brief Decides how long a device reader waits between two polls of the device status.
+ *
+ * The interval is derived from the arrival rate of the data packets, estimated from what each poll finds,
+ * rather than fixed: polls are spaced to read at least E4SchedulerConfig_t::minBatchPackets data packets,
+ * amortizing the cost of each device call, and at least every half latency target,
+ * but no more than three quarters of the latency target apart, leaving the rest for the jitter of the wake ups.
+ * A poll leaving data packets in the device is followed immediately by another one.
+ * The time spent reading and processing a batch since the previous wake up is taken out of the next wait,
+ * which also ends early by the average oversleep of the timer measured so far.
+ * On Windows a high resolution waitable timer is used, where available, instead of the default 15.6ms timer granularity.
+ * ReadScheduler::wait is called by the reader thread; the other methods may be called from any thread.
+ */
+class ReadScheduler {
+public:
+    ReadScheduler();
+    ~ReadScheduler();
+
+    /*! \brief Applies a configuration. Counters are kept.
+     *
+     * \param config [in] Scheduler configuration.
+     * \return false, leaving the configuration unchanged, if it is invalid.
+     */
+    bool configure(EDL_IN const E4SchedulerConfig_t &config);
+
+    /*! \brief Sets the nominal sampling rate, from which the arrival rate estimate starts, 0 if unknown.
+     */
+    void setSamplingRate(EDL_IN double samplingRateHz);
+
+    /*! \brief Resets the counters and the rate estimate, when a reader starts.
+     */
+    void reset(EDL_VOID);
+
+    /*! \brief Records a poll of the device and waits until the next one is due.
+     *
+     * \param availablePackets [in] Data packets available in the device at the poll.
+     * \param readPackets [in] Data packets read after the poll.
+     */
+    void wait(EDL_IN unsigned int availablePackets,
+              EDL_IN unsigned int readPackets);
+
+    /*! \brief Returns the counters.
+     */
+    void getStats(EDL_OUT E4SchedulerStats_t &stats) const;
+
+private:
+    void sleepFor(double microseconds);
+
+    mutable std::mutex mutex;
+    double latencyTargetUs;
+    unsigned int minBatchPackets;
+    double samplingRateHz;
+
+    bool polled;
+    std::chrono::steady_clock::time_point lastPollTime;
+    std::chrono::steady_clock::time_point wakeTime; /*!< End of the previous wait. */
+    unsigned long long leftoverPackets; /*!< Data packets left in the device by the previous poll. */
+    unsigned long long batchNum; /*!< Non-empty polls. */
+    E4SchedulerStats_t stats;
+
+    void * timer; /*!< High resolution waitable timer on Windows, NULL if unavailable or elsewhere. */
+};
+
+#endif // E4_SCHEDULER_H
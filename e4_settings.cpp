@@ -0,0 +1,86 @@
+/*! \file e4_settings.cpp
+ * \brief Defines class DeviceSettings.
+ */
+#include <cmath>
+#include <cstring>
+
+#include "e4_settings.h"
+
+/*! Sampling rates in Hz, indexed by the EDL_RADIO_SAMPLING_RATE_* values. */
+static const double samplingRates[] = {1.25e3, 5.0e3, 10.0e3, 20.0e3, 50.0e3, 100.0e3, 200.0e3};
+
+/*! Current ranges full scale, indexed by the EDL_RADIO_RANGE_* values:
+ * current channels are expressed in pA in the 200pA range and in nA in the others. */
+static const double currentRanges[] = {200.0, 2.0, 20.0, 200.0};
+
+DeviceSettings::DeviceSettings()
+{
+    clear();
+}
+
+void DeviceSettings::setCommand(EdlCommandId_t commandId, const EdlCommandStruct_t &commandStruct, bool sendFlag)
+{
+    if ((unsigned int)commandId >= EdlCommandIdNum) {return;}
+
+    std::lock_guard <std::mutex> lock(mutex);
+    stacked[commandId] = commandStruct;
+    stackedFlags[commandId] = true;
+    if (!sendFlag) {return;}
+
+    for (int commandIdx = 0; commandIdx < EdlCommandIdNum; commandIdx++)
+    {
+        if (stackedFlags[commandIdx])
+        {
+            applied[commandIdx] = stacked[commandIdx];
+            appliedFlags[commandIdx] = true;
+            stackedFlags[commandIdx] = false;
+        }
+    }
+}
+
+void DeviceSettings::clear()
+{
+    std::lock_guard <std::mutex> lock(mutex);
+    memset(stacked, 0, sizeof(stacked));
+    memset(stackedFlags, 0, sizeof(stackedFlags));
+    memset(applied, 0, sizeof(applied));
+    memset(appliedFlags, 0, sizeof(appliedFlags));
+}
+
+bool DeviceSettings::getCommand(EdlCommandId_t commandId, EdlCommandStruct_t &commandStruct) const
+{
+    if ((unsigned int)commandId >= EdlCommandIdNum) {return false;}
+
+    std::lock_guard <std::mutex> lock(mutex);
+    commandStruct = applied[commandId];
+    return appliedFlags[commandId];
+}
+
+double DeviceSettings::samplingRateHz() const
+{
+    EdlCommandStruct_t commandStruct;
+    if (!getCommand(EdlCommandSamplingRate, commandStruct)) {return 0.0;}
+    return samplingRateHz(commandStruct.radioId);
+}
+
+double DeviceSettings::currentRangeFullScale() const
+{
+    EdlCommandStruct_t commandStruct;
+    if (!getCommand(EdlCommandRange, commandStruct)) {return 0.0;}
+    if (commandStruct.radioId >= sizeof(currentRanges)/sizeof(currentRanges[0])) {return 0.0;}
+    return currentRanges[commandStruct.radioId];
+}
+
+double DeviceSettings::protocolPeriodMs() const
+{
+    EdlCommandStruct_t commandStruct;
+    if (!getCommand(EdlCommandMainTrial, commandStruct) || lrint(commandStruct.value) != E4_PROTOCOL_TRIANGULAR) {return 0.0;}
+    if (!getCommand(EdlCommandTPeriod, commandStruct)) {return 0.0;}
+    return commandStruct.value;
+}
+
+double DeviceSettings::samplingRateHz(unsigned int radioId)
+{
+    if (radioId >= sizeof(samplingRates)/sizeof(samplingRates[0])) {return 0.0;}
+    return samplingRates[radioId];
+}
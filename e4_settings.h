@@ -0,0 +1,71 @@
+/*! \file e4_settings.h
+ * \brief Declares class DeviceSettings.
+ */
+#ifndef E4_SETTINGS_H
+#define E4_SETTINGS_H
+
+#include <mutex>
+
+#include "edl.h"
+
+/*! \def E4_PROTOCOL_TRIANGULAR
+ * \brief Value of #EdlCommandMainTrial selecting the triangular protocol, of amplitude #EdlCommandVamp and period #EdlCommandTPeriod.
+ */
+#define E4_PROTOCOL_TRIANGULAR 1
+
+/*! \class DeviceSettings
+ * \brief Keeps track of the commands applied to a device through EDL::setCommand.
+ * Commands are first stacked, then applied together with the first command sent, mirroring EDL::setCommand.
+ */
+class DeviceSettings {
+public:
+    DeviceSettings();
+
+    /*! \brief Records a successful call to EDL::setCommand.
+     *
+     * \param commandId [in] Index of the command.
+     * \param commandStruct [in] Configuration of the command.
+     * \param sendFlag [in] Flag the command was sent with: if true, all of the stacked commands are applied.
+     */
+    void setCommand(EDL_IN EdlCommandId_t commandId,
+                    EDL_IN const EdlCommandStruct_t &commandStruct,
+                    EDL_IN bool sendFlag);
+
+    /*! \brief Forgets all of the commands, e.g. after connecting to a device.
+     */
+    void clear(EDL_VOID);
+
+    /*! \brief Returns the last applied configuration of a command.
+     *
+     * \param commandId [in] Index of the command.
+     * \param commandStruct [out] Configuration of the command.
+     * \return false if the command was never applied.
+     */
+    bool getCommand(EDL_IN EdlCommandId_t commandId,
+                    EDL_OUT EdlCommandStruct_t &commandStruct) const;
+
+    /*! \brief Returns the applied sampling rate in Hz, 0 if unknown.
+     */
+    double samplingRateHz(EDL_VOID) const;
+
+    /*! \brief Returns the full scale of the applied current range, in the unit of the current channels (pA or nA), 0 if unknown.
+     */
+    double currentRangeFullScale(EDL_VOID) const;
+
+    /*! \brief Returns the period in ms of the applied triangular protocol, 0 if none.
+     */
+    double protocolPeriodMs(EDL_VOID) const;
+
+    /*! \brief Converts a #EdlCommandSamplingRate radio index into Hz, 0 if out of range.
+     */
+    static double samplingRateHz(EDL_IN unsigned int radioId);
+
+private:
+    mutable std::mutex mutex;
+    EdlCommandStruct_t stacked[EdlCommandIdNum];
+    bool stackedFlags[EdlCommandIdNum];
+    EdlCommandStruct_t applied[EdlCommandIdNum];
+    bool appliedFlags[EdlCommandIdNum];
+};
+
+#endif // E4_SETTINGS_H
@@ -0,0 +1,54 @@
+/*! \file e4_sharedformat.h
+ * \brief Defines the layout of the shared memory rings published by startSharing.
+ *
+ * A shared ring is a named shared memory object (shm_open on POSIX systems, a named file mapping on Windows) made of:
+ * - one #E4SharedHeader_t;
+ * - E4SharedHeader_t::capacityPackets slots of E4SharedHeader_t::channelNum floats, starting at E4SharedHeader_t::headerBytes,
+ *   each holding one data packet laid out as returned by EDL::readData.
+ *
+ * Data packets are numbered from 0 in the order they are published: packet i is in slot i % E4SharedHeader_t::capacityPackets.
+ * There is a single writer, which never waits for the readers. To publish data packets up to index w, it:
+ * 1. stores w into E4SharedHeader_t::writeHead, then issues a release fence;
+ * 2. copies the data packets into their slots, overwriting the oldest ones;
+ * 3. stores w into E4SharedHeader_t::head with release semantics.
+ * Data packets from head-capacityPackets to head-1 are readable. A reader, after copying or using data packets
+ * from index r on, issues an acquire fence and loads writeHead: the data packets below writeHead-capacityPackets
+ * may have been overwritten meanwhile and must be discarded. Readers never write to the shared memory.
+ * The 64 bit fields are naturally aligned, so plain aligned loads are atomic on the supported platforms.
+ * All fields are little endian.
+ */
+#ifndef E4_SHAREDFORMAT_H
+#define E4_SHAREDFORMAT_H
+
+#include <stdint.h>
+
+#include "edl_devicespecs.h"
+
+/*! \def E4_SHARED_MAGIC
+ * \brief Value of E4SharedHeader_t::magic: "E4SR".
+ */
+#define E4_SHARED_MAGIC 0x52533445
+
+/*! \def E4_SHARED_VERSION
+ * \brief Value of E4SharedHeader_t::version.
+ */
+#define E4_SHARED_VERSION 1
+
+/*! \struct E4SharedHeader_t
+ * \brief Header at the beginning of a shared ring. The counters written while publishing have their own cache line.
+ */
+typedef struct {
+    uint32_t magic; /*!< #E4_SHARED_MAGIC. */
+    uint32_t version; /*!< #E4_SHARED_VERSION. */
+    uint32_t headerBytes; /*!< Size of this header: the first slot begins at this offset. */
+    uint32_t channelNum; /*!< Number of values per data packet, #EDL_CHANNEL_NUM of the publishing device. */
+    uint64_t capacityPackets; /*!< Number of slots, a power of two. */
+    double samplingRateHz; /*!< Applied sampling rate, 0 if unknown; updated by the writer when it changes. */
+    uint32_t closed; /*!< Set to 1 by the writer when it stops publishing: no data packets follow head. */
+    uint32_t reserved[7]; /*!< Always 0. */
+    uint64_t writeHead; /*!< Index of the data packet after the last one being written. */
+    uint64_t head; /*!< Index of the data packet after the last one published. */
+    uint64_t padding[6]; /*!< Always 0. */
+} E4SharedHeader_t;
+
+#endif // E4_SHAREDFORMAT_H
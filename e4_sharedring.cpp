@@ -0,0 +1,342 @@
+/*! \file e4_sharedring.cpp
+ * \brief Defines classes SharedRing and SharedRingReader.
+ */
+#include <cstring>
+
+#ifdef _WIN32
+#include "windows.h"
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "e4_sharedring.h"
+
+// The counters of the header are plain fields shared with other processes, possibly not written in C++:
+// they are accessed with the GCC atomic builtins rather than through std::atomic.
+#define E4_LOAD(field, order) __atomic_load_n(&(field), order)
+#define E4_STORE(field, value, order) __atomic_store_n(&(field), value, order)
+
+/*! \brief Returns the name of the shared memory object for \a name: POSIX names begin with a single '/'.
+ */
+static std::string objectName(const char * name)
+{
+#ifdef _WIN32
+    return name;
+#else
+    return name[0] == '/' ? std::string(name) : "/"+std::string(name);
+#endif
+}
+
+SharedRing::SharedRing() :
+    header(NULL),
+    slots(NULL),
+    mask(0),
+    bytesNum(0)
+#ifdef _WIN32
+    , mappingHandle(NULL)
+#endif
+{
+}
+
+SharedRing::~SharedRing()
+{
+    close();
+}
+
+bool SharedRing::create(const char * name, size_t capacityPackets, double samplingRateHz)
+{
+    close();
+    if (name == NULL || name[0] == '\0') {return false;}
+
+    size_t capacityNum = 1;
+    while (capacityNum < (capacityPackets > 0 ? capacityPackets : E4_SHARED_DEFAULT_PACKETS)) {capacityNum <<= 1;}
+    const size_t size = sizeof(E4SharedHeader_t)+capacityNum*EDL_CHANNEL_NUM*sizeof(float);
+    this->name = objectName(name);
+
+#ifdef _WIN32
+    mappingHandle = CreateFileMappingA(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE, (DWORD)((unsigned long long)size >> 32), (DWORD)size, this->name.c_str());
+    if (mappingHandle == NULL) {return false;}
+    if (GetLastError() == ERROR_ALREADY_EXISTS)
+    {
+        // Still mapped by another writer, or by readers of a previous one: do not share it.
+        CloseHandle((HANDLE)mappingHandle);
+        mappingHandle = NULL;
+        return false;
+    }
+    void * bytes = MapViewOfFile((HANDLE)mappingHandle, FILE_MAP_ALL_ACCESS, 0, 0, size);
+    if (bytes == NULL)
+    {
+        CloseHandle((HANDLE)mappingHandle);
+        mappingHandle = NULL;
+        return false;
+    }
+#else
+    // A leftover object, e.g. of a writer that crashed, is replaced: its readers keep their mapping.
+    shm_unlink(this->name.c_str());
+    int fd = shm_open(this->name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0644);
+    if (fd < 0) {return false;}
+    if (ftruncate(fd, (off_t)size) != 0)
+    {
+        ::close(fd);
+        shm_unlink(this->name.c_str());
+        return false;
+    }
+    void * bytes = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (bytes == MAP_FAILED)
+    {
+        shm_unlink(this->name.c_str());
+        return false;
+    }
+#endif
+
+    // The object is zero filled: the counters start at 0 and the reserved fields are already 0.
+    header = (E4SharedHeader_t *)bytes;
+    slots = (float *)((unsigned char *)bytes+sizeof(E4SharedHeader_t));
+    mask = capacityNum-1;
+    bytesNum = size;
+
+    header->headerBytes = sizeof(E4SharedHeader_t);
+    header->channelNum = EDL_CHANNEL_NUM;
+    header->capacityPackets = capacityNum;
+    header->samplingRateHz = samplingRateHz;
+    header->version = E4_SHARED_VERSION;
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    E4_STORE(header->magic, (uint32_t)E4_SHARED_MAGIC, __ATOMIC_RELEASE);
+    return true;
+}
+
+void SharedRing::close()
+{
+    if (header == NULL) {return;}
+
+    E4_STORE(header->closed, (uint32_t)1, __ATOMIC_RELEASE);
+#ifdef _WIN32
+    UnmapViewOfFile(header);
+    CloseHandle((HANDLE)mappingHandle);
+    mappingHandle = NULL;
+#else
+    munmap(header, bytesNum);
+    shm_unlink(name.c_str());
+#endif
+    header = NULL;
+    slots = NULL;
+    mask = 0;
+    bytesNum = 0;
+}
+
+bool SharedRing::isOpen() const
+{
+    return header != NULL;
+}
+
+void SharedRing::publish(const float * packets, size_t packetsNum)
+{
+    if (header == NULL || packetsNum == 0) {return;}
+
+    const uint64_t w = header->head+packetsNum;
+    E4_STORE(header->writeHead, w, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    // Only the newest capacity data packets survive anyway.
+    const size_t capacityNum = mask+1;
+    if (packetsNum > capacityNum)
+    {
+        packets += (packetsNum-capacityNum)*EDL_CHANNEL_NUM;
+        packetsNum = capacityNum;
+    }
+    const uint64_t h = w-packetsNum;
+
+    // Copy in at most two segments: up to the end of the slots, then from their beginning.
+    const size_t start = (size_t)h & mask;
+    const size_t firstNum = packetsNum < capacityNum-start ? packetsNum : capacityNum-start;
+    memcpy(slots+start*EDL_CHANNEL_NUM, packets, firstNum*EDL_CHANNEL_NUM*sizeof(float));
+    if (packetsNum > firstNum)
+    {
+        memcpy(slots, packets+firstNum*EDL_CHANNEL_NUM, (packetsNum-firstNum)*EDL_CHANNEL_NUM*sizeof(float));
+    }
+
+    E4_STORE(header->head, w, __ATOMIC_RELEASE);
+}
+
+void SharedRing::setSamplingRate(double samplingRateHz)
+{
+    if (header == NULL) {return;}
+
+    __atomic_store(&header->samplingRateHz, &samplingRateHz, __ATOMIC_RELAXED);
+}
+
+SharedRingReader::SharedRingReader() :
+    header(NULL),
+    slots(NULL),
+    mask(0),
+    bytesNum(0),
+    cursor(0),
+    lostNum(0)
+#ifdef _WIN32
+    , mappingHandle(NULL)
+#endif
+{
+}
+
+SharedRingReader::~SharedRingReader()
+{
+    close();
+}
+
+bool SharedRingReader::open(const char * name)
+{
+    close();
+    if (name == NULL || name[0] == '\0') {return false;}
+    const std::string objectNameStr = objectName(name);
+
+#ifdef _WIN32
+    mappingHandle = OpenFileMappingA(FILE_MAP_READ, FALSE, objectNameStr.c_str());
+    if (mappingHandle == NULL) {return false;}
+    const void * bytes = MapViewOfFile((HANDLE)mappingHandle, FILE_MAP_READ, 0, 0, 0);
+    if (bytes == NULL) {close(); return false;}
+    header = (const E4SharedHeader_t *)bytes;
+
+    MEMORY_BASIC_INFORMATION region;
+    if (VirtualQuery(bytes, &region, sizeof(region)) == 0) {close(); return false;}
+    const size_t size = region.RegionSize;
+#else
+    int fd = shm_open(objectNameStr.c_str(), O_RDONLY, 0);
+    if (fd < 0) {return false;}
+    struct stat objectStat;
+    if (fstat(fd, &objectStat) != 0 || (size_t)objectStat.st_size < sizeof(E4SharedHeader_t))
+    {
+        ::close(fd);
+        return false;
+    }
+    const size_t size = (size_t)objectStat.st_size;
+    const void * bytes = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (bytes == MAP_FAILED) {return false;}
+    header = (const E4SharedHeader_t *)bytes;
+#endif
+    bytesNum = size;
+
+    // The writer stores the magic last.
+    if (size < sizeof(E4SharedHeader_t) || E4_LOAD(header->magic, __ATOMIC_ACQUIRE) != E4_SHARED_MAGIC)
+    {
+        close();
+        return false;
+    }
+    const uint64_t capacityNum = header->capacityPackets;
+    if (header->version != E4_SHARED_VERSION || header->channelNum != EDL_CHANNEL_NUM
+            || header->headerBytes < sizeof(E4SharedHeader_t) || capacityNum == 0 || (capacityNum & (capacityNum-1)) != 0
+            || header->headerBytes+capacityNum*EDL_CHANNEL_NUM*sizeof(float) > size)
+    {
+        close();
+        return false;
+    }
+
+    slots = (const float *)((const unsigned char *)header+header->headerBytes);
+    mask = (size_t)capacityNum-1;
+    cursor = E4_LOAD(header->head, __ATOMIC_ACQUIRE);
+    lostNum = 0;
+    return true;
+}
+
+void SharedRingReader::close()
+{
+#ifdef _WIN32
+    if (header != NULL) {UnmapViewOfFile(header);}
+    if (mappingHandle != NULL) {CloseHandle((HANDLE)mappingHandle);}
+    mappingHandle = NULL;
+#else
+    if (header != NULL) {munmap((void *)header, bytesNum);}
+#endif
+    header = NULL;
+    slots = NULL;
+    mask = 0;
+    bytesNum = 0;
+}
+
+bool SharedRingReader::peek(const float * &packets, size_t &packetsNum, unsigned long long &firstPacketIdx)
+{
+    packets = NULL;
+    packetsNum = 0;
+    firstPacketIdx = cursor;
+    if (header == NULL) {return false;}
+
+    // Check closed before head: if the ring is closed and nothing is ready, nothing will be.
+    const bool closed = E4_LOAD(header->closed, __ATOMIC_ACQUIRE) != 0;
+    const uint64_t h = E4_LOAD(header->head, __ATOMIC_ACQUIRE);
+    const size_t capacityNum = mask+1;
+    if (h > capacityNum && cursor < h-capacityNum)
+    {
+        lostNum += h-capacityNum-cursor;
+        cursor = h-capacityNum;
+    }
+    if (h == cursor) {return !closed;}
+
+    const size_t start = (size_t)cursor & mask;
+    const size_t readyNum = (size_t)(h-cursor);
+    packetsNum = readyNum < capacityNum-start ? readyNum : capacityNum-start;
+    packets = slots+start*EDL_CHANNEL_NUM;
+    firstPacketIdx = cursor;
+    return true;
+}
+
+size_t SharedRingReader::release(size_t packetsNum)
+{
+    if (header == NULL) {return 0;}
+
+    const size_t overwrittenNum = overwritten(packetsNum);
+    lostNum += overwrittenNum;
+    cursor += packetsNum;
+    return overwrittenNum;
+}
+
+size_t SharedRingReader::overwritten(size_t packetsNum) const
+{
+    // Whatever was used before this point is ordered before the load of writeHead.
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    const uint64_t w = E4_LOAD(header->writeHead, __ATOMIC_RELAXED);
+    const size_t capacityNum = mask+1;
+    if (w <= capacityNum || cursor >= w-capacityNum) {return 0;}
+    return w-capacityNum-cursor < packetsNum ? (size_t)(w-capacityNum-cursor) : packetsNum;
+}
+
+bool SharedRingReader::read(float * dst, size_t maxPackets, size_t &packetsRead)
+{
+    packetsRead = 0;
+    while (packetsRead < maxPackets) {
+        const float * packets;
+        size_t packetsNum;
+        unsigned long long firstPacketIdx;
+        if (!peek(packets, packetsNum, firstPacketIdx)) {return packetsRead > 0;}
+        if (packetsNum == 0) {break;}
+
+        if (packetsNum > maxPackets-packetsRead) {packetsNum = maxPackets-packetsRead;}
+        memcpy(dst+packetsRead*EDL_CHANNEL_NUM, packets, packetsNum*EDL_CHANNEL_NUM*sizeof(float));
+
+        // Drop the copied data packets that were overwritten while copying: the oldest ones.
+        const size_t overwrittenNum = release(packetsNum);
+        if (overwrittenNum > 0)
+        {
+            memmove(dst+packetsRead*EDL_CHANNEL_NUM, dst+(packetsRead+overwrittenNum)*EDL_CHANNEL_NUM,
+                    (packetsNum-overwrittenNum)*EDL_CHANNEL_NUM*sizeof(float));
+        }
+        packetsRead += packetsNum-overwrittenNum;
+    }
+    return true;
+}
+
+void SharedRingReader::getInfo(E4SharedRingInfo_t &info) const
+{
+    memset(&info, 0, sizeof(info));
+    if (header == NULL) {return;}
+
+    __atomic_load(&header->samplingRateHz, &info.samplingRateHz, __ATOMIC_RELAXED);
+    info.capacityPackets = mask+1;
+    info.publishedPackets = E4_LOAD(header->head, __ATOMIC_ACQUIRE);
+    info.nextPacketIdx = cursor;
+    info.lostPackets = lostNum;
+    info.closed = E4_LOAD(header->closed, __ATOMIC_ACQUIRE);
+}
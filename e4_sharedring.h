@@ -0,0 +1,168 @@
+/*! \file e4_sharedring.h
+ * \brief Declares classes SharedRing and SharedRingReader.
+ */
+#ifndef E4_SHAREDRING_H
+#define E4_SHAREDRING_H
+
+#include <stddef.h>
+#include <string>
+
+#include "edl_global.h"
+#include "e4_sharedformat.h"
+
+/*! \def E4_SHARED_DEFAULT_PACKETS
+ * \brief Default capacity of a shared ring: about 1s of data at 200kHz.
+ */
+#define E4_SHARED_DEFAULT_PACKETS (1 << 18)
+
+/*! \struct E4SharedRingInfo_t
+ * \brief Struct that describes a shared ring as seen by one of its readers. Returned by getSharedRingInfo.
+ */
+typedef struct {
+    unsigned long long capacityPackets; /*!< Number of data packets the ring holds. */
+    double samplingRateHz; /*!< Sampling rate of the publishing device, 0 if unknown. */
+    unsigned long long publishedPackets; /*!< Data packets published since the ring was created. */
+    unsigned long long nextPacketIdx; /*!< Index of the next data packet this reader will get. */
+    unsigned long long lostPackets; /*!< Data packets this reader missed because they were overwritten before being read. */
+    unsigned int closed; /*!< 1 if the writer stopped publishing. */
+} E4SharedRingInfo_t;
+
+/*! \class SharedRing
+ * \brief Writer side of a shared memory ring, see e4_sharedformat.h: publishes data packets to reader processes.
+ * The writer never waits for the readers: readers falling behind by more than the capacity lose the oldest data packets.
+ * The shared memory object is created by SharedRing::create and removed by SharedRing::close;
+ * readers already attached keep their mapping until they detach.
+ * SharedRing::publish and SharedRing::setSamplingRate must be called from the same thread or serialized.
+ */
+class SharedRing {
+public:
+    SharedRing();
+
+    /*! \brief SharedRing destructor. Closes the ring.
+     */
+    ~SharedRing();
+
+    /*! \brief Creates the shared memory object. On POSIX systems a leftover object of the same name is replaced;
+     * on Windows the creation fails while processes still map a previous ring of the same name.
+     *
+     * \param name [in] Name of the shared memory object: on POSIX systems a leading '/' is added if missing;
+     * on Windows it is the name of the file mapping, e.g. "Local\\e4".
+     * \param capacityPackets [in] Minimum number of data packets the ring can hold, rounded up to a power of two; 0 for #E4_SHARED_DEFAULT_PACKETS.
+     * \param samplingRateHz [in] Applied sampling rate, 0 if unknown.
+     * \return false if the shared memory object could not be created.
+     */
+    bool create(EDL_IN const char * name,
+                EDL_IN size_t capacityPackets,
+                EDL_IN double samplingRateHz);
+
+    /*! \brief Marks the ring closed for the readers and removes the shared memory object.
+     */
+    void close(EDL_VOID);
+
+    /*! \brief Returns true between SharedRing::create and SharedRing::close.
+     */
+    bool isOpen(EDL_VOID) const;
+
+    /*! \brief Copies data packets into the ring, overwriting the oldest ones.
+     *
+     * \param packets [in] Buffer of \a packetsNum data packets of #EDL_CHANNEL_NUM values.
+     * \param packetsNum [in] Number of data packets in \a packets.
+     */
+    void publish(EDL_IN const float * packets,
+                 EDL_IN size_t packetsNum);
+
+    /*! \brief Updates the sampling rate seen by the readers.
+     */
+    void setSamplingRate(EDL_IN double samplingRateHz);
+
+private:
+    SharedRing(const SharedRing &);
+    SharedRing &operator=(const SharedRing &);
+
+    E4SharedHeader_t * header;
+    float * slots;
+    size_t mask;
+    size_t bytesNum;
+    std::string name;
+#ifdef _WIN32
+    void * mappingHandle;
+#endif
+};
+
+/*! \class SharedRingReader
+ * \brief Reader side of a shared memory ring, see e4_sharedformat.h, usually in another process than the writer.
+ * Data packets are either copied out by SharedRingReader::read, or used in place between SharedRingReader::peek
+ * and SharedRingReader::release, which tells whether they were overwritten meanwhile. Reading never slows the writer down.
+ * A SharedRingReader must not be used by several threads at the same time.
+ */
+class SharedRingReader {
+public:
+    SharedRingReader();
+
+    /*! \brief SharedRingReader destructor. Detaches from the ring.
+     */
+    ~SharedRingReader();
+
+    /*! \brief Attaches to a shared ring. Only the data packets published from then on are read.
+     *
+     * \param name [in] Name passed to SharedRing::create.
+     * \return false if there is no such ring or if its layout is not supported.
+     */
+    bool open(EDL_IN const char * name);
+
+    /*! \brief Detaches from the ring.
+     */
+    void close(EDL_VOID);
+
+    /*! \brief Returns the next data packets in place, without copying them: as many as are contiguous in the ring.
+     * Data packets already overwritten are skipped and counted as lost.
+     *
+     * \param packets [out] First of the data packets, valid until SharedRingReader::release.
+     * \param packetsNum [out] Number of data packets at \a packets, 0 if none are ready.
+     * \param firstPacketIdx [out] Index of the first data packet, see e4_sharedformat.h.
+     * \return false if no data packets are ready and the writer closed the ring.
+     */
+    bool peek(EDL_OUT const float * &packets,
+              EDL_OUT size_t &packetsNum,
+              EDL_OUT unsigned long long &firstPacketIdx);
+
+    /*! \brief Consumes the first data packets returned by SharedRingReader::peek.
+     *
+     * \param packetsNum [in] Number of data packets consumed, at most the number returned by SharedRingReader::peek.
+     * \return Number of the first consumed data packets that were overwritten while in use and must be discarded; also counted as lost.
+     */
+    size_t release(EDL_IN size_t packetsNum);
+
+    /*! \brief Copies the next data packets out of the ring, dropping any overwritten meanwhile.
+     *
+     * \param dst [out] Buffer with room for \a maxPackets data packets.
+     * \param maxPackets [in] Maximum number of data packets to copy.
+     * \param packetsRead [out] Number of valid data packets copied.
+     * \return false if no data packets are ready and the writer closed the ring.
+     */
+    bool read(EDL_OUT float * dst,
+              EDL_IN size_t maxPackets,
+              EDL_OUT size_t &packetsRead);
+
+    /*! \brief Returns a description of the ring and of the progress of this reader.
+     */
+    void getInfo(EDL_OUT E4SharedRingInfo_t &info) const;
+
+private:
+    SharedRingReader(const SharedRingReader &);
+    SharedRingReader &operator=(const SharedRingReader &);
+
+    size_t overwritten(size_t packetsNum) const;
+
+    const E4SharedHeader_t * header;
+    const float * slots;
+    size_t mask;
+    size_t bytesNum;
+    unsigned long long cursor; /*!< Index of the next data packet to read. */
+    unsigned long long lostNum;
+#ifdef _WIN32
+    void * mappingHandle;
+#endif
+};
+
+#endif // E4_SHAREDRING_H
@@ -0,0 +1,340 @@
+/*! \file e4_simulator.cpp
+ * \brief Defines class SimulatedBackend.
+ */
+#include <climits>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+#include "e4_simulator.h"
+#include "e4_compression.h"
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+/*! \def E4_SIMULATOR_NOISE_TABLE_BITS
+ * \brief The gaussian noise is drawn from a table of 2^E4_SIMULATOR_NOISE_TABLE_BITS precomputed values.
+ */
+#define E4_SIMULATOR_NOISE_TABLE_BITS 16
+
+/*! \brief Computes the table of standard normal values the noise is drawn from, with the Box-Muller transform.
+ */
+static std::vector <float> computeNoiseTable()
+{
+    const unsigned int valuesNum = 1 << E4_SIMULATOR_NOISE_TABLE_BITS;
+    std::vector <float> table(valuesNum);
+    uint64_t state = 0x9E3779B97F4A7C15ULL;
+
+    for (unsigned int valueIdx = 0; valueIdx < valuesNum; valueIdx += 2)
+    {
+        // Stratified radii, so that the table has the moments of the distribution; random angles.
+        state ^= state >> 12;
+        state ^= state << 25;
+        state ^= state >> 27;
+        const double radius = sqrt(-2.0*log((valueIdx+1.0)/(valuesNum+1.0)));
+        const double angle = 2.0*M_PI*((state*0x2545F4914F6CDD1DULL) >> 11)/9007199254740992.0;
+        table[valueIdx] = (float)(radius*cos(angle));
+        table[valueIdx+1] = (float)(radius*sin(angle));
+    }
+    return table;
+}
+
+/*! \brief Returns the table of standard normal values the noise is drawn from, computed on first use.
+ */
+static const float * noiseTable()
+{
+    static const std::vector <float> table = computeNoiseTable();
+    return table.data();
+}
+
+/*! \brief Converts a value to the nearest ADC code of step \a step, clipped at the full scale, and back.
+ */
+static inline float quantize(double value, float step)
+{
+    if (!(step > 0.0f)) {return (float)value;}
+    long code = lrint(value/step);
+    if (code > E4_ADC_CODES_HALF_RANGE-1) {code = E4_ADC_CODES_HALF_RANGE-1;}
+    if (code < -(E4_ADC_CODES_HALF_RANGE-1)) {code = -(E4_ADC_CODES_HALF_RANGE-1);}
+    return (float)code*step;
+}
+
+/*! \brief Scales the distance of \a idx ahead of \a currentIdx by \a ratio; ULLONG_MAX stays for never.
+ */
+static void rescale(unsigned long long &idx, unsigned long long currentIdx, double ratio)
+{
+    if (idx == ULLONG_MAX || idx <= currentIdx) {return;}
+    const double distance = (double)(idx-currentIdx)*ratio;
+    idx = currentIdx+(distance < 1.0 ? 1 : (distance < 1.0e18 ? (unsigned long long)distance : 1000000000000000000ULL));
+}
+
+SimulatedBackend::SimulatedBackend(const E4SimulatorConfig_t &config) :
+    config(config),
+    connected(false),
+    randomState(1),
+    packetRateHz(0.0),
+    rateStartPacketNum(0),
+    producedNum(0),
+    consumedNum(0),
+    signalIdx(0),
+    nextOverflowIdx(ULLONG_MAX),
+    nextLostDataIdx(ULLONG_MAX),
+    bufferOverflowFlag(false),
+    lostDataFlag(false),
+    voltageStep(0.0f),
+    currentStep(0.0f),
+    holdingVoltage(0.0),
+    triangleAmplitude(0.0),
+    trianglePeriodPackets(0.0)
+{
+    if (this->config.deviceNum == 0) {this->config.deviceNum = 1;}
+    if (!(this->config.speedFactor > 0.0)) {this->config.speedFactor = 1.0;}
+    if (this->config.bufferPackets == 0) {this->config.bufferPackets = E4_SIMULATOR_DEFAULT_BUFFER_PACKETS;}
+    if (this->config.eventDepth < 0.0) {this->config.eventDepth = 0.0;}
+    if (this->config.eventDepth > 1.0) {this->config.eventDepth = 1.0;}
+
+    for (unsigned int channelIdx = 0; channelIdx < EDL_CHANNEL_NUM-1; channelIdx++)
+    {
+        eventFlags[channelIdx] = false;
+        eventChangeIdxs[channelIdx] = ULLONG_MAX;
+    }
+}
+
+EdlErrorCode_t SimulatedBackend::detectDevices(std::vector <std::string> &deviceIds)
+{
+    char deviceId[32];
+
+    deviceIds.clear();
+    for (unsigned int deviceIdx = 0; deviceIdx < config.deviceNum; deviceIdx++)
+    {
+        snprintf(deviceId, sizeof(deviceId), "SIM%u", deviceIdx);
+        deviceIds.push_back(deviceId);
+    }
+    return EdlSuccess;
+}
+
+EdlErrorCode_t SimulatedBackend::connectDevice(std::string deviceId)
+{
+    unsigned int deviceIdx;
+    char tail;
+
+    if (connected) {return EdlDeviceAlreadyConnectedError;}
+    if (sscanf(deviceId.c_str(), "SIM%u%c", &deviceIdx, &tail) != 1 || deviceIdx >= config.deviceNum) {return EdlDeviceConnectionError;}
+
+    // SplitMix64 of the seed and the device index, so that every device gets its own noise and events.
+    uint64_t seed = ((uint64_t)config.seed << 32)+deviceIdx+0x9E3779B97F4A7C15ULL;
+    seed = (seed^(seed >> 30))*0xBF58476D1CE4E5B9ULL;
+    seed = (seed^(seed >> 27))*0x94D049BB133111EBULL;
+    randomState = (seed^(seed >> 31)) | 1;
+
+    connected = true;
+    packetRateHz = 0.0;
+    rateStartPacketNum = 0;
+    producedNum = 0;
+    consumedNum = 0;
+    signalIdx = 0;
+    bufferOverflowFlag = false;
+    lostDataFlag = false;
+
+    EdlCommandStruct_t commandStruct;
+    settings.clear();
+    commandStruct.radioId = EDL_RADIO_RANGE_200_PA;
+    settings.setCommand(EdlCommandRange, commandStruct, false);
+    commandStruct.radioId = E4_SIMULATOR_DEFAULT_SAMPLING_RATE;
+    settings.setCommand(EdlCommandSamplingRate, commandStruct, true);
+    applySettings();
+
+    const double samplingRateHz = settings.samplingRateHz();
+    nextOverflowIdx = config.overflowRateHz > 0.0 ? randomInterval(samplingRateHz/config.overflowRateHz) : ULLONG_MAX;
+    nextLostDataIdx = config.lostDataRateHz > 0.0 ? randomInterval(samplingRateHz/config.lostDataRateHz) : ULLONG_MAX;
+    for (unsigned int channelIdx = 0; channelIdx < EDL_CHANNEL_NUM-1; channelIdx++)
+    {
+        eventFlags[channelIdx] = false;
+        eventChangeIdxs[channelIdx] = config.eventRateHz > 0.0 ? randomInterval(samplingRateHz/config.eventRateHz) : ULLONG_MAX;
+    }
+    return EdlSuccess;
+}
+
+EdlErrorCode_t SimulatedBackend::disconnectDevice()
+{
+    connected = false;
+    return EdlSuccess;
+}
+
+EdlErrorCode_t SimulatedBackend::getDeviceStatus(EdlDeviceStatus_t &status)
+{
+    if (!connected) {return EdlDeviceNotConnectedError;}
+
+    update();
+    const unsigned long long availableNum = producedNum-consumedNum;
+    status.availableDataPackets = availableNum < UINT_MAX ? (unsigned int)availableNum : UINT_MAX;
+    status.bufferOverflowFlag = bufferOverflowFlag;
+    status.lostDataFlag = lostDataFlag;
+    bufferOverflowFlag = false;
+    lostDataFlag = false;
+    return EdlSuccess;
+}
+
+EdlErrorCode_t SimulatedBackend::readData(unsigned int dataToRead, unsigned int &dataRead, std::vector <float> &buffer)
+{
+    dataRead = 0;
+    if (!connected) {return EdlDeviceNotConnectedError;}
+
+    update();
+    const unsigned long long availableNum = producedNum-consumedNum;
+    dataRead = availableNum < dataToRead ? (unsigned int)availableNum : dataToRead;
+    if (buffer.size() < (size_t)dataRead*EDL_CHANNEL_NUM) {buffer.resize((size_t)dataRead*EDL_CHANNEL_NUM);}
+
+    generate(buffer.data(), dataRead);
+    consumedNum += dataRead;
+
+    // As with the device, the available data packets are returned anyway.
+    return dataRead < dataToRead ? EdlNotEnoughAvailableDataError : EdlSuccess;
+}
+
+EdlErrorCode_t SimulatedBackend::purgeData()
+{
+    if (!connected) {return EdlDeviceNotConnectedError;}
+
+    update();
+    skip(producedNum-consumedNum);
+    return EdlSuccess;
+}
+
+EdlErrorCode_t SimulatedBackend::setCommand(EdlCommandId_t commandId, EdlCommandStruct_t &commandStruct, bool sendFlag)
+{
+    if (!connected) {return EdlDeviceNotConnectedError;}
+    if ((unsigned int)commandId >= EdlCommandIdNum) {return EdlCommandIdOutOfRangeError;}
+
+    settings.setCommand(commandId, commandStruct, sendFlag);
+    if (sendFlag) {applySettings();}
+    return EdlSuccess;
+}
+
+void SimulatedBackend::update()
+{
+    const double elapsedS = std::chrono::duration <double> (std::chrono::steady_clock::now()-rateStartTime).count();
+    const unsigned long long nowProducedNum = rateStartPacketNum+(unsigned long long)(elapsedS*packetRateHz);
+    if (nowProducedNum <= producedNum) {return;}
+    producedNum = nowProducedNum;
+
+    const double samplingRateHz = settings.samplingRateHz();
+    while (nextOverflowIdx <= producedNum)
+    {
+        // The device buffer is overwritten: whatever was buffered before the overflow is lost.
+        if (nextOverflowIdx > consumedNum) {skip(nextOverflowIdx-consumedNum);}
+        bufferOverflowFlag = true;
+        nextOverflowIdx += randomInterval(samplingRateHz/config.overflowRateHz);
+    }
+    while (nextLostDataIdx <= producedNum)
+    {
+        // Up to 1ms of the signal never reaches the buffer.
+        signalIdx += 1+randomBits()%(1+(unsigned long long)(samplingRateHz*1.0e-3));
+        lostDataFlag = true;
+        nextLostDataIdx += randomInterval(samplingRateHz/config.lostDataRateHz);
+    }
+
+    if (producedNum-consumedNum > config.bufferPackets)
+    {
+        skip(producedNum-consumedNum-config.bufferPackets);
+        bufferOverflowFlag = true;
+    }
+}
+
+void SimulatedBackend::skip(unsigned long long packetsNum)
+{
+    consumedNum += packetsNum;
+    signalIdx += packetsNum;
+}
+
+void SimulatedBackend::generate(float * packets, unsigned int packetsNum)
+{
+    const float * noise = noiseTable();
+    const double samplingRateHz = settings.samplingRateHz();
+    const double gapPackets = config.eventRateHz > 0.0 ? samplingRateHz/config.eventRateHz : 0.0;
+    const double dwellPackets = config.eventDwellTimeS*samplingRateHz;
+    const double blockedCurrent = config.baselineCurrent*(1.0-config.eventDepth);
+
+    for (unsigned int packetIdx = 0; packetIdx < packetsNum; packetIdx++)
+    {
+        float * packet = packets+(size_t)packetIdx*EDL_CHANNEL_NUM;
+
+        double voltage = holdingVoltage;
+        if (trianglePeriodPackets > 0.0)
+        {
+            // 0 at the start of the period, +amplitude at a quarter, -amplitude at three quarters.
+            const double phase = fmod((double)signalIdx/trianglePeriodPackets, 1.0);
+            voltage += triangleAmplitude*(phase < 0.25 ? 4.0*phase : (phase < 0.75 ? 2.0-4.0*phase : 4.0*phase-4.0));
+        }
+        packet[0] = quantize(voltage, voltageStep);
+
+        for (unsigned int channelIdx = 0; channelIdx < EDL_CHANNEL_NUM-1; channelIdx++)
+        {
+            while (signalIdx >= eventChangeIdxs[channelIdx])
+            {
+                eventFlags[channelIdx] = !eventFlags[channelIdx];
+                eventChangeIdxs[channelIdx] += randomInterval(eventFlags[channelIdx] ? dwellPackets : gapPackets);
+            }
+
+            const double current = eventFlags[channelIdx] ? blockedCurrent : config.baselineCurrent;
+            packet[1+channelIdx] = quantize(current+config.noiseRms*noise[randomBits() >> (64-E4_SIMULATOR_NOISE_TABLE_BITS)], currentStep);
+        }
+        signalIdx++;
+    }
+}
+
+void SimulatedBackend::applySettings()
+{
+    EdlCommandStruct_t commandStruct;
+
+    // Account for the data packets produced at the previous rate before changing it.
+    const double nowPacketRateHz = settings.samplingRateHz()*config.speedFactor;
+    if (nowPacketRateHz != packetRateHz)
+    {
+        if (packetRateHz > 0.0)
+        {
+            update();
+
+            // Pending occurrences are scheduled in data packets: keep them at the same time ahead.
+            const double ratio = nowPacketRateHz/packetRateHz;
+            rescale(nextOverflowIdx, producedNum, ratio);
+            rescale(nextLostDataIdx, producedNum, ratio);
+            for (unsigned int channelIdx = 0; channelIdx < EDL_CHANNEL_NUM-1; channelIdx++) {rescale(eventChangeIdxs[channelIdx], signalIdx, ratio);}
+        }
+        rateStartTime = std::chrono::steady_clock::now();
+        rateStartPacketNum = producedNum;
+        packetRateHz = nowPacketRateHz;
+    }
+
+    voltageStep = (float)(E4_VOLTAGE_FULL_SCALE_MV/E4_ADC_CODES_HALF_RANGE);
+    currentStep = (float)(settings.currentRangeFullScale()/E4_ADC_CODES_HALF_RANGE);
+
+    holdingVoltage = settings.getCommand(EdlCommandVhold, commandStruct) ? commandStruct.value : 0.0;
+    triangleAmplitude = 0.0;
+    trianglePeriodPackets = 0.0;
+    if (settings.getCommand(EdlCommandMainTrial, commandStruct) && lrint(commandStruct.value) == E4_PROTOCOL_TRIANGULAR)
+    {
+        triangleAmplitude = settings.getCommand(EdlCommandVamp, commandStruct) ? commandStruct.value : 0.0;
+        const double periodMs = settings.getCommand(EdlCommandTPeriod, commandStruct) ? commandStruct.value : 0.0;
+        trianglePeriodPackets = periodMs*1.0e-3*settings.samplingRateHz();
+    }
+}
+
+uint64_t SimulatedBackend::randomBits()
+{
+    // xorshift64*.
+    randomState ^= randomState >> 12;
+    randomState ^= randomState << 25;
+    randomState ^= randomState >> 27;
+    return randomState*0x2545F4914F6CDD1DULL;
+}
+
+unsigned long long SimulatedBackend::randomInterval(double meanPackets)
+{
+    // Exponentially distributed, at least 1 data packet.
+    const double uniform = ((randomBits() >> 11)+1.0)/9007199254740993.0;
+    const double interval = -meanPackets*log(uniform);
+    if (interval < 1.0) {return 1;}
+    return interval < 1.0e18 ? (unsigned long long)interval : 1000000000000000000ULL;
+}
@@ -0,0 +1,109 @@
+/*! \file e4_simulator.h
+ * \brief Declares class SimulatedBackend.
+ */
+#ifndef E4_SIMULATOR_H
+#define E4_SIMULATOR_H
+
+#include <chrono>
+#include <stdint.h>
+
+#include "e4_backend.h"
+#include "e4_settings.h"
+
+/*! \def E4_SIMULATOR_DEFAULT_BUFFER_PACKETS
+ * \brief Default capacity of the simulated device buffer: about 1s of data at 200kHz.
+ */
+#define E4_SIMULATOR_DEFAULT_BUFFER_PACKETS (1 << 18)
+
+/*! \def E4_SIMULATOR_DEFAULT_SAMPLING_RATE
+ * \brief Sampling rate radio index of a simulated device until #EdlCommandSamplingRate is applied.
+ */
+#define E4_SIMULATOR_DEFAULT_SAMPLING_RATE EDL_RADIO_SAMPLING_RATE_200_KHZ
+
+/*! \struct E4SimulatorConfig_t
+ * \brief Struct that configures the simulated devices. Passed to setSimulation.
+ *
+ * Currents are in the unit of the current channels for the applied range (pA in the 200pA range, nA otherwise),
+ * and are quantized and clipped like the ADC of the device. Rates of random occurrences are means of Poisson processes,
+ * per second of data rather than of wall clock time.
+ */
+typedef struct {
+    unsigned int deviceNum; /*!< Number of simulated devices detected, 0 for 1. */
+    double speedFactor; /*!< Pace of the data packets relative to the sampling rate, e.g. 10 for 10 times faster than real time; 0 for real time. */
+    double baselineCurrent; /*!< Open pore current of every current channel. */
+    double noiseRms; /*!< RMS of the white gaussian noise added to every current channel, 0 for none. */
+    double eventRateHz; /*!< Blockade events per second on each current channel, 0 for none. */
+    double eventDepth; /*!< Fraction of the open pore current blocked during an event, from 0 to 1. */
+    double eventDwellTimeS; /*!< Mean duration of the blockade events, exponentially distributed. */
+    double overflowRateHz; /*!< Injected buffer overflows per second: the buffered data packets are lost and the next status reports EdlDeviceStatus_t::bufferOverflowFlag. */
+    double lostDataRateHz; /*!< Injected data losses per second: up to 1ms of the signal is skipped and the next status reports EdlDeviceStatus_t::lostDataFlag. */
+    unsigned int bufferPackets; /*!< Capacity of the device buffer, overflowing if not read in time; 0 for #E4_SIMULATOR_DEFAULT_BUFFER_PACKETS. */
+    unsigned int seed; /*!< Seed of the random generators, combined with the index of each device. */
+} E4SimulatorConfig_t;
+
+/*! \class SimulatedBackend
+ * \brief EdlBackend producing synthetic data packets, so that the library can be exercised and benchmarked without hardware.
+ *
+ * Data packets accumulate in a buffer of the simulated device at the applied sampling rate times E4SimulatorConfig_t::speedFactor,
+ * measured on the steady clock, and are generated when read.
+ * The voltage channel follows the applied protocol: #EdlCommandVhold, plus a triangular wave of amplitude #EdlCommandVamp
+ * and period #EdlCommandTPeriod when #EdlCommandMainTrial is 1, as set by setPotential.
+ * The current channels carry the open pore current, blockade events and white noise.
+ * Commands are stacked and applied like with EDL::setCommand; any command id below #EdlCommandIdNum is accepted.
+ */
+class SimulatedBackend : public EdlBackend {
+public:
+    /*! \brief SimulatedBackend constructor.
+     *
+     * \param config [in] Configuration of the simulated devices.
+     */
+    SimulatedBackend(EDL_IN const E4SimulatorConfig_t &config);
+
+    EdlErrorCode_t detectDevices(EDL_OUT std::vector <std::string> &deviceIds);
+    EdlErrorCode_t connectDevice(EDL_IN std::string deviceId);
+    EdlErrorCode_t disconnectDevice(EDL_VOID);
+    EdlErrorCode_t getDeviceStatus(EDL_OUT EdlDeviceStatus_t &status);
+    EdlErrorCode_t readData(EDL_IN unsigned int dataToRead,
+                            EDL_OUT unsigned int &dataRead,
+                            EDL_OUT std::vector <float> &buffer);
+    EdlErrorCode_t purgeData(EDL_VOID);
+    EdlErrorCode_t setCommand(EDL_IN EdlCommandId_t commandId,
+                              EDL_IN EdlCommandStruct_t &commandStruct,
+                              EDL_IN bool sendFlag);
+
+private:
+    void update(EDL_VOID);
+    void skip(unsigned long long packetsNum);
+    void generate(float * packets, unsigned int packetsNum);
+    void applySettings(EDL_VOID);
+    uint64_t randomBits(EDL_VOID);
+    unsigned long long randomInterval(double meanPackets);
+
+    E4SimulatorConfig_t config;
+    DeviceSettings settings;
+    bool connected;
+    uint64_t randomState;
+
+    double packetRateHz; /*!< Applied sampling rate times the speed factor. */
+    std::chrono::steady_clock::time_point rateStartTime;
+    unsigned long long rateStartPacketNum; /*!< Data packets produced when packetRateHz was last changed. */
+
+    unsigned long long producedNum; /*!< Data packets produced since the connection. */
+    unsigned long long consumedNum; /*!< Data packets read, purged or lost since the connection. */
+    unsigned long long signalIdx; /*!< Index of the next data packet in the synthetic signal, which also advances on lost data. */
+    unsigned long long nextOverflowIdx; /*!< Value of producedNum at which the next overflow is injected. */
+    unsigned long long nextLostDataIdx; /*!< Value of producedNum at which the next data loss is injected. */
+    bool bufferOverflowFlag;
+    bool lostDataFlag;
+
+    float voltageStep;
+    float currentStep;
+    double holdingVoltage;
+    double triangleAmplitude;
+    double trianglePeriodPackets; /*!< 0 for a constant voltage. */
+
+    bool eventFlags[EDL_CHANNEL_NUM-1];
+    unsigned long long eventChangeIdxs[EDL_CHANNEL_NUM-1]; /*!< Value of signalIdx at which each channel enters or leaves its next event. */
+};
+
+#endif // E4_SIMULATOR_H
@@ -0,0 +1,210 @@
+/*! \file e4_spectrum.cpp
+ * \brief Defines class WelchSpectrum.
+ */
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#include "e4_spectrum.h"
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+WelchSpectrum::WelchSpectrum() :
+    segmentPackets(0),
+    hopPackets(0),
+    averages(0),
+    samplingRateHz(0.0),
+    windowPower(0.0),
+    segmentFill(0),
+    poweredNum(0)
+{
+    memset(&spectrumInfo, 0, sizeof(spectrumInfo));
+}
+
+bool WelchSpectrum::configure(const E4SpectrumConfig_t &config, double samplingRateHz)
+{
+    const double rateHz = config.samplingRateHz > 0.0 ? config.samplingRateHz : samplingRateHz;
+    const unsigned int hopNum = config.hopPackets > 0 ? config.hopPackets : config.segmentPackets/2;
+    const unsigned int averageNum = config.averages > 0 ? config.averages : E4_SPECTRUM_DEFAULT_AVERAGES;
+
+    if (config.segmentPackets != 0)
+    {
+        if (config.segmentPackets < 2 || config.segmentPackets > E4_SPECTRUM_MAX_SEGMENT_PACKETS) {return false;}
+        if ((config.segmentPackets & (config.segmentPackets-1)) != 0) {return false;}
+        if (hopNum > config.segmentPackets || !(rateHz > 0.0)) {return false;}
+        fft.plan(config.segmentPackets);
+    }
+
+    segmentPackets = config.segmentPackets;
+    hopPackets = hopNum;
+    averages = averageNum;
+    this->samplingRateHz = rateHz;
+
+    if (segmentPackets > 0)
+    {
+        // Periodic Hann window.
+        window.resize(segmentPackets);
+        windowPower = 0.0;
+        for (unsigned int packetIdx = 0; packetIdx < segmentPackets; packetIdx++)
+        {
+            window[packetIdx] = 0.5-0.5*cos(2.0*M_PI*packetIdx/segmentPackets);
+            windowPower += window[packetIdx]*window[packetIdx];
+        }
+        segments.resize((size_t)E4_SPECTRUM_CHANNEL_NUM*segmentPackets);
+        re.resize(segmentPackets);
+        im.resize(segmentPackets);
+        powers.resize((size_t)E4_SPECTRUM_CHANNEL_NUM*(segmentPackets/2+1));
+    }
+    else
+    {
+        window.clear();
+        segments.clear();
+        re.clear();
+        im.clear();
+        powers.clear();
+    }
+
+    {
+        std::lock_guard <std::mutex> lock(spectrumMutex);
+        spectrum.assign(powers.size(), 0.0f);
+        spectrumInfo.binNum = segmentPackets > 0 ? segmentPackets/2+1 : 0;
+        spectrumInfo.averages = averages;
+        spectrumInfo.binWidthHz = segmentPackets > 0 ? rateHz/segmentPackets : 0.0;
+        spectrumInfo.spectrumCount = 0;
+    }
+
+    reset();
+    return true;
+}
+
+bool WelchSpectrum::isEnabled() const
+{
+    return segmentPackets > 0;
+}
+
+void WelchSpectrum::reset()
+{
+    segmentFill = 0;
+    poweredNum = 0;
+    std::fill(powers.begin(), powers.end(), 0.0);
+}
+
+void WelchSpectrum::process(const float * packets, unsigned int packetsNum)
+{
+    if (!isEnabled()) {return;}
+
+    while (packetsNum > 0) {
+        const unsigned int copyNum = packetsNum < segmentPackets-segmentFill ? packetsNum : segmentPackets-segmentFill;
+        for (unsigned int packetIdx = 0; packetIdx < copyNum; packetIdx++)
+        {
+            const float * packet = packets+(size_t)packetIdx*EDL_CHANNEL_NUM;
+            for (unsigned int channelIdx = 0; channelIdx < E4_SPECTRUM_CHANNEL_NUM; channelIdx++)
+            {
+                segments[(size_t)channelIdx*segmentPackets+segmentFill+packetIdx] = packet[1+channelIdx];
+            }
+        }
+        segmentFill += copyNum;
+        packets += (size_t)copyNum*EDL_CHANNEL_NUM;
+        packetsNum -= copyNum;
+
+        if (segmentFill == segmentPackets)
+        {
+            computeSegment();
+
+            // The next segment starts hopPackets later: keep the overlap.
+            for (unsigned int channelIdx = 0; channelIdx < E4_SPECTRUM_CHANNEL_NUM; channelIdx++)
+            {
+                float * segment = &segments[(size_t)channelIdx*segmentPackets];
+                memmove(segment, segment+hopPackets, sizeof(float)*(segmentPackets-hopPackets));
+            }
+            segmentFill = segmentPackets-hopPackets;
+        }
+    }
+}
+
+void WelchSpectrum::computeSegment()
+{
+    const unsigned int binNum = segmentPackets/2+1;
+
+    for (unsigned int channelIdx = 0; channelIdx < E4_SPECTRUM_CHANNEL_NUM; channelIdx += 2)
+    {
+        // Channel channelIdx goes in the real part, channelIdx+1 (if any) in the imaginary part.
+        const bool paired = channelIdx+1 < E4_SPECTRUM_CHANNEL_NUM;
+        const float * segmentRe = &segments[(size_t)channelIdx*segmentPackets];
+        const float * segmentIm = paired ? segmentRe+segmentPackets : NULL;
+
+        double meanRe = 0.0;
+        double meanIm = 0.0;
+        for (unsigned int packetIdx = 0; packetIdx < segmentPackets; packetIdx++)
+        {
+            meanRe += segmentRe[packetIdx];
+            if (paired) {meanIm += segmentIm[packetIdx];}
+        }
+        meanRe /= segmentPackets;
+        meanIm /= segmentPackets;
+
+        for (unsigned int packetIdx = 0; packetIdx < segmentPackets; packetIdx++)
+        {
+            re[packetIdx] = (segmentRe[packetIdx]-meanRe)*window[packetIdx];
+            im[packetIdx] = paired ? (segmentIm[packetIdx]-meanIm)*window[packetIdx] : 0.0;
+        }
+
+        fft.forward(re.data(), im.data());
+
+        // With Z = FFT(a+i*b): A[k] = (Z[k]+conj(Z[-k]))/2 and B[k] = (Z[k]-conj(Z[-k]))/(2i).
+        double * powerRe = &powers[(size_t)channelIdx*binNum];
+        double * powerIm = paired ? powerRe+binNum : NULL;
+        for (unsigned int binIdx = 0; binIdx < binNum; binIdx++)
+        {
+            const unsigned int mirrorIdx = binIdx == 0 ? 0 : segmentPackets-binIdx;
+            const double sumRe = re[binIdx]+re[mirrorIdx];
+            const double diffIm = im[binIdx]-im[mirrorIdx];
+            powerRe[binIdx] += 0.25*(sumRe*sumRe+diffIm*diffIm);
+            if (paired)
+            {
+                const double diffRe = re[binIdx]-re[mirrorIdx];
+                const double sumIm = im[binIdx]+im[mirrorIdx];
+                powerIm[binIdx] += 0.25*(sumIm*sumIm+diffRe*diffRe);
+            }
+        }
+    }
+
+    poweredNum++;
+    if (poweredNum == averages) {publish();}
+}
+
+void WelchSpectrum::publish()
+{
+    const unsigned int binNum = segmentPackets/2+1;
+    const double scale = 1.0/(samplingRateHz*windowPower*poweredNum);
+
+    std::lock_guard <std::mutex> lock(spectrumMutex);
+    for (unsigned int channelIdx = 0; channelIdx < E4_SPECTRUM_CHANNEL_NUM; channelIdx++)
+    {
+        for (unsigned int binIdx = 0; binIdx < binNum; binIdx++)
+        {
+            // One-sided density: the power of the negative frequencies is folded, except at 0Hz and Nyquist.
+            const double fold = binIdx == 0 || binIdx == binNum-1 ? 1.0 : 2.0;
+            const size_t idx = (size_t)channelIdx*binNum+binIdx;
+            spectrum[idx] = (float)(powers[idx]*scale*fold);
+        }
+    }
+    spectrumInfo.spectrumCount++;
+
+    std::fill(powers.begin(), powers.end(), 0.0);
+    poweredNum = 0;
+}
+
+void WelchSpectrum::get(float * dst, unsigned int maxBins, E4SpectrumInfo_t &info) const
+{
+    std::lock_guard <std::mutex> lock(spectrumMutex);
+    info = spectrumInfo;
+
+    const unsigned int copyNum = spectrumInfo.binNum < maxBins ? spectrumInfo.binNum : maxBins;
+    for (unsigned int channelIdx = 0; channelIdx < E4_SPECTRUM_CHANNEL_NUM && copyNum > 0; channelIdx++)
+    {
+        memcpy(dst+(size_t)channelIdx*maxBins, &spectrum[(size_t)channelIdx*spectrumInfo.binNum], sizeof(float)*copyNum);
+    }
+}
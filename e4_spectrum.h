@@ -0,0 +1,122 @@
+/*! \file e4_spectrum.h
+ * \brief Declares class WelchSpectrum.
+ */
+#ifndef E4_SPECTRUM_H
+#define E4_SPECTRUM_H
+
+#include <mutex>
+#include <vector>
+
+#include "edl_global.h"
+#include "edl_devicespecs.h"
+#include "e4_fft.h"
+
+/*! \def E4_SPECTRUM_CHANNEL_NUM
+ * \brief Number of channels with a spectrum: the current channels following the voltage in each data packet.
+ */
+#define E4_SPECTRUM_CHANNEL_NUM (EDL_CHANNEL_NUM-1)
+
+/*! \def E4_SPECTRUM_MAX_SEGMENT_PACKETS
+ * \brief Maximum length of the FFT segments.
+ */
+#define E4_SPECTRUM_MAX_SEGMENT_PACKETS (1 << 20)
+
+/*! \def E4_SPECTRUM_DEFAULT_AVERAGES
+ * \brief Default number of segments averaged into each spectrum.
+ */
+#define E4_SPECTRUM_DEFAULT_AVERAGES 8
+
+/*! \struct E4SpectrumConfig_t
+ * \brief Struct that configures a WelchSpectrum. Passed to setSpectrum.
+ */
+typedef struct {
+    unsigned int segmentPackets; /*!< Length of the FFT segments, a power of two up to #E4_SPECTRUM_MAX_SEGMENT_PACKETS; 0 disables the spectrum. */
+    unsigned int hopPackets; /*!< Distance between the starts of consecutive segments, at most segmentPackets; 0 for segmentPackets/2, i.e. 50% overlap. */
+    unsigned int averages; /*!< Number of segments averaged into each spectrum, 0 for #E4_SPECTRUM_DEFAULT_AVERAGES. */
+    double samplingRateHz; /*!< Input sampling rate, 0 to use the rate applied with #EdlCommandSamplingRate. */
+} E4SpectrumConfig_t;
+
+/*! \struct E4SpectrumInfo_t
+ * \brief Struct that describes the latest spectrum. Returned by getSpectrum.
+ */
+typedef struct {
+    unsigned int binNum; /*!< Number of frequency bins per channel: segmentPackets/2+1, from 0Hz to half the sampling rate. */
+    unsigned int averages; /*!< Number of segments averaged into the spectrum. */
+    double binWidthHz; /*!< Frequency step between consecutive bins. */
+    unsigned long long spectrumCount; /*!< Spectra computed since the configuration, 0 if none yet. */
+} E4SpectrumInfo_t;
+
+/*! \class WelchSpectrum
+ * \brief Estimates continuously the power spectral density of the current channels of a stream of data packets
+ * with Welch's method: overlapped, Hann windowed segments, with their mean removed, and averaged periodograms.
+ *
+ * Two channels share each complex FFT, as its real and imaginary parts, and are separated by conjugate symmetry.
+ * The densities are one-sided, in squared units of the current channels per Hz.
+ * WelchSpectrum::process and WelchSpectrum::configure must be called from the same thread or serialized;
+ * WelchSpectrum::get may be called from any thread.
+ */
+class WelchSpectrum {
+public:
+    WelchSpectrum();
+
+    /*! \brief Applies a configuration and discards the spectra.
+     *
+     * \param config [in] Spectrum configuration.
+     * \param samplingRateHz [in] Input sampling rate, used if E4SpectrumConfig_t::samplingRateHz is 0.
+     * \return false, leaving the spectrum unchanged, if the configuration is invalid.
+     */
+    bool configure(EDL_IN const E4SpectrumConfig_t &config,
+                   EDL_IN double samplingRateHz);
+
+    /*! \brief Returns true if spectra are computed.
+     */
+    bool isEnabled(EDL_VOID) const;
+
+    /*! \brief Discards the data packets of the segments in progress. The latest spectrum is kept.
+     */
+    void reset(EDL_VOID);
+
+    /*! \brief Adds data packets to the segments, computing a spectrum every E4SpectrumConfig_t::averages segments.
+     *
+     * \param packets [in] Buffer of \a packetsNum data packets of #EDL_CHANNEL_NUM values.
+     * \param packetsNum [in] Number of data packets in \a packets.
+     */
+    void process(EDL_IN const float * packets,
+                 EDL_IN unsigned int packetsNum);
+
+    /*! \brief Returns the latest spectrum.
+     *
+     * \param dst [out] Buffer of #E4_SPECTRUM_CHANNEL_NUM arrays of \a maxBins values, filled with the first bins of each channel.
+     * \param maxBins [in] Number of values of each array of \a dst.
+     * \param info [out] Description of the spectrum.
+     */
+    void get(EDL_OUT float * dst,
+             EDL_IN unsigned int maxBins,
+             EDL_OUT E4SpectrumInfo_t &info) const;
+
+private:
+    void computeSegment(EDL_VOID);
+    void publish(EDL_VOID);
+
+    unsigned int segmentPackets;
+    unsigned int hopPackets;
+    unsigned int averages;
+    double samplingRateHz;
+
+    FourierTransform fft;
+    std::vector <double> window;
+    double windowPower; /*!< Sum of the squared window values. */
+
+    std::vector <float> segments; /*!< #E4_SPECTRUM_CHANNEL_NUM arrays of segmentPackets values. */
+    unsigned int segmentFill;
+    std::vector <double> re;
+    std::vector <double> im;
+    std::vector <double> powers; /*!< Sum of the periodograms of the segments since the last spectrum, per channel and bin. */
+    unsigned int poweredNum;
+
+    mutable std::mutex spectrumMutex;
+    std::vector <float> spectrum; /*!< Latest spectrum, per channel and bin. */
+    E4SpectrumInfo_t spectrumInfo;
+};
+
+#endif // E4_SPECTRUM_H
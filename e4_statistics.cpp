@@ -0,0 +1,220 @@
+/*! \file e4_statistics.cpp
+ * \brief Defines class RunningStatistics.
+ */
+#include <cfloat>
+#include <cmath>
+
+#include "e4_statistics.h"
+#include "e4_compression.h"
+
+RunningStatistics::RunningStatistics() :
+    subwindowPackets(E4_STATS_DEFAULT_WINDOW_PACKETS/E4_STATS_SUBWINDOWS)
+{
+    for (unsigned int channelIdx = 0; channelIdx < EDL_CHANNEL_NUM; channelIdx++) {clipLevels[channelIdx] = FLT_MAX;}
+    reset();
+}
+
+void RunningStatistics::setWindow(unsigned int windowPackets)
+{
+    {
+        std::lock_guard <std::mutex> lock(mutex);
+        if (windowPackets == 0) {windowPackets = E4_STATS_DEFAULT_WINDOW_PACKETS;}
+        subwindowPackets = windowPackets/E4_STATS_SUBWINDOWS > 0 ? windowPackets/E4_STATS_SUBWINDOWS : 1;
+    }
+    reset();
+}
+
+void RunningStatistics::setRanges(double currentFullScale)
+{
+    // One ADC code below the full scale: the converter saturates there.
+    const double codeRatio = 1.0-1.0/E4_ADC_CODES_HALF_RANGE;
+
+    std::lock_guard <std::mutex> lock(mutex);
+    clipLevels[0] = (float)(E4_VOLTAGE_FULL_SCALE_MV*codeRatio);
+    for (unsigned int channelIdx = 1; channelIdx < EDL_CHANNEL_NUM; channelIdx++)
+    {
+        clipLevels[channelIdx] = currentFullScale > 0.0 ? (float)(currentFullScale*codeRatio) : FLT_MAX;
+    }
+}
+
+void RunningStatistics::reset()
+{
+    std::lock_guard <std::mutex> lock(mutex);
+    subwindows.resize((E4_STATS_SUBWINDOWS+1)*EDL_CHANNEL_NUM);
+    clear(subwindows.data());
+    subwindowIdx = 0;
+    subwindowFill = 0;
+    completedNum = 0;
+    clear(total);
+    packetNum = 0;
+    bufferOverflowCount = 0;
+    lostDataCount = 0;
+}
+
+void RunningStatistics::clear(Moments_t * moments)
+{
+    for (unsigned int channelIdx = 0; channelIdx < EDL_CHANNEL_NUM; channelIdx++)
+    {
+        moments[channelIdx].sampleNum = 0;
+        moments[channelIdx].clippedNum = 0;
+        moments[channelIdx].mean = 0.0;
+        moments[channelIdx].m2 = 0.0;
+        moments[channelIdx].min = FLT_MAX;
+        moments[channelIdx].max = -FLT_MAX;
+    }
+}
+
+void RunningStatistics::merge(Moments_t &dst, const Moments_t &src)
+{
+    if (src.sampleNum == 0) {return;}
+    if (dst.sampleNum == 0)
+    {
+        dst = src;
+        return;
+    }
+
+    const double sampleNum = (double)(dst.sampleNum+src.sampleNum);
+    const double delta = src.mean-dst.mean;
+    dst.mean += delta*src.sampleNum/sampleNum;
+    dst.m2 += src.m2+delta*delta*dst.sampleNum*src.sampleNum/sampleNum;
+    dst.sampleNum += src.sampleNum;
+    dst.clippedNum += src.clippedNum;
+    if (src.min < dst.min) {dst.min = src.min;}
+    if (src.max > dst.max) {dst.max = src.max;}
+}
+
+void RunningStatistics::fill(const Moments_t &moments, E4ChannelStats_t &stats)
+{
+    stats.sampleNum = moments.sampleNum;
+    stats.clippedNum = moments.clippedNum;
+    stats.mean = moments.mean;
+    stats.stdDev = moments.sampleNum > 0 ? sqrt(moments.m2/moments.sampleNum) : 0.0;
+    stats.rms = sqrt(stats.mean*stats.mean+stats.stdDev*stats.stdDev);
+    stats.min = moments.sampleNum > 0 ? moments.min : 0.0f;
+    stats.max = moments.sampleNum > 0 ? moments.max : 0.0f;
+}
+
+void RunningStatistics::measure(const float * packets, unsigned int packetsNum, Moments_t * moments) const
+{
+    double sums[EDL_CHANNEL_NUM];
+    double m2s[EDL_CHANNEL_NUM];
+    float mins[EDL_CHANNEL_NUM];
+    float maxs[EDL_CHANNEL_NUM];
+    unsigned long long clippedNums[EDL_CHANNEL_NUM];
+
+    for (unsigned int channelIdx = 0; channelIdx < EDL_CHANNEL_NUM; channelIdx++)
+    {
+        sums[channelIdx] = 0.0;
+        m2s[channelIdx] = 0.0;
+        mins[channelIdx] = FLT_MAX;
+        maxs[channelIdx] = -FLT_MAX;
+        clippedNums[channelIdx] = 0;
+    }
+
+    // Two passes over the batch, still in cache: the mean first, then the squared deviations from it.
+    for (unsigned int packetIdx = 0; packetIdx < packetsNum; packetIdx++)
+    {
+        const float * packet = packets+(size_t)packetIdx*EDL_CHANNEL_NUM;
+        for (unsigned int channelIdx = 0; channelIdx < EDL_CHANNEL_NUM; channelIdx++)
+        {
+            const float value = packet[channelIdx];
+            sums[channelIdx] += value;
+            mins[channelIdx] = value < mins[channelIdx] ? value : mins[channelIdx];
+            maxs[channelIdx] = value > maxs[channelIdx] ? value : maxs[channelIdx];
+            clippedNums[channelIdx] += fabsf(value) >= clipLevels[channelIdx];
+        }
+    }
+
+    for (unsigned int channelIdx = 0; channelIdx < EDL_CHANNEL_NUM; channelIdx++) {sums[channelIdx] /= packetsNum;}
+
+    for (unsigned int packetIdx = 0; packetIdx < packetsNum; packetIdx++)
+    {
+        const float * packet = packets+(size_t)packetIdx*EDL_CHANNEL_NUM;
+        for (unsigned int channelIdx = 0; channelIdx < EDL_CHANNEL_NUM; channelIdx++)
+        {
+            const double deviation = packet[channelIdx]-sums[channelIdx];
+            m2s[channelIdx] += deviation*deviation;
+        }
+    }
+
+    for (unsigned int channelIdx = 0; channelIdx < EDL_CHANNEL_NUM; channelIdx++)
+    {
+        moments[channelIdx].sampleNum = packetsNum;
+        moments[channelIdx].clippedNum = clippedNums[channelIdx];
+        moments[channelIdx].mean = sums[channelIdx];
+        moments[channelIdx].m2 = m2s[channelIdx];
+        moments[channelIdx].min = mins[channelIdx];
+        moments[channelIdx].max = maxs[channelIdx];
+    }
+}
+
+void RunningStatistics::update(const float * packets, unsigned int packetsNum, bool bufferOverflow, bool lostData)
+{
+    Moments_t moments[EDL_CHANNEL_NUM];
+
+    {
+        std::lock_guard <std::mutex> lock(mutex);
+        if (bufferOverflow) {bufferOverflowCount++;}
+        if (lostData) {lostDataCount++;}
+    }
+
+    while (packetsNum > 0) {
+        // Only this thread moves subwindowFill forward; a concurrent reset can only move it back.
+        unsigned int segmentNum;
+        {
+            std::lock_guard <std::mutex> lock(mutex);
+            segmentNum = packetsNum < subwindowPackets-subwindowFill ? packetsNum : subwindowPackets-subwindowFill;
+        }
+
+        // Measure out of the lock, so that get is never delayed by a whole batch.
+        measure(packets, segmentNum, moments);
+
+        std::lock_guard <std::mutex> lock(mutex);
+        Moments_t * subwindow = &subwindows[(size_t)subwindowIdx*EDL_CHANNEL_NUM];
+        for (unsigned int channelIdx = 0; channelIdx < EDL_CHANNEL_NUM; channelIdx++)
+        {
+            merge(subwindow[channelIdx], moments[channelIdx]);
+            merge(total[channelIdx], moments[channelIdx]);
+        }
+        packetNum += segmentNum;
+        subwindowFill += segmentNum;
+
+        if (subwindowFill >= subwindowPackets)
+        {
+            subwindowIdx = (subwindowIdx+1)%(E4_STATS_SUBWINDOWS+1);
+            clear(&subwindows[(size_t)subwindowIdx*EDL_CHANNEL_NUM]);
+            subwindowFill = 0;
+            if (completedNum < E4_STATS_SUBWINDOWS) {completedNum++;}
+        }
+
+        packets += (size_t)segmentNum*EDL_CHANNEL_NUM;
+        packetsNum -= segmentNum;
+    }
+}
+
+void RunningStatistics::get(E4Stats_t &stats) const
+{
+    Moments_t window[EDL_CHANNEL_NUM];
+    clear(window);
+
+    std::lock_guard <std::mutex> lock(mutex);
+    unsigned long long windowPacketNum = 0;
+    for (unsigned int completedIdx = 1; completedIdx <= completedNum; completedIdx++)
+    {
+        const unsigned int idx = (subwindowIdx+E4_STATS_SUBWINDOWS+1-completedIdx)%(E4_STATS_SUBWINDOWS+1);
+        const Moments_t * subwindow = &subwindows[(size_t)idx*EDL_CHANNEL_NUM];
+        for (unsigned int channelIdx = 0; channelIdx < EDL_CHANNEL_NUM; channelIdx++) {merge(window[channelIdx], subwindow[channelIdx]);}
+        windowPacketNum += subwindow[0].sampleNum;
+    }
+
+    stats.packetNum = packetNum;
+    stats.windowPacketNum = windowPacketNum;
+    stats.windowFirstPacketIdx = packetNum-subwindowFill-windowPacketNum;
+    stats.bufferOverflowCount = bufferOverflowCount;
+    stats.lostDataCount = lostDataCount;
+    for (unsigned int channelIdx = 0; channelIdx < EDL_CHANNEL_NUM; channelIdx++)
+    {
+        fill(window[channelIdx], stats.window[channelIdx]);
+        fill(total[channelIdx], stats.total[channelIdx]);
+    }
+}
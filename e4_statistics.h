@@ -0,0 +1,126 @@
+/*! \file e4_statistics.h
+ * \brief Declares class RunningStatistics.
+ */
+#ifndef E4_STATISTICS_H
+#define E4_STATISTICS_H
+
+#include <mutex>
+#include <vector>
+
+#include "edl_global.h"
+#include "edl_devicespecs.h"
+
+/*! \def E4_STATS_DEFAULT_WINDOW_PACKETS
+ * \brief Default length of the sliding window: 0.1s at 200kHz.
+ */
+#define E4_STATS_DEFAULT_WINDOW_PACKETS 20000
+
+/*! \def E4_STATS_SUBWINDOWS
+ * \brief Number of steps the sliding window advances by over its length.
+ */
+#define E4_STATS_SUBWINDOWS 10
+
+/*! \struct E4ChannelStats_t
+ * \brief Struct that contains the statistics of one channel over a range of data packets.
+ */
+typedef struct {
+    unsigned long long sampleNum; /*!< Number of samples. */
+    unsigned long long clippedNum; /*!< Number of samples within one ADC code of the full scale of the range. */
+    double mean; /*!< Mean value. */
+    double stdDev; /*!< Standard deviation, i.e. RMS noise around the mean. */
+    double rms; /*!< Root mean square, including the mean. */
+    float min; /*!< Minimum value. */
+    float max; /*!< Maximum value. */
+} E4ChannelStats_t;
+
+/*! \struct E4Stats_t
+ * \brief Struct that contains the running statistics of every channel. Returned by getStats.
+ * The first channel is the voltage, the others are currents, as in the data packets.
+ */
+typedef struct {
+    unsigned long long packetNum; /*!< Data packets since the statistics were reset. */
+    unsigned long long windowFirstPacketIdx; /*!< Index of the first data packet of the sliding window. */
+    unsigned long long windowPacketNum; /*!< Data packets in the sliding window: its length once filled. */
+    unsigned long long bufferOverflowCount; /*!< Number of reads following a status poll with EdlDeviceStatus_t::bufferOverflowFlag. */
+    unsigned long long lostDataCount; /*!< Number of reads following a status poll with EdlDeviceStatus_t::lostDataFlag. */
+    E4ChannelStats_t window[EDL_CHANNEL_NUM]; /*!< Statistics over the sliding window. */
+    E4ChannelStats_t total[EDL_CHANNEL_NUM]; /*!< Statistics since the reset. */
+} E4Stats_t;
+
+/*! \class RunningStatistics
+ * \brief Computes incrementally the statistics of each channel of a stream of data packets,
+ * over a sliding window and since the last reset.
+ *
+ * The window is split in #E4_STATS_SUBWINDOWS subwindows. The moments of each batch are computed in two passes,
+ * then merged into the current subwindow with the pairwise update of Chan et al., the parallel form of Welford's algorithm;
+ * RunningStatistics::get merges the completed subwindows. The window therefore slides in steps of 1/#E4_STATS_SUBWINDOWS
+ * of its length, and reading it costs a few tens of merges regardless of the sampling rate.
+ * RunningStatistics::update must be called from one thread at a time; RunningStatistics::get may be called from any thread.
+ */
+class RunningStatistics {
+public:
+    RunningStatistics();
+
+    /*! \brief Sets the length of the sliding window and resets the statistics.
+     *
+     * \param windowPackets [in] Length of the sliding window in data packets, 0 for #E4_STATS_DEFAULT_WINDOW_PACKETS.
+     */
+    void setWindow(EDL_IN unsigned int windowPackets);
+
+    /*! \brief Sets the full scale values samples are clipped at.
+     *
+     * \param currentFullScale [in] Full scale of the current range, in the unit of the current channels, 0 if unknown.
+     */
+    void setRanges(EDL_IN double currentFullScale);
+
+    /*! \brief Forgets all of the data packets.
+     */
+    void reset(EDL_VOID);
+
+    /*! \brief Adds data packets to the statistics.
+     *
+     * \param packets [in] Buffer of \a packetsNum data packets of #EDL_CHANNEL_NUM values.
+     * \param packetsNum [in] Number of data packets in \a packets.
+     * \param bufferOverflow [in] EdlDeviceStatus_t::bufferOverflowFlag of the status poll preceding the read.
+     * \param lostData [in] EdlDeviceStatus_t::lostDataFlag of the status poll preceding the read.
+     */
+    void update(EDL_IN const float * packets,
+                EDL_IN unsigned int packetsNum,
+                EDL_IN bool bufferOverflow,
+                EDL_IN bool lostData);
+
+    /*! \brief Returns the statistics.
+     */
+    void get(EDL_OUT E4Stats_t &stats) const;
+
+private:
+    typedef struct {
+        unsigned long long sampleNum;
+        unsigned long long clippedNum;
+        double mean;
+        double m2; /*!< Sum of the squared deviations from the mean. */
+        float min;
+        float max;
+    } Moments_t;
+
+    static void clear(Moments_t * moments);
+    static void merge(Moments_t &dst, const Moments_t &src);
+    static void fill(const Moments_t &moments, E4ChannelStats_t &stats);
+    void measure(const float * packets, unsigned int packetsNum, Moments_t * moments) const;
+
+    mutable std::mutex mutex;
+    unsigned int subwindowPackets;
+    float clipLevels[EDL_CHANNEL_NUM];
+
+    std::vector <Moments_t> subwindows; /*!< Ring of #E4_STATS_SUBWINDOWS+1 subwindows of #EDL_CHANNEL_NUM channels; the current one is partial. */
+    unsigned int subwindowIdx;
+    unsigned int subwindowFill; /*!< Data packets in the current subwindow. */
+    unsigned int completedNum; /*!< Completed subwindows in the ring. */
+
+    Moments_t total[EDL_CHANNEL_NUM];
+    unsigned long long packetNum;
+    unsigned long long bufferOverflowCount;
+    unsigned long long lostDataCount;
+};
+
+#endif // E4_STATISTICS_H
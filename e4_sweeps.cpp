@@ -0,0 +1,264 @@
+/*! \file e4_sweeps.cpp
+ * \brief Defines class SweepAverager.
+ */
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstring>
+
+#include "e4_sweeps.h"
+
+/*! Smallest voltage range a sweep is triggered on: below it the voltage is taken as constant. */
+#define E4_SWEEP_MIN_RANGE_MV 1.0
+
+/*! Relative deviation of the length of a sweep from the period beyond which the sweep is discarded. */
+#define E4_SWEEP_LENGTH_TOLERANCE 0.01
+
+SweepAverager::SweepAverager() :
+    channelMask(0),
+    averages(E4_SWEEP_DEFAULT_AVERAGES),
+    binNum(0),
+    periodPackets(0.0),
+    samplingRateHz(0.0),
+    sweepNum(0),
+    rejectedNum(0)
+{
+    memset(&sweepInfo, 0, sizeof(sweepInfo));
+    reset();
+}
+
+bool SweepAverager::configure(const E4SweepConfig_t &config, double samplingRateHz, double protocolPeriodMs)
+{
+    const double rateHz = config.samplingRateHz > 0.0 ? config.samplingRateHz : samplingRateHz;
+    const double periodMs = config.periodMs > 0.0 ? config.periodMs : protocolPeriodMs;
+    const unsigned int averageNum = config.averages > 0 ? config.averages : E4_SWEEP_DEFAULT_AVERAGES;
+    double packetsNum = 0.0;
+
+    if ((config.channelMask >> E4_SWEEP_CHANNEL_NUM) != 0) {return false;}
+    if (config.channelMask != 0)
+    {
+        if (!(rateHz > 0.0) || !(periodMs > 0.0)) {return false;}
+        packetsNum = periodMs*1.0e-3*rateHz;
+        if (packetsNum < 4.0 || packetsNum > E4_SWEEP_MAX_PACKETS) {return false;}
+    }
+
+    channelMask = config.channelMask;
+    averages = averageNum;
+    binNum = (unsigned int)packetsNum;
+    periodPackets = packetsNum;
+    this->samplingRateHz = rateHz;
+    sweepNum = 0;
+    rejectedNum = 0;
+
+    sweep.assign((size_t)EDL_CHANNEL_NUM*binNum, 0.0f);
+    averaged.assign((size_t)EDL_CHANNEL_NUM*binNum, 0.0);
+    counts.assign(binNum, 0);
+
+    {
+        std::lock_guard <std::mutex> lock(sweepMutex);
+        published.assign(averaged.size(), 0.0f);
+        memset(&sweepInfo, 0, sizeof(sweepInfo));
+        sweepInfo.binNum = binNum;
+        sweepInfo.binTimeS = rateHz > 0.0 ? 1.0/rateHz : 0.0;
+    }
+
+    reset();
+    return true;
+}
+
+bool SweepAverager::isEnabled() const
+{
+    return channelMask != 0;
+}
+
+void SweepAverager::reset()
+{
+    learnedNum = 0;
+    voltageMin = FLT_MAX;
+    voltageMax = -FLT_MAX;
+    armed = false;
+    inSweep = false;
+    sweepFill = 0;
+}
+
+void SweepAverager::process(const float * packets, unsigned int packetsNum, bool discontinuity)
+{
+    if (!isEnabled()) {return;}
+
+    if (discontinuity)
+    {
+        if (inSweep) {reject();}
+        inSweep = false;
+        armed = false;
+    }
+
+    const float middle = 0.5f*(voltageMin+voltageMax);
+    const float low = middle-0.25f*(voltageMax-voltageMin);
+    const bool triggered = voltageMax-voltageMin >= E4_SWEEP_MIN_RANGE_MV;
+    const double maxFill = periodPackets*(1.0+E4_SWEEP_LENGTH_TOLERANCE)+1.0;
+
+    for (unsigned int packetIdx = 0; packetIdx < packetsNum; packetIdx++)
+    {
+        const float * packet = packets+(size_t)packetIdx*EDL_CHANNEL_NUM;
+        const float voltage = packet[0];
+
+        if (learnedNum < binNum)
+        {
+            // Learn the voltage range over a whole period before triggering.
+            voltageMin = std::min(voltageMin, voltage);
+            voltageMax = std::max(voltageMax, voltage);
+            if (++learnedNum == binNum)
+            {
+                process(packet+EDL_CHANNEL_NUM, packetsNum-packetIdx-1, false);
+                return;
+            }
+            continue;
+        }
+        if (!triggered) {continue;}
+
+        if (voltage < low) {armed = true;}
+        else if (armed && voltage >= middle)
+        {
+            armed = false;
+            if (inSweep) {endSweep();}
+            inSweep = true;
+            sweepFill = 0;
+        }
+
+        if (!inSweep) {continue;}
+        if (sweepFill < binNum)
+        {
+            sweep[sweepFill] = voltage;
+            for (unsigned int channelIdx = 0; channelIdx < E4_SWEEP_CHANNEL_NUM; channelIdx++)
+            {
+                if (channelMask & (1u << channelIdx)) {sweep[(size_t)(1+channelIdx)*binNum+sweepFill] = packet[1+channelIdx];}
+            }
+        }
+        sweepFill++;
+
+        // The next sweep is overdue: the protocol stopped or changed.
+        if (sweepFill > maxFill)
+        {
+            reject();
+            inSweep = false;
+        }
+    }
+}
+
+void SweepAverager::endSweep()
+{
+    if (fabs(sweepFill-periodPackets) > std::max(1.0, E4_SWEEP_LENGTH_TOLERANCE*periodPackets))
+    {
+        reject();
+        return;
+    }
+
+    // Plain mean of the first sweeps, then exponential average over the last ones.
+    const unsigned int filledNum = std::min(sweepFill, binNum);
+    for (unsigned int binIdx = 0; binIdx < filledNum; binIdx++)
+    {
+        if (counts[binIdx] < averages) {counts[binIdx]++;}
+        const double weight = 1.0/counts[binIdx];
+        for (unsigned int channelIdx = 0; channelIdx < EDL_CHANNEL_NUM; channelIdx++)
+        {
+            if (channelIdx > 0 && (channelMask & (1u << (channelIdx-1))) == 0) {continue;}
+            const size_t idx = (size_t)channelIdx*binNum+binIdx;
+            averaged[idx] += weight*(sweep[idx]-averaged[idx]);
+        }
+    }
+    sweepNum++;
+    publish();
+}
+
+void SweepAverager::reject()
+{
+    rejectedNum++;
+    std::lock_guard <std::mutex> lock(sweepMutex);
+    sweepInfo.rejectedCount = rejectedNum;
+}
+
+void SweepAverager::fit(unsigned int channelIdx, E4SweepFit_t &fit) const
+{
+    memset(&fit, 0, sizeof(fit));
+    if ((channelMask & (1u << channelIdx)) == 0) {return;}
+
+    const double * voltages = &averaged[0];
+    const double * currents = &averaged[(size_t)(1+channelIdx)*binNum];
+    const double halfStepMs = 2.0e3/samplingRateHz;
+
+    // dV/dt by central differences: the first and last bins are left out, and so are those not averaged yet.
+    double n = 0.0;
+    double meanV = 0.0;
+    double meanD = 0.0;
+    double meanI = 0.0;
+    for (unsigned int binIdx = 1; binIdx+1 < binNum; binIdx++)
+    {
+        if (counts[binIdx+1] == 0) {break;}
+        n += 1.0;
+        meanV += voltages[binIdx];
+        meanD += (voltages[binIdx+1]-voltages[binIdx-1])/halfStepMs;
+        meanI += currents[binIdx];
+    }
+    if (n < 3.0) {return;}
+    meanV /= n;
+    meanD /= n;
+    meanI /= n;
+
+    // Least squares on the centred regressors.
+    double svv = 0.0;
+    double sdd = 0.0;
+    double svd = 0.0;
+    double svi = 0.0;
+    double sdi = 0.0;
+    for (unsigned int binIdx = 1; binIdx <= (unsigned int)n; binIdx++)
+    {
+        const double v = voltages[binIdx]-meanV;
+        const double d = (voltages[binIdx+1]-voltages[binIdx-1])/halfStepMs-meanD;
+        const double i = currents[binIdx]-meanI;
+        svv += v*v;
+        sdd += d*d;
+        svd += v*d;
+        svi += v*i;
+        sdi += d*i;
+    }
+    const double det = svv*sdd-svd*svd;
+    if (!(det > 1.0e-9*svv*sdd)) {return;}
+
+    fit.fitted = true;
+    fit.conductance = (svi*sdd-sdi*svd)/det;
+    fit.capacitance = (sdi*svv-svi*svd)/det;
+    fit.offsetCurrent = meanI-fit.conductance*meanV-fit.capacitance*meanD;
+
+    double residuals = 0.0;
+    for (unsigned int binIdx = 1; binIdx <= (unsigned int)n; binIdx++)
+    {
+        const double d = (voltages[binIdx+1]-voltages[binIdx-1])/halfStepMs;
+        const double r = currents[binIdx]-fit.conductance*voltages[binIdx]-fit.capacitance*d-fit.offsetCurrent;
+        residuals += r*r;
+    }
+    fit.residualRms = sqrt(residuals/n);
+}
+
+void SweepAverager::publish()
+{
+    E4SweepFit_t fits[E4_SWEEP_CHANNEL_NUM];
+    for (unsigned int channelIdx = 0; channelIdx < E4_SWEEP_CHANNEL_NUM; channelIdx++) {fit(channelIdx, fits[channelIdx]);}
+
+    std::lock_guard <std::mutex> lock(sweepMutex);
+    for (size_t idx = 0; idx < averaged.size(); idx++) {published[idx] = (float)averaged[idx];}
+    memcpy(sweepInfo.fits, fits, sizeof(fits));
+    sweepInfo.sweepCount = sweepNum;
+    sweepInfo.rejectedCount = rejectedNum;
+}
+
+void SweepAverager::get(float * dst, unsigned int maxBins, E4SweepInfo_t &info) const
+{
+    std::lock_guard <std::mutex> lock(sweepMutex);
+    info = sweepInfo;
+
+    const unsigned int copyNum = sweepInfo.binNum < maxBins ? sweepInfo.binNum : maxBins;
+    for (unsigned int channelIdx = 0; channelIdx < EDL_CHANNEL_NUM && copyNum > 0; channelIdx++)
+    {
+        memcpy(dst+(size_t)channelIdx*maxBins, &published[(size_t)channelIdx*sweepInfo.binNum], sizeof(float)*copyNum);
+    }
+}
@@ -0,0 +1,147 @@
+/*! \file e4_sweeps.h
+ * \brief Declares class SweepAverager.
+ */
+#ifndef E4_SWEEPS_H
+#define E4_SWEEPS_H
+
+#include <mutex>
+#include <vector>
+
+#include "edl_global.h"
+#include "edl_devicespecs.h"
+
+/*! \def E4_SWEEP_CHANNEL_NUM
+ * \brief Number of channels averaged against the voltage: the current channels following the voltage in each data packet.
+ */
+#define E4_SWEEP_CHANNEL_NUM (EDL_CHANNEL_NUM-1)
+
+/*! \def E4_SWEEP_MAX_PACKETS
+ * \brief Maximum length of a protocol period in data packets, i.e. of an averaged sweep.
+ */
+#define E4_SWEEP_MAX_PACKETS (1 << 20)
+
+/*! \def E4_SWEEP_DEFAULT_AVERAGES
+ * \brief Default number of sweeps in the running averages.
+ */
+#define E4_SWEEP_DEFAULT_AVERAGES 16
+
+/*! \struct E4SweepConfig_t
+ * \brief Struct that configures a SweepAverager. Passed to setSweeps.
+ */
+typedef struct {
+    unsigned int channelMask; /*!< Bit c enables the averaging of current channel c; 0 disables the sweeps. */
+    unsigned int averages; /*!< Sweeps in the running averages: plain mean of the first ones, then exponential average with this time constant; 0 for #E4_SWEEP_DEFAULT_AVERAGES. */
+    double periodMs; /*!< Protocol period, 0 to use the period applied with #EdlCommandTPeriod by a triangular protocol. */
+    double samplingRateHz; /*!< Input sampling rate, 0 to use the rate applied with #EdlCommandSamplingRate. */
+} E4SweepConfig_t;
+
+/*! \struct E4SweepFit_t
+ * \brief Struct that contains the least squares fit of the averaged sweep of a current channel: I = G*V+C*dV/dt+I0.
+ * With the voltage in mV and the time in ms, G is in nS and C in pF in the 200pA range, where currents are in pA,
+ * and in uS and nF in the other ranges, where currents are in nA.
+ */
+typedef struct {
+    bool fitted; /*!< false if the channel is not averaged, or if the averaged voltage does not vary enough to separate G from C. */
+    double conductance; /*!< G: current per mV of the voltage. */
+    double capacitance; /*!< C: current per mV/ms of the voltage slope. */
+    double offsetCurrent; /*!< I0: current at 0mV and constant voltage. */
+    double residualRms; /*!< RMS of the averaged current around the fit. */
+} E4SweepFit_t;
+
+/*! \struct E4SweepInfo_t
+ * \brief Struct that describes the latest averaged sweep. Returned by getSweep.
+ */
+typedef struct {
+    unsigned int binNum; /*!< Data packets per sweep, i.e. values per channel of the averaged sweep. */
+    double binTimeS; /*!< Time step between consecutive values. */
+    unsigned long long sweepCount; /*!< Sweeps averaged since the configuration, 0 if none yet. */
+    unsigned long long rejectedCount; /*!< Sweeps discarded because their length did not match the period or data packets were lost. */
+    E4SweepFit_t fits[E4_SWEEP_CHANNEL_NUM]; /*!< Fit of each current channel. */
+} E4SweepInfo_t;
+
+/*! \class SweepAverager
+ * \brief Splits a stream of data packets into protocol periods using the voltage channel, and keeps running averages
+ * of the voltage and of the current channels over the periods, i.e. of the current vs voltage curve of each sweep.
+ *
+ * A sweep starts when the voltage rises through the middle of its range, with a hysteresis of a quarter of the range;
+ * the range is learnt over the first period after each reset. For a triangular protocol this is the start of the period,
+ * for a step protocol the rising edge of the step. A sweep is averaged, data packet by data packet, when the next one starts,
+ * if its length matches the period within 1%; a sweep interrupted by lost data packets is discarded.
+ * Each averaged sweep is published with its fit, see E4SweepFit_t, where dV/dt is derived from the averaged voltage.
+ * SweepAverager::process and SweepAverager::configure must be called from the same thread or serialized;
+ * SweepAverager::get may be called from any thread.
+ */
+class SweepAverager {
+public:
+    SweepAverager();
+
+    /*! \brief Applies a configuration and discards the averaged sweeps.
+     *
+     * \param config [in] Sweep configuration.
+     * \param samplingRateHz [in] Input sampling rate, used if E4SweepConfig_t::samplingRateHz is 0.
+     * \param protocolPeriodMs [in] Applied protocol period, used if E4SweepConfig_t::periodMs is 0.
+     * \return false, leaving the sweeps unchanged, if the configuration is invalid.
+     */
+    bool configure(EDL_IN const E4SweepConfig_t &config,
+                   EDL_IN double samplingRateHz,
+                   EDL_IN double protocolPeriodMs);
+
+    /*! \brief Returns true if sweeps are averaged.
+     */
+    bool isEnabled(EDL_VOID) const;
+
+    /*! \brief Discards the sweep in progress and learns the voltage range again. The averaged sweeps are kept.
+     */
+    void reset(EDL_VOID);
+
+    /*! \brief Adds data packets to the sweep in progress, averaging and publishing every completed sweep.
+     *
+     * \param packets [in] Buffer of \a packetsNum data packets of #EDL_CHANNEL_NUM values.
+     * \param packetsNum [in] Number of data packets in \a packets.
+     * \param discontinuity [in] Flag set if data packets were lost before \a packets: the sweep in progress is discarded.
+     */
+    void process(EDL_IN const float * packets,
+                 EDL_IN unsigned int packetsNum,
+                 EDL_IN bool discontinuity);
+
+    /*! \brief Returns the latest averaged sweep.
+     *
+     * \param dst [out] Buffer of #EDL_CHANNEL_NUM arrays of \a maxBins values, the voltage followed by the current channels,
+     * filled with the first bins of each channel.
+     * \param maxBins [in] Number of values of each array of \a dst.
+     * \param info [out] Description of the sweep.
+     */
+    void get(EDL_OUT float * dst,
+             EDL_IN unsigned int maxBins,
+             EDL_OUT E4SweepInfo_t &info) const;
+
+private:
+    void endSweep(EDL_VOID);
+    void reject(EDL_VOID);
+    void fit(unsigned int channelIdx, E4SweepFit_t &fit) const;
+    void publish(EDL_VOID);
+
+    unsigned int channelMask;
+    unsigned int averages;
+    unsigned int binNum;
+    double periodPackets; /*!< Expected sweep length, binNum being its integer part. */
+    double samplingRateHz;
+
+    unsigned int learnedNum; /*!< Data packets of the voltage range learnt since the last reset, up to binNum. */
+    float voltageMin;
+    float voltageMax;
+    bool armed; /*!< The voltage went below the trigger band: the next rise through the middle starts a sweep. */
+    bool inSweep;
+    unsigned int sweepFill; /*!< Data packets of the sweep in progress. */
+    std::vector <float> sweep; /*!< #EDL_CHANNEL_NUM arrays of binNum values of the sweep in progress. */
+    std::vector <double> averaged; /*!< #EDL_CHANNEL_NUM arrays of binNum running averages. */
+    std::vector <unsigned int> counts; /*!< Sweeps averaged into each bin. */
+    unsigned long long sweepNum;
+    unsigned long long rejectedNum;
+
+    mutable std::mutex sweepMutex;
+    std::vector <float> published; /*!< Latest averaged sweep, per channel and bin. */
+    E4SweepInfo_t sweepInfo;
+};
+
+#endif // E4_SWEEPS_H
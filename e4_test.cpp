@@ -0,0 +1,1949 @@
+/*! \file e4_test.cpp
+ * \brief Tests of the data path, built by the Test target.
+ *
+ * Each test prints its failed checks; the exit code is 0 only if every check passed.
+ * Files are written in the working directory and removed.
+ *
+ * Usage: e4_test
+ */
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "edl_global.h"
+#include "edl_devicespecs.h"
+#include "e4_acquisition.h"
+#include "e4_commands.h"
+#include "e4_compression.h"
+#include "e4_deinterleave.h"
+#include "e4_envelope.h"
+#include "e4_events.h"
+#include "e4_fft.h"
+#include "e4_filter.h"
+#include "e4_metrics.h"
+#include "e4_recordformat.h"
+#include "e4_recordreader.h"
+#include "e4_recording.h"
+#include "e4_replay.h"
+#include "e4_scheduler.h"
+#include "e4_settings.h"
+#include "e4_sharedring.h"
+#include "e4_simulator.h"
+#include "e4_spectrum.h"
+#include "e4_statistics.h"
+#include "e4_sweeps.h"
+
+#define TEST_RECORDING_FILE "e4_test.e4r"
+#define TEST_SHARED_RING "e4_test_ring"
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+// Exported by e4_dll.cpp, which is linked into the tests.
+extern "C" EdlErrorCode_t setSimulation(const E4SimulatorConfig_t * config);
+extern "C" int getDeviceCount();
+extern "C" int openDevice(unsigned int deviceIdx);
+extern "C" EdlErrorCode_t closeEDL(int deviceHandle);
+extern "C" EdlErrorCode_t readDataFor(int deviceHandle, FILE * f, double seconds, unsigned long long packetsNum);
+extern "C" EdlErrorCode_t readInto(int deviceHandle, float * dst, size_t capacityPackets, size_t * packetsRead);
+extern "C" EdlErrorCode_t readIntoChannelMajor(int deviceHandle, float * dst, size_t capacityPackets, size_t * packetsRead);
+extern "C" EdlErrorCode_t setCommand(int deviceHandle, EdlCommandId_t commandId, const EdlCommandStruct_t * commandStruct, bool sendFlag);
+extern "C" EdlErrorCode_t startAcquisition(int deviceHandle, unsigned int ringPackets);
+extern "C" void stopAcquisition(int deviceHandle);
+extern "C" EdlErrorCode_t pullPackets(int deviceHandle, float * dst, unsigned int maxPackets, unsigned int * packetsRead);
+extern "C" void getAcquisitionStats(int deviceHandle, E4AcquisitionStats_t * stats);
+extern "C" EdlErrorCode_t startRecording(int deviceHandle, const char * path, unsigned int flags, unsigned long long preallocateBytes);
+extern "C" EdlErrorCode_t stopRecording(int deviceHandle);
+extern "C" EdlErrorCode_t setFilter(int deviceHandle, const E4FilterConfig_t * config);
+extern "C" EdlErrorCode_t pullFilteredPackets(int deviceHandle, float * dst, unsigned int maxPackets, unsigned int * packetsRead);
+extern "C" EdlErrorCode_t setPotential(int deviceHandle);
+extern "C" EdlErrorCode_t setSweeps(int deviceHandle, const E4SweepConfig_t * config);
+extern "C" EdlErrorCode_t getSweep(int deviceHandle, float * dst, unsigned int maxBins, E4SweepInfo_t * info);
+extern "C" void getMetrics(int deviceHandle, E4Metrics_t * metrics);
+extern "C" int openReplay(const E4ReplayConfig_t * config);
+extern "C" EdlErrorCode_t getReplayStats(int deviceHandle, E4ReplayStats_t * stats);
+extern "C" EdlErrorCode_t startDigitalOffsetCompensation(int deviceHandle, E4CommandCallback_t callback, void * context, unsigned long long * ticket);
+extern "C" EdlErrorCode_t submitCommands(int deviceHandle, const E4Command_t * commands, unsigned int commandsNum,
+                                         E4CommandCallback_t callback, void * context, unsigned long long * ticket);
+extern "C" int waitCommands(int deviceHandle, unsigned long long ticket, unsigned int timeoutMs, EdlErrorCode_t * result);
+extern "C" void getCommandStats(int deviceHandle, E4CommandStats_t * stats);
+
+static unsigned int failedNum = 0;
+
+/*! \brief Counts and prints a failed check.
+ */
+static bool check(bool condition, const char * test, const char * what)
+{
+    if (!condition)
+    {
+        printf("  FAIL %s: %s\n", test, what);
+        failedNum++;
+    }
+    return condition;
+}
+
+/*! \brief Returns the next value of a xorshift generator, so that every run tests the same data.
+ */
+static uint32_t nextRandom(uint32_t &state)
+{
+    state ^= state << 13;
+    state ^= state >> 17;
+    state ^= state << 5;
+    return state;
+}
+
+/*! \brief Applies the current range \a radioId to \a settings, as EDL::setCommand would.
+ */
+static void setRange(DeviceSettings &settings, unsigned int radioId)
+{
+    EdlCommandStruct_t commandStruct;
+    memset(&commandStruct, 0, sizeof(commandStruct));
+    commandStruct.radioId = radioId;
+    settings.setCommand(EdlCommandRange, commandStruct, true);
+}
+
+/*! \brief Returns \a packetsNum data packets of ADC codes times \a currentStep, or times the voltage step on the voltage channel.
+ *
+ * \param signal [in] 0: codes jumping across the whole range, with runs of plus and minus full scale codes;
+ * 1: slow walk of a few codes per data packet, like a quiet trace; 2: as 1 with NaNs, infinities, negative zeros
+ * and values between codes scattered in; 3: random bit patterns; 4: constant minus full scale.
+ */
+static std::vector <float> codecPackets(unsigned int signal, unsigned int packetsNum, float currentStep, uint32_t &state)
+{
+    const float voltageStep = (float)(E4_VOLTAGE_FULL_SCALE_MV/E4_ADC_CODES_HALF_RANGE);
+    std::vector <float> packets((size_t)packetsNum*EDL_CHANNEL_NUM);
+    int32_t walk[EDL_CHANNEL_NUM] = {0};
+
+    for (unsigned int packetIdx = 0; packetIdx < packetsNum; packetIdx++) {
+        for (unsigned int channelIdx = 0; channelIdx < EDL_CHANNEL_NUM; channelIdx++) {
+            const float step = channelIdx == 0 ? voltageStep : currentStep;
+            float &value = packets[(size_t)packetIdx*EDL_CHANNEL_NUM+channelIdx];
+            int32_t code;
+            uint32_t bits;
+
+            switch (signal) {
+            case 0:
+                code = (int32_t)(nextRandom(state)%(2*E4_ADC_CODES_HALF_RANGE+1))-E4_ADC_CODES_HALF_RANGE;
+                if (packetIdx%8 < 3) {code = (packetIdx/8)%2 == 0 ? E4_ADC_CODES_HALF_RANGE : -E4_ADC_CODES_HALF_RANGE;}
+                value = (float)code*step;
+                break;
+            case 1:
+            case 2:
+                walk[channelIdx] += (int32_t)(nextRandom(state)%7)-3;
+                value = (float)walk[channelIdx]*step;
+                if (signal == 1) {break;}
+                switch (nextRandom(state)%64) {
+                case 0: value = NAN; break;
+                case 1: value = INFINITY; break;
+                case 2: value = -INFINITY; break;
+                case 3: value = -0.0f; break;
+                case 4: value += step/3.0f; break;
+                default: break;
+                }
+                break;
+            case 3:
+                bits = nextRandom(state);
+                memcpy(&value, &bits, sizeof(value));
+                break;
+            default:
+                value = -(float)E4_ADC_CODES_HALF_RANGE*step;
+                break;
+            }
+        }
+    }
+    return packets;
+}
+
+/*! \brief Checks that TraceCodec decodes bit by bit what it encoded, in every current range and with an unknown range,
+ * for signals on either encoding path and for data packet counts that are not multiples of the block size.
+ */
+static void testTraceCodec()
+{
+    const char * test = "TraceCodec";
+    const unsigned int packetNums[] = {1, 2, 3, 17, E4_CODEC_BLOCK_SAMPLES-1, E4_CODEC_BLOCK_SAMPLES, E4_CODEC_BLOCK_SAMPLES+1,
+                                       E4_RECORD_CHUNK_PACKETS-1, E4_RECORD_CHUNK_PACKETS, E4_RECORD_CHUNK_PACKETS+1};
+    uint32_t state = 1;
+    TraceCodec codec;
+    std::vector <unsigned char> compressed;
+    char what[128];
+
+    // The radio index past EDL_RADIO_RANGE_200_NA is an unknown range: the current channels have no step.
+    for (unsigned int radioId = EDL_RADIO_RANGE_200_PA; radioId <= EDL_RADIO_RANGE_200_NA+1; radioId++) {
+        DeviceSettings settings;
+        setRange(settings, radioId);
+        const double fullScale = settings.currentRangeFullScale();
+        const float currentStep = (float)((fullScale > 0.0 ? fullScale : 20.0)/E4_ADC_CODES_HALF_RANGE);
+        codec.setRanges(fullScale);
+
+        for (unsigned int signal = 0; signal < 5; signal++) {
+            for (size_t numIdx = 0; numIdx < sizeof(packetNums)/sizeof(packetNums[0]); numIdx++) {
+                const unsigned int packetsNum = packetNums[numIdx];
+                const std::vector <float> packets = codecPackets(signal, packetsNum, currentStep, state);
+                std::vector <float> decoded(packets.size());
+                codec.compress(packets.data(), packetsNum, compressed);
+
+                snprintf(what, sizeof(what), "range %u, signal %u, %u data packets: round trip is bit exact", radioId, signal, packetsNum);
+                check(TraceCodec::decompress(compressed.data(), compressed.size(), packetsNum, EDL_CHANNEL_NUM, decoded.data()) &&
+                      memcmp(decoded.data(), packets.data(), sizeof(float)*packets.size()) == 0, test, what);
+
+                snprintf(what, sizeof(what), "range %u, signal %u, %u data packets: truncated data are rejected", radioId, signal, packetsNum);
+                check(!TraceCodec::decompress(compressed.data(), compressed.size()-1, packetsNum, EDL_CHANNEL_NUM, decoded.data()), test, what);
+
+                if (signal == 1 && fullScale > 0.0 && packetsNum >= E4_CODEC_BLOCK_SAMPLES)
+                {
+                    snprintf(what, sizeof(what), "range %u, %u data packets: a quiet trace is encoded as codes", radioId, packetsNum);
+                    check(compressed.size() < sizeof(float)*packets.size()/4, test, what);
+                }
+            }
+        }
+    }
+}
+
+/*! \brief Returns \a packetsNum data packets whose values are the index of the data packet plus the channel.
+ */
+static std::vector <float> indexPackets(unsigned int packetsNum)
+{
+    std::vector <float> packets((size_t)packetsNum*EDL_CHANNEL_NUM);
+    for (unsigned int packetIdx = 0; packetIdx < packetsNum; packetIdx++) {
+        for (unsigned int channelIdx = 0; channelIdx < EDL_CHANNEL_NUM; channelIdx++) {packets[(size_t)packetIdx*EDL_CHANNEL_NUM+channelIdx] = (float)(packetIdx+channelIdx);}
+    }
+    return packets;
+}
+
+/*! \brief Returns the indexes of the data packets of a recording file, walking its chunks,
+ * and checks that every data packet holds its index as written by indexPackets.
+ */
+static std::vector <unsigned long long> recordedIndexes(const char * test, const char * path)
+{
+    std::vector <unsigned long long> indexes;
+    RecordReader reader;
+    if (!check(reader.open(path), test, "open the recording")) {return indexes;}
+
+    E4RecordingInfo_t info;
+    reader.getInfo(info);
+    std::vector <float> chunk((size_t)reader.getHeader().chunkPackets*EDL_CHANNEL_NUM);
+    for (size_t chunkIdx = 0; chunkIdx < info.chunkNum; chunkIdx++) {
+        E4RecordChunkHeader_t chunkHeader;
+        if (!check(reader.decodeChunk(chunkIdx, chunkHeader, chunk.data()), test, "decode a chunk")) {break;}
+        for (unsigned int packetIdx = 0; packetIdx < chunkHeader.packetNum; packetIdx++) {
+            const unsigned long long idx = chunkHeader.firstPacketIdx+packetIdx;
+            check(chunk[(size_t)packetIdx*EDL_CHANNEL_NUM] == (float)idx, test, "data packet matches its index");
+            indexes.push_back(idx);
+        }
+    }
+    reader.close();
+    return indexes;
+}
+
+/*! \brief Records events only, in batches of \a batchPackets data packets, with events detected at \a activeIdxs.
+ */
+static std::vector <unsigned long long> gateIndexes(const char * test, unsigned int pre, unsigned int post, unsigned int packetsNum,
+                                                    const std::vector <unsigned int> &activeIdxs, unsigned int batchPackets)
+{
+    const std::vector <float> packets = indexPackets(packetsNum);
+    std::vector <unsigned char> active(packetsNum, 0);
+    for (size_t idx = 0; idx < activeIdxs.size(); idx++) {active[activeIdxs[idx]] = 1;}
+
+    DeviceSettings settings;
+    Recording recording;
+    EventGate gate;
+    if (!check(recording.open(TEST_RECORDING_FILE, settings, false, 0, false), test, "create the recording")) {return std::vector <unsigned long long>();}
+    gate.configure(pre, post);
+    for (unsigned int firstIdx = 0; firstIdx < packetsNum; firstIdx += batchPackets) {
+        const unsigned int n = packetsNum-firstIdx < batchPackets ? packetsNum-firstIdx : batchPackets;
+        gate.write(recording, &packets[(size_t)firstIdx*EDL_CHANNEL_NUM], n, firstIdx, &active[firstIdx], false, false);
+    }
+    check(recording.close(), test, "close the recording");
+
+    const std::vector <unsigned long long> indexes = recordedIndexes(test, TEST_RECORDING_FILE);
+    remove(TEST_RECORDING_FILE);
+    return indexes;
+}
+
+/*! \brief Checks that EventGate records the pre and post windows of every event, whatever the batches,
+ * including an event starting exactly where the post window of the previous one ends.
+ */
+static void testEventGate()
+{
+    const char * test = "EventGate";
+    const unsigned int batches[] = {1, 3, 19, 40};
+
+    for (size_t batchIdx = 0; batchIdx < sizeof(batches)/sizeof(batches[0]); batchIdx++) {
+        // Post window of the event at 10 ends at 18: the event at 19 starts right after it.
+        std::vector <unsigned int> activeIdxs;
+        activeIdxs.push_back(10);
+        activeIdxs.push_back(19);
+        std::vector <unsigned long long> expected;
+        for (unsigned long long idx = 6; idx <= 27; idx++) {expected.push_back(idx);}
+        check(gateIndexes(test, 4, 8, 40, activeIdxs, batches[batchIdx]) == expected, test, "adjacent events keep every packet");
+
+        // Separate events, each with its own pre window.
+        activeIdxs.assign(1, 10);
+        activeIdxs.push_back(30);
+        expected.clear();
+        for (unsigned long long idx = 6; idx <= 18; idx++) {expected.push_back(idx);}
+        for (unsigned long long idx = 26; idx <= 38; idx++) {expected.push_back(idx);}
+        check(gateIndexes(test, 4, 8, 40, activeIdxs, batches[batchIdx]) == expected, test, "separate events keep their windows");
+    }
+}
+
+/*! \brief Writes \a packetsNum data packets made by indexPackets to a recording file.
+ */
+static bool writeIndexRecording(const char * test, const char * path, unsigned int packetsNum, bool compress)
+{
+    const std::vector <float> packets = indexPackets(packetsNum);
+    DeviceSettings settings;
+    Recording recording;
+    if (!check(recording.open(path, settings, false, 0, compress), test, "create the recording")) {return false;}
+    recording.write(packets.data(), packetsNum, 0, false, false);
+    return check(recording.close(), test, "close the recording");
+}
+
+/*! \brief Returns the bytes of a file.
+ */
+static std::vector <unsigned char> loadFile(const char * path)
+{
+    std::vector <unsigned char> bytes;
+    FILE * f = fopen(path, "rb");
+    if (f == NULL) {return bytes;}
+    fseek(f, 0, SEEK_END);
+    bytes.resize((size_t)ftell(f));
+    fseek(f, 0, SEEK_SET);
+    if (fread(bytes.data(), 1, bytes.size(), f) != bytes.size()) {bytes.clear();}
+    fclose(f);
+    return bytes;
+}
+
+/*! \brief Replaces the content of a file.
+ */
+static void saveFile(const char * path, const std::vector <unsigned char> &bytes)
+{
+    FILE * f = fopen(path, "wb");
+    if (f == NULL) {return;}
+    fwrite(bytes.data(), 1, bytes.size(), f);
+    fclose(f);
+}
+
+/*! \brief Checks the display points of RecordReader::readEnvelope against those computed from \a packets, the data packets of the recording:
+ * exact minimum and maximum, mean up to the rounding of the sums, NaN for points without data packets.
+ */
+static void checkEnvelope(const char * test, const RecordReader &reader, const std::vector <float> &packets,
+                          unsigned long long packetOffset, unsigned long long packetsNum, size_t pointsNum)
+{
+    std::vector <float> minimum(pointsNum*EDL_CHANNEL_NUM), maximum(pointsNum*EDL_CHANNEL_NUM), mean(pointsNum*EDL_CHANNEL_NUM);
+    std::vector <float> expectedMinimum(pointsNum*EDL_CHANNEL_NUM, INFINITY), expectedMaximum(pointsNum*EDL_CHANNEL_NUM, -INFINITY);
+    std::vector <double> sums(pointsNum*EDL_CHANNEL_NUM, 0.0);
+    std::vector <unsigned long long> counts(pointsNum, 0);
+    char what[128];
+
+    snprintf(what, sizeof(what), "%llu data packets from %llu in %u points: envelope is read", packetsNum, packetOffset, (unsigned int)pointsNum);
+    if (!check(reader.readEnvelope(packetOffset, packetsNum, pointsNum, minimum.data(), maximum.data(), mean.data()), test, what)) {return;}
+
+    const size_t recordedNum = packets.size()/EDL_CHANNEL_NUM;
+    for (unsigned long long packetIdx = packetOffset; packetIdx < packetOffset+packetsNum && packetIdx < recordedNum; packetIdx++) {
+        // Same mapping of data packets to points as RecordReader.
+        const size_t pointIdx = (size_t)((double)(packetIdx-packetOffset)*(double)pointsNum/(double)packetsNum);
+        counts[pointIdx]++;
+        for (unsigned int channelIdx = 0; channelIdx < EDL_CHANNEL_NUM; channelIdx++) {
+            const float value = packets[(size_t)packetIdx*EDL_CHANNEL_NUM+channelIdx];
+            const size_t idx = pointIdx*EDL_CHANNEL_NUM+channelIdx;
+            if (value < expectedMinimum[idx]) {expectedMinimum[idx] = value;}
+            if (value > expectedMaximum[idx]) {expectedMaximum[idx] = value;}
+            sums[idx] += value;
+        }
+    }
+
+    bool emptyOk = true;
+    bool extremaOk = true;
+    bool meanOk = true;
+    for (size_t pointIdx = 0; pointIdx < pointsNum; pointIdx++) {
+        for (unsigned int channelIdx = 0; channelIdx < EDL_CHANNEL_NUM; channelIdx++) {
+            const size_t idx = pointIdx*EDL_CHANNEL_NUM+channelIdx;
+            if (counts[pointIdx] == 0)
+            {
+                emptyOk = emptyOk && std::isnan(minimum[idx]) && std::isnan(maximum[idx]) && std::isnan(mean[idx]);
+                continue;
+            }
+            const double expectedMean = sums[idx]/(double)counts[pointIdx];
+            extremaOk = extremaOk && minimum[idx] == expectedMinimum[idx] && maximum[idx] == expectedMaximum[idx];
+            meanOk = meanOk && std::fabs(mean[idx]-expectedMean) <= 1e-4*(1.0+std::fabs(expectedMean));
+        }
+    }
+    snprintf(what, sizeof(what), "%llu data packets from %llu in %u points: empty points are NaN", packetsNum, packetOffset, (unsigned int)pointsNum);
+    check(emptyOk, test, what);
+    snprintf(what, sizeof(what), "%llu data packets from %llu in %u points: minimum and maximum", packetsNum, packetOffset, (unsigned int)pointsNum);
+    check(extremaOk, test, what);
+    snprintf(what, sizeof(what), "%llu data packets from %llu in %u points: mean", packetsNum, packetOffset, (unsigned int)pointsNum);
+    check(meanOk, test, what);
+}
+
+/*! \brief Checks that a recording written in uneven batches, compressed or not, reads back bit exact with RecordReader,
+ * and that its envelope matches its data packets at every zoom level.
+ */
+static void testRecordingReadBack()
+{
+    const char * test = "Recording read back";
+    const unsigned int packetsNum = 3*E4_RECORD_CHUNK_PACKETS+37;
+    const unsigned int batchPackets = 1000;
+    DeviceSettings settings;
+    setRange(settings, EDL_RADIO_RANGE_20_NA);
+    uint32_t state = 2;
+    const std::vector <float> packets = codecPackets(1, packetsNum, (float)(settings.currentRangeFullScale()/E4_ADC_CODES_HALF_RANGE), state);
+
+    for (unsigned int compress = 0; compress < 2; compress++) {
+        Recording recording;
+        if (!check(recording.open(TEST_RECORDING_FILE, settings, false, 0, compress != 0), test, "create the recording")) {continue;}
+        for (unsigned int firstIdx = 0; firstIdx < packetsNum; firstIdx += batchPackets) {
+            const unsigned int n = packetsNum-firstIdx < batchPackets ? packetsNum-firstIdx : batchPackets;
+            recording.write(&packets[(size_t)firstIdx*EDL_CHANNEL_NUM], n, firstIdx, false, false);
+        }
+        check(recording.close(), test, "close the recording");
+
+        RecordReader reader;
+        if (!check(reader.open(TEST_RECORDING_FILE), test, "open the recording")) {continue;}
+        E4RecordingInfo_t info;
+        reader.getInfo(info);
+        check(info.indexed != 0 && info.chunkNum == 4 && info.packetNum == packetsNum, test, "the index covers every data packet");
+
+        std::vector <float> readPackets(packets.size());
+        check(reader.read(0, packetsNum, readPackets.data()) == packetsNum &&
+              memcmp(readPackets.data(), packets.data(), sizeof(float)*packets.size()) == 0, test, "the data packets read back bit exact");
+        check(reader.read(E4_RECORD_CHUNK_PACKETS-5, 10, readPackets.data()) == 10 &&
+              memcmp(readPackets.data(), &packets[(size_t)(E4_RECORD_CHUNK_PACKETS-5)*EDL_CHANNEL_NUM], sizeof(float)*10*EDL_CHANNEL_NUM) == 0,
+              test, "data packets across chunks read back bit exact");
+        check(reader.read(packetsNum, 10, readPackets.data()) == 0, test, "nothing is read past the end");
+
+        // Data packets one by one, level 0 entries, level 1 entries, and a span running past the end.
+        checkEnvelope(test, reader, packets, 100, 1000, 40);
+        checkEnvelope(test, reader, packets, 0, 2*E4_RECORD_CHUNK_PACKETS, 16);
+        checkEnvelope(test, reader, packets, 0, 4*E4_RECORD_CHUNK_PACKETS, 4);
+        checkEnvelope(test, reader, packets, packetsNum-10, 100, 10);
+        reader.close();
+    }
+    remove(TEST_RECORDING_FILE);
+}
+
+/*! \brief Checks that RecordReader opens recordings with a corrupt index or a truncated end
+ * by walking their chunks, and still reads their data packets.
+ */
+static void testCorruptIndex()
+{
+    const char * test = "RecordReader corrupt index";
+    const unsigned int packetsNum = 3*E4_RECORD_CHUNK_PACKETS+100;
+    if (!writeIndexRecording(test, TEST_RECORDING_FILE, packetsNum, false)) {return;}
+    const std::vector <unsigned char> bytes = loadFile(TEST_RECORDING_FILE);
+    if (!check(bytes.size() > sizeof(E4RecordFooter_t), test, "load the recording")) {return;}
+
+    E4RecordFooter_t footer;
+    memcpy(&footer, &bytes[bytes.size()-sizeof(footer)], sizeof(footer));
+    check(footer.chunkNum == 4, test, "four chunks are indexed");
+
+    for (unsigned int caseIdx = 0; caseIdx < 5; caseIdx++) {
+        std::vector <unsigned char> corrupt = bytes;
+        E4RecordFooter_t corruptFooter = footer;
+        uint64_t offset;
+        size_t expectedNum = packetsNum;
+
+        switch (caseIdx) {
+        case 0:
+            // An offset far past the end of the file.
+            offset = 1ULL << 40;
+            memcpy(&corrupt[footer.indexOffset+8], &offset, sizeof(offset));
+            break;
+        case 1:
+            // An offset that is not 8 bytes aligned.
+            memcpy(&offset, &corrupt[footer.indexOffset+8], sizeof(offset));
+            offset += 4;
+            memcpy(&corrupt[footer.indexOffset+8], &offset, sizeof(offset));
+            break;
+        case 2:
+            // A chunk count whose index size overflows 64 bits back to the right file size.
+            corruptFooter.chunkNum += 1ULL << 61;
+            break;
+        case 3:
+            // An index offset past the end of the file.
+            corruptFooter.indexOffset = ~0ULL-8;
+            break;
+        default:
+            // A file cut in the middle of the last chunk.
+            corrupt.resize(footer.indexOffset-1000);
+            expectedNum = 3*E4_RECORD_CHUNK_PACKETS;
+            break;
+        }
+        if (caseIdx < 4) {memcpy(&corrupt[corrupt.size()-sizeof(corruptFooter)], &corruptFooter, sizeof(corruptFooter));}
+        saveFile(TEST_RECORDING_FILE, corrupt);
+
+        RecordReader reader;
+        if (!check(reader.open(TEST_RECORDING_FILE), test, "open the corrupt recording")) {continue;}
+        E4RecordingInfo_t info;
+        reader.getInfo(info);
+        check(info.indexed == 0, test, "the corrupt index is not used");
+        check(info.packetNum == expectedNum, test, "the chunks are found by walking the file");
+
+        std::vector <float> packets((size_t)packetsNum*EDL_CHANNEL_NUM);
+        const size_t readNum = reader.read(0, packetsNum, packets.data());
+        check(readNum == expectedNum, test, "the data packets are read");
+        check(memcmp(packets.data(), indexPackets(packetsNum).data(), sizeof(float)*EDL_CHANNEL_NUM*readNum) == 0, test, "the data packets are intact");
+    }
+    remove(TEST_RECORDING_FILE);
+}
+
+/*! \brief Checks that the synchronous readers of a simulated device exclude each other and the background acquisition,
+ * rather than sharing the read buffer and the data packets of the device.
+ */
+static void testConcurrentReaders()
+{
+    const char * test = "concurrent readers";
+    E4SimulatorConfig_t config;
+    memset(&config, 0, sizeof(config));
+    config.baselineCurrent = 100.0;
+    config.noiseRms = 5.0;
+    config.seed = 1;
+    if (!check(setSimulation(&config) == EdlSuccess, test, "configure the simulation")) {return;}
+    const int handle = openDevice(0);
+    if (!check(handle >= 0, test, "open the simulated device")) {return;}
+
+    // While readDataFor reads, the other readers are refused.
+    FILE * f = fopen(TEST_RECORDING_FILE, "wb");
+    if (check(f != NULL, test, "create the readDataFor file"))
+    {
+        EdlErrorCode_t readDataRes = EdlUnknownError;
+        std::thread reader([&] {readDataRes = readDataFor(handle, f, 0.3, 0);});
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+        std::vector <float> packets(4096*EDL_CHANNEL_NUM);
+        size_t readNum;
+        check(startAcquisition(handle, 0) == EdlUnknownError, test, "startAcquisition is refused during readDataFor");
+        check(readInto(handle, packets.data(), 4096, &readNum) == EdlUnknownError && readNum == 0, test, "readInto is refused during readDataFor");
+        check(readDataFor(handle, f, 0.1, 0) == EdlUnknownError, test, "readDataFor is refused during readDataFor");
+        reader.join();
+        check(readDataRes == EdlSuccess, test, "readDataFor succeeds");
+
+        // The offsets in a recording count from the start of the file, so it cannot be appended to another one.
+        const long recordedBytes = ftell(f);
+        check(readDataFor(handle, f, 0.1, 0) == EdlUnknownError && ftell(f) == recordedBytes, test, "readDataFor refuses a file past its start");
+        fclose(f);
+    }
+    remove(TEST_RECORDING_FILE);
+
+    // Threads reading the same device either read or are refused, and never share the read buffer.
+    std::atomic <unsigned long long> readTotal(0);
+    std::atomic <unsigned int> errorNum(0);
+    std::vector <std::thread> readers;
+    for (unsigned int threadIdx = 0; threadIdx < 4; threadIdx++) {
+        readers.push_back(std::thread([&, threadIdx] {
+            std::vector <float> packets(4096*EDL_CHANNEL_NUM);
+            const std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now()+std::chrono::milliseconds(200);
+            while (std::chrono::steady_clock::now() < end) {
+                size_t readNum;
+                const EdlErrorCode_t res = threadIdx%2 == 0 ? readInto(handle, packets.data(), 4096, &readNum) : readIntoChannelMajor(handle, packets.data(), 4096, &readNum);
+                if (res == EdlSuccess) {readTotal += readNum;}
+                else if (res != EdlUnknownError) {errorNum++;}
+                std::this_thread::sleep_for(std::chrono::microseconds(100));
+            }
+        }));
+    }
+    for (size_t threadIdx = 0; threadIdx < readers.size(); threadIdx++) {readers[threadIdx].join();}
+    check(errorNum == 0, test, "readInto from several threads only fails by refusing");
+    check(readTotal > 0, test, "readInto from several threads reads data packets");
+
+    check(startAcquisition(handle, 0) == EdlSuccess, test, "startAcquisition succeeds once the readers are done");
+    stopAcquisition(handle);
+    closeEDL(handle);
+}
+
+/*! \brief Builds the envelope of chunks shorter than #E4_RECORD_CHUNK_PACKETS, and checks that the level 1 entries and the level spans
+ * follow the chunk length of the recording rather than the default one.
+ */
+static void testEnvelopeChunkSpan()
+{
+    const char * test = "envelope chunk span";
+    const unsigned int chunkPackets = 1000;
+    const unsigned int chunkNum = 2*E4_RECORD_ENVELOPE_FACTOR+3;
+    std::vector <float> chunk((size_t)chunkPackets*EDL_CHANNEL_NUM);
+    std::vector <E4RecordEnvelope_t> entries;
+    std::vector <std::vector <E4RecordEnvelope_t> > levels;
+    EnvelopeBuilder builder;
+
+    builder.reset(chunkPackets);
+    for (unsigned int chunkIdx = 0; chunkIdx < chunkNum; chunkIdx++) {
+        std::fill(chunk.begin(), chunk.end(), (float)chunkIdx);
+        builder.addChunk(chunk.data(), chunkPackets, (unsigned long long)chunkIdx*chunkPackets, entries);
+    }
+    builder.finish(levels);
+
+    bool chunkEntries = levels.size() == 3 && levels[0].size() == chunkNum;
+    for (unsigned int chunkIdx = 0; chunkEntries && chunkIdx < chunkNum; chunkIdx++) {
+        const E4RecordEnvelope_t &entry = levels[0][chunkIdx];
+        chunkEntries = entry.packetNum == chunkPackets && entry.minimum[0] == (float)chunkIdx && entry.maximum[0] == (float)chunkIdx;
+    }
+    check(chunkEntries, test, "one level 1 entry per chunk");
+    check(levels.size() == 3 && levels[1].size() == 3 && levels[1][0].packetNum == E4_RECORD_ENVELOPE_FACTOR*chunkPackets &&
+          levels[2].size() == 1 && levels[2][0].packetNum == chunkNum*chunkPackets, test, "the levels above merge the chunk entries");
+    check(EnvelopeBuilder::levelPackets(0, chunkPackets) == E4_RECORD_ENVELOPE_PACKETS && EnvelopeBuilder::levelPackets(1, chunkPackets) == chunkPackets &&
+          EnvelopeBuilder::levelPackets(2, chunkPackets) == E4_RECORD_ENVELOPE_FACTOR*chunkPackets, test, "the level spans follow the chunk length");
+}
+
+/*! \brief Counts the simulated devices as configured, and checks that opening a device twice is refused without disturbing the first handle.
+ */
+static void testDeviceOpening()
+{
+    const char * test = "device opening";
+    E4SimulatorConfig_t config;
+    memset(&config, 0, sizeof(config));
+    config.deviceNum = 2;
+    if (!check(setSimulation(&config) == EdlSuccess, test, "configure the simulation")) {return;}
+    check(getDeviceCount() == 2 && getDeviceCount() == 2, test, "the configured devices are counted");
+    config.deviceNum = 3;
+    setSimulation(&config);
+    check(getDeviceCount() == 3, test, "the count follows the simulation");
+
+    const int handle = openDevice(1);
+    if (!check(handle >= 0, test, "open the simulated device")) {return;}
+    check(openDevice(1) < 0, test, "an open device is refused");
+    check(openDevice(3) < 0, test, "a device past the count is refused");
+
+    std::vector <float> packets((size_t)64*EDL_CHANNEL_NUM);
+    unsigned int readNum = 0;
+    if (check(startAcquisition(handle, 0) == EdlSuccess, test, "the first handle still acquires")) {
+        for (unsigned int waitIdx = 0; waitIdx < 200 && readNum == 0; waitIdx++) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(5));
+            pullPackets(handle, packets.data(), 64, &readNum);
+        }
+        stopAcquisition(handle);
+        check(readNum > 0, test, "the first handle still reads data packets");
+    }
+    closeEDL(handle);
+    const int reopened = openDevice(1);
+    check(reopened >= 0, test, "a closed device opens again");
+    closeEDL(reopened);
+}
+
+/*! \brief Acquires several simulated devices in parallel, each in its own current range and recording compressed or not,
+ * and checks that every recording reads back bit exact as the data packets pulled from the acquisition ring.
+ */
+static void testSimulatedDevices()
+{
+    const char * test = "simulated devices";
+    const unsigned int deviceNum = 3;
+    E4SimulatorConfig_t config;
+    memset(&config, 0, sizeof(config));
+    config.deviceNum = deviceNum;
+    config.baselineCurrent = 100.0;
+    config.noiseRms = 5.0;
+    config.eventRateHz = 50.0;
+    config.eventDepth = 0.5;
+    config.eventDwellTimeS = 1e-3;
+    config.seed = 2;
+    if (!check(setSimulation(&config) == EdlSuccess, test, "configure the simulation")) {return;}
+
+    int handles[deviceNum];
+    char paths[deviceNum][32];
+    std::vector <float> pulled[deviceNum];
+    for (unsigned int deviceIdx = 0; deviceIdx < deviceNum; deviceIdx++) {
+        handles[deviceIdx] = openDevice(deviceIdx);
+        snprintf(paths[deviceIdx], sizeof(paths[deviceIdx]), "e4_test_%u.e4r", deviceIdx);
+        if (!check(handles[deviceIdx] >= 0, test, "open the simulated device")) {continue;}
+
+        // The 2nA range clips the 100nA baseline at the full scale.
+        EdlCommandStruct_t commandStruct;
+        memset(&commandStruct, 0, sizeof(commandStruct));
+        commandStruct.radioId = EDL_RADIO_RANGE_200_PA+deviceIdx;
+        check(setCommand(handles[deviceIdx], EdlCommandRange, &commandStruct, true) == EdlSuccess, test, "set the range");
+        check(startRecording(handles[deviceIdx], paths[deviceIdx], deviceIdx%2 == 0 ? E4_RECORDING_COMPRESS : 0, 0) == EdlSuccess, test, "start the recording");
+        check(startAcquisition(handles[deviceIdx], 0) == EdlSuccess, test, "start the acquisition");
+    }
+
+    std::vector <float> buffer((size_t)E4_RECORD_CHUNK_PACKETS*EDL_CHANNEL_NUM);
+    const std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now()+std::chrono::milliseconds(300);
+    for (bool stopped = false; !stopped; ) {
+        if (std::chrono::steady_clock::now() >= end)
+        {
+            // Stop every device, then drain their rings.
+            for (unsigned int deviceIdx = 0; deviceIdx < deviceNum; deviceIdx++) {
+                if (handles[deviceIdx] < 0) {continue;}
+                stopAcquisition(handles[deviceIdx]);
+                check(stopRecording(handles[deviceIdx]) == EdlSuccess, test, "stop the recording");
+            }
+            stopped = true;
+        }
+        for (unsigned int deviceIdx = 0; deviceIdx < deviceNum; deviceIdx++) {
+            unsigned int readNum;
+            if (handles[deviceIdx] < 0) {continue;}
+            while (pullPackets(handles[deviceIdx], buffer.data(), E4_RECORD_CHUNK_PACKETS, &readNum) == EdlSuccess && readNum > 0) {
+                pulled[deviceIdx].insert(pulled[deviceIdx].end(), buffer.begin(), buffer.begin()+(size_t)readNum*EDL_CHANNEL_NUM);
+            }
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    }
+
+    for (unsigned int deviceIdx = 0; deviceIdx < deviceNum; deviceIdx++) {
+        if (handles[deviceIdx] < 0) {continue;}
+        E4AcquisitionStats_t stats;
+        getAcquisitionStats(handles[deviceIdx], &stats);
+        closeEDL(handles[deviceIdx]);
+
+        const size_t pulledNum = pulled[deviceIdx].size()/EDL_CHANNEL_NUM;
+        check(pulledNum > 0, test, "data packets are acquired from every device");
+        check(stats.packetsDropped == 0, test, "the ring keeps every data packet");
+
+        RecordReader reader;
+        if (!check(reader.open(paths[deviceIdx]), test, "open the recording")) {continue;}
+        E4RecordingInfo_t info;
+        reader.getInfo(info);
+        check(info.packetNum == pulledNum, test, "the recording holds every data packet pulled");
+
+        std::vector <float> packets(pulled[deviceIdx].size());
+        check(reader.read(0, pulledNum, packets.data()) == pulledNum &&
+              memcmp(packets.data(), pulled[deviceIdx].data(), sizeof(float)*packets.size()) == 0, test, "the recording reads back bit exact");
+
+        if (deviceIdx%2 == 0 && info.chunkNum > 0)
+        {
+            E4RecordChunkHeader_t chunkHeader;
+            std::vector <float> chunk((size_t)reader.getHeader().chunkPackets*EDL_CHANNEL_NUM);
+            check(reader.decodeChunk(0, chunkHeader, chunk.data()) && chunkHeader.payloadBytes < sizeof(float)*EDL_CHANNEL_NUM*chunkHeader.packetNum,
+                  test, "the device data are compressed");
+        }
+        reader.close();
+        remove(paths[deviceIdx]);
+    }
+}
+
+/*! \brief Records a simulated device while pulling its data packets, then replays the recording through the acquisition,
+ * as fast as possible with one and with several decoding threads and paced at 10 times real time,
+ * and checks that the replayed data packets are the pulled ones, bit exact, and that getReplayStats counts them.
+ */
+static void testReplay()
+{
+    const char * test = "replay";
+    E4SimulatorConfig_t simulatorConfig;
+    memset(&simulatorConfig, 0, sizeof(simulatorConfig));
+    simulatorConfig.baselineCurrent = 100.0;
+    simulatorConfig.noiseRms = 5.0;
+    simulatorConfig.eventRateHz = 50.0;
+    simulatorConfig.eventDepth = 0.5;
+    simulatorConfig.eventDwellTimeS = 1e-3;
+    simulatorConfig.seed = 11;
+    if (!check(setSimulation(&simulatorConfig) == EdlSuccess, test, "configure the simulation")) {return;}
+    int handle = openDevice(0);
+    if (!check(handle >= 0, test, "open the simulated device")) {return;}
+
+    EdlCommandStruct_t commandStruct;
+    memset(&commandStruct, 0, sizeof(commandStruct));
+    commandStruct.radioId = EDL_RADIO_RANGE_200_NA;
+    check(setCommand(handle, EdlCommandRange, &commandStruct, true) == EdlSuccess, test, "set the range");
+    commandStruct.radioId = EDL_RADIO_SAMPLING_RATE_200_KHZ;
+    check(setCommand(handle, EdlCommandSamplingRate, &commandStruct, true) == EdlSuccess, test, "set the sampling rate");
+    check(startRecording(handle, TEST_RECORDING_FILE, E4_RECORDING_COMPRESS, 0) == EdlSuccess, test, "start the recording");
+    check(startAcquisition(handle, 0) == EdlSuccess, test, "start the acquisition");
+
+    // About 10 chunks of 200kHz data.
+    std::vector <float> recorded;
+    std::vector <float> buffer((size_t)E4_RECORD_CHUNK_PACKETS*EDL_CHANNEL_NUM);
+    unsigned int readNum;
+    const std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now()+std::chrono::milliseconds(200);
+    while (std::chrono::steady_clock::now() < end) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(5));
+        while (pullPackets(handle, buffer.data(), E4_RECORD_CHUNK_PACKETS, &readNum) == EdlSuccess && readNum > 0) {
+            recorded.insert(recorded.end(), buffer.begin(), buffer.begin()+(size_t)readNum*EDL_CHANNEL_NUM);
+        }
+    }
+    stopAcquisition(handle);
+    check(stopRecording(handle) == EdlSuccess, test, "stop the recording");
+    while (pullPackets(handle, buffer.data(), E4_RECORD_CHUNK_PACKETS, &readNum) == EdlSuccess && readNum > 0) {
+        recorded.insert(recorded.end(), buffer.begin(), buffer.begin()+(size_t)readNum*EDL_CHANNEL_NUM);
+    }
+    closeEDL(handle);
+    const unsigned long long recordedNum = recorded.size()/EDL_CHANNEL_NUM;
+    check(recordedNum > 2*E4_RECORD_CHUNK_PACKETS, test, "several chunks are recorded");
+
+    const unsigned int threadNums[] = {1, 3, 2};
+    for (unsigned int runIdx = 0; runIdx < 3; runIdx++) {
+        E4ReplayConfig_t config;
+        memset(&config, 0, sizeof(config));
+        config.path = TEST_RECORDING_FILE;
+        config.threadNum = threadNums[runIdx];
+        config.asFastAsPossible = runIdx < 2 ? 1 : 0;
+        config.speedFactor = 10.0;
+        handle = openReplay(&config);
+        if (!check(handle >= 0, test, "open the replay")) {continue;}
+
+        E4ReplayStats_t stats;
+        check(getReplayStats(handle, &stats) == EdlSuccess && stats.packetNum == recordedNum && stats.packetsReplayed == 0 &&
+              stats.samplingRateHz == 200.0e3 && stats.threadNum == threadNums[runIdx] && stats.finished == 0, test, "the replay starts at the first data packet");
+
+        std::vector <float> replayed;
+        if (check(startAcquisition(handle, 0) == EdlSuccess, test, "start the acquisition of the replay")) {
+            for (unsigned int waitIdx = 0; waitIdx < 1000 && replayed.size() < recorded.size(); waitIdx++) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(5));
+                while (pullPackets(handle, buffer.data(), E4_RECORD_CHUNK_PACKETS, &readNum) == EdlSuccess && readNum > 0) {
+                    replayed.insert(replayed.end(), buffer.begin(), buffer.begin()+(size_t)readNum*EDL_CHANNEL_NUM);
+                }
+            }
+            E4AcquisitionStats_t acquisitionStats;
+            getAcquisitionStats(handle, &acquisitionStats);
+            stopAcquisition(handle);
+            check(acquisitionStats.packetsDropped == 0, test, "the ring keeps every replayed data packet");
+        }
+        check(replayed.size() == recorded.size() && memcmp(replayed.data(), recorded.data(), sizeof(float)*recorded.size()) == 0,
+              test, "the replay reproduces the recorded data packets bit exact");
+
+        check(getReplayStats(handle, &stats) == EdlSuccess && stats.packetNum == recordedNum && stats.packetsReplayed == recordedNum &&
+              stats.finished == 1 && stats.packetsPerSecond > 0.0, test, "the replay counts every data packet, and is finished");
+        if (runIdx == 2) {check(stats.elapsedS > 0.9*recordedNum/(10.0*200.0e3), test, "the paced replay keeps to 10 times the recorded sampling rate");}
+        closeEDL(handle);
+    }
+    remove(TEST_RECORDING_FILE);
+}
+
+/*! \brief Filters a sine of amplitude 1 on every channel, \a frequencyHz 0 for a unit step, in batches of uneven sizes.
+ *
+ * \return Amplitude of the output of a current channel, measured over the second half of the output;
+ * 0 if the configuration is rejected.
+ */
+static double filterGain(E4FilterType_t type, unsigned int order, double cutoffHz, unsigned int decimation, double frequencyHz,
+                         unsigned int &outputNum, bool &voltageKept)
+{
+    const double samplingRateHz = 200.0e3;
+    const unsigned int packetsNum = 40000;
+    const unsigned int batchPackets = 777;
+    E4FilterConfig_t config;
+    memset(&config, 0, sizeof(config));
+    config.type = type;
+    config.order = order;
+    config.cutoffHz = cutoffHz;
+    config.decimation = decimation;
+    config.samplingRateHz = samplingRateHz;
+
+    StreamFilter filter;
+    outputNum = 0;
+    voltageKept = true;
+    if (!filter.configure(config, 0.0)) {return 0.0;}
+
+    std::vector <float> packets((size_t)packetsNum*EDL_CHANNEL_NUM);
+    for (unsigned int packetIdx = 0; packetIdx < packetsNum; packetIdx++) {
+        const float value = frequencyHz > 0.0 ? (float)sin(2.0*M_PI*frequencyHz*packetIdx/samplingRateHz) : 1.0f;
+        for (unsigned int channelIdx = 0; channelIdx < EDL_CHANNEL_NUM; channelIdx++) {packets[(size_t)packetIdx*EDL_CHANNEL_NUM+channelIdx] = value;}
+    }
+
+    std::vector <float> output(packets.size()+EDL_CHANNEL_NUM);
+    for (unsigned int firstIdx = 0; firstIdx < packetsNum; firstIdx += batchPackets) {
+        const unsigned int n = packetsNum-firstIdx < batchPackets ? packetsNum-firstIdx : batchPackets;
+        outputNum += filter.process(&packets[(size_t)firstIdx*EDL_CHANNEL_NUM], n, &output[(size_t)outputNum*EDL_CHANNEL_NUM]);
+    }
+
+    // The voltage is decimated without filtering: every output is one of the input values.
+    for (unsigned int outputIdx = 0; outputIdx < outputNum && decimation <= 1; outputIdx++) {
+        voltageKept = voltageKept && output[(size_t)outputIdx*EDL_CHANNEL_NUM] == packets[(size_t)outputIdx*EDL_CHANNEL_NUM];
+    }
+
+    // Project the second half on the input frequency, over a whole number of periods.
+    const unsigned int firstIdx = outputNum/2;
+    const double outputRateHz = samplingRateHz/(decimation > 1 ? decimation : 1);
+    double inPhase = 0.0;
+    double quadrature = 0.0;
+    for (unsigned int outputIdx = firstIdx; outputIdx < outputNum; outputIdx++) {
+        const double value = output[(size_t)outputIdx*EDL_CHANNEL_NUM+1];
+        if (frequencyHz > 0.0)
+        {
+            inPhase += value*sin(2.0*M_PI*frequencyHz*outputIdx/outputRateHz);
+            quadrature += value*cos(2.0*M_PI*frequencyHz*outputIdx/outputRateHz);
+        }
+        else {inPhase += value;}
+    }
+    const double samplesNum = (double)(outputNum-firstIdx);
+    return frequencyHz > 0.0 ? 2.0*sqrt(inPhase*inPhase+quadrature*quadrature)/samplesNum : inPhase/samplesNum;
+}
+
+/*! \brief Checks the response of StreamFilter: unit DC gain, -3dB at the cutoff, the roll-off of the Butterworth shape,
+ * and the number of data packets kept by the decimator.
+ */
+static void testStreamFilter()
+{
+    const char * test = "StreamFilter";
+    const E4FilterType_t types[] = {E4FilterBessel, E4FilterButterworth};
+    const unsigned int orders[] = {1, 2, 4, 8};
+    unsigned int outputNum;
+    bool voltageKept;
+    char what[128];
+
+    for (size_t typeIdx = 0; typeIdx < sizeof(types)/sizeof(types[0]); typeIdx++) {
+        for (size_t orderIdx = 0; orderIdx < sizeof(orders)/sizeof(orders[0]); orderIdx++) {
+            const unsigned int order = orders[orderIdx];
+            snprintf(what, sizeof(what), "type %d, order %u: unit DC gain", (int)types[typeIdx], order);
+            check(fabs(filterGain(types[typeIdx], order, 5.0e3, 1, 0.0, outputNum, voltageKept)-1.0) < 1e-3 && outputNum == 40000, test, what);
+
+            snprintf(what, sizeof(what), "type %d, order %u: -3dB at the cutoff", (int)types[typeIdx], order);
+            check(fabs(filterGain(types[typeIdx], order, 5.0e3, 1, 5.0e3, outputNum, voltageKept)-sqrt(0.5)) < 0.01, test, what);
+            snprintf(what, sizeof(what), "type %d, order %u: the voltage is not filtered", (int)types[typeIdx], order);
+            check(voltageKept, test, what);
+
+            // Butterworth: 1/sqrt(1+2^(2*order)) an octave above the cutoff, slightly less after the bilinear transform.
+            if (types[typeIdx] == E4FilterButterworth)
+            {
+                const double gain = filterGain(types[typeIdx], order, 5.0e3, 1, 10.0e3, outputNum, voltageKept);
+                snprintf(what, sizeof(what), "order %u: Butterworth roll-off", order);
+                check(gain < 1.0/sqrt(1.0+pow(2.0, 2.0*order)) && gain > 0.5/sqrt(1.0+pow(2.0, 2.0*order)), test, what);
+            }
+        }
+    }
+
+    const unsigned int decimations[] = {2, 10, 64};
+    for (size_t decimationIdx = 0; decimationIdx < sizeof(decimations)/sizeof(decimations[0]); decimationIdx++) {
+        const unsigned int decimation = decimations[decimationIdx];
+        snprintf(what, sizeof(what), "decimation %u: unit DC gain", decimation);
+        check(fabs(filterGain(E4FilterNone, 0, 0.0, decimation, 0.0, outputNum, voltageKept)-1.0) < 1e-3, test, what);
+        snprintf(what, sizeof(what), "decimation %u: one data packet kept per %u", decimation, decimation);
+        check(outputNum == (40000+decimation-1)/decimation, test, what);
+    }
+
+    unsigned int outputNumWithIir;
+    filterGain(E4FilterBessel, 4, 5.0e3, 10, 0.0, outputNumWithIir, voltageKept);
+    check(outputNumWithIir == 4000, test, "filter and decimation keep one data packet per 10");
+
+    E4FilterConfig_t config;
+    memset(&config, 0, sizeof(config));
+    config.type = E4FilterBessel;
+    config.order = 4;
+    config.cutoffHz = 100.0e3;
+    config.samplingRateHz = 200.0e3;
+    StreamFilter filter;
+    check(!filter.configure(config, 0.0), test, "a cutoff at the Nyquist frequency is rejected");
+}
+
+/*! \brief Filters and decimates the constant current of a simulated device through setFilter and pullFilteredPackets,
+ * and checks the DC level, the number of filtered data packets and the size of the filtered ring.
+ */
+static void testFilteredAcquisition()
+{
+    const char * test = "filtered acquisition";
+    const unsigned int decimation = 10;
+    const unsigned int ringPackets = 1 << 16;
+    E4SimulatorConfig_t simulatorConfig;
+    memset(&simulatorConfig, 0, sizeof(simulatorConfig));
+    simulatorConfig.baselineCurrent = 100.0;
+    simulatorConfig.seed = 3;
+    if (!check(setSimulation(&simulatorConfig) == EdlSuccess, test, "configure the simulation")) {return;}
+    const int handle = openDevice(0);
+    if (!check(handle >= 0, test, "open the simulated device")) {return;}
+
+    EdlCommandStruct_t commandStruct;
+    memset(&commandStruct, 0, sizeof(commandStruct));
+    commandStruct.radioId = EDL_RADIO_SAMPLING_RATE_200_KHZ;
+    check(setCommand(handle, EdlCommandSamplingRate, &commandStruct, true) == EdlSuccess, test, "set the sampling rate");
+
+    E4FilterConfig_t config;
+    memset(&config, 0, sizeof(config));
+    config.type = E4FilterBessel;
+    config.order = 4;
+    config.cutoffHz = 5.0e3;
+    config.decimation = decimation;
+    check(setFilter(handle, &config) == EdlSuccess, test, "set the filter");
+
+    E4AcquisitionStats_t stats;
+    if (!check(startAcquisition(handle, ringPackets) == EdlSuccess, test, "start the acquisition")) {closeEDL(handle); return;}
+    getAcquisitionStats(handle, &stats);
+    check(stats.filteredRingCapacityPackets >= ringPackets/decimation && stats.filteredRingCapacityPackets < 2*ringPackets/decimation,
+          test, "the filtered ring is sized for the decimation");
+
+    std::vector <float> raw;
+    std::vector <float> filtered;
+    std::vector <float> buffer((size_t)E4_RECORD_CHUNK_PACKETS*EDL_CHANNEL_NUM);
+    const std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now()+std::chrono::milliseconds(200);
+    for (bool stopped = false; !stopped; ) {
+        if (std::chrono::steady_clock::now() >= end)
+        {
+            stopAcquisition(handle);
+            stopped = true;
+        }
+        unsigned int readNum;
+        while (pullPackets(handle, buffer.data(), E4_RECORD_CHUNK_PACKETS, &readNum) == EdlSuccess && readNum > 0) {
+            raw.insert(raw.end(), buffer.begin(), buffer.begin()+(size_t)readNum*EDL_CHANNEL_NUM);
+        }
+        while (pullFilteredPackets(handle, buffer.data(), E4_RECORD_CHUNK_PACKETS, &readNum) == EdlSuccess && readNum > 0) {
+            filtered.insert(filtered.end(), buffer.begin(), buffer.begin()+(size_t)readNum*EDL_CHANNEL_NUM);
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    }
+
+    getAcquisitionStats(handle, &stats);
+    const size_t rawNum = raw.size()/EDL_CHANNEL_NUM;
+    const size_t filteredNum = filtered.size()/EDL_CHANNEL_NUM;
+    check(rawNum > 1000 && stats.packetsDropped == 0 && stats.filteredPacketsDropped == 0, test, "data packets are acquired without drops");
+    check(filteredNum == (rawNum+decimation-1)/decimation, test, "one filtered data packet per decimation");
+
+    // Past the settling of the filters, the constant current comes out unchanged.
+    bool levelOk = filteredNum > 100;
+    for (size_t packetIdx = 100; packetIdx < filteredNum; packetIdx++) {
+        for (unsigned int channelIdx = 1; channelIdx < EDL_CHANNEL_NUM; channelIdx++) {
+            levelOk = levelOk && fabs(filtered[packetIdx*EDL_CHANNEL_NUM+channelIdx]-simulatorConfig.baselineCurrent) < 1e-3*simulatorConfig.baselineCurrent;
+        }
+    }
+    check(levelOk, test, "unit DC gain");
+
+    memset(&config, 0, sizeof(config));
+    check(setFilter(handle, &config) == EdlSuccess, test, "disable the filter");
+    getAcquisitionStats(handle, &stats);
+    check(stats.filteredRingCapacityPackets == 0, test, "the filtered ring is freed without filter");
+    closeEDL(handle);
+}
+
+/*! \brief Returns true if the voltages of \a packetsNum data packets follow the simulated triangular protocol without gaps,
+ * from any starting point, taking one data packet every \a stride.
+ */
+static bool followsTriangle(const float * packets, size_t packetsNum, unsigned int stride, double amplitude, unsigned int periodPackets)
+{
+    const double tolerance = 2.0*E4_VOLTAGE_FULL_SCALE_MV/E4_ADC_CODES_HALF_RANGE;
+    for (unsigned int startIdx = 0; startIdx < periodPackets; startIdx++) {
+        size_t packetIdx = 0;
+        for (; packetIdx < packetsNum; packetIdx++) {
+            const double phase = (double)((startIdx+packetIdx*stride)%periodPackets)/periodPackets;
+            const double voltage = amplitude*(phase < 0.25 ? 4.0*phase : (phase < 0.75 ? 2.0-4.0*phase : 4.0*phase-4.0));
+            if (fabs(packets[packetIdx*EDL_CHANNEL_NUM]-voltage) > tolerance) {break;}
+        }
+        if (packetIdx == packetsNum) {return true;}
+    }
+    return false;
+}
+
+/*! \brief Acquires into tiny rings pulled by a slow consumer, and checks that the overflowing data packets are counted as dropped,
+ * while the kept ones are the oldest, without gaps.
+ */
+static void testSlowConsumer()
+{
+    const char * test = "slow consumer";
+    const unsigned int decimation = 10;
+    E4SimulatorConfig_t simulatorConfig;
+    memset(&simulatorConfig, 0, sizeof(simulatorConfig));
+    simulatorConfig.speedFactor = 10.0;
+    simulatorConfig.baselineCurrent = 100.0;
+    simulatorConfig.seed = 11;
+    if (!check(setSimulation(&simulatorConfig) == EdlSuccess, test, "configure the simulation")) {return;}
+    const int handle = openDevice(0);
+    if (!check(handle >= 0, test, "open the simulated device")) {return;}
+
+    // The default protocol is a 50mV triangle of 100ms, i.e. 1000 data packets at 10kHz: the voltage tells where each packet was.
+    EdlCommandStruct_t commandStruct;
+    memset(&commandStruct, 0, sizeof(commandStruct));
+    commandStruct.radioId = EDL_RADIO_SAMPLING_RATE_10_KHZ;
+    check(setCommand(handle, EdlCommandSamplingRate, &commandStruct, true) == EdlSuccess, test, "set the sampling rate");
+    check(setPotential(handle) == EdlSuccess, test, "apply the triangular protocol");
+
+    E4FilterConfig_t config;
+    memset(&config, 0, sizeof(config));
+    config.type = E4FilterNone;
+    config.decimation = decimation;
+    check(setFilter(handle, &config) == EdlSuccess, test, "set the decimation");
+
+    E4AcquisitionStats_t stats;
+    if (!check(startAcquisition(handle, 1024) == EdlSuccess, test, "start the acquisition")) {closeEDL(handle); return;}
+    getAcquisitionStats(handle, &stats);
+    const unsigned int capacity = stats.ringCapacityPackets;
+    const unsigned int filteredCapacity = stats.filteredRingCapacityPackets;
+
+    // 100000 data packets per second fill both rings long before every pull.
+    std::vector <float> raw((size_t)4*capacity*EDL_CHANNEL_NUM);
+    std::vector <float> filtered((size_t)4*filteredCapacity*EDL_CHANNEL_NUM);
+    unsigned long long rawTotal = 0;
+    unsigned long long filteredTotal = 0;
+    for (unsigned int pullIdx = 0; pullIdx < 3; pullIdx++) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        unsigned int rawNum = 0;
+        unsigned int filteredNum = 0;
+        pullPackets(handle, raw.data(), 4*capacity, &rawNum);
+        pullFilteredPackets(handle, filtered.data(), 4*filteredCapacity, &filteredNum);
+        rawTotal += rawNum;
+        filteredTotal += filteredNum;
+
+        check(rawNum == capacity && filteredNum == filteredCapacity, test, "the full rings are pulled");
+        check(followsTriangle(raw.data(), rawNum, 1, 50.0, 1000), test, "the kept data packets are contiguous");
+        check(followsTriangle(filtered.data(), filteredNum, decimation, 50.0, 1000), test, "the kept filtered data packets are contiguous");
+        if (pullIdx == 0)
+        {
+            // Both rings keep the oldest data packets, from the start of the acquisition.
+            bool sameStart = true;
+            for (unsigned int packetIdx = 0; packetIdx*decimation < rawNum && packetIdx < filteredNum; packetIdx++) {
+                sameStart = sameStart && filtered[(size_t)packetIdx*EDL_CHANNEL_NUM] == raw[(size_t)packetIdx*decimation*EDL_CHANNEL_NUM];
+            }
+            check(sameStart, test, "the filtered ring keeps the same data packets");
+        }
+    }
+
+    stopAcquisition(handle);
+    unsigned int readNum;
+    while (pullPackets(handle, raw.data(), 4*capacity, &readNum) == EdlSuccess && readNum > 0) {rawTotal += readNum;}
+    while (pullFilteredPackets(handle, filtered.data(), 4*filteredCapacity, &readNum) == EdlSuccess && readNum > 0) {filteredTotal += readNum;}
+    getAcquisitionStats(handle, &stats);
+    check(stats.packetsDropped > 0 && rawTotal+stats.packetsDropped == stats.packetsRead, test, "every data packet read is either pulled or dropped");
+    check(stats.filteredPacketsDropped > 0 && filteredTotal+stats.filteredPacketsDropped == (stats.packetsRead+decimation-1)/decimation,
+          test, "every filtered data packet is either pulled or dropped");
+    closeEDL(handle);
+}
+
+/*! \brief Returns a sample of a gaussian distribution of unit variance, with the Box-Muller transform.
+ */
+static double nextGaussian(uint32_t &state)
+{
+    const double u1 = ((double)nextRandom(state)+1.0)/4294967297.0;
+    const double u2 = (double)nextRandom(state)/4294967296.0;
+    return sqrt(-2.0*log(u1))*cos(2.0*M_PI*u2);
+}
+
+/*! \brief Checks FourierTransform against a direct evaluation of the DFT, on random complex inputs of every size up to 4096.
+ */
+static void testFourierTransform()
+{
+    const char * test = "FourierTransform";
+    uint32_t state = 4;
+    FourierTransform fft;
+    char what[128];
+
+    check(!fft.plan(0) && !fft.plan(1) && !fft.plan(12), test, "sizes that are not powers of two are rejected");
+
+    for (unsigned int size = 2; size <= 4096; size *= 2) {
+        std::vector <double> re(size), im(size);
+        for (unsigned int idx = 0; idx < size; idx++) {
+            re[idx] = nextGaussian(state);
+            im[idx] = nextGaussian(state);
+        }
+        const std::vector <double> inRe = re, inIm = im;
+        if (!check(fft.plan(size) && fft.size() == size, test, "plan a power of two")) {continue;}
+        fft.forward(re.data(), im.data());
+
+        double maxError = 0.0;
+        for (unsigned int binIdx = 0; binIdx < size; binIdx++) {
+            double sumRe = 0.0;
+            double sumIm = 0.0;
+            for (unsigned int idx = 0; idx < size; idx++) {
+                // Reduce k*n first, so that the angle is exact for large sizes.
+                const double angle = -2.0*M_PI*(double)(((unsigned long long)binIdx*idx)%size)/size;
+                sumRe += inRe[idx]*cos(angle)-inIm[idx]*sin(angle);
+                sumIm += inRe[idx]*sin(angle)+inIm[idx]*cos(angle);
+            }
+            maxError = std::max(maxError, std::max(fabs(re[binIdx]-sumRe), fabs(im[binIdx]-sumIm)));
+        }
+        snprintf(what, sizeof(what), "%u points: same as the direct DFT", size);
+        check(maxError < 1e-9*size, test, what);
+    }
+}
+
+/*! \brief Checks the power spectral density of WelchSpectrum: a sine on a bin center with white noise on the first current channel,
+ * white noise only on the second, which shares its FFT, another sine on the third and nothing on the fourth.
+ * The sine power must be found around its bin, the noise floor at 2*variance/rate, and the channels must not leak into each other.
+ */
+static void testWelchSpectrum()
+{
+    const char * test = "WelchSpectrum";
+    const double samplingRateHz = 102400.0;
+    const unsigned int segmentPackets = 1024;
+    const double binWidthHz = samplingRateHz/segmentPackets;
+    const unsigned int sineBin = 100;
+    const unsigned int otherSineBin = 300;
+    const double noiseRms = 0.1;
+    const unsigned int packetsNum = 64*segmentPackets;
+    uint32_t state = 5;
+
+    E4SpectrumConfig_t config;
+    memset(&config, 0, sizeof(config));
+    config.segmentPackets = segmentPackets;
+    config.averages = 64;
+    config.samplingRateHz = samplingRateHz;
+    WelchSpectrum spectrum;
+    if (!check(spectrum.configure(config, 0.0), test, "configure the spectrum")) {return;}
+
+    std::vector <float> packets((size_t)packetsNum*EDL_CHANNEL_NUM);
+    for (unsigned int packetIdx = 0; packetIdx < packetsNum; packetIdx++) {
+        float * packet = &packets[(size_t)packetIdx*EDL_CHANNEL_NUM];
+        packet[0] = 0.0f;
+        packet[1] = (float)(5.0+sin(2.0*M_PI*sineBin*binWidthHz*packetIdx/samplingRateHz)+noiseRms*nextGaussian(state));
+        packet[2] = (float)(noiseRms*nextGaussian(state));
+        packet[3] = (float)(0.5*sin(2.0*M_PI*otherSineBin*binWidthHz*packetIdx/samplingRateHz));
+        packet[4] = 0.0f;
+    }
+    for (unsigned int firstIdx = 0; firstIdx < packetsNum; firstIdx += 1000) {
+        spectrum.process(&packets[(size_t)firstIdx*EDL_CHANNEL_NUM], packetsNum-firstIdx < 1000 ? packetsNum-firstIdx : 1000);
+    }
+
+    const unsigned int binNum = segmentPackets/2+1;
+    std::vector <float> densities((size_t)E4_SPECTRUM_CHANNEL_NUM*binNum);
+    E4SpectrumInfo_t info;
+    spectrum.get(densities.data(), binNum, info);
+    if (!check(info.spectrumCount == 1 && info.binNum == binNum && info.averages == 64, test, "one spectrum of 64 segments")) {return;}
+    check(fabs(info.binWidthHz-binWidthHz) < 1e-9, test, "bin width");
+
+    const float * first = &densities[0];
+    const float * second = &densities[binNum];
+    const float * third = &densities[2*binNum];
+    const float * fourth = &densities[3*binNum];
+    const double noiseDensity = 2.0*noiseRms*noiseRms/samplingRateHz;
+
+    unsigned int peakIdx = 0;
+    for (unsigned int binIdx = 1; binIdx < binNum; binIdx++) {
+        if (first[binIdx] > first[peakIdx]) {peakIdx = binIdx;}
+    }
+    check(peakIdx == sineBin, test, "the peak is at the sine frequency");
+
+    // The Hann window spreads the sine over 3 bins; its power is the squared amplitude over 2.
+    double sinePower = 0.0;
+    double otherSinePower = 0.0;
+    for (unsigned int binIdx = sineBin-3; binIdx <= sineBin+3; binIdx++) {sinePower += (first[binIdx]-noiseDensity)*binWidthHz;}
+    for (unsigned int binIdx = otherSineBin-3; binIdx <= otherSineBin+3; binIdx++) {otherSinePower += third[binIdx]*binWidthHz;}
+    check(fabs(sinePower-0.5) < 0.01, test, "the sine power is found around its bin");
+    check(fabs(otherSinePower-0.125) < 0.0025, test, "the sine of the third channel is found around its bin");
+
+    // Noise floor away from the sine, averaged over bins to tame the variance of the estimate.
+    double firstFloor = 0.0;
+    double secondFloor = 0.0;
+    double fourthMax = 0.0;
+    unsigned int floorBins = 0;
+    for (unsigned int binIdx = 2; binIdx < binNum-1; binIdx++) {
+        fourthMax = std::max(fourthMax, (double)fourth[binIdx]);
+        if (binIdx+10 > sineBin && binIdx < sineBin+10) {continue;}
+        firstFloor += first[binIdx];
+        secondFloor += second[binIdx];
+        floorBins++;
+    }
+    firstFloor /= floorBins;
+    secondFloor /= floorBins;
+    check(fabs(firstFloor/noiseDensity-1.0) < 0.05, test, "noise floor of the channel with the sine");
+    check(fabs(secondFloor/noiseDensity-1.0) < 0.05, test, "noise floor of the channel sharing its FFT");
+    check(second[sineBin] < 3.0*noiseDensity, test, "the sine does not leak into the channel sharing its FFT");
+    check(fourthMax < 1e-12, test, "a silent channel stays silent");
+}
+
+/*! \brief Averages the sweeps of a triangular protocol applied to a parallel RC on every current channel, with white noise,
+ * and checks the fitted G, C and offset current against those of the simulated circuit.
+ * The capacitive current charges through an access resistance with a 5us time constant, as with a real electrode.
+ */
+static void testSweepFit()
+{
+    const char * test = "SweepAverager fit";
+    const double samplingRateHz = 100.0e3;
+    const double periodMs = 10.0;
+    const double amplitudeMv = 50.0;
+    const unsigned int periodPackets = 1000;
+    const unsigned int packetsNum = 30*periodPackets;
+    const double stepMs = 1.0e3/samplingRateHz;
+    const double relaxation = 1.0-exp(-stepMs/0.005);
+    uint32_t state = 6;
+
+    E4SweepConfig_t config;
+    memset(&config, 0, sizeof(config));
+    config.channelMask = (1u << E4_SWEEP_CHANNEL_NUM)-1;
+    config.periodMs = periodMs;
+    config.samplingRateHz = samplingRateHz;
+    SweepAverager sweeps;
+    if (!check(sweeps.configure(config, 0.0, 0.0), test, "configure the sweeps")) {return;}
+
+    double conductances[E4_SWEEP_CHANNEL_NUM];
+    double capacitances[E4_SWEEP_CHANNEL_NUM];
+    double offsets[E4_SWEEP_CHANNEL_NUM];
+    double capacitiveCurrents[E4_SWEEP_CHANNEL_NUM];
+    for (unsigned int channelIdx = 0; channelIdx < E4_SWEEP_CHANNEL_NUM; channelIdx++) {
+        conductances[channelIdx] = 1.0+channelIdx;
+        capacitances[channelIdx] = 5.0-channelIdx;
+        offsets[channelIdx] = channelIdx-1.5;
+        capacitiveCurrents[channelIdx] = 0.0;
+    }
+
+    std::vector <float> packets((size_t)packetsNum*EDL_CHANNEL_NUM);
+    for (unsigned int packetIdx = 0; packetIdx < packetsNum; packetIdx++) {
+        // Triangle from -amplitude up to +amplitude in the first half period, and back down.
+        const double phase = (double)(packetIdx%periodPackets)/periodPackets;
+        const double voltage = phase < 0.5 ? amplitudeMv*(4.0*phase-1.0) : amplitudeMv*(3.0-4.0*phase);
+        const double slope = (phase < 0.5 ? 4.0 : -4.0)*amplitudeMv/periodMs;
+        float * packet = &packets[(size_t)packetIdx*EDL_CHANNEL_NUM];
+        packet[0] = (float)voltage;
+        for (unsigned int channelIdx = 0; channelIdx < E4_SWEEP_CHANNEL_NUM; channelIdx++) {
+            capacitiveCurrents[channelIdx] += (capacitances[channelIdx]*slope-capacitiveCurrents[channelIdx])*relaxation;
+            packet[1+channelIdx] = (float)(conductances[channelIdx]*voltage+capacitiveCurrents[channelIdx]+offsets[channelIdx]+nextGaussian(state));
+        }
+    }
+    for (unsigned int firstIdx = 0; firstIdx < packetsNum; firstIdx += 999) {
+        sweeps.process(&packets[(size_t)firstIdx*EDL_CHANNEL_NUM], packetsNum-firstIdx < 999 ? packetsNum-firstIdx : 999, false);
+    }
+
+    std::vector <float> averaged((size_t)EDL_CHANNEL_NUM*periodPackets);
+    E4SweepInfo_t info;
+    sweeps.get(averaged.data(), periodPackets, info);
+    check(info.binNum == periodPackets && fabs(info.binTimeS-1.0/samplingRateHz) < 1e-12, test, "one bin per data packet of the period");
+    check(info.sweepCount >= 25 && info.rejectedCount == 0, test, "every complete period is averaged");
+
+    char what[128];
+    for (unsigned int channelIdx = 0; channelIdx < E4_SWEEP_CHANNEL_NUM; channelIdx++) {
+        const E4SweepFit_t &fit = info.fits[channelIdx];
+        snprintf(what, sizeof(what), "channel %u: G, C and I0 of the circuit are fitted", channelIdx);
+        check(fit.fitted && fabs(fit.conductance/conductances[channelIdx]-1.0) < 0.02 && fabs(fit.capacitance/capacitances[channelIdx]-1.0) < 0.01 &&
+              fabs(fit.offsetCurrent-offsets[channelIdx]) < 0.5, test, what);
+        // At the corners of the triangle the central difference misses the capacitive current of about one bin each.
+        snprintf(what, sizeof(what), "channel %u: the residual is the averaged noise and the corners of the triangle", channelIdx);
+        check(fit.residualRms < 0.5+capacitances[channelIdx]*4.0*amplitudeMv/periodMs*sqrt(2.0/periodPackets), test, what);
+    }
+
+    // Sweeps lost in a gap are rejected rather than averaged out of phase.
+    sweeps.process(packets.data(), 3*periodPackets/2, true);
+    sweeps.process(&packets[(size_t)(periodPackets/3)*EDL_CHANNEL_NUM], 3*periodPackets, true);
+    sweeps.get(averaged.data(), periodPackets, info);
+    check(info.rejectedCount > 0, test, "sweeps interrupted by lost data packets are rejected");
+}
+
+/*! \brief Averages the sweeps of setPotential on a simulated device, and checks that they start over when the protocol
+ * or the sampling rate is applied again, with the bins of the new period.
+ */
+static void testDeviceSweeps()
+{
+    const char * test = "device sweeps";
+    E4SimulatorConfig_t simulatorConfig;
+    memset(&simulatorConfig, 0, sizeof(simulatorConfig));
+    simulatorConfig.speedFactor = 10.0;
+    simulatorConfig.baselineCurrent = 1.0;
+    simulatorConfig.seed = 7;
+    if (!check(setSimulation(&simulatorConfig) == EdlSuccess, test, "configure the simulation")) {return;}
+    const int handle = openDevice(0);
+    if (!check(handle >= 0, test, "open the simulated device")) {return;}
+
+    EdlCommandStruct_t commandStruct;
+    memset(&commandStruct, 0, sizeof(commandStruct));
+    commandStruct.radioId = EDL_RADIO_SAMPLING_RATE_10_KHZ;
+    check(setCommand(handle, EdlCommandSamplingRate, &commandStruct, true) == EdlSuccess, test, "set the sampling rate");
+    check(setPotential(handle) == EdlSuccess, test, "apply the triangular protocol");
+
+    E4SweepConfig_t config;
+    memset(&config, 0, sizeof(config));
+    config.channelMask = 1;
+    check(setSweeps(handle, &config) == EdlSuccess, test, "follow the applied protocol");
+
+    // 100ms periods at 10kHz, 10 times faster than real time.
+    std::vector <float> sweep((size_t)EDL_CHANNEL_NUM*2000);
+    E4SweepInfo_t info;
+    for (unsigned int runIdx = 0; runIdx < 3; runIdx++) {
+        const unsigned int binNum = runIdx < 2 ? 1000 : 2000;
+        getSweep(handle, sweep.data(), 2000, &info);
+        check(info.binNum == binNum && info.sweepCount == 0, test, "the sweeps start empty, with the bins of the period");
+
+        if (!check(startAcquisition(handle, 1 << 16) == EdlSuccess, test, "start the acquisition")) {break;}
+        for (unsigned int waitIdx = 0; waitIdx < 200 && info.sweepCount < 3; waitIdx++) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+            getSweep(handle, sweep.data(), 2000, &info);
+        }
+        stopAcquisition(handle);
+        check(info.sweepCount >= 3 && info.binNum == binNum, test, "the sweeps of the protocol are averaged");
+        check(fabs(sweep[binNum/4]-50.0f) < 0.5f && fabs(sweep[3*binNum/4]+50.0f) < 0.5f, test, "the averaged voltage is the triangle, from the start of its rise");
+
+        if (runIdx == 0) {check(setPotential(handle) == EdlSuccess, test, "apply the protocol again");}
+        commandStruct.radioId = EDL_RADIO_SAMPLING_RATE_20_KHZ;
+        if (runIdx == 1) {check(setCommand(handle, EdlCommandSamplingRate, &commandStruct, true) == EdlSuccess, test, "change the sampling rate");}
+    }
+    closeEDL(handle);
+}
+
+/*! \brief Deinterleaves random bit patterns with every kernel available on this CPU, and checks them bit by bit against the scalar kernel,
+ * for data packet counts around the widths of the vector kernels, from unaligned buffers, without writing past the channel arrays.
+ */
+static void testDeinterleaveKernels()
+{
+    const char * test = "deinterleave kernels";
+    const size_t packetNums[] = {0, 1, 7, 8, 9, 4099};
+    const float guard = -12345.0f;
+    uint32_t state = 9;
+    char what[128];
+
+    check(deinterleaveKernelAvailable(E4DeinterleaveScalar), test, "the scalar kernel is always available");
+    check(!deinterleaveKernelAvailable(E4DeinterleaveKernelNum), test, "the kernel count is not a kernel");
+
+    for (int kernelIdx = 0; kernelIdx < E4DeinterleaveKernelNum; kernelIdx++) {
+        const E4DeinterleaveKernel_t kernel = (E4DeinterleaveKernel_t)kernelIdx;
+        if (!deinterleaveKernelAvailable(kernel)) {continue;}
+
+        for (size_t numIdx = 0; numIdx < sizeof(packetNums)/sizeof(packetNums[0]); numIdx++) {
+            const size_t packetsNum = packetNums[numIdx];
+            const size_t channelStride = packetsNum+3;
+
+            // One value more than needed, so that the data packets start off the alignment of the vectors.
+            std::vector <float> src(packetsNum*EDL_CHANNEL_NUM+1);
+            for (size_t idx = 0; idx < src.size(); idx++) {
+                const uint32_t bits = nextRandom(state);
+                memcpy(&src[idx], &bits, sizeof(bits));
+            }
+            std::vector <float> expected(EDL_CHANNEL_NUM*channelStride+1, guard);
+            std::vector <float> actual(EDL_CHANNEL_NUM*channelStride+1, guard);
+
+            snprintf(what, sizeof(what), "%s, %u data packets: the kernel runs", deinterleaveKernelName(kernel), (unsigned int)packetsNum);
+            check(deinterleavePacketsWith(E4DeinterleaveScalar, &src[1], packetsNum, &expected[1], channelStride), test, what);
+            if (!check(deinterleavePacketsWith(kernel, &src[1], packetsNum, &actual[1], channelStride), test, what)) {continue;}
+
+            snprintf(what, sizeof(what), "%s, %u data packets: same bits as the scalar kernel, padding untouched", deinterleaveKernelName(kernel), (unsigned int)packetsNum);
+            check(memcmp(expected.data(), actual.data(), actual.size()*sizeof(float)) == 0, test, what);
+            if (packetsNum > 0) {
+                check(memcmp(&expected[1+(EDL_CHANNEL_NUM-1)*channelStride+packetsNum-1], &src[packetsNum*EDL_CHANNEL_NUM], sizeof(float)) == 0 &&
+                      expected[1+packetsNum] == guard, test, "the scalar kernel writes sample i of channel c at c*channelStride+i");
+            }
+        }
+    }
+
+    // The dispatched kernel is one of them.
+    std::vector <float> src((size_t)9*EDL_CHANNEL_NUM, 1.0f);
+    std::vector <float> dst((size_t)9*EDL_CHANNEL_NUM, 0.0f);
+    deinterleavePackets(src.data(), 9, dst.data(), 9);
+    check(deinterleaveKernelAvailable(deinterleaveKernel()) && std::count(dst.begin(), dst.end(), 1.0f) == (long)dst.size(), test, "deinterleavePackets runs an available kernel");
+}
+
+/*! \brief Returns \a packetsNum data packets whose values encode their index, from \a firstPacketIdx on.
+ */
+static std::vector <float> sharedPackets(unsigned long long firstPacketIdx, size_t packetsNum)
+{
+    std::vector <float> packets(packetsNum*EDL_CHANNEL_NUM);
+    for (size_t packetIdx = 0; packetIdx < packetsNum; packetIdx++) {
+        for (unsigned int channelIdx = 0; channelIdx < EDL_CHANNEL_NUM; channelIdx++) {
+            packets[packetIdx*EDL_CHANNEL_NUM+channelIdx] = (float)((firstPacketIdx+packetIdx)*EDL_CHANNEL_NUM+channelIdx);
+        }
+    }
+    return packets;
+}
+
+/*! \brief Returns true if \a packets are the data packets of sharedPackets from \a firstPacketIdx on.
+ */
+static bool isSharedSequence(const float * packets, size_t packetsNum, unsigned long long firstPacketIdx)
+{
+    const std::vector <float> expected = sharedPackets(firstPacketIdx, packetsNum);
+    return memcmp(packets, expected.data(), expected.size()*sizeof(float)) == 0;
+}
+
+/*! \brief Publishes data packets to a shared ring and reads them back in the same process: in order, in place and copied,
+ * skipping and counting the overwritten ones when the reader falls behind, until the writer closes the ring.
+ * Then reads while another thread publishes, and checks that every data packet is read or counted lost, never torn.
+ */
+static void testSharedRing()
+{
+    const char * test = "shared ring";
+    const size_t capacityNum = 64;
+    SharedRing writer;
+    SharedRingReader reader;
+    E4SharedRingInfo_t info;
+    std::vector <float> packets(4*capacityNum*EDL_CHANNEL_NUM);
+    size_t packetsRead = 0;
+
+    writer.close();
+    check(!reader.open(TEST_SHARED_RING), test, "there is no ring before the writer creates it");
+    if (!check(writer.create(TEST_SHARED_RING, capacityNum-1, 10.0e3), test, "create the ring")) {return;}
+    writer.publish(sharedPackets(0, 5).data(), 5);
+    if (!check(reader.open(TEST_SHARED_RING), test, "attach to the ring")) {return;}
+
+    reader.getInfo(info);
+    check(info.capacityPackets == capacityNum && info.samplingRateHz == 10.0e3 && info.publishedPackets == 5 && info.nextPacketIdx == 5 &&
+          info.lostPackets == 0 && info.closed == 0, test, "the reader starts with the data packets published after attaching");
+    check(reader.read(packets.data(), capacityNum, packetsRead) && packetsRead == 0, test, "nothing is ready yet");
+
+    // Read in order, across the end of the slots.
+    unsigned long long nextIdx = 5;
+    for (unsigned int roundIdx = 0; roundIdx < 5; roundIdx++) {
+        writer.publish(sharedPackets(nextIdx, 40).data(), 40);
+        check(reader.read(packets.data(), capacityNum, packetsRead) && packetsRead == 40 && isSharedSequence(packets.data(), 40, nextIdx),
+              test, "the published data packets are read in order");
+        nextIdx += 40;
+    }
+
+    // In place: as many as are contiguous in the slots, then the rest.
+    const float * slots = NULL;
+    size_t slotsNum = 0;
+    unsigned long long firstIdx = 0;
+    writer.publish(sharedPackets(nextIdx, 60).data(), 60);
+    check(reader.peek(slots, slotsNum, firstIdx) && firstIdx == nextIdx && slotsNum == capacityNum-nextIdx%capacityNum &&
+          isSharedSequence(slots, slotsNum, firstIdx), test, "peek returns the data packets up to the end of the slots");
+    check(reader.release(slotsNum) == 0, test, "data packets released in time were not overwritten");
+    check(reader.peek(slots, slotsNum, firstIdx) && firstIdx+slotsNum == nextIdx+60 && isSharedSequence(slots, slotsNum, firstIdx),
+          test, "peek then returns the rest from the beginning of the slots");
+    check(reader.release(slotsNum) == 0, test, "data packets released in time were not overwritten");
+    nextIdx += 60;
+
+    // Overrun: only the newest capacity data packets are left.
+    writer.publish(sharedPackets(nextIdx, 3*capacityNum+7).data(), 3*capacityNum+7);
+    nextIdx += 3*capacityNum+7;
+    check(reader.read(packets.data(), 4*capacityNum, packetsRead) && packetsRead == capacityNum && isSharedSequence(packets.data(), capacityNum, nextIdx-capacityNum),
+          test, "a reader that fell behind gets the newest data packets, in order");
+    reader.getInfo(info);
+    check(info.lostPackets == 2*capacityNum+7 && info.nextPacketIdx == nextIdx && info.publishedPackets == nextIdx, test, "the skipped data packets are counted lost");
+
+    // Overwritten while in use.
+    writer.publish(sharedPackets(nextIdx, 10).data(), 10);
+    check(reader.peek(slots, slotsNum, firstIdx) && slotsNum == 10, test, "peek the next data packets");
+    writer.publish(sharedPackets(nextIdx+10, capacityNum-4).data(), capacityNum-4);
+    check(reader.release(10) == 6, test, "release tells how many data packets were overwritten while in use");
+    nextIdx += capacityNum+6;
+    reader.getInfo(info);
+    check(info.lostPackets == 2*capacityNum+13, test, "the overwritten data packets are counted lost");
+
+    writer.setSamplingRate(20.0e3);
+    writer.publish(sharedPackets(nextIdx, 3).data(), 3);
+    writer.close();
+    reader.getInfo(info);
+    check(info.samplingRateHz == 20.0e3 && info.closed == 1, test, "the reader sees the new sampling rate and the closed ring");
+    check(reader.read(packets.data(), 4*capacityNum, packetsRead) && packetsRead == capacityNum-4+3 &&
+          isSharedSequence(packets.data(), packetsRead, nextIdx+3-packetsRead), test, "the data packets published before closing are still read");
+    check(!reader.read(packets.data(), 4*capacityNum, packetsRead) && packetsRead == 0, test, "then the reader sees the end of the ring");
+    reader.close();
+    check(!reader.open(TEST_SHARED_RING), test, "the closed ring is removed");
+
+    // Concurrent writer: every data packet is read whole and in order, or counted lost.
+    if (!check(writer.create(TEST_SHARED_RING, capacityNum, 0.0) && reader.open(TEST_SHARED_RING), test, "create the ring again")) {return;}
+    const unsigned long long publishNum = 200000;
+    std::thread publisher([&] {
+        for (unsigned long long packetIdx = 0; packetIdx < publishNum; packetIdx += 25) {
+            writer.publish(sharedPackets(packetIdx, 25).data(), 25);
+            if (packetIdx%1000 == 0) {std::this_thread::yield();}
+        }
+        writer.close();
+    });
+    unsigned long long readNum = 0;
+    unsigned long long expectedIdx = 0;
+    bool ordered = true;
+    while (reader.read(packets.data(), 16, packetsRead)) {
+        for (size_t packetIdx = 0; packetIdx < packetsRead; packetIdx++) {
+            const unsigned long long packetNum = (unsigned long long)packets[packetIdx*EDL_CHANNEL_NUM]/EDL_CHANNEL_NUM;
+            if (packetNum < expectedIdx || !isSharedSequence(&packets[packetIdx*EDL_CHANNEL_NUM], 1, packetNum)) {ordered = false;}
+            expectedIdx = packetNum+1;
+        }
+        readNum += packetsRead;
+    }
+    publisher.join();
+    reader.getInfo(info);
+    check(ordered, test, "data packets read while the writer publishes are whole and in order");
+    check(readNum+info.lostPackets == publishNum && info.nextPacketIdx == publishNum, test, "every published data packet is read or counted lost");
+    reader.close();
+}
+
+/*! \brief Returns a command of a sequence passed to submitCommands.
+ */
+static E4Command_t queuedCommand(EdlCommandId_t commandId, bool sendFlag, double value, unsigned int delayMs)
+{
+    E4Command_t command;
+    memset(&command, 0, sizeof(command));
+    command.commandId = commandId;
+    command.sendFlag = sendFlag;
+    command.commandStruct.value = value;
+    command.commandStruct.buttonPressed = EDL_BUTTON_PRESSED;
+    command.delayMs = delayMs;
+    return command;
+}
+
+/*! \brief Completions reported to commandCompleted.
+ */
+typedef struct {
+    std::mutex mutex;
+    std::vector <unsigned long long> tickets;
+    std::vector <EdlErrorCode_t> results;
+} CommandLog_t;
+
+static void commandCompleted(unsigned long long ticket, EdlErrorCode_t result, void * context)
+{
+    CommandLog_t * log = (CommandLog_t *)context;
+    std::lock_guard <std::mutex> lock(log->mutex);
+    log->tickets.push_back(ticket);
+    log->results.push_back(result);
+}
+
+/*! \brief Queues sequences of commands on a simulated device, and checks the coalescing of superseded stacked commands,
+ * the merging of consecutive sequences except after push buttons, the rejection of sequences breaking the stacking rules,
+ * and the order of the tickets and of the callbacks. A sequence delayed on its first command holds the command thread
+ * while the sequences to merge are queued.
+ */
+static void testCommandQueue()
+{
+    const char * test = "command queue";
+    E4SimulatorConfig_t simulatorConfig;
+    memset(&simulatorConfig, 0, sizeof(simulatorConfig));
+    simulatorConfig.seed = 8;
+    if (!check(setSimulation(&simulatorConfig) == EdlSuccess, test, "configure the simulation")) {return;}
+    const int handle = openDevice(0);
+    if (!check(handle >= 0, test, "open the simulated device")) {return;}
+
+    EdlCommandStruct_t commandStruct;
+    memset(&commandStruct, 0, sizeof(commandStruct));
+    commandStruct.radioId = EDL_RADIO_SAMPLING_RATE_10_KHZ;
+    check(setCommand(handle, EdlCommandSamplingRate, &commandStruct, true) == EdlSuccess, test, "set the sampling rate");
+
+    CommandLog_t log;
+    EdlErrorCode_t result = EdlUnknownError;
+    E4CommandStats_t before;
+    E4CommandStats_t after;
+    unsigned long long ticket = 0;
+
+    // Stacked values superseded before the send are dropped, and the last one is applied.
+    const E4Command_t coalesced[] = {queuedCommand(EdlCommandVhold, false, 10.0, 0), queuedCommand(EdlCommandMainTrial, false, 0.0, 0),
+                                     queuedCommand(EdlCommandVhold, false, 20.0, 0), queuedCommand(EdlCommandApplyProtocol, true, 0.0, 0)};
+    getCommandStats(handle, &before);
+    check(submitCommands(handle, coalesced, 4, NULL, NULL, &ticket) == EdlSuccess, test, "submit a sequence");
+    check(waitCommands(handle, ticket, 1000, &result) == 1 && result == EdlSuccess, test, "the sequence completes");
+    getCommandStats(handle, &after);
+    check(after.commandsCoalesced-before.commandsCoalesced == 1 && after.commandsIssued-before.commandsIssued == 3 &&
+          after.sends-before.sends == 1, test, "the superseded stacked value is dropped");
+
+    std::vector <float> packets((size_t)256*EDL_CHANNEL_NUM);
+    unsigned int packetsRead = 0;
+    if (check(startAcquisition(handle, 0) == EdlSuccess, test, "start the acquisition")) {
+        for (unsigned int waitIdx = 0; waitIdx < 200 && packetsRead == 0; waitIdx++) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(5));
+            pullPackets(handle, packets.data(), 256, &packetsRead);
+        }
+        stopAcquisition(handle);
+        check(packetsRead > 0 && fabs(packets[(size_t)(packetsRead-1)*EDL_CHANNEL_NUM]-20.0f) < 0.01f, test, "the last stacked value is applied");
+    }
+
+    // A sequence with a push button is applied alone, even if the next one could take its commands.
+    const E4Command_t busy[] = {queuedCommand(EdlCommandVamp, false, 0.0, 300)};
+    const E4Command_t button[] = {queuedCommand(EdlCommandApplyProtocol, true, 0.0, 0)};
+    const E4Command_t stacked[] = {queuedCommand(EdlCommandVhold, false, 0.0, 0), queuedCommand(EdlCommandApplyProtocol, true, 0.0, 0)};
+    getCommandStats(handle, &before);
+    check(submitCommands(handle, busy, 1, NULL, NULL, NULL) == EdlSuccess, test, "submit a sequence without a ticket");
+    check(submitCommands(handle, button, 1, NULL, NULL, NULL) == EdlSuccess, test, "submit a push button");
+    check(submitCommands(handle, stacked, 2, NULL, NULL, &ticket) == EdlSuccess, test, "submit a sequence after the push button");
+    check(waitCommands(handle, ticket, 2000, &result) == 1 && result == EdlSuccess, test, "the sequences complete");
+    getCommandStats(handle, &after);
+    check(after.sequencesMerged == before.sequencesMerged && after.sends-before.sends == 2, test, "the push button is not merged");
+
+    // Consecutive sequences without push buttons are merged into the next one, with a single send.
+    E4Command_t first[] = {queuedCommand(EdlCommandVhold, false, 10.0, 0), queuedCommand(EdlCommandSamplingRate, true, 0.0, 0)};
+    const E4Command_t second[] = {queuedCommand(EdlCommandVhold, false, 30.0, 0), queuedCommand(EdlCommandApplyProtocol, true, 0.0, 0)};
+    first[1].commandStruct.radioId = EDL_RADIO_SAMPLING_RATE_10_KHZ;
+    getCommandStats(handle, &before);
+    check(submitCommands(handle, busy, 1, NULL, NULL, NULL) == EdlSuccess, test, "submit a sequence without a ticket");
+    check(submitCommands(handle, first, 2, NULL, NULL, NULL) == EdlSuccess, test, "submit a sequence to merge");
+    check(submitCommands(handle, second, 2, NULL, NULL, &ticket) == EdlSuccess, test, "submit the sequence merging it");
+    check(waitCommands(handle, ticket, 2000, &result) == 1 && result == EdlSuccess, test, "the sequences complete");
+    getCommandStats(handle, &after);
+    check(after.sequencesMerged-before.sequencesMerged == 1 && after.sends-before.sends == 1 && after.commandsCoalesced-before.commandsCoalesced == 1,
+          test, "the sequences are merged, and the value stacked by the first is superseded by the second");
+
+    // Sequences breaking the stacking rules are refused whole, before any command is applied.
+    const E4Command_t sentValue[] = {queuedCommand(EdlCommandVhold, true, 0.0, 0)};
+    const E4Command_t stackedButton[] = {queuedCommand(EdlCommandVhold, false, 0.0, 0), queuedCommand(EdlCommandApplyProtocol, false, 0.0, 0)};
+    const E4Command_t outOfRange[] = {queuedCommand(EdlCommandVhold, false, 0.0, 0), queuedCommand(EdlCommandIdNum, true, 0.0, 0)};
+    getCommandStats(handle, &before);
+    ticket = 0;
+    check(submitCommands(handle, sentValue, 1, NULL, NULL, &ticket) == EdlTrialValueSendNotDisabledError, test, "a sent protocol value is refused");
+    check(submitCommands(handle, stackedButton, 2, NULL, NULL, &ticket) == EdlPushButtonSendDisabledError, test, "a stacked push button is refused");
+    check(submitCommands(handle, outOfRange, 2, NULL, NULL, &ticket) == EdlCommandIdOutOfRangeError, test, "an unknown command is refused");
+    check(submitCommands(handle, sentValue, 0, NULL, NULL, &ticket) == EdlUnknownError, test, "an empty sequence is refused");
+    getCommandStats(handle, &after);
+    check(ticket == 0 && after.sequencesRejected-before.sequencesRejected == 4 && after.sequencesSubmitted == before.sequencesSubmitted &&
+          after.commandsIssued == before.commandsIssued, test, "nothing of the refused sequences is queued");
+
+    // Tickets increase, and sequences complete and call back in their order.
+    std::vector <unsigned long long> tickets;
+    for (unsigned int sequenceIdx = 0; sequenceIdx < 8; sequenceIdx++) {
+        const E4Command_t * sequence = sequenceIdx%2 == 0 ? button : stacked;
+        if (!check(submitCommands(handle, sequence, sequenceIdx%2 == 0 ? 1 : 2, commandCompleted, &log, &ticket) == EdlSuccess, test, "submit a sequence with a callback")) {break;}
+        check(tickets.empty() || ticket > tickets.back(), test, "tickets increase");
+        tickets.push_back(ticket);
+    }
+    check(waitCommands(handle, tickets.back(), 2000, &result) == 1 && result == EdlSuccess, test, "the last sequence completes");
+    for (size_t sequenceIdx = 0; sequenceIdx < tickets.size(); sequenceIdx++) {
+        check(waitCommands(handle, tickets[sequenceIdx], 0, &result) == 1 && result == EdlSuccess, test, "the earlier sequences completed");
+    }
+    for (unsigned int waitIdx = 0; waitIdx < 200; waitIdx++) {
+        {
+            std::lock_guard <std::mutex> lock(log.mutex);
+            if (log.tickets.size() >= tickets.size()) {break;}
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    }
+    {
+        std::lock_guard <std::mutex> lock(log.mutex);
+        check(log.tickets == tickets && std::count(log.results.begin(), log.results.end(), EdlSuccess) == (long)tickets.size(),
+              test, "the callbacks are called once per sequence, in order");
+        log.tickets.clear();
+        log.results.clear();
+    }
+
+    // A pending sequence submitted without a ticket still calls back when the device is closed.
+    check(startDigitalOffsetCompensation(handle, commandCompleted, &log, NULL) == EdlSuccess, test, "start the compensation without a ticket");
+    closeEDL(handle);
+    check(log.tickets.size() == 1 && log.results[0] == EdlDeviceNotConnectedError, test, "closing the device interrupts the compensation");
+}
+
+/*! \brief Returns true if \a stats are the statistics of channel \a channelIdx over data packets \a firstPacketIdx to \a endPacketIdx-1,
+ * computed directly in double precision, with \a clipLevel as the clipping level.
+ */
+static bool isChannelStats(const E4ChannelStats_t &stats, const std::vector <float> &packets, unsigned int channelIdx,
+                           size_t firstPacketIdx, size_t endPacketIdx, float clipLevel)
+{
+    const size_t sampleNum = endPacketIdx-firstPacketIdx;
+    double mean = 0.0;
+    double m2 = 0.0;
+    float min = packets[firstPacketIdx*EDL_CHANNEL_NUM+channelIdx];
+    float max = min;
+    unsigned long long clippedNum = 0;
+    for (size_t packetIdx = firstPacketIdx; packetIdx < endPacketIdx; packetIdx++) {
+        const float value = packets[packetIdx*EDL_CHANNEL_NUM+channelIdx];
+        mean += value;
+        min = std::min(min, value);
+        max = std::max(max, value);
+        if (fabsf(value) >= clipLevel) {clippedNum++;}
+    }
+    mean /= sampleNum;
+    for (size_t packetIdx = firstPacketIdx; packetIdx < endPacketIdx; packetIdx++) {
+        const double deviation = packets[packetIdx*EDL_CHANNEL_NUM+channelIdx]-mean;
+        m2 += deviation*deviation;
+    }
+    const double stdDev = sqrt(m2/sampleNum);
+    const double rms = sqrt(mean*mean+stdDev*stdDev);
+
+    return stats.sampleNum == sampleNum && stats.clippedNum == clippedNum && stats.min == min && stats.max == max &&
+            fabs(stats.mean-mean) <= 1e-9*(fabs(mean)+1.0) && fabs(stats.stdDev-stdDev) <= 1e-6*stdDev+1e-12 && fabs(stats.rms-rms) <= 1e-9*(rms+1.0);
+}
+
+/*! \brief Feeds RunningStatistics with known data packets in batches of uneven sizes, and checks the statistics of every channel
+ * over the sliding window and since the reset against a direct computation, as the window fills and then slides.
+ * One channel sits on a large offset with a small noise, where a naive sum of squares would lose the noise.
+ */
+static void testRunningStatistics()
+{
+    const char * test = "RunningStatistics";
+    const unsigned int windowPackets = 1000;
+    const unsigned int packetsNum = 5537;
+    const unsigned int batchPackets = 173;
+    const double fullScale = 2.0e4;
+    const float currentClip = (float)(fullScale*(1.0-1.0/E4_ADC_CODES_HALF_RANGE));
+    const float voltageClip = (float)(E4_VOLTAGE_FULL_SCALE_MV*(1.0-1.0/E4_ADC_CODES_HALF_RANGE));
+    uint32_t state = 12;
+    char what[128];
+
+    std::vector <float> packets((size_t)packetsNum*EDL_CHANNEL_NUM);
+    for (unsigned int packetIdx = 0; packetIdx < packetsNum; packetIdx++) {
+        float * packet = &packets[(size_t)packetIdx*EDL_CHANNEL_NUM];
+        packet[0] = (float)(100.0*nextGaussian(state));
+        for (unsigned int channelIdx = 1; channelIdx < EDL_CHANNEL_NUM; channelIdx++) {
+            switch (channelIdx%4) {
+            case 1: packet[channelIdx] = (float)(1.0e4+0.01*nextGaussian(state)); break;
+            case 2: packet[channelIdx] = packetIdx%97 == 0 ? (float)((packetIdx/97)%2 == 0 ? fullScale : -fullScale) : (float)(5.0e3*nextGaussian(state)); break;
+            case 3: packet[channelIdx] = -5.0f; break;
+            default: packet[channelIdx] = (float)nextGaussian(state); break;
+            }
+        }
+    }
+
+    RunningStatistics statistics;
+    statistics.setWindow(windowPackets);
+    statistics.setRanges(fullScale);
+    E4Stats_t stats;
+    statistics.get(stats);
+    check(stats.packetNum == 0 && stats.windowPacketNum == 0 && stats.total[0].sampleNum == 0, test, "the statistics start empty");
+
+    unsigned int batchIdx = 0;
+    for (unsigned int firstIdx = 0; firstIdx < packetsNum; firstIdx += batchPackets, batchIdx++) {
+        const unsigned int batchNum = std::min(batchPackets, packetsNum-firstIdx);
+        statistics.update(&packets[(size_t)firstIdx*EDL_CHANNEL_NUM], batchNum, batchIdx%5 == 1, batchIdx%7 == 2);
+        statistics.get(stats);
+
+        // The window is made of the completed tenths of its length, up to its length.
+        const size_t endIdx = firstIdx+batchNum;
+        const size_t windowEndIdx = endIdx-endIdx%(windowPackets/E4_STATS_SUBWINDOWS);
+        const size_t windowFirstIdx = windowEndIdx > windowPackets ? windowEndIdx-windowPackets : 0;
+        snprintf(what, sizeof(what), "after %u data packets: the window covers the last completed tenths", (unsigned int)endIdx);
+        check(stats.packetNum == endIdx && stats.windowFirstPacketIdx == windowFirstIdx && stats.windowPacketNum == windowEndIdx-windowFirstIdx, test, what);
+
+        for (unsigned int channelIdx = 0; channelIdx < EDL_CHANNEL_NUM; channelIdx++) {
+            const float clipLevel = channelIdx == 0 ? voltageClip : currentClip;
+            snprintf(what, sizeof(what), "after %u data packets, channel %u: statistics since the reset", (unsigned int)endIdx, channelIdx);
+            check(isChannelStats(stats.total[channelIdx], packets, channelIdx, 0, endIdx, clipLevel), test, what);
+            if (windowEndIdx == windowFirstIdx) {continue;}
+            snprintf(what, sizeof(what), "after %u data packets, channel %u: statistics over the window", (unsigned int)endIdx, channelIdx);
+            check(isChannelStats(stats.window[channelIdx], packets, channelIdx, windowFirstIdx, windowEndIdx, clipLevel), test, what);
+        }
+    }
+    check(stats.bufferOverflowCount == (batchIdx+3)/5 && stats.lostDataCount == (batchIdx+4)/7, test, "the flags of the status polls are counted");
+    check(stats.window[1].stdDev > 0.009 && stats.window[1].stdDev < 0.011, test, "the small noise on the large offset is kept");
+
+    statistics.reset();
+    statistics.get(stats);
+    check(stats.packetNum == 0 && stats.windowPacketNum == 0 && stats.total[0].sampleNum == 0 && stats.lostDataCount == 0, test, "reset forgets everything");
+}
+
+/*! \brief Returns the pollIntervalUs aimed at by \a scheduler after a first poll with \a samplingRateHz as the rate estimate.
+ */
+static double firstPollInterval(ReadScheduler &scheduler, double samplingRateHz)
+{
+    E4SchedulerStats_t stats;
+    scheduler.setSamplingRate(samplingRateHz);
+    scheduler.reset();
+    scheduler.wait(0, 0);
+    scheduler.getStats(stats);
+    return stats.pollIntervalUs;
+}
+
+/*! \brief Drives ReadScheduler::wait with data packet counts of a device producing at a known rate, measured on the steady clock,
+ * and checks the bounds of the poll interval, the catch up polls, the late polls and the convergence of the rate estimate.
+ */
+static void testReadScheduler()
+{
+    const char * test = "ReadScheduler";
+    const double latencyUs = 2000.0;
+    ReadScheduler scheduler;
+    E4SchedulerConfig_t config;
+    E4SchedulerStats_t stats;
+
+    memset(&config, 0, sizeof(config));
+    config.latencyTargetUs = E4_SCHEDULER_MAX_LATENCY_US+1;
+    check(!scheduler.configure(config), test, "a latency target above the maximum is refused");
+    config.latencyTargetUs = (unsigned int)latencyUs;
+    config.minBatchPackets = 64;
+    check(scheduler.configure(config), test, "configure the scheduler");
+
+    // Polls gather the minimum batch, within a half and three quarters of the latency target.
+    check(fabs(firstPollInterval(scheduler, 0.0)-0.75*latencyUs) < 1e-9, test, "without a rate, polls are three quarters of the latency target apart");
+    check(fabs(firstPollInterval(scheduler, 1.0e3)-0.75*latencyUs) < 1e-9, test, "at low rates, polls are three quarters of the latency target apart");
+    check(fabs(firstPollInterval(scheduler, 50.0e3)-64*1.0e6/50.0e3) < 1e-9, test, "in between, polls are spaced to gather the minimum batch");
+    check(fabs(firstPollInterval(scheduler, 200.0e3)-0.5*latencyUs) < 1e-9, test, "at high rates, polls are half the latency target apart");
+
+    // A poll leaving data packets in the device is followed at once by another one.
+    scheduler.setSamplingRate(50.0e3);
+    scheduler.reset();
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    scheduler.wait(100, 40);
+    scheduler.wait(60, 60);
+    const double catchUpUs = std::chrono::duration <double, std::micro> (std::chrono::steady_clock::now()-start).count();
+    scheduler.getStats(stats);
+    check(stats.polls == 2 && stats.catchUpPolls == 1 && stats.packetsRead == 100 && stats.lastBatchPackets == 60 && stats.maxBatchPackets == 60 &&
+          fabs(stats.meanBatchPackets-50.0) < 1e-9, test, "the batches are counted");
+    check(stats.waitMicroseconds < catchUpUs && stats.waitMicroseconds > 0.0, test, "only the poll that emptied the device waited");
+    scheduler.wait(0, 0);
+    scheduler.getStats(stats);
+    check(stats.emptyPolls == 1 && stats.catchUpPolls == 1, test, "an empty poll is counted, and waits");
+
+    std::this_thread::sleep_for(std::chrono::microseconds((long long)(2*latencyUs)));
+    scheduler.wait(0, 0);
+    scheduler.getStats(stats);
+    check(stats.latePolls >= 1, test, "a poll later than the latency target is counted");
+
+    // The rate estimate converges from a wrong nominal rate to the arrival rate of the data packets.
+    const double rateHz = 100.0e3;
+    scheduler.setSamplingRate(20.0e3);
+    scheduler.reset();
+    start = std::chrono::steady_clock::now();
+    unsigned long long consumedNum = 0;
+    for (unsigned int pollIdx = 0; pollIdx < 200; pollIdx++) {
+        const double elapsedS = std::chrono::duration <double> (std::chrono::steady_clock::now()-start).count();
+        const unsigned long long producedNum = (unsigned long long)(elapsedS*rateHz);
+        const unsigned int availableNum = (unsigned int)(producedNum-consumedNum);
+        const unsigned int readNum = std::min(availableNum, 4096u);
+        consumedNum += readNum;
+        scheduler.wait(availableNum, readNum);
+    }
+    scheduler.getStats(stats);
+    check(fabs(stats.rateEstimateHz/rateHz-1.0) < 0.1, test, "the rate estimate converges to the arrival rate");
+    check(stats.pollIntervalUs >= 0.5*latencyUs && stats.pollIntervalUs <= 0.75*latencyUs, test, "the poll interval stays within its bounds");
+    check(stats.meanBatchPackets >= 0.4*latencyUs*1.0e-6*rateHz, test, "the batches gather the data packets of the interval");
+}
+
+/*! \brief Acquires simulated devices with and without injected data losses, and checks that getMetrics reports the losses
+ * at the injected rate, in its counters and in its drop events, consistently with the acquisition statistics and the stage timings.
+ */
+static void testLostDataMetrics()
+{
+    const char * test = "lost data metrics";
+    const double lostDataRateHz = 200.0;
+    char what[128];
+
+    for (unsigned int runIdx = 0; runIdx < 2; runIdx++) {
+        E4SimulatorConfig_t simulatorConfig;
+        memset(&simulatorConfig, 0, sizeof(simulatorConfig));
+        simulatorConfig.baselineCurrent = 100.0;
+        simulatorConfig.noiseRms = 5.0;
+        simulatorConfig.lostDataRateHz = runIdx == 0 ? 0.0 : lostDataRateHz;
+        simulatorConfig.seed = 13;
+        if (!check(setSimulation(&simulatorConfig) == EdlSuccess, test, "configure the simulation")) {return;}
+        const int handle = openDevice(0);
+        if (!check(handle >= 0, test, "open the simulated device")) {return;}
+
+        std::vector <float> buffer((size_t)E4_RECORD_CHUNK_PACKETS*EDL_CHANNEL_NUM);
+        unsigned long long pulledNum = 0;
+        unsigned int readNum;
+        if (!check(startAcquisition(handle, 0) == EdlSuccess, test, "start the acquisition")) {
+            closeEDL(handle);
+            continue;
+        }
+        const std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now()+std::chrono::milliseconds(300);
+        while (std::chrono::steady_clock::now() < end) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(5));
+            while (pullPackets(handle, buffer.data(), E4_RECORD_CHUNK_PACKETS, &readNum) == EdlSuccess && readNum > 0) {pulledNum += readNum;}
+        }
+        stopAcquisition(handle);
+        while (pullPackets(handle, buffer.data(), E4_RECORD_CHUNK_PACKETS, &readNum) == EdlSuccess && readNum > 0) {pulledNum += readNum;}
+
+        E4Metrics_t metrics;
+        E4AcquisitionStats_t stats;
+        getMetrics(handle, &metrics);
+        getAcquisitionStats(handle, &stats);
+        closeEDL(handle);
+
+        check(metrics.statusPolls > 0 && metrics.stages[E4StageStatusPoll].count == metrics.statusPolls &&
+              metrics.stages[E4StageRead].count == metrics.reads && metrics.packetsRead == pulledNum, test, "the stages count the polls, the reads and the data packets");
+        unsigned long long bucketNum = 0;
+        for (unsigned int bucketIdx = 0; bucketIdx < E4_METRICS_BUCKETS; bucketIdx++) {bucketNum += metrics.stages[E4StageRead].buckets[bucketIdx];}
+        check(bucketNum == metrics.stages[E4StageRead].count, test, "every read is in the latency histogram");
+        check(metrics.bufferOverflowCount == 0 && metrics.ringDroppedPackets == 0 && metrics.statusErrors == 0 && metrics.readErrors == 0,
+              test, "nothing else is lost");
+        check(metrics.lostDataCount == stats.lostDataCount, test, "the losses are those seen by the acquisition");
+
+        if (runIdx == 0) {
+            check(metrics.lostDataCount == 0 && metrics.eventNum == 0 && metrics.eventsReturned == 0, test, "no loss is reported without injected losses");
+            continue;
+        }
+
+        // Losses closer than a poll interval are reported by one status.
+        const double expectedNum = lostDataRateHz*metrics.elapsedS;
+        snprintf(what, sizeof(what), "%llu losses are reported, about %.0f were injected", metrics.lostDataCount, expectedNum);
+        check(metrics.lostDataCount > 0.5*expectedNum && metrics.lostDataCount < 1.3*expectedNum, test, what);
+        check(metrics.eventNum == metrics.lostDataCount &&
+              metrics.eventsReturned == std::min(metrics.eventNum, (unsigned long long)E4_METRICS_EVENTS), test, "every loss is a drop event");
+        bool ordered = true;
+        for (unsigned int eventIdx = 0; eventIdx < metrics.eventsReturned; eventIdx++) {
+            const E4DropEvent_t &event = metrics.events[eventIdx];
+            if (event.flags != E4_METRICS_LOST_DATA || event.timeNs > metrics.elapsedS*1.0e9 || event.packetIdx > pulledNum) {ordered = false;}
+            if (eventIdx > 0 && (event.packetIdx < metrics.events[eventIdx-1].packetIdx || event.timeNs < metrics.events[eventIdx-1].timeNs)) {ordered = false;}
+        }
+        check(ordered, test, "the drop events are the losses, oldest first");
+    }
+}
+
+int main()
+{
+    testTraceCodec();
+    testEventGate();
+    testRecordingReadBack();
+    testCorruptIndex();
+    testConcurrentReaders();
+    testEnvelopeChunkSpan();
+    testDeviceOpening();
+    testSimulatedDevices();
+    testReplay();
+    testStreamFilter();
+    testFilteredAcquisition();
+    testSlowConsumer();
+    testFourierTransform();
+    testWelchSpectrum();
+    testSweepFit();
+    testDeviceSweeps();
+    testDeinterleaveKernels();
+    testSharedRing();
+    testCommandQueue();
+    testRunningStatistics();
+    testReadScheduler();
+    testLostDataMetrics();
+
+    if (failedNum > 0)
+    {
+        printf("%u checks failed\n", failedNum);
+        return 1;
+    }
+    printf("all checks passed\n");
+    return 0;
+}